@@ -1150,7 +1150,7 @@ static inline bool memslot_valid_for_gpte(struct kvm_memory_slot *slot,
 {
 	if (!slot || slot->flags & KVM_MEMSLOT_INVALID)
 		return false;
-	if (no_dirty_log && slot->dirty_bitmap)
+	if (no_dirty_log && (slot->flags & KVM_MEM_LOG_DIRTY_PAGES))
 		return false;
 
 	return true;
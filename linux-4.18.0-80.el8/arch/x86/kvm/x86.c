@@ -4242,6 +4242,14 @@ static int kvm_vm_ioctl_reinject(struct kvm *kvm,
 	return 0;
 }
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+/* A full PML buffer is logged to the dirty ring in one go */
+int kvm_cpu_dirty_log_size(void)
+{
+	return kvm_x86_ops->flush_log_dirty ? PAGE_SIZE / sizeof(u64) : 0;
+}
+#endif
+
 /**
  * kvm_vm_ioctl_get_dirty_log - get and clear the log of dirty pages in a slot
  * @kvm: kvm instance
@@ -7399,6 +7407,14 @@ static int vcpu_enter_guest(struct kvm_vcpu *vcpu)
 
 	bool req_immediate_exit = false;
 
+	/* Let userspace harvest the ring before the guest dirties more */
+	if (unlikely(vcpu->kvm->dirty_ring_size &&
+		     kvm_dirty_ring_soft_full(&vcpu->dirty_ring))) {
+		vcpu->run->exit_reason = KVM_EXIT_DIRTY_RING_FULL;
+		r = 0;
+		goto out;
+	}
+
 	if (kvm_request_pending(vcpu)) {
 		if (kvm_check_request(KVM_REQ_GET_VMCS12_PAGES, vcpu))
 			kvm_x86_ops->get_vmcs12_pages(vcpu);
@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * x86-64 code generation for BPF trampolines, see kernel/bpf/trampoline.c
+ *
+ * The trampoline is entered from the 5-byte fentry call-site of the traced
+ * function. It saves the register arguments into a u64 array on its stack,
+ * which is the context the programs run with, and either returns to the
+ * traced function (fentry only) or calls it, stores its return value after
+ * the arguments, runs the fexit programs and returns to the caller of the
+ * traced function directly. The call is bracketed by __bpf_tramp_enter()
+ * and __bpf_tramp_exit(), and followed by a nop that is turned into a jmp
+ * over the fexit programs when the image is retired.
+ */
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/memory.h>
+#include <asm/nops.h>
+#include <asm/text-patching.h>
+
+/* size of a call rel32 and of the nop ftrace leaves at the call-site */
+#define X86_PATCH_SIZE		5
+
+static u8 *emit_code(u8 *ptr, u32 bytes, unsigned int len)
+{
+	if (len == 1)
+		*ptr = bytes;
+	else if (len == 2)
+		*(u16 *)ptr = bytes;
+	else {
+		*(u32 *)ptr = bytes;
+		barrier();
+	}
+	return ptr + len;
+}
+
+#define EMIT(bytes, len) \
+	do { prog = emit_code(prog, bytes, len); } while (0)
+
+#define EMIT1(b1)		EMIT(b1, 1)
+#define EMIT2(b1, b2)		EMIT((b1) + ((b2) << 8), 2)
+#define EMIT3(b1, b2, b3)	EMIT((b1) + ((b2) << 8) + ((b3) << 16), 3)
+#define EMIT4(b1, b2, b3, b4)   EMIT((b1) + ((b2) << 8) + ((b3) << 16) + ((b4) << 24), 4)
+
+/* Argument registers of the x86-64 calling convention, as the low three
+ * bits of their number. The last two need REX.B/REX.R (r8, r9).
+ */
+static const u8 arg_regs[MAX_BPF_FUNC_ARGS] = {
+	7,	/* rdi */
+	6,	/* rsi */
+	2,	/* rdx */
+	1,	/* rcx */
+	0,	/* r8 */
+	1,	/* r9 */
+};
+
+static bool arg_reg_is_ext(int i)
+{
+	return i >= 4;
+}
+
+/* Encode a call or jmp rel32 to func at ip into insn, or the 5-byte nop
+ * if func is NULL.
+ */
+static int emit_insn5(u8 *insn, enum bpf_text_poke_type t, void *ip,
+		      void *func)
+{
+	s64 offset;
+
+	if (!func) {
+		memcpy(insn, ideal_nops[NOP_ATOMIC5], X86_PATCH_SIZE);
+		return 0;
+	}
+	offset = (u8 *)func - ((u8 *)ip + X86_PATCH_SIZE);
+	if (offset != (s32)offset) {
+		pr_err("Target call %p is out of range\n", func);
+		return -ERANGE;
+	}
+	insn[0] = t == BPF_MOD_JUMP ? 0xE9 : 0xE8;
+	*(s32 *)(insn + 1) = offset;
+	return 0;
+}
+
+static int emit_call(u8 **pprog, void *func)
+{
+	int err;
+
+	err = emit_insn5(*pprog, BPF_MOD_CALL, *pprog, func);
+	if (err)
+		return err;
+	*pprog += X86_PATCH_SIZE;
+	return 0;
+}
+
+/* mov rdi, im; call func */
+static int emit_call_im(u8 **pprog, struct bpf_tramp_image *im, void *func)
+{
+	u8 *prog = *pprog;
+
+	/* movabs rdi, imm64 */
+	EMIT2(0x48, 0xBF);
+	*(u64 *)prog = (unsigned long)im;
+	prog += 8;
+	*pprog = prog;
+	return emit_call(pprog, func);
+}
+
+/* Zero-extend the narrow arguments and store all of them to the u64 array
+ * at [rbp - stack_size].
+ */
+static int save_regs(const struct btf_func_model *m, u8 **pprog,
+		     int stack_size)
+{
+	u8 *prog = *pprog;
+	int i;
+
+	for (i = 0; i < m->nr_args; i++) {
+		u8 rex = arg_reg_is_ext(i) ? 0x45 : 0x40;
+		u8 modrm = 0xC0 | (arg_regs[i] << 3) | arg_regs[i];
+
+		switch (m->arg_size[i]) {
+		case 1:
+			/* movzx r32, r8 */
+			EMIT4(rex, 0x0F, 0xB6, modrm);
+			break;
+		case 2:
+			/* movzx r32, r16 */
+			EMIT4(rex, 0x0F, 0xB7, modrm);
+			break;
+		case 4:
+			/* mov r32, r32 */
+			EMIT3(rex, 0x89, modrm);
+			break;
+		case 8:
+			break;
+		default:
+			return -ENOTSUPP;
+		}
+		/* mov qword ptr [rbp - stack_size + i * 8], reg */
+		EMIT4(arg_reg_is_ext(i) ? 0x4C : 0x48, 0x89,
+		      0x45 | (arg_regs[i] << 3), -(stack_size - i * 8));
+	}
+	*pprog = prog;
+	return 0;
+}
+
+static void restore_regs(const struct btf_func_model *m, u8 **pprog,
+			 int stack_size)
+{
+	u8 *prog = *pprog;
+	int i;
+
+	for (i = 0; i < m->nr_args; i++)
+		/* mov reg, qword ptr [rbp - stack_size + i * 8] */
+		EMIT4(arg_reg_is_ext(i) ? 0x4C : 0x48, 0x8B,
+		      0x45 | (arg_regs[i] << 3), -(stack_size - i * 8));
+	*pprog = prog;
+}
+
+static int invoke_bpf(const struct btf_func_model *m, u8 **pprog,
+		      struct bpf_prog **progs, int prog_cnt, int stack_size)
+{
+	u8 *prog = *pprog;
+	int i;
+
+	for (i = 0; i < prog_cnt; i++) {
+		if (emit_call(&prog, __bpf_prog_enter))
+			return -EINVAL;
+		/* mov rbx, rax; __bpf_prog_exit() needs it back */
+		EMIT3(0x48, 0x89, 0xC3);
+		/* test rax, rax; skip the program on recursion */
+		EMIT3(0x48, 0x85, 0xC0);
+		/* je over lea, movabs and call */
+		EMIT2(0x74, 4 + 10 + X86_PATCH_SIZE);
+
+		/* arg1: lea rdi, [rbp - stack_size] */
+		EMIT4(0x48, 0x8D, 0x7D, -stack_size);
+		/* arg2: movabs rsi, progs[i]->insnsi for the interpreter */
+		EMIT2(0x48, 0xBE);
+		*(u64 *)prog = (unsigned long)progs[i]->insnsi;
+		prog += 8;
+		if (emit_call(&prog, progs[i]->bpf_func))
+			return -EINVAL;
+
+		/* arg1: mov rdi, rbx */
+		EMIT3(0x48, 0x89, 0xDF);
+		if (emit_call(&prog, __bpf_prog_exit))
+			return -EINVAL;
+	}
+	*pprog = prog;
+	return 0;
+}
+
+/* Upper bound of the code emitted below: 9 bytes of prologue, at most 8
+ * bytes to save and 4 to restore each argument, twice for fexit, 40 bytes
+ * per program, 20 bytes around the call of the traced function plus the
+ * epilogue and 35 for the __bpf_tramp_enter()/__bpf_tramp_exit() calls
+ * and the nop between them.
+ */
+static int bpf_trampoline_max_size(const struct btf_func_model *m,
+				   int prog_cnt)
+{
+	return 9 + m->nr_args * (8 + 4 + 4) + prog_cnt * 40 + 20 + 7 + 35;
+}
+
+/* Example:
+ * __be16 eth_type_trans(struct sk_buff *skb, struct net_device *dev);
+ * its 'struct btf_func_model' will be nr_args=2
+ * The assembly code when eth_type_trans is executing after trampoline:
+ *
+ * push rbp
+ * mov rbp, rsp
+ * sub rsp, 16                     // space for skb and dev
+ * push rbx                        // callee saved, holds enter result
+ * mov qword ptr [rbp - 16], rdi   // save skb pointer to stack
+ * mov qword ptr [rbp - 8], rsi    // save dev pointer to stack
+ * call __bpf_prog_enter           // rcu_read_lock and preempt_disable
+ * mov rbx, rax                    // remember whether prog may run
+ * test rax, rax
+ * je 1f
+ * lea rdi, [rbp - 16]             // R1==ctx of bpf prog
+ * movabs rsi, insnsi              // R2 for the interpreter
+ * call addr_of_jited_FENTRY_prog
+ * 1: mov rdi, rbx
+ * call __bpf_prog_exit            // rcu_read_unlock and preempt_enable
+ * mov rdi, qword ptr [rbp - 16]   // restore skb pointer from stack
+ * mov rsi, qword ptr [rbp - 8]    // restore dev pointer from stack
+ * pop rbx
+ * leave
+ * ret
+ *
+ * With an fexit program the trampoline calls __bpf_tramp_enter(im) after
+ * saving the arguments, calls eth_type_trans itself after restoring them,
+ * saves rax to [rbp - 8] (stack_size grows by 8), runs the fexit programs
+ * past a 5-byte nop, calls __bpf_tramp_exit(im), reloads rax and does
+ * "add rsp, 8" before "ret" to return to the caller of eth_type_trans
+ * directly.
+ */
+int arch_prepare_bpf_trampoline(struct bpf_tramp_image *im,
+				void *image, void *image_end,
+				const struct btf_func_model *m, u32 flags,
+				struct bpf_prog **fentry_progs, int fentry_cnt,
+				struct bpf_prog **fexit_progs, int fexit_cnt,
+				void *orig_call)
+{
+	int cnt = 0, nr_args = m->nr_args;
+	int stack_size = nr_args * 8;
+	u8 *prog;
+
+	/* x86-64 supports up to 6 arguments. 7+ can be added in the future */
+	if (nr_args > 6)
+		return -ENOTSUPP;
+
+	if ((flags & BPF_TRAMP_F_RESTORE_REGS) &&
+	    (flags & BPF_TRAMP_F_SKIP_FRAME))
+		return -EINVAL;
+
+	if (bpf_trampoline_max_size(m, fentry_cnt + fexit_cnt) >
+	    (u8 *)image_end - (u8 *)image)
+		return -E2BIG;
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG)
+		stack_size += 8; /* room for return value of orig_call */
+
+	prog = image;
+
+	EMIT1(0x55);		 /* push rbp */
+	EMIT3(0x48, 0x89, 0xE5); /* mov rbp, rsp */
+	EMIT4(0x48, 0x83, 0xEC, stack_size); /* sub rsp, stack_size */
+	EMIT1(0x53);		 /* push rbx */
+
+	if (save_regs(m, &prog, stack_size))
+		return -ENOTSUPP;
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG)
+		/* the image stays around until the traced function returns */
+		if (emit_call_im(&prog, im, __bpf_tramp_enter))
+			return -EINVAL;
+
+	if (fentry_cnt)
+		if (invoke_bpf(m, &prog, fentry_progs, fentry_cnt, stack_size))
+			return -EINVAL;
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG) {
+		restore_regs(m, &prog, stack_size);
+
+		/* call original function */
+		if (emit_call(&prog, (u8 *)orig_call + X86_PATCH_SIZE))
+			return -EINVAL;
+		/* remember return value in a stack for bpf prog to access */
+		/* mov qword ptr [rbp - 8], rax */
+		EMIT4(0x48, 0x89, 0x45, -8);
+		/* becomes a jmp to the epilogue once the image is retired */
+		im->ip_after_call = prog;
+		memcpy(prog, ideal_nops[NOP_ATOMIC5], X86_PATCH_SIZE);
+		prog += X86_PATCH_SIZE;
+	}
+
+	if (fexit_cnt)
+		if (invoke_bpf(m, &prog, fexit_progs, fexit_cnt, stack_size))
+			return -EINVAL;
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG) {
+		im->ip_epilogue = prog;
+		if (emit_call_im(&prog, im, __bpf_tramp_exit))
+			return -EINVAL;
+	}
+
+	if (flags & BPF_TRAMP_F_RESTORE_REGS)
+		restore_regs(m, &prog, stack_size);
+
+	if (flags & BPF_TRAMP_F_CALL_ORIG)
+		/* restore original return value back into RAX */
+		/* mov rax, qword ptr [rbp - 8] */
+		EMIT4(0x48, 0x8B, 0x45, -8);
+
+	EMIT1(0x5B); /* pop rbx */
+	EMIT1(0xC9); /* leave */
+	if (flags & BPF_TRAMP_F_SKIP_FRAME)
+		/* skip our return address and return to parent */
+		EMIT4(0x48, 0x83, 0xC4, 8); /* add rsp, 8 */
+	EMIT1(0xC3); /* ret */
+
+	cnt = prog - (u8 *)image;
+	/* Make sure the trampoline generation logic doesn't overflow */
+	if (WARN_ON_ONCE(prog > (u8 *)image_end))
+		return -EFAULT;
+	return cnt > 0 ? 0 : -EINVAL;
+}
+
+int bpf_arch_text_poke(void *ip, enum bpf_text_poke_type t,
+		       void *old_addr, void *new_addr)
+{
+	u8 old_insn[X86_PATCH_SIZE], new_insn[X86_PATCH_SIZE];
+	int ret;
+
+	/* jumps are only patched into trampoline images */
+	if (t == BPF_MOD_CALL && !core_kernel_text((unsigned long)ip))
+		/* BPF trampoline in modules is not supported */
+		return -EINVAL;
+
+	ret = emit_insn5(old_insn, t, ip, old_addr);
+	if (ret)
+		return ret;
+	ret = emit_insn5(new_insn, t, ip, new_addr);
+	if (ret)
+		return ret;
+
+	mutex_lock(&text_mutex);
+	if (memcmp(ip, old_insn, X86_PATCH_SIZE)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	/* While the int3 is in place other cpus skip the call-site */
+	if (memcmp(ip, new_insn, X86_PATCH_SIZE))
+		text_poke_bp(ip, new_insn, X86_PATCH_SIZE,
+			     (u8 *)ip + X86_PATCH_SIZE);
+out:
+	mutex_unlock(&text_mutex);
+	return ret;
+}
@@ -869,6 +869,14 @@ static int tun_attach(struct tun_struct *tun, struct file *file,
 		tun_napi_init(tun, tfile, napi, napi_frags);
 	}
 
+	/* XDP buffer batches are Ethernet frames, built into skbs without
+	 * going through napi frags. */
+	if ((tun->flags & TUN_TYPE_MASK) == IFF_TAP &&
+	    !tun_napi_frags_enabled(tfile))
+		sock_set_flag(&tfile->sk, SOCK_XDP);
+	else
+		sock_reset_flag(&tfile->sk, SOCK_XDP);
+
 	tun_set_real_num_queues(tun);
 
 	/* device is allowed to go away first, so no need to hold extra
@@ -2392,18 +2400,176 @@ static void tun_sock_write_space(struct sock *sk)
 	kill_fasync(&tfile->fasync, SIGIO, POLL_OUT);
 }
 
+/* Run XDP on one buffer of a TUN_MSG_PTR batch, or build an skb around it
+ * and add it to @queue. Called with bh disabled, under RCU. */
+static int tun_xdp_one(struct tun_struct *tun,
+		       struct tun_file *tfile,
+		       struct xdp_buff *xdp, int *flush,
+		       struct sk_buff_head *queue)
+{
+	unsigned int datasize = xdp->data_end - xdp->data;
+	struct tun_xdp_hdr *hdr = xdp->data_hard_start;
+	struct virtio_net_hdr gso = hdr->gso;
+	int buflen = hdr->buflen;
+	struct tun_pcpu_stats *stats;
+	struct bpf_prog *xdp_prog;
+	struct sk_buff *skb;
+	bool skb_xdp = false;
+	u32 rxhash = 0;
+	u32 act;
+	int err;
+
+	if (unlikely(datasize < ETH_HLEN)) {
+		err = -EINVAL;
+		goto drop;
+	}
+
+	xdp_prog = rcu_dereference(tun->xdp_prog);
+	if (xdp_prog) {
+		/* As in tun_build_skb(), gso packets get XDP on the skb */
+		if (gso.gso_type) {
+			skb_xdp = true;
+			goto build;
+		}
+		xdp_set_data_meta_invalid(xdp);
+		xdp->rxq = &tfile->xdp_rxq;
+
+		act = bpf_prog_run_xdp(xdp_prog, xdp);
+		switch (act) {
+		case XDP_REDIRECT:
+			err = xdp_do_redirect(tun->dev, xdp, xdp_prog);
+			if (err)
+				goto drop;
+			*flush = true;
+			return 0;
+		case XDP_TX:
+			err = tun_xdp_tx(tun->dev, xdp);
+			if (err < 0)
+				goto drop;
+			return 0;
+		case XDP_PASS:
+			break;
+		default:
+			bpf_warn_invalid_xdp_action(act);
+			/* fall through */
+		case XDP_ABORTED:
+			trace_xdp_exception(tun->dev, xdp_prog, act);
+			/* fall through */
+		case XDP_DROP:
+			err = 0;
+			goto drop;
+		}
+	}
+
+build:
+	skb = build_skb(xdp->data_hard_start, buflen);
+	if (!skb) {
+		err = -ENOMEM;
+		goto drop;
+	}
+
+	skb_reserve(skb, xdp->data - xdp->data_hard_start);
+	skb_put(skb, xdp->data_end - xdp->data);
+
+	if (virtio_net_hdr_to_skb(skb, &gso, tun_is_little_endian(tun))) {
+		this_cpu_inc(tun->pcpu_stats->rx_frame_errors);
+		kfree_skb(skb);
+		return -EINVAL;
+	}
+
+	skb->protocol = eth_type_trans(skb, tun->dev);
+	skb_reset_network_header(skb);
+	skb_probe_transport_header(skb, 0);
+
+	if (skb_xdp && do_xdp_generic(xdp_prog, skb) != XDP_PASS)
+		return 0;
+
+	if (!rcu_dereference(tun->steering_prog) && tun->numqueues > 1 &&
+	    !tfile->detached)
+		rxhash = __skb_get_hash_symmetric(skb);
+
+	__skb_queue_tail(queue, skb);
+
+	stats = get_cpu_ptr(tun->pcpu_stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->rx_packets++;
+	stats->rx_bytes += datasize;
+	u64_stats_update_end(&stats->syncp);
+	put_cpu_ptr(stats);
+
+	if (rxhash)
+		tun_flow_update(tun, rxhash, tfile);
+
+	return 0;
+
+drop:
+	put_page(virt_to_head_page(xdp->data));
+	this_cpu_inc(tun->pcpu_stats->rx_dropped);
+	return err;
+}
+
+/* Take a batch of packets from vhost-net, and pass the skbs built from
+ * them to the stack together. */
+static void tun_xdp_batch(struct tun_struct *tun, struct tun_file *tfile,
+			  struct tun_msg_ctl *ctl)
+{
+	struct xdp_buff *xdp = ctl->ptr;
+	struct sk_buff_head queue;
+	struct sk_buff *skb;
+	int flush = 0;
+	int i;
+
+	__skb_queue_head_init(&queue);
+
+	local_bh_disable();
+	rcu_read_lock();
+
+	for (i = 0; i < ctl->num; i++)
+		tun_xdp_one(tun, tfile, &xdp[i], &flush, &queue);
+
+	if (flush)
+		xdp_do_flush_map();
+
+	if (tfile->napi_enabled) {
+		struct sk_buff_head *napi_queue = &tfile->sk.sk_write_queue;
+
+		spin_lock(&napi_queue->lock);
+		skb_queue_splice_tail_init(&queue, napi_queue);
+		spin_unlock(&napi_queue->lock);
+		napi_schedule(&tfile->napi);
+	} else {
+		while ((skb = __skb_dequeue(&queue))) {
+			if (IS_ENABLED(CONFIG_4KSTACKS))
+				netif_rx(skb);
+			else
+				netif_receive_skb(skb);
+		}
+	}
+
+	rcu_read_unlock();
+	local_bh_enable();
+}
+
 static int tun_sendmsg(struct socket *sock, struct msghdr *m, size_t total_len)
 {
 	int ret;
 	struct tun_file *tfile = container_of(sock, struct tun_file, socket);
 	struct tun_struct *tun = tun_get(tfile);
+	struct tun_msg_ctl *ctl = m->msg_control;
 
 	if (!tun)
 		return -EBADFD;
 
-	ret = tun_get_user(tun, tfile, m->msg_control, &m->msg_iter,
+	if (ctl && ctl->type == TUN_MSG_PTR) {
+		tun_xdp_batch(tun, tfile, ctl);
+		ret = total_len;
+		goto out;
+	}
+
+	ret = tun_get_user(tun, tfile, ctl ? ctl->ptr : NULL, &m->msg_iter,
 			   m->msg_flags & MSG_DONTWAIT,
 			   m->msg_flags & MSG_MORE);
+out:
 	tun_put(tun);
 	return ret;
 }
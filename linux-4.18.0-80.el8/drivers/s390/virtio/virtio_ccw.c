@@ -790,6 +790,9 @@ static int virtio_ccw_finalize_features(struct virtio_device *vdev)
 	}
 	/* Give virtio_ring a chance to accept features. */
 	vring_transport_features(vdev);
+	/* Our rings come from vring_new_virtqueue, which is split only. */
+	__virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
+	__virtio_clear_bit(vdev, VIRTIO_F_IN_ORDER);
 
 	features->index = 0;
 	features->features = cpu_to_le32((u32)vdev->features);
@@ -74,7 +74,8 @@ enum {
 	VHOST_NET_FEATURES = VHOST_FEATURES |
 			 (1ULL << VHOST_NET_F_VIRTIO_NET_HDR) |
 			 (1ULL << VIRTIO_NET_F_MRG_RXBUF) |
-			 (1ULL << VIRTIO_F_IOMMU_PLATFORM)
+			 (1ULL << VIRTIO_F_IOMMU_PLATFORM) |
+			 (1ULL << VIRTIO_F_IN_ORDER)
 };
 
 enum {
@@ -95,6 +96,10 @@ struct vhost_net_ubuf_ref {
 };
 
 #define VHOST_RX_BATCH 64
+/* Max number of copied TX packets handed to tun in one sendmsg() */
+#define VHOST_NET_BATCH 64
+/* Same as the headroom tun leaves before the frame of an skb it builds */
+#define VHOST_NET_RX_PAD (NET_IP_ALIGN + NET_SKB_PAD)
 struct vhost_net_buf {
 	void **queue;
 	int tail;
@@ -108,7 +113,8 @@ struct vhost_net_virtqueue {
 	/* vhost zerocopy support fields below: */
 	/* last used idx for outstanding DMA zerocopy buffers */
 	int upend_idx;
-	/* For TX, first used idx for DMA done zerocopy buffers
+	/* For TX, first used idx for DMA done zerocopy buffers, or
+	 * number of batched heads when copying
 	 * For RX, number of batched heads
 	 */
 	int done_idx;
@@ -119,6 +125,12 @@ struct vhost_net_virtqueue {
 	struct vhost_net_ubuf_ref *ubufs;
 	struct ptr_ring *rx_ring;
 	struct vhost_net_buf rxq;
+	/* For TX, copied packets not yet passed to the socket */
+	struct xdp_buff *xdp;
+	int batched_xdp;
+	/* Time to busy poll for next, in us: adapts between a fraction of
+	 * busyloop_timeout and all of it, see vhost_net_busy_poll_adapt(). */
+	unsigned long busyloop_time;
 };
 
 struct vhost_net {
@@ -396,13 +408,119 @@ static inline unsigned long busy_clock(void)
 	return local_clock() >> 10;
 }
 
-static bool vhost_can_busy_poll(struct vhost_dev *dev,
-				unsigned long endtime)
+static bool vhost_can_busy_poll(unsigned long endtime)
 {
 	return likely(!need_resched()) &&
 	       likely(!time_after(busy_clock(), endtime)) &&
-	       likely(!signal_pending(current)) &&
-	       !vhost_has_work(dev);
+	       likely(!signal_pending(current));
+}
+
+/* Busy polling shrinks down to 1/16 of busyloop_timeout while it finds
+ * nothing, and doubles back up to it when it does. */
+#define VHOST_NET_BUSY_POLL_SHRINK 4
+
+static unsigned long vhost_net_busy_poll_time(struct vhost_net_virtqueue *nvq)
+{
+	unsigned long hi = nvq->vq.busyloop_timeout;
+
+	if (!nvq->busyloop_time || nvq->busyloop_time > hi)
+		nvq->busyloop_time = hi;
+	return nvq->busyloop_time;
+}
+
+static void vhost_net_busy_poll_adapt(struct vhost_net_virtqueue *nvq,
+				      bool found)
+{
+	unsigned long hi = nvq->vq.busyloop_timeout;
+	unsigned long lo = hi >> VHOST_NET_BUSY_POLL_SHRINK ? : 1;
+
+	if (found)
+		nvq->busyloop_time = min(nvq->busyloop_time << 1, hi);
+	else
+		nvq->busyloop_time = max(nvq->busyloop_time >> 1, lo);
+}
+
+static int sk_has_rx_data(struct sock *sk)
+{
+	struct socket *sock = sk->sk_socket;
+
+	if (sock->ops->peek_len)
+		return sock->ops->peek_len(sock);
+
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+
+static void vhost_net_busy_poll_try_queue(struct vhost_net *net,
+					  struct vhost_virtqueue *vq)
+{
+	if (!vhost_vq_avail_empty(&net->dev, vq)) {
+		vhost_poll_queue(&vq->poll);
+	} else if (unlikely(vhost_enable_notify(&net->dev, vq))) {
+		vhost_disable_notify(&net->dev, vq);
+		vhost_poll_queue(&vq->poll);
+	}
+}
+
+/* Busy poll for work on the vq of the pair the caller holds the mutex of:
+ * the rx socket with poll_rx, the tx ring otherwise. When both vqs are
+ * served by the same worker the other one is polled too, so that a busy
+ * tx side does not leave rx waiting for a wakeup, and the other way around.
+ * Vqs on different workers are each polled by their own worker. */
+static void vhost_net_busy_poll(struct vhost_net *net,
+				struct vhost_net_virtqueue *rnvq,
+				struct vhost_net_virtqueue *tnvq,
+				bool poll_rx)
+{
+	struct vhost_net_virtqueue *nvq = poll_rx ? rnvq : tnvq;
+	struct vhost_virtqueue *rvq = &rnvq->vq;
+	struct vhost_virtqueue *tvq = &tnvq->vq;
+	struct vhost_virtqueue *pvq = poll_rx ? tvq : rvq;
+	struct socket *sock = NULL;
+	unsigned long endtime;
+	bool paired, found;
+
+	/* Try to hold the vq mutex of the paired virtqueue. We can't
+	 * use mutex_lock() here since we could not guarantee a
+	 * consistent lock ordering. */
+	paired = rcu_access_pointer(rvq->worker) ==
+		 rcu_access_pointer(tvq->worker) &&
+		 mutex_trylock(&pvq->mutex);
+	if (paired)
+		vhost_disable_notify(&net->dev, pvq);
+	if (poll_rx || paired)
+		sock = rvq->private_data;
+
+	preempt_disable();
+	endtime = busy_clock() + vhost_net_busy_poll_time(nvq);
+
+	while (vhost_can_busy_poll(endtime) &&
+	       !vhost_vq_has_work(&nvq->vq)) {
+		if (sock && sk_has_rx_data(sock->sk) &&
+		    !vhost_vq_avail_empty(&net->dev, rvq))
+			break;
+		if ((!poll_rx || paired) &&
+		    !vhost_vq_avail_empty(&net->dev, tvq))
+			break;
+		cpu_relax();
+	}
+
+	preempt_enable();
+
+	if (poll_rx)
+		found = sock && sk_has_rx_data(sock->sk);
+	else
+		found = !vhost_vq_avail_empty(&net->dev, tvq);
+	vhost_net_busy_poll_adapt(nvq, found);
+
+	if (!paired)
+		return;
+
+	if (poll_rx || (sock && sk_has_rx_data(sock->sk)))
+		vhost_net_busy_poll_try_queue(net, pvq);
+	else /* On tx here, sock has no rx data. */
+		vhost_enable_notify(&net->dev, pvq);
+
+	mutex_unlock(&pvq->mutex);
 }
 
 static void vhost_net_disable_vq(struct vhost_net *n,
@@ -431,22 +549,53 @@ static int vhost_net_enable_vq(struct vhost_net *n,
 	return vhost_poll_start(poll, sock->file);
 }
 
+/* Pass the batched packets to tun, and their heads back to the guest. */
+static void vhost_tx_batch(struct vhost_net *net,
+			   struct vhost_net_virtqueue *nvq,
+			   struct socket *sock,
+			   struct msghdr *msghdr)
+{
+	struct tun_msg_ctl ctl = {
+		.type = TUN_MSG_PTR,
+		.num = nvq->batched_xdp,
+		.ptr = nvq->xdp,
+	};
+	int err, i;
+
+	if (!nvq->batched_xdp)
+		return;
+
+	msghdr->msg_control = &ctl;
+	msghdr->msg_controllen = sizeof(ctl);
+	err = sock->ops->sendmsg(sock, msghdr, 0);
+	if (unlikely(err < 0)) {
+		vq_err(&nvq->vq, "Fail to batch sending packets\n");
+		for (i = 0; i < nvq->batched_xdp; i++)
+			put_page(virt_to_head_page(nvq->xdp[i].data));
+	}
+
+	vhost_add_used_and_signal_n(&net->dev, &nvq->vq, nvq->vq.heads,
+				    nvq->done_idx);
+	nvq->done_idx = 0;
+	nvq->batched_xdp = 0;
+}
+
 static int vhost_net_tx_get_vq_desc(struct vhost_net *net,
 				    struct vhost_virtqueue *vq,
 				    struct iovec iov[], unsigned int iov_size,
-				    unsigned int *out_num, unsigned int *in_num)
+				    unsigned int *out_num, unsigned int *in_num,
+				    struct socket *sock, struct msghdr *msghdr)
 {
-	unsigned long uninitialized_var(endtime);
+	struct vhost_net_virtqueue *tnvq =
+		container_of(vq, struct vhost_net_virtqueue, vq);
 	int r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
 				  out_num, in_num, NULL, NULL);
 
 	if (r == vq->num && vq->busyloop_timeout) {
-		preempt_disable();
-		endtime = busy_clock() + vq->busyloop_timeout;
-		while (vhost_can_busy_poll(vq->dev, endtime) &&
-		       vhost_vq_avail_empty(vq->dev, vq))
-			cpu_relax();
-		preempt_enable();
+		/* Don't hold back the batched packets while polling */
+		vhost_tx_batch(net, tnvq, sock, msghdr);
+		vhost_net_busy_poll(net, &net->vqs[VHOST_NET_VQ_RX], tnvq,
+				    false);
 		r = vhost_get_vq_desc(vq, vq->iov, ARRAY_SIZE(vq->iov),
 				      out_num, in_num, NULL, NULL);
 	}
@@ -454,6 +603,82 @@ static int vhost_net_tx_get_vq_desc(struct vhost_net *net,
 	return r;
 }
 
+static bool vhost_sock_xdp(struct socket *sock)
+{
+	return sock_flag(sock->sk, SOCK_XDP);
+}
+
+/* Copy the packet at @from into a page fragment laid out the way tun
+ * builds skbs, with a tun_xdp_hdr carrying the vnet header in front.
+ * Returns -ENOSPC if it does not fit in a page, and the packet should
+ * take the sendmsg() path instead. */
+static int vhost_net_build_xdp(struct vhost_net_virtqueue *nvq,
+			       struct iov_iter *from)
+{
+	struct vhost_virtqueue *vq = &nvq->vq;
+	struct page_frag *alloc_frag = &current->task_frag;
+	struct xdp_buff *xdp = &nvq->xdp[nvq->batched_xdp];
+	struct virtio_net_hdr *gso;
+	struct tun_xdp_hdr *hdr;
+	size_t len = iov_iter_count(from);
+	size_t sock_hlen = nvq->sock_hlen;
+	size_t gso_len = min(sock_hlen, sizeof(*gso));
+	int pad = SKB_DATA_ALIGN(VHOST_NET_RX_PAD + XDP_PACKET_HEADROOM +
+				 sock_hlen);
+	int buflen;
+	void *buf;
+
+	if (unlikely(len < sock_hlen))
+		return -EFAULT;
+
+	buflen = SKB_DATA_ALIGN(len + pad) +
+		 SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+	if (buflen > PAGE_SIZE)
+		return -ENOSPC;
+
+	alloc_frag->offset = ALIGN((u64)alloc_frag->offset, SMP_CACHE_BYTES);
+	if (unlikely(!skb_page_frag_refill(buflen, alloc_frag, GFP_KERNEL)))
+		return -ENOMEM;
+
+	buf = (char *)page_address(alloc_frag->page) + alloc_frag->offset;
+	hdr = buf;
+	gso = &hdr->gso;
+
+	memset(gso, 0, sizeof(*gso));
+	if (copy_from_iter(gso, gso_len, from) != gso_len)
+		return -EFAULT;
+	iov_iter_advance(from, sock_hlen - gso_len);
+
+	if ((gso->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) &&
+	    vhost16_to_cpu(vq, gso->csum_start) +
+	    vhost16_to_cpu(vq, gso->csum_offset) + 2 >
+	    vhost16_to_cpu(vq, gso->hdr_len)) {
+		gso->hdr_len = cpu_to_vhost16(vq,
+			       vhost16_to_cpu(vq, gso->csum_start) +
+			       vhost16_to_cpu(vq, gso->csum_offset) + 2);
+
+		if (vhost16_to_cpu(vq, gso->hdr_len) > len)
+			return -EINVAL;
+	}
+
+	len -= sock_hlen;
+	if (copy_page_from_iter(alloc_frag->page, alloc_frag->offset + pad,
+				len, from) != len)
+		return -EFAULT;
+
+	xdp->data_hard_start = buf;
+	xdp->data = buf + pad;
+	xdp->data_end = xdp->data + len;
+	hdr->buflen = buflen;
+
+	get_page(alloc_frag->page);
+	alloc_frag->offset += buflen;
+
+	++nvq->batched_xdp;
+
+	return 0;
+}
+
 static bool vhost_exceeds_maxpend(struct vhost_net *net)
 {
 	struct vhost_net_virtqueue *nvq = &net->vqs[VHOST_NET_VQ_TX];
@@ -483,7 +708,8 @@ static void handle_tx(struct vhost_net *net)
 	size_t hdr_size;
 	struct socket *sock;
 	struct vhost_net_ubuf_ref *uninitialized_var(ubufs);
-	bool zcopy, zcopy_used;
+	struct tun_msg_ctl ctl;
+	bool zcopy, zcopy_used, batch;
 	int sent_pkts = 0;
 
 	mutex_lock(&vq->mutex);
@@ -499,6 +725,10 @@ static void handle_tx(struct vhost_net *net)
 
 	hdr_size = nvq->vhost_hlen;
 	zcopy = nvq->ubufs;
+	/* A socket with a limited sndbuf wants to account for every skb,
+	 * which batching bypasses. */
+	batch = !zcopy && vhost_sock_xdp(sock) &&
+		sock->sk->sk_sndbuf == INT_MAX;
 
 	for (;;) {
 		/* Release DMAs done buffers first */
@@ -508,7 +738,7 @@ static void handle_tx(struct vhost_net *net)
 
 		head = vhost_net_tx_get_vq_desc(net, vq, vq->iov,
 						ARRAY_SIZE(vq->iov),
-						&out, &in);
+						&out, &in, sock, &msg);
 		/* On error, stop handling until the next kick. */
 		if (unlikely(head < 0))
 			break;
@@ -538,6 +768,27 @@ static void handle_tx(struct vhost_net *net)
 		}
 		len = msg_data_left(&msg);
 
+		if (batch) {
+			err = vhost_net_build_xdp(nvq, &msg.msg_iter);
+			if (!err) {
+				vq->heads[nvq->done_idx].id =
+					cpu_to_vhost32(vq, head);
+				vq->heads[nvq->done_idx].len = 0;
+				++nvq->done_idx;
+				total_len += len;
+				if (nvq->batched_xdp == VHOST_NET_BATCH)
+					vhost_tx_batch(net, nvq, sock, &msg);
+				goto done;
+			}
+			vhost_tx_batch(net, nvq, sock, &msg);
+			if (unlikely(err != -ENOSPC)) {
+				vhost_discard_vq_desc(vq, 1);
+				vhost_net_enable_vq(net, vq);
+				break;
+			}
+			/* Too large to batch, send it on its own below */
+		}
+
 		zcopy_used = zcopy && len >= VHOST_GOODCOPY_LEN
 				   && !vhost_exceeds_maxpend(net)
 				   && vhost_net_tx_select_zcopy(net);
@@ -553,8 +804,10 @@ static void handle_tx(struct vhost_net *net)
 			ubuf->ctx = nvq->ubufs;
 			ubuf->desc = nvq->upend_idx;
 			refcount_set(&ubuf->refcnt, 1);
-			msg.msg_control = ubuf;
-			msg.msg_controllen = sizeof(ubuf);
+			ctl.type = TUN_MSG_UBUF;
+			ctl.ptr = ubuf;
+			msg.msg_control = &ctl;
+			msg.msg_controllen = sizeof(ctl);
 			ubufs = nvq->ubufs;
 			atomic_inc(&ubufs->refcount);
 			nvq->upend_idx = (nvq->upend_idx + 1) % UIO_MAXIOV;
@@ -591,6 +844,7 @@ static void handle_tx(struct vhost_net *net)
 			vhost_add_used_and_signal(&net->dev, vq, head, 0);
 		else
 			vhost_zerocopy_signal_used(net, vq);
+done:
 		vhost_net_tx_packet(net);
 		if (unlikely(total_len >= VHOST_NET_WEIGHT) ||
 		    unlikely(++sent_pkts >= VHOST_NET_PKT_WEIGHT)) {
@@ -598,6 +852,7 @@ static void handle_tx(struct vhost_net *net)
 			break;
 		}
 	}
+	vhost_tx_batch(net, nvq, sock, &msg);
 out:
 	mutex_unlock(&vq->mutex);
 }
@@ -623,16 +878,6 @@ static int peek_head_len(struct vhost_net_virtqueue *rvq, struct sock *sk)
 	return len;
 }
 
-static int sk_has_rx_data(struct sock *sk)
-{
-	struct socket *sock = sk->sk_socket;
-
-	if (sock->ops->peek_len)
-		return sock->ops->peek_len(sock);
-
-	return skb_queue_empty(&sk->sk_receive_queue);
-}
-
 static void vhost_rx_signal_used(struct vhost_net_virtqueue *nvq)
 {
 	struct vhost_virtqueue *vq = &nvq->vq;
@@ -647,39 +892,15 @@ static void vhost_rx_signal_used(struct vhost_net_virtqueue *nvq)
 
 static int vhost_net_rx_peek_head_len(struct vhost_net *net, struct sock *sk)
 {
-	struct vhost_net_virtqueue *rvq = &net->vqs[VHOST_NET_VQ_RX];
-	struct vhost_net_virtqueue *nvq = &net->vqs[VHOST_NET_VQ_TX];
-	struct vhost_virtqueue *vq = &nvq->vq;
-	unsigned long uninitialized_var(endtime);
-	int len = peek_head_len(rvq, sk);
+	struct vhost_net_virtqueue *rnvq = &net->vqs[VHOST_NET_VQ_RX];
+	struct vhost_net_virtqueue *tnvq = &net->vqs[VHOST_NET_VQ_TX];
+	int len = peek_head_len(rnvq, sk);
 
-	if (!len && vq->busyloop_timeout) {
+	if (!len && rnvq->vq.busyloop_timeout) {
 		/* Flush batched heads first */
-		vhost_rx_signal_used(rvq);
-		/* Both tx vq and rx socket were polled here */
-		mutex_lock_nested(&vq->mutex, 1);
-		vhost_disable_notify(&net->dev, vq);
-
-		preempt_disable();
-		endtime = busy_clock() + vq->busyloop_timeout;
-
-		while (vhost_can_busy_poll(&net->dev, endtime) &&
-		       !sk_has_rx_data(sk) &&
-		       vhost_vq_avail_empty(&net->dev, vq))
-			cpu_relax();
-
-		preempt_enable();
-
-		if (!vhost_vq_avail_empty(&net->dev, vq))
-			vhost_poll_queue(&vq->poll);
-		else if (unlikely(vhost_enable_notify(&net->dev, vq))) {
-			vhost_disable_notify(&net->dev, vq);
-			vhost_poll_queue(&vq->poll);
-		}
-
-		mutex_unlock(&vq->mutex);
-
-		len = peek_head_len(rvq, sk);
+		vhost_rx_signal_used(rnvq);
+		vhost_net_busy_poll(net, rnvq, tnvq, true);
+		len = peek_head_len(rnvq, sk);
 	}
 
 	return len;
@@ -940,6 +1161,7 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 	struct vhost_net *n;
 	struct vhost_dev *dev;
 	struct vhost_virtqueue **vqs;
+	struct xdp_buff *xdp;
 	void **queue;
 	int i;
 
@@ -961,6 +1183,15 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 	}
 	n->vqs[VHOST_NET_VQ_RX].rxq.queue = queue;
 
+	xdp = kmalloc_array(VHOST_NET_BATCH, sizeof(*xdp), GFP_KERNEL);
+	if (!xdp) {
+		kfree(vqs);
+		kvfree(n);
+		kfree(queue);
+		return -ENOMEM;
+	}
+	n->vqs[VHOST_NET_VQ_TX].xdp = xdp;
+
 	dev = &n->dev;
 	vqs[VHOST_NET_VQ_TX] = &n->vqs[VHOST_NET_VQ_TX].vq;
 	vqs[VHOST_NET_VQ_RX] = &n->vqs[VHOST_NET_VQ_RX].vq;
@@ -974,13 +1205,18 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 		n->vqs[i].vhost_hlen = 0;
 		n->vqs[i].sock_hlen = 0;
 		n->vqs[i].rx_ring = NULL;
+		n->vqs[i].batched_xdp = 0;
+		n->vqs[i].busyloop_time = 0;
 		vhost_net_buf_init(&n->vqs[i].rxq);
 	}
 	vhost_dev_init(dev, vqs, VHOST_NET_VQ_MAX,
 		       UIO_MAXIOV + VHOST_RX_BATCH);
+	dev->multi_worker = true;
 
-	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev);
-	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, EPOLLOUT, dev,
+			vqs[VHOST_NET_VQ_TX]);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, EPOLLIN, dev,
+			vqs[VHOST_NET_VQ_RX]);
 
 	f->private_data = n;
 
@@ -1055,6 +1291,7 @@ static int vhost_net_release(struct inode *inode, struct file *f)
 	 * since jobs can re-queue themselves. */
 	vhost_net_flush(n);
 	kfree(n->vqs[VHOST_NET_VQ_RX].rxq.queue);
+	kfree(n->vqs[VHOST_NET_VQ_TX].xdp);
 	kfree(n->dev.vqs);
 	kvfree(n);
 	return 0;
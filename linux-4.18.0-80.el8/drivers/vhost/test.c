@@ -15,6 +15,8 @@
 #include <linux/workqueue.h>
 #include <linux/file.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include "test.h"
 #include "vhost.h"
@@ -23,6 +25,11 @@
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_TEST_WEIGHT 0x80000
 
+enum {
+	VHOST_TEST_FEATURES = VHOST_FEATURES |
+			      (1ULL << VIRTIO_F_IN_ORDER)
+};
+
 enum {
 	VHOST_TEST_VQ = 0,
 	VHOST_TEST_VQ_MAX = 1,
@@ -31,6 +38,10 @@ enum {
 struct vhost_test {
 	struct vhost_dev dev;
 	struct vhost_virtqueue vqs[VHOST_TEST_VQ_MAX];
+	/* Descriptors consumed since the test was started, to compare
+	 * ring layouts: see vhost_test_report(). */
+	u64 descs;
+	ktime_t start;
 };
 
 /* Expects to be always run from workqueue - which acts as
@@ -80,6 +91,7 @@ static void handle_vq(struct vhost_test *n)
 			break;
 		}
 		vhost_add_used_and_signal(&n->dev, vq, head, 0);
+		n->descs++;
 		total_len += len;
 		if (unlikely(total_len >= VHOST_TEST_WEIGHT)) {
 			vhost_poll_queue(&vq->poll);
@@ -165,6 +177,19 @@ static int vhost_test_release(struct inode *inode, struct file *f)
 	return 0;
 }
 
+static void vhost_test_report(struct vhost_test *n)
+{
+	struct vhost_virtqueue *vq = &n->vqs[VHOST_TEST_VQ];
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), n->start));
+
+	if (ns <= 0)
+		return;
+	pr_info("vhost-test: %llu descs in %lld ns, %llu descs/s (%s ring%s)\n",
+		n->descs, ns, div64_u64(n->descs * NSEC_PER_SEC, ns),
+		vhost_vq_is_packed(vq) ? "packed" : "split",
+		vhost_has_feature(vq, VIRTIO_F_IN_ORDER) ? ", in order" : "");
+}
+
 static long vhost_test_run(struct vhost_test *n, int test)
 {
 	void *priv, *oldpriv;
@@ -187,6 +212,11 @@ static long vhost_test_run(struct vhost_test *n, int test)
 		}
 	}
 
+	if (test) {
+		n->descs = 0;
+		n->start = ktime_get();
+	}
+
 	for (index = 0; index < n->dev.nvqs; ++index) {
 		vq = n->vqs + index;
 		mutex_lock(&vq->mutex);
@@ -205,6 +235,8 @@ static long vhost_test_run(struct vhost_test *n, int test)
 
 		if (oldpriv) {
 			vhost_test_flush_vq(n, index);
+			if (!test)
+				vhost_test_report(n);
 		}
 	}
 
@@ -272,7 +304,7 @@ static long vhost_test_ioctl(struct file *f, unsigned int ioctl,
 			return -EFAULT;
 		return vhost_test_run(n, test);
 	case VHOST_GET_FEATURES:
-		features = VHOST_FEATURES;
+		features = VHOST_TEST_FEATURES;
 		if (copy_to_user(featurep, &features, sizeof features))
 			return -EFAULT;
 		return 0;
@@ -281,7 +313,7 @@ static long vhost_test_ioctl(struct file *f, unsigned int ioctl,
 		if (copy_from_user(&features, featurep, sizeof features))
 			return -EFAULT;
 		printk(KERN_ERR "2\n");
-		if (features & ~VHOST_FEATURES)
+		if (features & ~VHOST_TEST_FEATURES)
 			return -EOPNOTSUPP;
 		printk(KERN_ERR "3\n");
 		return vhost_test_set_features(n, features);
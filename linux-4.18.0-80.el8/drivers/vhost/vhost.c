@@ -185,14 +185,17 @@ void vhost_work_init(struct vhost_work *work, vhost_work_fn_t fn)
 }
 EXPORT_SYMBOL_GPL(vhost_work_init);
 
-/* Init poll structure */
+/* Init poll structure. Work for a poll with a vq runs on the worker the vq
+ * is attached to, otherwise on the default worker of the device. */
 void vhost_poll_init(struct vhost_poll *poll, vhost_work_fn_t fn,
-		     __poll_t mask, struct vhost_dev *dev)
+		     __poll_t mask, struct vhost_dev *dev,
+		     struct vhost_virtqueue *vq)
 {
 	init_waitqueue_func_entry(&poll->wait, vhost_poll_wakeup);
 	init_poll_funcptr(&poll->table, vhost_poll_func);
 	poll->mask = mask;
 	poll->dev = dev;
+	poll->vq = vq;
 	poll->wqh = NULL;
 
 	vhost_work_init(&poll->work, fn);
@@ -232,25 +235,62 @@ void vhost_poll_stop(struct vhost_poll *poll)
 }
 EXPORT_SYMBOL_GPL(vhost_poll_stop);
 
-void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+static void vhost_worker_queue(struct vhost_worker *worker,
+			       struct vhost_work *work)
+{
+	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
+		/* We can only add the work to the list after we're
+		 * sure it was not in the list.
+		 * test_and_set_bit() implies a memory barrier.
+		 */
+		llist_add(&work->node, &worker->work_list);
+		wake_up_process(worker->task);
+	}
+}
+
+static void vhost_worker_flush(struct vhost_worker *worker)
 {
 	struct vhost_flush_struct flush;
 
-	if (dev->worker) {
-		init_completion(&flush.wait_event);
-		vhost_work_init(&flush.work, vhost_flush_work);
+	init_completion(&flush.wait_event);
+	vhost_work_init(&flush.work, vhost_flush_work);
 
-		vhost_work_queue(dev, &flush.work);
-		wait_for_completion(&flush.wait_event);
-	}
+	vhost_worker_queue(worker, &flush.work);
+	wait_for_completion(&flush.wait_event);
+}
+
+/* The worker of a vq only changes under the device mutex, which callers of
+ * the flush functions hold unless the device is being released. */
+static struct vhost_worker *vhost_vq_worker(struct vhost_virtqueue *vq)
+{
+	return rcu_dereference_protected(vq->worker, 1);
+}
+
+void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work)
+{
+	if (dev->worker)
+		vhost_worker_flush(dev->worker);
 }
 EXPORT_SYMBOL_GPL(vhost_work_flush);
 
+/* Flush the work queued on the worker of a vq. */
+void vhost_vq_flush(struct vhost_virtqueue *vq)
+{
+	struct vhost_worker *worker = vhost_vq_worker(vq);
+
+	if (worker)
+		vhost_worker_flush(worker);
+}
+EXPORT_SYMBOL_GPL(vhost_vq_flush);
+
 /* Flush any work that has been scheduled. When calling this, don't hold any
  * locks that are also used by the callback. */
 void vhost_poll_flush(struct vhost_poll *poll)
 {
-	vhost_work_flush(poll->dev, &poll->work);
+	if (poll->vq)
+		vhost_vq_flush(poll->vq);
+	else
+		vhost_work_flush(poll->dev, &poll->work);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_flush);
 
@@ -259,27 +299,53 @@ void vhost_work_queue(struct vhost_dev *dev, struct vhost_work *work)
 	if (!dev->worker)
 		return;
 
-	if (!test_and_set_bit(VHOST_WORK_QUEUED, &work->flags)) {
-		/* We can only add the work to the list after we're
-		 * sure it was not in the list.
-		 * test_and_set_bit() implies a memory barrier.
-		 */
-		llist_add(&work->node, &dev->work_list);
-		wake_up_process(dev->worker);
-	}
+	vhost_worker_queue(dev->worker, work);
 }
 EXPORT_SYMBOL_GPL(vhost_work_queue);
 
+/* Queue work on the worker the vq is attached to. */
+void vhost_vq_work_queue(struct vhost_virtqueue *vq, struct vhost_work *work)
+{
+	struct vhost_worker *worker;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker);
+	if (worker)
+		vhost_worker_queue(worker, work);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(vhost_vq_work_queue);
+
 /* A lockless hint for busy polling code to exit the loop */
 bool vhost_has_work(struct vhost_dev *dev)
 {
-	return !llist_empty(&dev->work_list);
+	return dev->worker && !llist_empty(&dev->worker->work_list);
 }
 EXPORT_SYMBOL_GPL(vhost_has_work);
 
+/* Same, for the worker a vq is attached to: busy polling on a worker
+ * serving several vqs must not hold up the others. */
+bool vhost_vq_has_work(struct vhost_virtqueue *vq)
+{
+	struct vhost_worker *worker;
+	bool has_work = false;
+
+	rcu_read_lock();
+	worker = rcu_dereference(vq->worker);
+	if (worker && !llist_empty(&worker->work_list))
+		has_work = true;
+	rcu_read_unlock();
+
+	return has_work;
+}
+EXPORT_SYMBOL_GPL(vhost_vq_has_work);
+
 void vhost_poll_queue(struct vhost_poll *poll)
 {
-	vhost_work_queue(poll->dev, &poll->work);
+	if (poll->vq)
+		vhost_vq_work_queue(poll->vq, &poll->work);
+	else
+		vhost_work_queue(poll->dev, &poll->work);
 }
 EXPORT_SYMBOL_GPL(vhost_poll_queue);
 
@@ -311,6 +377,8 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->last_used_idx = 0;
 	vq->signalled_used = 0;
 	vq->signalled_used_valid = false;
+	vq->last_avail_wrap_counter = true;
+	vq->last_used_wrap_counter = true;
 	vq->used_flags = 0;
 	vq->log_used = false;
 	vq->log_addr = -1ull;
@@ -331,7 +399,8 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 
 static int vhost_worker(void *data)
 {
-	struct vhost_dev *dev = data;
+	struct vhost_worker *worker = data;
+	struct vhost_dev *dev = worker->dev;
 	struct vhost_work *work, *work_next;
 	struct llist_node *node;
 	mm_segment_t oldfs = get_fs();
@@ -348,7 +417,7 @@ static int vhost_worker(void *data)
 			break;
 		}
 
-		node = llist_del_all(&dev->work_list);
+		node = llist_del_all(&worker->work_list);
 		if (!node)
 			schedule();
 
@@ -376,6 +445,8 @@ static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 	vq->log = NULL;
 	kfree(vq->heads);
 	vq->heads = NULL;
+	kvfree(vq->packed);
+	vq->packed = NULL;
 }
 
 /* Helper to allocate iovec buffers for all vqs. */
@@ -426,8 +497,9 @@ void vhost_dev_init(struct vhost_dev *dev,
 	dev->iotlb = NULL;
 	dev->mm = NULL;
 	dev->worker = NULL;
+	dev->multi_worker = false;
 	dev->iov_limit = iov_limit;
-	init_llist_head(&dev->work_list);
+	idr_init(&dev->worker_idr);
 	init_waitqueue_head(&dev->wait);
 	INIT_LIST_HEAD(&dev->read_list);
 	INIT_LIST_HEAD(&dev->pending_list);
@@ -439,12 +511,14 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vq->log = NULL;
 		vq->indirect = NULL;
 		vq->heads = NULL;
+		vq->packed = NULL;
 		vq->dev = dev;
+		RCU_INIT_POINTER(vq->worker, NULL);
 		mutex_init(&vq->mutex);
 		vhost_vq_reset(dev, vq);
 		if (vq->handle_kick)
 			vhost_poll_init(&vq->poll, vq->handle_kick,
-					EPOLLIN, dev);
+					EPOLLIN, dev, vq);
 	}
 }
 EXPORT_SYMBOL_GPL(vhost_dev_init);
@@ -471,17 +545,250 @@ static void vhost_attach_cgroups_work(struct vhost_work *work)
 	s->ret = cgroup_attach_task_all(s->owner, current);
 }
 
-static int vhost_attach_cgroups(struct vhost_dev *dev)
+static int vhost_attach_cgroups(struct vhost_worker *worker)
 {
 	struct vhost_attach_cgroups_struct attach;
 
 	attach.owner = current;
 	vhost_work_init(&attach.work, vhost_attach_cgroups_work);
-	vhost_work_queue(dev, &attach.work);
-	vhost_work_flush(dev, &attach.work);
+	vhost_worker_queue(worker, &attach.work);
+	vhost_worker_flush(worker);
 	return attach.ret;
 }
 
+/* Caller should have device mutex, and be the owner */
+static struct vhost_worker *vhost_worker_create(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	struct task_struct *task;
+	int id, err;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return ERR_PTR(-ENOMEM);
+
+	worker->dev = dev;
+	init_llist_head(&worker->work_list);
+
+	task = kthread_create(vhost_worker, worker, "vhost-%d", current->pid);
+	if (IS_ERR(task)) {
+		err = PTR_ERR(task);
+		goto err_task;
+	}
+
+	worker->task = task;
+	wake_up_process(task);	/* avoid contributing to loadavg */
+
+	err = vhost_attach_cgroups(worker);
+	if (err)
+		goto err_cgroup;
+
+	id = idr_alloc(&dev->worker_idr, worker, 0, 0, GFP_KERNEL);
+	if (id < 0) {
+		err = id;
+		goto err_cgroup;
+	}
+	worker->id = id;
+
+	return worker;
+err_cgroup:
+	kthread_stop(task);
+err_task:
+	kfree(worker);
+	return ERR_PTR(err);
+}
+
+static void vhost_worker_destroy(struct vhost_dev *dev,
+				 struct vhost_worker *worker)
+{
+	WARN_ON(!llist_empty(&worker->work_list));
+	idr_remove(&dev->worker_idr, worker->id);
+	kthread_stop(worker->task);
+	kfree(worker);
+}
+
+static void vhost_workers_free(struct vhost_dev *dev)
+{
+	struct vhost_worker *worker;
+	int i, id;
+
+	for (i = 0; i < dev->nvqs; i++)
+		RCU_INIT_POINTER(dev->vqs[i]->worker, NULL);
+	/* vhost_vq_work_queue() and vhost_vq_has_work() may still be looking
+	 * at the workers under rcu_read_lock() */
+	synchronize_rcu();
+	idr_for_each_entry(&dev->worker_idr, worker, id)
+		vhost_worker_destroy(dev, worker);
+	dev->worker = NULL;
+}
+
+/* Pin a worker to a CPU the owner may run on, or with cpu < 0 give it the
+ * affinity of the owner. */
+static int vhost_worker_set_cpu(struct vhost_worker *worker, int cpu)
+{
+	if (cpu < 0)
+		return set_cpus_allowed_ptr(worker->task,
+					    &current->cpus_allowed);
+
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu) ||
+	    !cpumask_test_cpu(cpu, &current->cpus_allowed))
+		return -EINVAL;
+
+	return set_cpus_allowed_ptr(worker->task, cpumask_of(cpu));
+}
+
+static long vhost_new_worker(struct vhost_dev *dev,
+			     struct vhost_worker_state __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+	long r;
+
+	worker = vhost_worker_create(dev);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	r = vhost_worker_set_cpu(worker, -1);
+	if (r)
+		goto err;
+
+	state.worker_id = worker->id;
+	if (copy_to_user(argp, &state, sizeof(state))) {
+		r = -EFAULT;
+		goto err;
+	}
+	return 0;
+err:
+	vhost_worker_destroy(dev, worker);
+	return r;
+}
+
+static long vhost_free_worker(struct vhost_dev *dev,
+			      struct vhost_worker_state __user *argp)
+{
+	struct vhost_worker_state state;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&state, argp, sizeof(state)))
+		return -EFAULT;
+
+	worker = idr_find(&dev->worker_idr, state.worker_id);
+	if (!worker)
+		return -ENODEV;
+	/* The default worker goes with the device, the others once no vq
+	 * uses them any more. */
+	if (worker == dev->worker || worker->attachment_cnt)
+		return -EBUSY;
+
+	vhost_worker_destroy(dev, worker);
+	return 0;
+}
+
+static long vhost_set_worker_cpu(struct vhost_dev *dev,
+				 struct vhost_worker_cpu __user *argp)
+{
+	struct vhost_worker_cpu wc;
+	struct vhost_worker *worker;
+
+	if (copy_from_user(&wc, argp, sizeof(wc)))
+		return -EFAULT;
+
+	worker = idr_find(&dev->worker_idr, wc.worker_id);
+	if (!worker)
+		return -ENODEV;
+
+	return vhost_worker_set_cpu(worker, wc.cpu);
+}
+
+static struct vhost_virtqueue *vhost_worker_vq(struct vhost_dev *dev,
+					       struct vhost_vring_worker *w)
+{
+	if (w->index >= dev->nvqs)
+		return NULL;
+
+	return dev->vqs[array_index_nospec(w->index, dev->nvqs)];
+}
+
+static long vhost_attach_vring_worker(struct vhost_dev *dev,
+				      struct vhost_vring_worker __user *argp)
+{
+	struct vhost_worker *worker, *old;
+	struct vhost_vring_worker w;
+	struct vhost_virtqueue *vq;
+
+	if (copy_from_user(&w, argp, sizeof(w)))
+		return -EFAULT;
+
+	vq = vhost_worker_vq(dev, &w);
+	if (!vq)
+		return -ENOBUFS;
+
+	worker = idr_find(&dev->worker_idr, w.worker_id);
+	if (!worker)
+		return -ENODEV;
+
+	mutex_lock(&vq->mutex);
+	old = rcu_dereference_protected(vq->worker,
+					lockdep_is_held(&vq->mutex));
+	rcu_assign_pointer(vq->worker, worker);
+	mutex_unlock(&vq->mutex);
+
+	if (old == worker)
+		return 0;
+
+	worker->attachment_cnt++;
+	old->attachment_cnt--;
+
+	/* Wait until nothing can queue on the old worker any more, then
+	 * let it finish what it was given. Until then the vq may have work
+	 * running on both workers, which the vq mutex serializes. */
+	synchronize_rcu();
+	vhost_worker_flush(old);
+	return 0;
+}
+
+static long vhost_get_vring_worker(struct vhost_dev *dev,
+				   struct vhost_vring_worker __user *argp)
+{
+	struct vhost_vring_worker w;
+	struct vhost_virtqueue *vq;
+
+	if (copy_from_user(&w, argp, sizeof(w)))
+		return -EFAULT;
+
+	vq = vhost_worker_vq(dev, &w);
+	if (!vq)
+		return -ENOBUFS;
+
+	w.worker_id = vhost_vq_worker(vq)->id;
+	if (copy_to_user(argp, &w, sizeof(w)))
+		return -EFAULT;
+	return 0;
+}
+
+static long vhost_worker_ioctl(struct vhost_dev *dev, unsigned int ioctl,
+			       void __user *argp)
+{
+	/* Only drivers that serialize all used ring updates on the vq mutex
+	 * opt in. vhost-scsi completes requests from work queued on the
+	 * default worker and relies on it being the only one. */
+	if (!dev->multi_worker)
+		return -ENOIOCTLCMD;
+
+	switch (ioctl) {
+	case VHOST_NEW_WORKER:
+		return vhost_new_worker(dev, argp);
+	case VHOST_FREE_WORKER:
+		return vhost_free_worker(dev, argp);
+	case VHOST_SET_WORKER_CPU:
+		return vhost_set_worker_cpu(dev, argp);
+	case VHOST_ATTACH_VRING_WORKER:
+		return vhost_attach_vring_worker(dev, argp);
+	default:
+		return vhost_get_vring_worker(dev, argp);
+	}
+}
+
 /* Caller should have device mutex */
 bool vhost_dev_has_owner(struct vhost_dev *dev)
 {
@@ -492,8 +799,8 @@ EXPORT_SYMBOL_GPL(vhost_dev_has_owner);
 /* Caller should have device mutex */
 long vhost_dev_set_owner(struct vhost_dev *dev)
 {
-	struct task_struct *worker;
-	int err;
+	struct vhost_worker *worker;
+	int i, err;
 
 	/* Is there an owner already? */
 	if (vhost_dev_has_owner(dev)) {
@@ -503,27 +810,26 @@ long vhost_dev_set_owner(struct vhost_dev *dev)
 
 	/* No owner, become one */
 	dev->mm = get_task_mm(current);
-	worker = kthread_create(vhost_worker, dev, "vhost-%d", current->pid);
+	worker = vhost_worker_create(dev);
 	if (IS_ERR(worker)) {
 		err = PTR_ERR(worker);
 		goto err_worker;
 	}
 
+	/* All vqs start out on the default worker, userspace can spread
+	 * them over more with VHOST_ATTACH_VRING_WORKER. */
 	dev->worker = worker;
-	wake_up_process(worker);	/* avoid contributing to loadavg */
-
-	err = vhost_attach_cgroups(dev);
-	if (err)
-		goto err_cgroup;
+	for (i = 0; i < dev->nvqs; i++)
+		rcu_assign_pointer(dev->vqs[i]->worker, worker);
+	worker->attachment_cnt = dev->nvqs;
 
 	err = vhost_dev_alloc_iovecs(dev);
 	if (err)
-		goto err_cgroup;
+		goto err_iovecs;
 
 	return 0;
-err_cgroup:
-	kthread_stop(worker);
-	dev->worker = NULL;
+err_iovecs:
+	vhost_workers_free(dev);
 err_worker:
 	if (dev->mm)
 		mmput(dev->mm);
@@ -635,11 +941,7 @@ void vhost_dev_cleanup(struct vhost_dev *dev)
 	dev->iotlb = NULL;
 	vhost_clear_msg(dev);
 	wake_up_interruptible_poll(&dev->wait, EPOLLIN | EPOLLRDNORM);
-	WARN_ON(!llist_empty(&dev->work_list));
-	if (dev->worker) {
-		kthread_stop(dev->worker);
-		dev->worker = NULL;
-	}
+	vhost_workers_free(dev);
 	if (dev->mm)
 		mmput(dev->mm);
 	dev->mm = NULL;
@@ -851,7 +1153,7 @@ static inline void __user *__vhost_get_user(struct vhost_virtqueue *vq,
 	return __vhost_get_user_slow(vq, addr, size, type);
 }
 
-#define vhost_put_user(vq, x, ptr)		\
+#define __vhost_put_user(vq, x, ptr, type)	\
 ({ \
 	int ret = -EFAULT; \
 	if (!vq->iotlb) { \
@@ -859,7 +1161,7 @@ static inline void __user *__vhost_get_user(struct vhost_virtqueue *vq,
 	} else { \
 		__typeof__(ptr) to = \
 			(__typeof__(ptr)) __vhost_get_user(vq, ptr,	\
-					  sizeof(*ptr), VHOST_ADDR_USED); \
+					  sizeof(*ptr), type); \
 		if (to != NULL) \
 			ret = __put_user(x, to); \
 		else \
@@ -886,6 +1188,16 @@ static inline void __user *__vhost_get_user(struct vhost_virtqueue *vq,
 	ret; \
 })
 
+#define vhost_put_user(vq, x, ptr) \
+	__vhost_put_user(vq, x, ptr, VHOST_ADDR_USED)
+
+/* Packed rings are written back in place, the descriptors are used too */
+#define vhost_put_desc(vq, x, ptr) \
+	__vhost_put_user(vq, x, ptr, VHOST_ADDR_DESC)
+
+#define vhost_get_desc(vq, x, ptr) \
+	vhost_get_user(vq, x, ptr, VHOST_ADDR_DESC)
+
 #define vhost_get_avail(vq, x, ptr) \
 	vhost_get_user(vq, x, ptr, VHOST_ADDR_AVAIL)
 
@@ -1143,6 +1455,16 @@ static int vhost_iotlb_miss(struct vhost_virtqueue *vq, u64 iova, int access)
 	return 0;
 }
 
+static bool vq_access_ok_packed(unsigned int num,
+				struct vring_packed_desc __user *desc,
+				struct vring_packed_desc_event __user *driver,
+				struct vring_packed_desc_event __user *device)
+{
+	return access_ok(VERIFY_WRITE, desc, num * sizeof *desc) &&
+	       access_ok(VERIFY_READ, driver, sizeof *driver) &&
+	       access_ok(VERIFY_WRITE, device, sizeof *device);
+}
+
 static bool vq_access_ok(struct vhost_virtqueue *vq, unsigned int num,
 			 struct vring_desc __user *desc,
 			 struct vring_avail __user *avail,
@@ -1151,6 +1473,11 @@ static bool vq_access_ok(struct vhost_virtqueue *vq, unsigned int num,
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
 
+	if (vhost_vq_is_packed(vq))
+		return vq_access_ok_packed(num, (void __user *)desc,
+					   (void __user *)avail,
+					   (void __user *)used);
+
 	return access_ok(VERIFY_READ, desc, num * sizeof *desc) &&
 	       access_ok(VERIFY_READ, avail,
 			 sizeof *avail + num * sizeof *avail->ring + s) &&
@@ -1165,7 +1492,10 @@ static void vhost_vq_meta_update(struct vhost_virtqueue *vq,
 	int access = (type == VHOST_ADDR_USED) ?
 		     VHOST_ACCESS_WO : VHOST_ACCESS_RO;
 
-	if (likely(node->perm & access))
+	if (type == VHOST_ADDR_DESC && vhost_vq_is_packed(vq))
+		access = VHOST_ACCESS_RW;
+
+	if (likely((node->perm & access) == access))
 		vq->meta_iotlb[type] = node;
 }
 
@@ -1186,7 +1516,7 @@ static bool iotlb_access_ok(struct vhost_virtqueue *vq,
 		if (node == NULL || node->start > addr) {
 			vhost_iotlb_miss(vq, addr, access);
 			return false;
-		} else if (!(node->perm & access)) {
+		} else if ((node->perm & access) != access) {
 			/* Report the possible access violation by
 			 * request another translation from userspace.
 			 */
@@ -1213,6 +1543,20 @@ int vq_iotlb_prefetch(struct vhost_virtqueue *vq)
 	if (!vq->iotlb)
 		return 1;
 
+	if (vhost_vq_is_packed(vq))
+		return iotlb_access_ok(vq, VHOST_ACCESS_RW,
+				       (u64)(uintptr_t)vq->desc_packed,
+				       num * sizeof(*vq->desc_packed),
+				       VHOST_ADDR_DESC) &&
+		       iotlb_access_ok(vq, VHOST_ACCESS_RO,
+				       (u64)(uintptr_t)vq->driver_event,
+				       sizeof(*vq->driver_event),
+				       VHOST_ADDR_AVAIL) &&
+		       iotlb_access_ok(vq, VHOST_ACCESS_WO,
+				       (u64)(uintptr_t)vq->device_event,
+				       sizeof(*vq->device_event),
+				       VHOST_ADDR_USED);
+
 	return iotlb_access_ok(vq, VHOST_ACCESS_RO, (u64)(uintptr_t)vq->desc,
 			       num * sizeof(*vq->desc), VHOST_ADDR_DESC) &&
 	       iotlb_access_ok(vq, VHOST_ACCESS_RO, (u64)(uintptr_t)vq->avail,
@@ -1241,11 +1585,13 @@ static bool vq_log_access_ok(struct vhost_virtqueue *vq,
 {
 	size_t s = vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
 
+	/* Packed rings log their writes by address, not from log_addr. */
 	return vq_memory_access_ok(log_base, vq->umem,
 				   vhost_has_feature(vq, VHOST_F_LOG_ALL)) &&
-		(!vq->log_used || log_access_ok(log_base, vq->log_addr,
-					sizeof *vq->used +
-					vq->num * sizeof *vq->used->ring + s));
+		(!vq->log_used || vhost_vq_is_packed(vq) ||
+		 log_access_ok(log_base, vq->log_addr,
+			       sizeof *vq->used +
+			       vq->num * sizeof *vq->used->ring + s));
 }
 
 /* Can we start vq? */
@@ -1381,7 +1727,11 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 			r = -EFAULT;
 			break;
 		}
-		if (!s.num || s.num > 0xffff || (s.num & (s.num - 1))) {
+		/* Packed rings need not be a power of 2, but their indices
+		 * leave a bit for the wrap counter. */
+		if (!s.num || s.num > 0xffff ||
+		    (vhost_vq_is_packed(vq) ? s.num > 0x8000 :
+					      (s.num & (s.num - 1)))) {
 			r = -EINVAL;
 			break;
 		}
@@ -1402,13 +1752,21 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 			r = -EINVAL;
 			break;
 		}
-		vq->last_avail_idx = s.num;
+		/* Packed rings pass the wrap counter in the top bit. */
+		if (vhost_vq_is_packed(vq)) {
+			vq->last_avail_idx = s.num & 0x7fff;
+			vq->last_avail_wrap_counter = !!(s.num & 0x8000);
+		} else {
+			vq->last_avail_idx = s.num;
+		}
 		/* Forget the cached index value. */
 		vq->avail_idx = vq->last_avail_idx;
 		break;
 	case VHOST_GET_VRING_BASE:
 		s.index = idx;
 		s.num = vq->last_avail_idx;
+		if (vhost_vq_is_packed(vq))
+			s.num |= vq->last_avail_wrap_counter << 15;
 		if (copy_to_user(argp, &s, sizeof s))
 			r = -EFAULT;
 		break;
@@ -1439,6 +1797,11 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 			r = -EINVAL;
 			break;
 		}
+		if (vhost_vq_is_packed(vq) &&
+		    (a.desc_user_addr & (VRING_DESC_ALIGN_SIZE - 1))) {
+			r = -EINVAL;
+			break;
+		}
 
 		/* We only verify access here if backend is configured.
 		 * If it is not, we don't as size might not have been setup.
@@ -1454,6 +1817,7 @@ long vhost_vring_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *arg
 
 			/* Also validate log access for used ring if enabled. */
 			if ((a.flags & (0x1 << VHOST_VRING_F_LOG)) &&
+			    !vhost_vq_is_packed(vq) &&
 			    !log_access_ok(vq->log_base, a.log_guest_addr,
 					   sizeof *vq->used +
 					   vq->num * sizeof *vq->used->ring)) {
@@ -1640,6 +2004,13 @@ long vhost_dev_ioctl(struct vhost_dev *d, unsigned int ioctl, void __user *argp)
 		if (ctx)
 			eventfd_ctx_put(ctx);
 		break;
+	case VHOST_NEW_WORKER:
+	case VHOST_FREE_WORKER:
+	case VHOST_SET_WORKER_CPU:
+	case VHOST_ATTACH_VRING_WORKER:
+	case VHOST_GET_VRING_WORKER:
+		r = vhost_worker_ioctl(d, ioctl, argp);
+		break;
 	default:
 		r = -ENOIOCTLCMD;
 		break;
@@ -1762,6 +2133,31 @@ static int log_used(struct vhost_virtqueue *vq, u64 used_offset, u64 len)
 	return 0;
 }
 
+/* Packed rings write to the descriptor ring too, log by address. */
+static int log_used_packed(struct vhost_virtqueue *vq, void __user *addr,
+			   u64 len)
+{
+	struct iovec iov[64];
+	int i, ret, r;
+
+	if (!vq->iotlb)
+		return log_write_hva(vq, (uintptr_t)addr, len);
+
+	ret = translate_desc(vq, (uintptr_t)addr, len, iov, 64,
+			     VHOST_ACCESS_WO);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ret; i++) {
+		r = log_write_hva(vq, (uintptr_t)iov[i].iov_base,
+				  iov[i].iov_len);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
 int vhost_log_write(struct vhost_virtqueue *vq, struct vhost_log *log,
 		    unsigned int log_num, u64 len, struct iovec *iov, int count)
 {
@@ -1836,6 +2232,62 @@ static int vhost_update_avail_event(struct vhost_virtqueue *vq, u16 avail_event)
 	return 0;
 }
 
+/* Tell the guest whether and where to kick us, from used_flags. */
+static int vhost_update_device_event(struct vhost_virtqueue *vq)
+{
+	u16 off_wrap;
+	__le16 flags;
+
+	if (vq->used_flags & VRING_USED_F_NO_NOTIFY) {
+		flags = cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE);
+	} else if (vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
+		off_wrap = vq->last_avail_idx |
+			   vq->last_avail_wrap_counter <<
+			   VRING_PACKED_EVENT_F_WRAP_CTR;
+		if (vhost_put_user(vq, cpu_to_le16(off_wrap),
+				   &vq->device_event->off_wrap))
+			return -EFAULT;
+		/* Make sure the offset is seen before the flags using it. */
+		smp_wmb();
+		flags = cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC);
+	} else {
+		flags = cpu_to_le16(VRING_PACKED_EVENT_FLAG_ENABLE);
+	}
+	if (vhost_put_user(vq, flags, &vq->device_event->flags))
+		return -EFAULT;
+	if (unlikely(vq->log_used)) {
+		/* Make sure the event is seen before log. */
+		smp_wmb();
+		log_used_packed(vq, vq->device_event,
+				sizeof *vq->device_event);
+		if (vq->log_ctx)
+			eventfd_signal(vq->log_ctx, 1);
+	}
+	return 0;
+}
+
+static int vhost_vq_init_access_packed(struct vhost_virtqueue *vq)
+{
+	struct vhost_packed_state *packed;
+	int r;
+
+	packed = kvmalloc_array(vq->num, sizeof(*packed), GFP_KERNEL);
+	if (!packed)
+		return -ENOMEM;
+	kvfree(vq->packed);
+	vq->packed = packed;
+
+	r = vhost_update_device_event(vq);
+	if (r)
+		return r;
+	vq->signalled_used_valid = false;
+	/* There is no used index to read back: all the guest made
+	 * available before last_avail_idx has been used. */
+	vq->last_used_idx = vq->last_avail_idx;
+	vq->last_used_wrap_counter = vq->last_avail_wrap_counter;
+	return 0;
+}
+
 int vhost_vq_init_access(struct vhost_virtqueue *vq)
 {
 	__virtio16 last_used_idx;
@@ -1847,6 +2299,13 @@ int vhost_vq_init_access(struct vhost_virtqueue *vq)
 
 	vhost_init_is_le(vq);
 
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_vq_init_access_packed(vq);
+		if (r)
+			goto err;
+		return 0;
+	}
+
 	r = vhost_update_used_flags(vq);
 	if (r)
 		goto err;
@@ -2031,6 +2490,205 @@ static int get_indirect(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+static inline bool vhost_desc_avail_packed(__le16 flags, bool wrap_counter)
+{
+	bool avail = flags & cpu_to_le16(1 << VRING_PACKED_DESC_F_AVAIL);
+	bool used = flags & cpu_to_le16(1 << VRING_PACKED_DESC_F_USED);
+
+	return avail == wrap_counter && used != wrap_counter;
+}
+
+static int get_buf_desc_packed(struct vhost_virtqueue *vq,
+			       struct vring_packed_desc *desc,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num)
+{
+	unsigned iov_count = *in_num + *out_num;
+	u64 addr = le64_to_cpu(desc->addr);
+	u32 len = le32_to_cpu(desc->len);
+	int ret, access;
+
+	if (desc->flags & cpu_to_le16(VRING_DESC_F_WRITE))
+		access = VHOST_ACCESS_WO;
+	else
+		access = VHOST_ACCESS_RO;
+	ret = translate_desc(vq, addr, len, iov + iov_count,
+			     iov_size - iov_count, access);
+	if (unlikely(ret < 0)) {
+		if (ret != -EAGAIN)
+			vq_err(vq, "Translation failure %d in packed descriptor\n",
+			       ret);
+		return ret;
+	}
+	if (access == VHOST_ACCESS_WO) {
+		/* If this is an input descriptor,
+		 * increment that count. */
+		*in_num += ret;
+		if (unlikely(log)) {
+			log[*log_num].addr = addr;
+			log[*log_num].len = len;
+			++*log_num;
+		}
+	} else {
+		/* If it's an output descriptor, they're all supposed
+		 * to come before any input descriptors. */
+		if (unlikely(*in_num)) {
+			vq_err(vq, "Packed descriptor has out after in\n");
+			return -EINVAL;
+		}
+		*out_num += ret;
+	}
+	return 0;
+}
+
+static int get_indirect_packed(struct vhost_virtqueue *vq,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num,
+			       struct vring_packed_desc *indirect)
+{
+	struct vring_packed_desc desc;
+	unsigned int i, count;
+	u32 len = le32_to_cpu(indirect->len);
+	struct iov_iter from;
+	int ret;
+
+	/* Sanity check */
+	if (unlikely(!len || len % sizeof desc)) {
+		vq_err(vq, "Invalid length in indirect descriptor: "
+		       "len 0x%llx not multiple of 0x%zx\n",
+		       (unsigned long long)len,
+		       sizeof desc);
+		return -EINVAL;
+	}
+
+	ret = translate_desc(vq, le64_to_cpu(indirect->addr), len,
+			     vq->indirect, UIO_MAXIOV, VHOST_ACCESS_RO);
+	if (unlikely(ret < 0)) {
+		if (ret != -EAGAIN)
+			vq_err(vq, "Translation failure %d in indirect.\n", ret);
+		return ret;
+	}
+	iov_iter_init(&from, READ, vq->indirect, ret, len);
+
+	/* We will use the result as an address to read from, so most
+	 * architectures only need a compiler barrier here. */
+	read_barrier_depends();
+
+	count = len / sizeof desc;
+	/* Same limit as for split rings, chains there have 16 bit indices. */
+	if (unlikely(count > USHRT_MAX + 1)) {
+		vq_err(vq, "Indirect buffer length too big: %d\n", len);
+		return -E2BIG;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(!copy_from_iter_full(&desc, sizeof(desc), &from))) {
+			vq_err(vq, "Failed indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)le64_to_cpu(indirect->addr) + i * sizeof desc);
+			return -EINVAL;
+		}
+		if (unlikely(desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT))) {
+			vq_err(vq, "Nested indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)le64_to_cpu(indirect->addr) + i * sizeof desc);
+			return -EINVAL;
+		}
+		ret = get_buf_desc_packed(vq, &desc, iov, iov_size,
+					  out_num, in_num, log, log_num);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+	return 0;
+}
+
+/* Packed version of vhost_get_vq_desc: the guest makes a chain available
+ * in place by flipping the flags of its first descriptor. The buffer id
+ * is taken from the last descriptor of the chain. */
+static int vhost_get_vq_desc_packed(struct vhost_virtqueue *vq,
+				    struct iovec iov[], unsigned int iov_size,
+				    unsigned int *out_num, unsigned int *in_num,
+				    struct vhost_log *log, unsigned int *log_num)
+{
+	struct vring_packed_desc desc;
+	unsigned int i = vq->last_avail_idx, count = 0;
+	bool wrap_counter = vq->last_avail_wrap_counter;
+	__le16 flags;
+	u16 id;
+	int ret;
+
+	if (unlikely(vhost_get_desc(vq, flags, &vq->desc_packed[i].flags))) {
+		vq_err(vq, "Failed to get flags: idx %d addr %p\n",
+		       i, &vq->desc_packed[i].flags);
+		return -EFAULT;
+	}
+
+	if (!vhost_desc_avail_packed(flags, wrap_counter))
+		return vq->num;
+
+	/* Only get the descriptors after they have been exposed by guest. */
+	smp_rmb();
+
+	/* When we start there are none of either input nor output. */
+	*out_num = *in_num = 0;
+	if (unlikely(log))
+		*log_num = 0;
+
+	do {
+		if (unlikely(++count > vq->num)) {
+			vq_err(vq, "Loop detected: last one at %u "
+			       "vq size %u\n", i, vq->num);
+			return -EINVAL;
+		}
+		ret = vhost_copy_from_user(vq, &desc, vq->desc_packed + i,
+					   sizeof desc);
+		if (unlikely(ret)) {
+			vq_err(vq, "Failed to get descriptor: idx %d addr %p\n",
+			       i, vq->desc_packed + i);
+			return -EFAULT;
+		}
+		if (desc.flags & cpu_to_le16(VRING_DESC_F_INDIRECT))
+			ret = get_indirect_packed(vq, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num, &desc);
+		else
+			ret = get_buf_desc_packed(vq, &desc, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num);
+		if (unlikely(ret < 0)) {
+			if (ret != -EAGAIN)
+				vq_err(vq, "Failure detected "
+				       "in descriptor at idx %d\n", i);
+			return ret;
+		}
+		if (++i >= vq->num) {
+			i = 0;
+			wrap_counter = !wrap_counter;
+		}
+	} while (desc.flags & cpu_to_le16(VRING_DESC_F_NEXT));
+
+	id = le16_to_cpu(desc.id);
+
+	/* If their number is silly, that's an error. */
+	if (unlikely(id >= vq->num)) {
+		vq_err(vq, "Guest says id %u > %u is available",
+		       id, vq->num);
+		return -EINVAL;
+	}
+
+	vq->packed[id].id_descs = count;
+	vq->packed[i ? i - 1 : vq->num - 1].tail_descs = count;
+
+	/* On success, move past the chain. */
+	vq->last_avail_idx = i;
+	vq->last_avail_wrap_counter = wrap_counter;
+
+	/* Assume notifications from guest are disabled at this point,
+	 * if they aren't we would need to update the device event. */
+	BUG_ON(!(vq->used_flags & VRING_USED_F_NO_NOTIFY));
+	return id;
+}
+
 /* This looks in the virtqueue and for the first available buffer, and converts
  * it to an iovec for convenient access.  Since descriptors consist of some
  * number of output then some number of input descriptors, it's actually two
@@ -2051,6 +2709,11 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 	__virtio16 ring_head;
 	int ret, access;
 
+	if (vhost_vq_is_packed(vq))
+		return vhost_get_vq_desc_packed(vq, iov, iov_size,
+						out_num, in_num,
+						log, log_num);
+
 	/* Check it isn't doing very strange things with descriptor numbers. */
 	last_avail_idx = vq->last_avail_idx;
 
@@ -2182,9 +2845,32 @@ int vhost_get_vq_desc(struct vhost_virtqueue *vq,
 }
 EXPORT_SYMBOL_GPL(vhost_get_vq_desc);
 
+/* Step back over the last n chains, by the length of the one ending at
+ * each point. */
+static void vhost_discard_vq_desc_packed(struct vhost_virtqueue *vq, int n)
+{
+	u16 count;
+
+	while (n--) {
+		count = vq->packed[vq->last_avail_idx ?
+				   vq->last_avail_idx - 1 :
+				   vq->num - 1].tail_descs;
+		if (vq->last_avail_idx < count) {
+			vq->last_avail_idx += vq->num;
+			vq->last_avail_wrap_counter =
+				!vq->last_avail_wrap_counter;
+		}
+		vq->last_avail_idx -= count;
+	}
+}
+
 /* Reverse the effect of vhost_get_vq_desc. Useful for error handling. */
 void vhost_discard_vq_desc(struct vhost_virtqueue *vq, int n)
 {
+	if (vhost_vq_is_packed(vq)) {
+		vhost_discard_vq_desc_packed(vq, n);
+		return;
+	}
 	vq->last_avail_idx -= n;
 }
 EXPORT_SYMBOL_GPL(vhost_discard_vq_desc);
@@ -2243,6 +2929,101 @@ static int __vhost_add_used_n(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* Write used buffers back over their descriptors. The flags of the first
+ * one go last, so the guest sees the whole batch at once. With in order,
+ * buffers that wrote nothing are left for the used descriptor of the next
+ * one to cover: the guest skips ahead by the chains it had made available. */
+static int vhost_add_used_packed(struct vhost_virtqueue *vq,
+				 struct vring_used_elem *heads,
+				 unsigned count)
+{
+	struct vring_packed_desc __user *desc;
+	bool in_order = vhost_has_feature(vq, VIRTIO_F_IN_ORDER);
+	bool wrap_counter = vq->last_used_wrap_counter;
+	u16 idx = vq->last_used_idx, head_idx = idx, sig;
+	__le16 uninitialized_var(head_flags), flags;
+	unsigned int i, descs, skip = 0, total = 0;
+	u32 id, len;
+
+	for (i = 0; i < count; i++) {
+		id = vhost32_to_cpu(vq, heads[i].id);
+		len = vhost32_to_cpu(vq, heads[i].len);
+		if (unlikely(id >= vq->num)) {
+			vq_err(vq, "Used id %u > %u\n", id, vq->num);
+			return -EINVAL;
+		}
+		descs = vq->packed[id].id_descs;
+
+		if (in_order && !len && i + 1 < count) {
+			skip += descs;
+			continue;
+		}
+
+		desc = vq->desc_packed + idx;
+		flags = wrap_counter ?
+			cpu_to_le16(1 << VRING_PACKED_DESC_F_AVAIL |
+				    1 << VRING_PACKED_DESC_F_USED) : 0;
+		if (len)
+			flags |= cpu_to_le16(VRING_DESC_F_WRITE);
+
+		if (vhost_put_desc(vq, cpu_to_le16(id), &desc->id) ||
+		    vhost_put_desc(vq, cpu_to_le32(len), &desc->len)) {
+			vq_err(vq, "Failed to write used");
+			return -EFAULT;
+		}
+		if (idx == head_idx && !total) {
+			head_flags = flags;
+		} else {
+			/* Make sure id and len are seen before the flags. */
+			smp_wmb();
+			if (vhost_put_desc(vq, flags, &desc->flags)) {
+				vq_err(vq, "Failed to write used flags");
+				return -EFAULT;
+			}
+			if (unlikely(vq->log_used)) {
+				smp_wmb();
+				log_used_packed(vq, desc, sizeof *desc);
+			}
+		}
+
+		descs += skip;
+		skip = 0;
+		total += descs;
+		idx += descs;
+		if (idx >= vq->num) {
+			idx -= vq->num;
+			wrap_counter = !wrap_counter;
+		}
+	}
+
+	if (!total)
+		return 0;
+
+	/* Make sure buffers are written before the guest can see them. */
+	smp_wmb();
+	desc = vq->desc_packed + head_idx;
+	if (vhost_put_desc(vq, head_flags, &desc->flags)) {
+		vq_err(vq, "Failed to write used flags");
+		return -EFAULT;
+	}
+	if (unlikely(vq->log_used)) {
+		/* Make sure data is seen before log. */
+		smp_wmb();
+		log_used_packed(vq, desc, sizeof *desc);
+		if (vq->log_ctx)
+			eventfd_signal(vq->log_ctx, 1);
+	}
+
+	/* Moved past the index we have signalled on? See vhost_notify. */
+	sig = (vq->signalled_used + vq->num - head_idx) % vq->num;
+	if (unlikely(total >= vq->num || (sig && sig <= total)))
+		vq->signalled_used_valid = false;
+
+	vq->last_used_idx = idx;
+	vq->last_used_wrap_counter = wrap_counter;
+	return 0;
+}
+
 /* After we've used one of their buffers, we tell them about it.  We'll then
  * want to notify the guest, using eventfd. */
 int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
@@ -2250,6 +3031,9 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 {
 	int start, n, r;
 
+	if (vhost_vq_is_packed(vq))
+		return vhost_add_used_packed(vq, heads, count);
+
 	start = vq->last_used_idx & (vq->num - 1);
 	n = vq->num - start;
 	if (n < count) {
@@ -2279,6 +3063,47 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 }
 EXPORT_SYMBOL_GPL(vhost_add_used_n);
 
+static bool vhost_notify_packed(struct vhost_virtqueue *vq)
+{
+	__le16 flags, off_wrap;
+	u16 old, new, event;
+	bool v;
+
+	if (vhost_get_avail(vq, flags, &vq->driver_event->flags)) {
+		vq_err(vq, "Failed to get driver event flags");
+		return true;
+	}
+	if (flags == cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE))
+		return false;
+	if (flags != cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC) ||
+	    !vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX))
+		return true;
+
+	old = vq->signalled_used;
+	v = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_valid = true;
+
+	if (unlikely(!v))
+		return true;
+
+	if (vhost_get_avail(vq, off_wrap, &vq->driver_event->off_wrap)) {
+		vq_err(vq, "Failed to get driver event offset");
+		return true;
+	}
+
+	/* Indices restart at 0 on each lap of the ring: count those of
+	 * the previous lap as negative, which vring_need_event handles. */
+	event = le16_to_cpu(off_wrap) & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((le16_to_cpu(off_wrap) >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->last_used_wrap_counter)
+		event -= vq->num;
+	if (new < old)
+		old -= vq->num;
+
+	return vring_need_event(event, new, old);
+}
+
 static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__u16 old, new;
@@ -2289,6 +3114,9 @@ static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	 * interrupts. */
 	smp_mb();
 
+	if (vhost_vq_is_packed(vq))
+		return vhost_notify_packed(vq);
+
 	if (vhost_has_feature(vq, VIRTIO_F_NOTIFY_ON_EMPTY) &&
 	    unlikely(vq->avail_idx == vq->last_avail_idx))
 		return true;
@@ -2349,8 +3177,18 @@ EXPORT_SYMBOL_GPL(vhost_add_used_and_signal_n);
 bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__virtio16 avail_idx;
+	__le16 flags;
 	int r;
 
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_get_desc(vq, flags,
+				   &vq->desc_packed[vq->last_avail_idx].flags);
+		if (unlikely(r))
+			return false;
+		return !vhost_desc_avail_packed(flags,
+						vq->last_avail_wrap_counter);
+	}
+
 	if (vq->avail_idx != vq->last_avail_idx)
 		return false;
 
@@ -2364,6 +3202,31 @@ bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 EXPORT_SYMBOL_GPL(vhost_vq_avail_empty);
 
 /* OK, now we need to know about added descriptors. */
+static bool vhost_enable_notify_packed(struct vhost_virtqueue *vq)
+{
+	__le16 flags;
+	int r;
+
+	r = vhost_update_device_event(vq);
+	if (r) {
+		vq_err(vq, "Failed to enable notification at %p: %d\n",
+		       vq->device_event, r);
+		return false;
+	}
+	/* They could have slipped one in as we were doing that: make
+	 * sure it's written, then check again. */
+	smp_mb();
+	r = vhost_get_desc(vq, flags,
+			   &vq->desc_packed[vq->last_avail_idx].flags);
+	if (r) {
+		vq_err(vq, "Failed to check avail descriptor at %p: %d\n",
+		       &vq->desc_packed[vq->last_avail_idx], r);
+		return false;
+	}
+
+	return vhost_desc_avail_packed(flags, vq->last_avail_wrap_counter);
+}
+
 bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__virtio16 avail_idx;
@@ -2372,6 +3235,8 @@ bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY))
 		return false;
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vhost_vq_is_packed(vq))
+		return vhost_enable_notify_packed(vq);
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r) {
@@ -2409,6 +3274,13 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
+	if (vhost_vq_is_packed(vq)) {
+		r = vhost_update_device_event(vq);
+		if (r)
+			vq_err(vq, "Failed to disable notification at %p: %d\n",
+			       vq->device_event, r);
+		return;
+	}
 	if (!vhost_has_feature(vq, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r)
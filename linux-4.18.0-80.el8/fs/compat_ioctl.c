@@ -1445,6 +1445,7 @@ COMPAT_SYSCALL_DEFINE3(ioctl, unsigned int, fd, unsigned int, cmd,
 	case FICLONERANGE:
 	case FIDEDUPERANGE:
 	case FS_IOC_FIEMAP:
+	case FS_IOC_STATX_BATCH:
 		goto do_ioctl;
 
 	case FIBMAP:
@@ -101,6 +101,24 @@ static inline struct hlist_bl_head *d_hash(unsigned int hash)
 	return dentry_hashtable + (hash >> d_hash_shift);
 }
 
+/*
+ * A rename moves dentries from one hash chain to another, which can send a
+ * concurrent __d_lookup() walking the old chain off into the new one, so
+ * that it misses the name it is looking for.  Lookups that can't live with
+ * such a false negative retry if the sequence count of their bucket
+ * changed, instead of retrying on any rename anywhere.  The counts are
+ * striped over the buckets and only written by __d_move(), which is
+ * serialized by rename_lock.
+ */
+#define D_HASH_SEQ_SHIFT 12
+static seqcount_t d_hash_seqs[1 << D_HASH_SEQ_SHIFT];
+
+static inline seqcount_t *d_hash_seq(unsigned int hash)
+{
+	return d_hash_seqs +
+		((hash >> d_hash_shift) & ((1 << D_HASH_SEQ_SHIFT) - 1));
+}
+
 #define IN_LOOKUP_SHIFT 10
 static struct hlist_bl_head in_lookup_hashtable[1 << IN_LOOKUP_SHIFT];
 
@@ -119,6 +137,20 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
+static DEFINE_PER_CPU(long, nr_dentry_negative);
+
+/*
+ * Negative dentries on the LRU lists are limited to this many per mille of
+ * total memory, if set.  A cpu that adds more than its share kicks
+ * negative_dentry_trim_work, which trims the oldest unused negative
+ * dentries off the superblock LRUs down to the limit again.
+ */
+int sysctl_negative_dentry_limit __read_mostly;
+static long negative_dentry_limit __read_mostly;
+static long negative_dentry_pcpu_limit __read_mostly;
+
+static void negative_dentry_trim(struct work_struct *work);
+static DECLARE_DELAYED_WORK(negative_dentry_trim_work, negative_dentry_trim);
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
@@ -151,14 +183,46 @@ static long get_nr_dentry_unused(void)
 		sum += per_cpu(nr_dentry_unused, i);
 	return sum < 0 ? 0 : sum;
 }
+#endif
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
+
+int proc_negative_dentry_limit(struct ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	u64 limit;
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	limit = ((u64)totalram_pages << PAGE_SHIFT) / 1000 *
+		sysctl_negative_dentry_limit / sizeof(struct dentry);
+	WRITE_ONCE(negative_dentry_limit, limit);
+	WRITE_ONCE(negative_dentry_pcpu_limit,
+		   limit ? max_t(long, limit / num_possible_cpus(), 1) : 0);
+	if (limit)
+		schedule_delayed_work(&negative_dentry_trim_work, 0);
+	return 0;
+}
 #endif
 
 /*
@@ -311,12 +375,28 @@ void release_dentry_name_snapshot(struct name_snapshot *name)
 }
 EXPORT_SYMBOL(release_dentry_name_snapshot);
 
+/*
+ * The per-cpu "nr_dentry_negative" counters count the negative dentries
+ * with DCACHE_LRU_LIST set.  d_lock must be held by the caller.
+ */
+static inline void d_negative_inc(void)
+{
+	long limit = READ_ONCE(negative_dentry_pcpu_limit);
+
+	this_cpu_inc(nr_dentry_negative);
+	if (unlikely(limit) && this_cpu_read(nr_dentry_negative) > limit &&
+	    !delayed_work_pending(&negative_dentry_trim_work))
+		schedule_delayed_work(&negative_dentry_trim_work, HZ / 10);
+}
+
 static inline void __d_set_inode_and_type(struct dentry *dentry,
 					  struct inode *inode,
 					  unsigned type_flags)
 {
 	unsigned flags;
 
+	if (d_is_negative(dentry) && (dentry->d_flags & DCACHE_LRU_LIST))
+		this_cpu_dec(nr_dentry_negative);
 	dentry->d_inode = inode;
 	flags = READ_ONCE(dentry->d_flags);
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
@@ -331,6 +411,8 @@ static inline void __d_clear_type_and_inode(struct dentry *dentry)
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
+	if (flags & DCACHE_LRU_LIST)
+		d_negative_inc();
 }
 
 static void dentry_free(struct dentry *dentry)
@@ -394,6 +476,8 @@ static void d_lru_add(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc();
 	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -402,6 +486,8 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -411,6 +497,8 @@ static void d_shrink_del(struct dentry *dentry)
 	list_del_init(&dentry->d_lru);
 	dentry->d_flags &= ~(DCACHE_SHRINK_LIST | DCACHE_LRU_LIST);
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 }
 
 static void d_shrink_add(struct dentry *dentry, struct list_head *list)
@@ -419,6 +507,8 @@ static void d_shrink_add(struct dentry *dentry, struct list_head *list)
 	list_add(&dentry->d_lru, list);
 	dentry->d_flags |= DCACHE_SHRINK_LIST | DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		d_negative_inc();
 }
 
 /*
@@ -432,6 +522,8 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 	list_lru_isolate(lru, &dentry->d_lru);
 }
 
@@ -1216,6 +1308,69 @@ void shrink_dcache_sb(struct super_block *sb)
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
+static enum lru_status dentry_lru_isolate_negative(struct list_head *item,
+		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *freeable = arg;
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	/* Leave everything but unused negative dentries to the shrinker */
+	if (dentry->d_lockref.count || !d_is_negative(dentry)) {
+		spin_unlock(&dentry->d_lock);
+		return LRU_SKIP;
+	}
+
+	if (dentry->d_flags & DCACHE_REFERENCED) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(lru, dentry, freeable);
+	spin_unlock(&dentry->d_lock);
+
+	return LRU_REMOVED;
+}
+
+static void negative_dentry_trim_sb(struct super_block *sb, void *arg)
+{
+	long *excess = arg;
+	unsigned long nr_to_walk;
+	LIST_HEAD(dispose);
+
+	if (*excess <= 0)
+		return;
+
+	/* Negative dentries may be few and far between on this LRU */
+	nr_to_walk = min_t(unsigned long, list_lru_count(&sb->s_dentry_lru),
+			   *excess * 4);
+	*excess -= list_lru_walk(&sb->s_dentry_lru,
+				 dentry_lru_isolate_negative, &dispose,
+				 nr_to_walk);
+	shrink_dentry_list(&dispose);
+}
+
+static void negative_dentry_trim(struct work_struct *work)
+{
+	long limit = READ_ONCE(negative_dentry_limit);
+	long excess;
+
+	if (!limit)
+		return;
+
+	excess = get_nr_dentry_negative() - limit;
+	if (excess <= 0)
+		return;
+	iterate_supers(negative_dentry_trim_sb, &excess);
+
+	/* Skipped busy dentries, try again later */
+	if (excess > 0)
+		schedule_delayed_work(&negative_dentry_trim_work, HZ);
+}
+
 /**
  * enum d_walk_ret - action to talke during tree walk
  * @D_WALK_CONTINUE:	contrinue walk
@@ -2184,7 +2339,7 @@ struct dentry *__d_lookup_rcu(const struct dentry *parent,
 	 * It is possible that concurrent renames can mess up our list
 	 * walk here and result in missing our dentry, resulting in the
 	 * false-negative result. d_lookup() protects against concurrent
-	 * renames using rename_lock seqlock.
+	 * renames using the sequence count of the hash bucket.
 	 *
 	 * See Documentation/filesystems/path-lookup.txt for more details.
 	 */
@@ -2255,15 +2410,16 @@ seqretry:
  */
 struct dentry *d_lookup(const struct dentry *parent, const struct qstr *name)
 {
+	seqcount_t *s = d_hash_seq(name->hash);
 	struct dentry *dentry;
 	unsigned seq;
 
 	do {
-		seq = read_seqbegin(&rename_lock);
+		seq = read_seqcount_begin(s);
 		dentry = __d_lookup(parent, name);
 		if (dentry)
 			break;
-	} while (read_seqretry(&rename_lock, seq));
+	} while (read_seqcount_retry(s, seq));
 	return dentry;
 }
 EXPORT_SYMBOL(d_lookup);
@@ -2277,7 +2433,7 @@ EXPORT_SYMBOL(d_lookup);
  * __d_lookup is like d_lookup, however it may (rarely) return a
  * false-negative result due to unrelated rename activity.
  *
- * __d_lookup is slightly faster by avoiding rename_lock read seqlock,
+ * __d_lookup is slightly faster by avoiding the bucket sequence count,
  * however it must be used carefully, eg. with a following d_lookup in
  * the case of failure.
  *
@@ -2307,7 +2463,7 @@ struct dentry *__d_lookup(const struct dentry *parent, const struct qstr *name)
 	 * It is possible that concurrent renames can mess up our list
 	 * walk here and result in missing our dentry, resulting in the
 	 * false-negative result. d_lookup() protects against concurrent
-	 * renames using rename_lock seqlock.
+	 * renames using the sequence count of the hash bucket.
 	 *
 	 * See Documentation/filesystems/path-lookup.txt for more details.
 	 */
@@ -2466,6 +2622,7 @@ struct dentry *d_alloc_parallel(struct dentry *parent,
 {
 	unsigned int hash = name->hash;
 	struct hlist_bl_head *b = in_lookup_hash(parent, hash);
+	seqcount_t *s = d_hash_seq(hash);
 	struct hlist_bl_node *node;
 	struct dentry *new = d_alloc(parent, name);
 	struct dentry *dentry;
@@ -2477,7 +2634,7 @@ struct dentry *d_alloc_parallel(struct dentry *parent,
 retry:
 	rcu_read_lock();
 	seq = smp_load_acquire(&parent->d_inode->i_dir_seq);
-	r_seq = read_seqbegin(&rename_lock);
+	r_seq = read_seqcount_begin(s);
 	dentry = __d_lookup_rcu(parent, name, &d_seq);
 	if (unlikely(dentry)) {
 		if (!lockref_get_not_dead(&dentry->d_lockref)) {
@@ -2493,7 +2650,7 @@ retry:
 		dput(new);
 		return dentry;
 	}
-	if (unlikely(read_seqretry(&rename_lock, r_seq))) {
+	if (unlikely(read_seqcount_retry(s, r_seq))) {
 		rcu_read_unlock();
 		goto retry;
 	}
@@ -2782,6 +2939,7 @@ static void __d_move(struct dentry *dentry, struct dentry *target,
 {
 	struct dentry *old_parent, *p;
 	struct inode *dir = NULL;
+	seqcount_t *s1, *s2;
 	unsigned n;
 
 	WARN_ON(!dentry->d_inode);
@@ -2817,6 +2975,13 @@ static void __d_move(struct dentry *dentry, struct dentry *target,
 	write_seqcount_begin(&dentry->d_seq);
 	write_seqcount_begin_nested(&target->d_seq, DENTRY_D_LOCK_NESTED);
 
+	/* both may leave their hash chains, see d_hash_seq() */
+	s1 = d_hash_seq(dentry->d_name.hash);
+	s2 = d_hash_seq(target->d_name.hash);
+	raw_write_seqcount_begin(s1);
+	if (s2 != s1)
+		raw_write_seqcount_begin(s2);
+
 	/* unhash both */
 	if (!d_unhashed(dentry))
 		___d_drop(dentry);
@@ -2844,6 +3009,10 @@ static void __d_move(struct dentry *dentry, struct dentry *target,
 	__d_rehash(dentry);
 	fsnotify_update_flags(dentry);
 
+	if (s2 != s1)
+		raw_write_seqcount_end(s2);
+	raw_write_seqcount_end(s1);
+
 	write_seqcount_end(&target->d_seq);
 	write_seqcount_end(&dentry->d_seq);
 
@@ -3175,6 +3344,8 @@ void __init vfs_caches_init_early(void)
 
 	for (i = 0; i < ARRAY_SIZE(in_lookup_hashtable); i++)
 		INIT_HLIST_BL_HEAD(&in_lookup_hashtable[i]);
+	for (i = 0; i < ARRAY_SIZE(d_hash_seqs); i++)
+		seqcount_init(&d_hash_seqs[i]);
 
 	dcache_init_early();
 	inode_init_early();
@@ -895,6 +895,7 @@ do {									       \
 #endif /* defined(__KERNEL__) || defined(__linux__) */
 
 #include "extents_status.h"
+#include "fast_commit.h"
 
 /*
  * Lock subclasses for i_data_sem in the ext4_inode_info structure.
@@ -1413,6 +1414,13 @@ struct ext4_sb_info {
 	unsigned int s_mb_free_pending;
 	struct list_head s_freed_data_list;	/* List of blocks to be freed
 						   after commit completed */
+	/* groups by order of their largest free extent */
+	struct list_head *s_mb_largest_free_orders;
+	rwlock_t *s_mb_largest_free_orders_locks;
+	/* groups by order of their average free extent size */
+	struct list_head *s_mb_avg_fragment_size;
+	rwlock_t *s_mb_avg_fragment_size_locks;
+	atomic_t s_mb_groups_need_init;	/* groups not on the lists above */
 
 	/* tunables */
 	unsigned long s_stripe;
@@ -1422,6 +1430,8 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
+	unsigned int s_mb_max_linear_groups;
 	unsigned int s_max_dir_size_kb;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -1435,6 +1445,14 @@ struct ext4_sb_info {
 	atomic_t s_bal_goals;	/* goal hits */
 	atomic_t s_bal_breaks;	/* too long searches */
 	atomic_t s_bal_2orders;	/* 2^order hits */
+	atomic_t s_bal_groups_scanned;	/* groups scanned */
+	atomic64_t s_bal_cX_groups_considered[4];
+	atomic_t s_bal_cX_hits[4];
+	atomic_t s_bal_cX_failed[4];	/* cX loop didn't find blocks */
+	atomic_t s_bal_index_picks;	/* groups picked from the lists */
+	atomic_t s_bal_index_bad_picks;	/* ... that didn't satisfy the req */
+	atomic_t s_bal_regular_calls;	/* regular allocator invocations */
+	atomic64_t s_bal_regular_ns;	/* ... and time spent in there */
 	spinlock_t s_bal_lock;
 	unsigned long s_mb_buddies_generated;
 	unsigned long long s_mb_generation_time;
@@ -1497,6 +1515,15 @@ struct ext4_sb_info {
 	/* Barrier between changing inodes' journal flags and writepages ops. */
 	struct percpu_rw_semaphore s_journal_flag_rwsem;
 	struct dax_device *s_daxdev;
+
+	/* Fast commit area, see fast_commit.c */
+	unsigned long s_fc_first;	/* First fc block, journal-relative */
+	unsigned int s_fc_blocks;	/* Size of the fc area, 0 if disabled */
+	unsigned int s_fc_off;		/* Next free slot for s_fc_tid */
+	tid_t s_fc_tid;			/* Transaction the fc area belongs to */
+	tid_t s_fc_ineligible_tid;	/* Last tid not fast-committable */
+	struct mutex s_fc_lock;		/* Serializes slot allocation */
+	struct ext4_fc_stats s_fc_stats;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -1616,6 +1643,7 @@ static inline void ext4_clear_state_flags(struct ext4_inode_info *ei)
 #define EXT4_FEATURE_COMPAT_RESIZE_INODE	0x0010
 #define EXT4_FEATURE_COMPAT_DIR_INDEX		0x0020
 #define EXT4_FEATURE_COMPAT_SPARSE_SUPER2	0x0200
+#define EXT4_FEATURE_COMPAT_FAST_COMMIT		0x0400
 
 #define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT4_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -1710,6 +1738,7 @@ EXT4_FEATURE_COMPAT_FUNCS(xattr,		EXT_ATTR)
 EXT4_FEATURE_COMPAT_FUNCS(resize_inode,		RESIZE_INODE)
 EXT4_FEATURE_COMPAT_FUNCS(dir_index,		DIR_INDEX)
 EXT4_FEATURE_COMPAT_FUNCS(sparse_super2,	SPARSE_SUPER2)
+EXT4_FEATURE_COMPAT_FUNCS(fast_commit,		FAST_COMMIT)
 
 EXT4_FEATURE_RO_COMPAT_FUNCS(sparse_super,	SPARSE_SUPER)
 EXT4_FEATURE_RO_COMPAT_FUNCS(large_file,	LARGE_FILE)
@@ -2396,6 +2425,7 @@ extern void ext4_end_bitmap_read(struct buffer_head *bh, int uptodate);
 
 /* mballoc.c */
 extern const struct seq_operations ext4_mb_seq_groups_ops;
+extern int ext4_seq_mb_stats_show(struct seq_file *seq, void *offset);
 extern long ext4_mb_stats;
 extern long ext4_mb_max_to_scan;
 extern int ext4_mb_init(struct super_block *);
@@ -2851,7 +2881,12 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_grpblk_t	bb_avg_fragment_size_order;	/* order of average
+							   fragment in BG */
+	ext4_group_t	bb_group;	/* group number */
 	struct          list_head bb_prealloc_list;
+	struct		list_head bb_largest_free_order_node;
+	struct		list_head bb_avg_fragment_size_node;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
 #endif
@@ -0,0 +1,474 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits for fsync()-heavy workloads.
+ *
+ * A full jbd2 commit writes every metadata block dirtied by the running
+ * transaction plus descriptor and commit blocks, even when the fsync()ing
+ * task only appended to a file.  For the common case of a regular file
+ * whose whole extent tree fits in the inode (depth 0), the inode image
+ * alone describes the file: size, timestamps and every extent.  Such an
+ * fsync() can therefore be satisfied by writing one block holding the raw
+ * inode into a small log area, the fast commit area, and replaying it on
+ * top of the last full commit after a crash.
+ *
+ * The fast commit area consists of the journal inode blocks past the end
+ * of the jbd2 log (s_maxlen), so jbd2 itself never uses them.  Slots are
+ * handed out in order for each running transaction; a slot is only
+ * replayed if it was written for the transaction that was running when
+ * the filesystem went down, i.e. whose full commit never made it.
+ *
+ * Anything that changes state a raw inode image cannot express (directory
+ * entries, freed blocks, orphan list, xattr blocks, uninitialized block
+ * groups, the superblock...) marks the whole running transaction as
+ * ineligible, and fsync() then falls back to the full commit.
+ */
+
+#include <linux/fs.h>
+#include <linux/buffer_head.h>
+#include <linux/crc32.h>
+#include <linux/quotaops.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+/* Upper bound on the area, replay reads all of it at mount time */
+#define EXT4_FC_MAX_BLOCKS	4096
+
+static __u32 ext4_fc_csum(struct super_block *sb, const char *data)
+{
+	const unsigned int off = offsetof(struct ext4_fc_block_head, fc_crc);
+	__u32 crc;
+
+	crc = crc32_le(~0, sb->s_uuid.b, sizeof(sb->s_uuid.b));
+	crc = crc32_le(crc, data, off);
+	return crc32_le(crc, data + off + sizeof(__le32),
+			sb->s_blocksize - off - sizeof(__le32));
+}
+
+/*
+ * Set up the fast commit area right after jbd2_journal_load().  At this
+ * point j_transaction_sequence - 1 is the transaction that was running
+ * when the filesystem was last in use, which is the only one whose fast
+ * commit blocks may be replayed.
+ */
+void ext4_fc_init(struct super_block *sb, journal_t *journal)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned long maxlen, nblocks;
+
+	sbi->s_fc_blocks = 0;
+	sbi->s_fc_off = 0;
+	sbi->s_fc_tid = journal->j_transaction_sequence - 1;
+	sbi->s_fc_ineligible_tid = sbi->s_fc_tid;
+
+	if (!ext4_has_feature_fast_commit(sb))
+		return;
+
+	if (!journal->j_inode) {
+		ext4_msg(sb, KERN_WARNING, "fast commit requires an "
+			 "internal journal, disabled");
+		return;
+	}
+	if (ext4_has_feature_bigalloc(sb)) {
+		ext4_msg(sb, KERN_WARNING, "fast commit not supported "
+			 "with bigalloc, disabled");
+		return;
+	}
+	if (sizeof(struct ext4_fc_block_head) + EXT4_INODE_SIZE(sb) >
+	    sb->s_blocksize) {
+		ext4_msg(sb, KERN_WARNING, "inode size too large for "
+			 "fast commit, disabled");
+		return;
+	}
+
+	maxlen = be32_to_cpu(journal->j_superblock->s_maxlen);
+	nblocks = i_size_read(journal->j_inode) >>
+		  journal->j_inode->i_blkbits;
+	if (nblocks <= maxlen) {
+		ext4_msg(sb, KERN_WARNING, "journal inode has no blocks "
+			 "past the log for a fast commit area, disabled");
+		return;
+	}
+
+	sbi->s_fc_first = maxlen;
+	sbi->s_fc_blocks = min_t(unsigned long, nblocks - maxlen,
+				 EXT4_FC_MAX_BLOCKS);
+}
+
+/*
+ * Mark the transaction @handle belongs to as not fast-committable.  Must
+ * be called before the operation modifies anything, so that a concurrent
+ * ext4_fc_commit() copying an inode image sees it.
+ */
+void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (!sbi->s_fc_blocks || !ext4_handle_valid(handle))
+		return;
+	WRITE_ONCE(sbi->s_fc_ineligible_tid, handle->h_transaction->t_tid);
+}
+
+/*
+ * Try to satisfy an fsync() of @inode, whose last change went into
+ * transaction @commit_tid, with a fast commit.  Returns 0 when the inode
+ * is on stable storage, or an error if the caller has to fall back to a
+ * full commit.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	journal_t *journal = sbi->s_journal;
+	struct ext4_fc_block_head *head;
+	struct buffer_head *bh;
+	struct ext4_iloc iloc;
+	unsigned long long pblk = 0;
+	handle_t *handle;
+	int op_flags = REQ_SYNC;
+	bool running;
+	char *buf;
+	tid_t tid;
+	int ret;
+
+	if (!sbi->s_fc_blocks)
+		return -EOPNOTSUPP;
+
+	/*
+	 * Only the running transaction can be fast committed, an older one
+	 * is already being written out and the full commit path just waits
+	 * for it.
+	 */
+	read_lock(&journal->j_state_lock);
+	running = journal->j_running_transaction &&
+		  journal->j_running_transaction->t_tid == commit_tid;
+	read_unlock(&journal->j_state_lock);
+	if (!running)
+		return -EAGAIN;
+
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    ext4_has_inline_data(inode) || sb_any_quota_loaded(sb))
+		goto ineligible;
+
+	buf = kzalloc(sb->s_blocksize, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+
+	/*
+	 * Holding a handle keeps the transaction from committing while the
+	 * inode image is taken, so the image belongs to exactly @tid.
+	 */
+	handle = jbd2_journal_start(journal, 1);
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out_free;
+	}
+	tid = handle->h_transaction->t_tid;
+	if (tid != commit_tid) {
+		ret = -EAGAIN;
+		goto out_stop;
+	}
+
+	/*
+	 * The inode was dirtied in @tid, so its inode table buffer is
+	 * attached to the transaction and up to date in memory.
+	 */
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		goto out_stop;
+
+	mutex_lock(&sbi->s_fc_lock);
+	if (sbi->s_fc_tid != tid) {
+		sbi->s_fc_tid = tid;
+		sbi->s_fc_off = 0;
+	}
+	if (sbi->s_fc_off >= sbi->s_fc_blocks) {
+		atomic64_inc(&sbi->s_fc_stats.fc_full);
+		ret = -ENOSPC;
+		goto out_unlock;
+	}
+
+	/* i_data_sem keeps extent tree updates from showing half done */
+	head = (struct ext4_fc_block_head *)buf;
+	down_read(&ei->i_data_sem);
+	if (ext_depth(inode) == 0) {
+		spin_lock(&ei->i_raw_lock);
+		memcpy(head + 1, ext4_raw_inode(&iloc), EXT4_INODE_SIZE(sb));
+		spin_unlock(&ei->i_raw_lock);
+	} else {
+		ret = -EAGAIN;
+	}
+	up_read(&ei->i_data_sem);
+	if (!ret && READ_ONCE(sbi->s_fc_ineligible_tid) == tid)
+		ret = -EAGAIN;
+	if (ret) {
+		atomic64_inc(&sbi->s_fc_stats.fc_ineligible);
+		goto out_unlock;
+	}
+
+	head->fc_magic = cpu_to_le32(EXT4_FC_MAGIC);
+	head->fc_tid = cpu_to_le32(tid);
+	head->fc_seq = cpu_to_le32(sbi->s_fc_off);
+	head->fc_ino = cpu_to_le32(inode->i_ino);
+	head->fc_isize = cpu_to_le16(EXT4_INODE_SIZE(sb));
+	head->fc_crc = cpu_to_le32(ext4_fc_csum(sb, buf));
+	ret = jbd2_journal_bmap(journal, sbi->s_fc_first + sbi->s_fc_off,
+				&pblk);
+	if (!ret)
+		sbi->s_fc_off++;
+out_unlock:
+	mutex_unlock(&sbi->s_fc_lock);
+	brelse(iloc.bh);
+out_stop:
+	jbd2_journal_stop(handle);
+	if (ret)
+		goto out_free;
+
+	/*
+	 * Blocks allocated by writeback racing with this fsync() may be in
+	 * the image; their data has to reach the disk first, just as the
+	 * full commit does for data=ordered.
+	 */
+	if (ext4_should_order_data(inode)) {
+		ret = filemap_write_and_wait(inode->i_mapping);
+		if (ret)
+			goto out_free;
+	}
+
+	bh = __getblk(journal->j_dev, pblk, journal->j_blocksize);
+	if (!bh) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	if (journal->j_flags & JBD2_BARRIER)
+		op_flags |= REQ_PREFLUSH | REQ_FUA;
+	lock_buffer(bh);
+	memcpy(bh->b_data, buf, bh->b_size);
+	set_buffer_uptodate(bh);
+	clear_buffer_dirty(bh);
+	get_bh(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	submit_bh(REQ_OP_WRITE, op_flags, bh);
+	wait_on_buffer(bh);
+	if (!buffer_uptodate(bh))
+		ret = -EIO;
+	brelse(bh);
+	if (!ret)
+		atomic64_inc(&sbi->s_fc_stats.fc_commits);
+out_free:
+	kfree(buf);
+	return ret;
+
+ineligible:
+	atomic64_inc(&sbi->s_fc_stats.fc_ineligible);
+	return -EAGAIN;
+}
+
+/* Mark @len blocks at @pblk in use, as mballoc did before the crash */
+static int ext4_fc_replay_blocks(struct super_block *sb, ext4_fsblk_t pblk,
+				 unsigned int len)
+{
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+	struct buffer_head *bitmap_bh, *gd_bh;
+	struct ext4_group_desc *gdp;
+	ext4_grpblk_t bit;
+	ext4_group_t group;
+	unsigned int count, i, newly, free;
+	int err = 0;
+
+	if (!len || pblk < le32_to_cpu(es->s_first_data_block) ||
+	    pblk + len > ext4_blocks_count(es))
+		return -EFSCORRUPTED;
+
+	while (len) {
+		ext4_get_group_no_and_offset(sb, pblk, &group, &bit);
+		count = min_t(unsigned int, len,
+			      EXT4_BLOCKS_PER_GROUP(sb) - bit);
+		gdp = ext4_get_group_desc(sb, group, &gd_bh);
+		if (!gdp)
+			return -EFSCORRUPTED;
+		/* Allocating from such a group is never fast committed */
+		if (ext4_has_group_desc_csum(sb) &&
+		    (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)))
+			return -EFSCORRUPTED;
+
+		bitmap_bh = sb_bread(sb, ext4_block_bitmap(sb, gdp));
+		if (!bitmap_bh)
+			return -EIO;
+		for (i = 0, newly = 0; i < count; i++)
+			if (!ext4_test_and_set_bit(bit + i, bitmap_bh->b_data))
+				newly++;
+		if (newly) {
+			free = ext4_free_group_clusters(sb, gdp);
+			ext4_free_group_clusters_set(sb, gdp,
+					free > newly ? free - newly : 0);
+			ext4_block_bitmap_csum_set(sb, group, gdp, bitmap_bh);
+			ext4_group_desc_csum_set(sb, group, gdp);
+			mark_buffer_dirty(bitmap_bh);
+			err = sync_dirty_buffer(bitmap_bh);
+			if (!err) {
+				mark_buffer_dirty(gd_bh);
+				err = sync_dirty_buffer(gd_bh);
+			}
+		}
+		brelse(bitmap_bh);
+		if (err)
+			return err;
+		pblk += count;
+		len -= count;
+	}
+	return 0;
+}
+
+/*
+ * Write the inode image @raw of inode @ino back into the inode table.  The
+ * blocks it maps are marked in use first, so a failure half way leaks
+ * blocks at worst and never leaves an inode pointing at free space.
+ */
+static int ext4_fc_replay_inode(struct super_block *sb, unsigned long ino,
+				struct ext4_inode *raw)
+{
+	struct ext4_extent_header *eh = (struct ext4_extent_header *)raw->i_block;
+	unsigned long ipg = EXT4_INODES_PER_GROUP(sb);
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	struct ext4_extent *ex;
+	ext4_group_t group;
+	unsigned long offset;
+	int i, err;
+
+	if (!ext4_valid_inum(sb, ino) || !S_ISREG(le16_to_cpu(raw->i_mode)) ||
+	    !(le32_to_cpu(raw->i_flags) & EXT4_EXTENTS_FL) ||
+	    eh->eh_magic != EXT4_EXT_MAGIC || eh->eh_depth != 0 ||
+	    le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max) ||
+	    le16_to_cpu(eh->eh_max) > (sizeof(raw->i_block) - sizeof(*eh)) /
+				      sizeof(struct ext4_extent))
+		return -EFSCORRUPTED;
+
+	group = (ino - 1) / ipg;
+	offset = ((ino - 1) % ipg) * EXT4_INODE_SIZE(sb);
+	gdp = ext4_get_group_desc(sb, group, NULL);
+	if (!gdp)
+		return -EFSCORRUPTED;
+
+	/* The image can only belong to an inode allocated before the crash */
+	if (ext4_has_group_desc_csum(sb) &&
+	    (gdp->bg_flags & cpu_to_le16(EXT4_BG_INODE_UNINIT)))
+		return -EFSCORRUPTED;
+	bh = sb_bread(sb, ext4_inode_bitmap(sb, gdp));
+	if (!bh)
+		return -EIO;
+	err = ext4_test_bit((ino - 1) % ipg, bh->b_data) ? 0 : -EFSCORRUPTED;
+	brelse(bh);
+	if (err)
+		return err;
+
+	for (i = 0, ex = EXT_FIRST_EXTENT(eh); i < le16_to_cpu(eh->eh_entries);
+	     i++, ex++) {
+		err = ext4_fc_replay_blocks(sb, ext4_ext_pblock(ex),
+					    ext4_ext_get_actual_len(ex));
+		if (err)
+			return err;
+	}
+
+	bh = sb_bread(sb, ext4_inode_table(sb, gdp) +
+			  offset / sb->s_blocksize);
+	if (!bh)
+		return -EIO;
+	lock_buffer(bh);
+	memcpy(bh->b_data + (offset & (sb->s_blocksize - 1)), raw,
+	       EXT4_INODE_SIZE(sb));
+	unlock_buffer(bh);
+	mark_buffer_dirty(bh);
+	err = sync_dirty_buffer(bh);
+	brelse(bh);
+	return err;
+}
+
+/*
+ * Replay the fast commit area after jbd2 recovery.  Called before anything
+ * else reads the bitmaps or inode tables, and before the free block counts
+ * are summed up from the group descriptors.
+ */
+int ext4_fc_replay(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	struct ext4_fc_block_head *head;
+	unsigned long long pblk;
+	struct buffer_head *bh;
+	unsigned int i;
+	int err, ret = 0;
+
+	for (i = 0; i < sbi->s_fc_blocks; i++) {
+		err = jbd2_journal_bmap(journal, sbi->s_fc_first + i, &pblk);
+		if (err) {
+			ret = err;
+			break;
+		}
+		bh = __bread(journal->j_dev, pblk, journal->j_blocksize);
+		if (!bh) {
+			ret = -EIO;
+			continue;
+		}
+
+		/*
+		 * Slots may complete out of order, so a bad slot does not
+		 * end the log: it was never acknowledged to anybody.
+		 */
+		head = (struct ext4_fc_block_head *)bh->b_data;
+		if (le32_to_cpu(head->fc_magic) != EXT4_FC_MAGIC ||
+		    le32_to_cpu(head->fc_tid) != sbi->s_fc_tid ||
+		    le32_to_cpu(head->fc_seq) != i ||
+		    le16_to_cpu(head->fc_isize) != EXT4_INODE_SIZE(sb) ||
+		    le32_to_cpu(head->fc_crc) != ext4_fc_csum(sb, bh->b_data)) {
+			brelse(bh);
+			continue;
+		}
+
+		err = ext4_fc_replay_inode(sb, le32_to_cpu(head->fc_ino),
+					   (struct ext4_inode *)(head + 1));
+		if (err) {
+			ext4_msg(sb, KERN_ERR, "failed to replay fast commit "
+				 "of inode %u (%d)", le32_to_cpu(head->fc_ino),
+				 err);
+			ret = err;
+		} else {
+			sbi->s_fc_stats.fc_replayed++;
+		}
+		brelse(bh);
+	}
+
+	if (sbi->s_fc_stats.fc_replayed)
+		ext4_msg(sb, KERN_INFO, "replayed %lu fast commit(s) of "
+			 "transaction %u", sbi->s_fc_stats.fc_replayed,
+			 sbi->s_fc_tid);
+	return ret;
+}
+
+int ext4_seq_fc_info_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_stats *stats = &sbi->s_fc_stats;
+
+	if (!sbi->s_fc_blocks) {
+		seq_puts(seq, "fast commit: disabled\n");
+		return 0;
+	}
+	seq_printf(seq, "fast commit area: %u blocks\n", sbi->s_fc_blocks);
+	seq_printf(seq, "fast commits: %lld\n",
+		   (long long)atomic64_read(&stats->fc_commits));
+	seq_printf(seq, "ineligible: %lld\n",
+		   (long long)atomic64_read(&stats->fc_ineligible));
+	seq_printf(seq, "area full: %lld\n",
+		   (long long)atomic64_read(&stats->fc_full));
+	seq_printf(seq, "replayed at mount: %lu\n", stats->fc_replayed);
+	return 0;
+}
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  fs/ext4/fast_commit.h
+ *
+ * Fast commit area: a small log of raw inode images kept in the journal
+ * inode blocks that lie past the end of the jbd2 log (s_maxlen).  jbd2
+ * never touches those blocks; ext4 fills them from fsync() in between two
+ * full commits and replays them after jbd2 recovery.
+ */
+
+#ifndef _EXT4_FAST_COMMIT_H
+#define _EXT4_FAST_COMMIT_H
+
+#define EXT4_FC_MAGIC		0xfc0ce407
+
+/*
+ * On-disk layout of a fast commit block.  Every block carries one inode
+ * image and is self-validating: a block is replayed only if its magic and
+ * checksum are good and fc_tid names the transaction that was running
+ * when the filesystem went down.
+ */
+struct ext4_fc_block_head {
+	__le32	fc_magic;	/* EXT4_FC_MAGIC */
+	__le32	fc_tid;		/* running jbd2 transaction */
+	__le32	fc_seq;		/* slot number within fc_tid */
+	__le32	fc_ino;		/* inode number of the image */
+	__le16	fc_isize;	/* size of the inode image in bytes */
+	__le16	fc_pad;
+	__le32	fc_crc;		/* crc32 of the block, fc_crc zeroed */
+	/* followed by fc_isize bytes of struct ext4_inode */
+};
+
+struct ext4_fc_stats {
+	atomic64_t	fc_commits;	/* fsyncs served by a fast commit */
+	atomic64_t	fc_ineligible;	/* fsyncs that needed a full commit */
+	atomic64_t	fc_full;	/* fast commit area ran out of space */
+	unsigned long	fc_replayed;	/* inode images replayed at mount */
+};
+
+extern void ext4_fc_init(struct super_block *sb, journal_t *journal);
+extern int ext4_fc_replay(struct super_block *sb);
+extern void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle);
+extern int ext4_fc_commit(struct inode *inode, tid_t commit_tid);
+extern int ext4_seq_fc_info_show(struct seq_file *seq, void *v);
+
+#endif /* _EXT4_FAST_COMMIT_H */
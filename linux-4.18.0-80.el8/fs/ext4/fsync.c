@@ -148,6 +148,12 @@ int ext4_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
 	}
 
 	commit_tid = datasync ? ei->i_datasync_tid : ei->i_sync_tid;
+	/*
+	 * If only this inode's size and extents need to go out, a fast
+	 * commit writes them without committing the running transaction.
+	 */
+	if (!ext4_fc_commit(inode, commit_tid))
+		goto out;
 	if (journal->j_flags & JBD2_BARRIER &&
 	    !jbd2_trans_will_send_data_barrier(journal, commit_tid))
 		needs_barrier = true;
@@ -686,13 +686,74 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 	}
 }
 
+/*
+ * Initialized groups are kept on two sets of per-order lists so that the
+ * allocator can go straight to a group that is likely to satisfy a request
+ * instead of checking them one after the other:
+ *
+ *   s_mb_largest_free_orders[o]: groups whose largest free extent is 2^o
+ *   s_mb_avg_fragment_size[o]:   groups whose average free extent size
+ *				  (bb_free / bb_fragments) is in [2^o, 2^(o+1))
+ *
+ * A group moves between lists only when the order changes, under the group
+ * lock.  Every list has its own rwlock so that the allocator walking one
+ * list does not stall frees and allocations that update other orders.
+ */
+static void mb_group_list_move(struct list_head *node, int old, int new,
+			       struct list_head *lists, rwlock_t *locks)
+{
+	if (old >= 0) {
+		write_lock(&locks[old]);
+		list_del_init(node);
+		write_unlock(&locks[old]);
+	}
+	if (new >= 0) {
+		write_lock(&locks[new]);
+		list_add_tail(node, &lists[new]);
+		write_unlock(&locks[new]);
+	}
+}
+
+static int mb_avg_fragment_size_order(struct super_block *sb,
+				      ext4_grpblk_t len)
+{
+	int order = fls(len) - 1;
+
+	return min(order, MB_NUM_ORDERS(sb) - 1);
+}
+
+/*
+ * Cache the order of the average free extent size of this block group.
+ * Called with the group lock held.
+ */
+static void
+mb_update_avg_fragment_size(struct super_block *sb, struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_avg_fragment_size_order;
+	int new = -1;
+
+	if (grp->bb_free && grp->bb_fragments)
+		new = mb_avg_fragment_size_order(sb,
+					grp->bb_free / grp->bb_fragments);
+	if (new == old)
+		return;
+
+	grp->bb_avg_fragment_size_order = new;
+	mb_group_list_move(&grp->bb_avg_fragment_size_node, old, new,
+			   sbi->s_mb_avg_fragment_size,
+			   sbi->s_mb_avg_fragment_size_locks);
+}
+
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group.  Called with the group lock held.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
 	int i;
 	int bits;
 
@@ -705,6 +766,12 @@ mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 			break;
 		}
 	}
+
+	if (grp->bb_largest_free_order != old)
+		mb_group_list_move(&grp->bb_largest_free_order_node, old,
+				   grp->bb_largest_free_order,
+				   sbi->s_mb_largest_free_orders,
+				   sbi->s_mb_largest_free_orders_locks);
 }
 
 static noinline_for_stack
@@ -754,8 +821,10 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 					EXT4_GROUP_INFO_BBITMAP_CORRUPT);
 	}
 	mb_set_largest_free_order(sb, grp);
+	mb_update_avg_fragment_size(sb, grp);
 
-	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
+	if (test_and_clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state)))
+		atomic_dec(&sbi->s_mb_groups_need_init);
 
 	period = get_cycles() - period;
 	spin_lock(&sbi->s_bal_lock);
@@ -1487,6 +1556,7 @@ static void mb_free_blocks(struct inode *inode, struct ext4_buddy *e4b,
 
 done:
 	mb_set_largest_free_order(sb, e4b->bd_info);
+	mb_update_avg_fragment_size(sb, e4b->bd_info);
 	mb_check_buddy(e4b);
 }
 
@@ -1621,6 +1691,7 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 		e4b->bd_info->bb_counters[ord]++;
 	}
 	mb_set_largest_free_order(e4b->bd_sb, e4b->bd_info);
+	mb_update_avg_fragment_size(e4b->bd_sb, e4b->bd_info);
 
 	ext4_set_bits(e4b->bd_bitmap, ex->fe_start, len0);
 	mb_check_buddy(e4b);
@@ -2026,39 +2097,35 @@ void ext4_mb_scan_aligned(struct ext4_allocation_context *ac,
 }
 
 /*
- * This is now called BEFORE we load the buddy bitmap.
- * Returns either 1 or 0 indicating that the group is either suitable
- * for the allocation or not. In addition it can also return negative
- * error code when something goes wrong.
+ * Check from the in-core group info only whether @grp may satisfy the
+ * allocation with criteria @cr.  Never sleeps.  Groups that have never
+ * been initialized pass as long as they have enough free blocks: nothing
+ * else is known about them before their buddy is generated.
  */
-static int ext4_mb_good_group(struct ext4_allocation_context *ac,
-				ext4_group_t group, int cr)
+static bool ext4_mb_group_fits(struct ext4_allocation_context *ac,
+			       struct ext4_group_info *grp,
+			       ext4_group_t group, int cr)
 {
 	unsigned free, fragments;
 	int flex_size = ext4_flex_bg_size(EXT4_SB(ac->ac_sb));
-	struct ext4_group_info *grp = ext4_get_group_info(ac->ac_sb, group);
 
 	BUG_ON(cr < 0 || cr >= 4);
 
 	free = grp->bb_free;
 	if (free == 0)
-		return 0;
+		return false;
 	if (cr <= 2 && free < ac->ac_g_ex.fe_len)
-		return 0;
+		return false;
 
 	if (unlikely(EXT4_MB_GRP_BBITMAP_CORRUPT(grp)))
-		return 0;
+		return false;
 
-	/* We only do this if the grp has never been initialized */
-	if (unlikely(EXT4_MB_GRP_NEED_INIT(grp))) {
-		int ret = ext4_mb_init_group(ac->ac_sb, group, GFP_NOFS);
-		if (ret)
-			return ret;
-	}
+	if (unlikely(EXT4_MB_GRP_NEED_INIT(grp)))
+		return true;
 
 	fragments = grp->bb_fragments;
 	if (fragments == 0)
-		return 0;
+		return false;
 
 	switch (cr) {
 	case 0:
@@ -2072,38 +2139,223 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 
 		if ((ac->ac_2order > ac->ac_sb->s_blocksize_bits+1) ||
 		    (free / fragments) >= ac->ac_g_ex.fe_len)
-			return 1;
+			return true;
 
 		if (grp->bb_largest_free_order < ac->ac_2order)
-			return 0;
+			return false;
 
-		return 1;
+		return true;
 	case 1:
 		if ((free / fragments) >= ac->ac_g_ex.fe_len)
-			return 1;
+			return true;
 		break;
 	case 2:
 		if (free >= ac->ac_g_ex.fe_len)
-			return 1;
+			return true;
 		break;
 	case 3:
-		return 1;
+		return true;
 	default:
 		BUG();
 	}
 
+	return false;
+}
+
+/*
+ * This is now called BEFORE we load the buddy bitmap.
+ * Returns either 1 or 0 indicating that the group is either suitable
+ * for the allocation or not. In addition it can also return negative
+ * error code when something goes wrong.
+ */
+static int ext4_mb_good_group(struct ext4_allocation_context *ac,
+				ext4_group_t group, int cr)
+{
+	struct ext4_group_info *grp = ext4_get_group_info(ac->ac_sb, group);
+
+	if (!ext4_mb_group_fits(ac, grp, group, cr))
+		return 0;
+
+	/* We only do this if the grp has never been initialized */
+	if (unlikely(EXT4_MB_GRP_NEED_INIT(grp))) {
+		int ret = ext4_mb_init_group(ac->ac_sb, group, GFP_NOFS);
+		if (ret)
+			return ret;
+		if (!ext4_mb_group_fits(ac, grp, group, cr))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Scan @group for criteria @cr if it looks suitable.  Only buddy loading
+ * errors are returned, the ones from ext4_mb_good_group() are kept in
+ * @first_err in case nothing is found at all.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr, int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int ret, err;
+
+	if (sbi->s_mb_stats)
+		atomic64_inc(&sbi->s_bal_cX_groups_considered[cr]);
+
+	/* This now checks without needing the buddy page */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(&e4b);
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
 	return 0;
 }
 
+/*
+ * Walk the per-order group lists from *@order on and return the next group
+ * that passes ext4_mb_group_fits() for @cr.  *@order and *@nth are where
+ * the walk got to, the list and the number of fitting groups on it already
+ * returned, so that repeated calls go through all the fitting groups once.
+ * Lists changing in between can make a group be skipped or returned twice,
+ * which only costs a wasted scan.
+ */
+static bool ext4_mb_find_group_in_lists(struct ext4_allocation_context *ac,
+					struct list_head *lists,
+					rwlock_t *locks, size_t node_off,
+					int *order, unsigned int *nth,
+					int cr, ext4_group_t ngroups,
+					ext4_group_t *group)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_group_info *grp;
+	struct list_head *pos;
+	unsigned int n;
+	bool found;
+
+	for (; *order < MB_NUM_ORDERS(sb); (*order)++, *nth = 0) {
+		if (list_empty(&lists[*order]))
+			continue;
+		n = 0;
+		found = false;
+		read_lock(&locks[*order]);
+		list_for_each(pos, &lists[*order]) {
+			grp = (struct ext4_group_info *)
+				((char *)pos - node_off);
+			/* non-extent files are limited to low groups */
+			if (grp->bb_group >= ngroups)
+				continue;
+			if (!ext4_mb_group_fits(ac, grp, grp->bb_group, cr))
+				continue;
+			if (n++ < *nth)
+				continue;
+			*group = grp->bb_group;
+			found = true;
+			break;
+		}
+		read_unlock(&locks[*order]);
+		if (found) {
+			(*nth)++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Pick a group for criteria 0 or 1 from the per-order group lists.
+ *
+ * cr 0 wants a buddy of order ac_2order: any group whose largest free
+ * extent is at least that big will do.  cr 1 wants a group whose average
+ * free extent is at least the goal length, which can only be on the
+ * lists of that order and above.
+ *
+ * *@order and *@nth keep track of the walk between calls, see
+ * ext4_mb_find_group_in_lists(); start with *@order negative.
+ */
+static bool ext4_mb_choose_next_group(struct ext4_allocation_context *ac,
+				      int cr, ext4_group_t ngroups,
+				      int *order, unsigned int *nth,
+				      ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+
+	if (cr == 0) {
+		if (*order < 0)
+			*order = ac->ac_2order;
+		return ext4_mb_find_group_in_lists(ac,
+				sbi->s_mb_largest_free_orders,
+				sbi->s_mb_largest_free_orders_locks,
+				offsetof(struct ext4_group_info,
+					 bb_largest_free_order_node),
+				order, nth, cr, ngroups, group);
+	}
+
+	if (*order < 0)
+		*order = mb_avg_fragment_size_order(ac->ac_sb,
+						    ac->ac_g_ex.fe_len);
+	return ext4_mb_find_group_in_lists(ac,
+			sbi->s_mb_avg_fragment_size,
+			sbi->s_mb_avg_fragment_size_locks,
+			offsetof(struct ext4_group_info,
+				 bb_avg_fragment_size_node),
+			order, nth, cr, ngroups, group);
+}
+
+static inline bool
+ext4_mb_should_optimize_scan(struct ext4_allocation_context *ac, int cr,
+			     ext4_group_t ngroups)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+
+	return cr < 2 && sbi->s_mb_optimize_scan &&
+		ngroups > sbi->s_mb_max_linear_groups;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
 	ext4_group_t ngroups, group, i;
+	ext4_group_t linear;
 	int cr;
 	int err = 0, first_err = 0;
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
 	struct ext4_buddy e4b;
+	u64 start_ns = 0;
 
 	sb = ac->ac_sb;
 	sbi = EXT4_SB(sb);
@@ -2122,6 +2374,9 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	if (unlikely(ac->ac_flags & EXT4_MB_HINT_GOAL_ONLY))
 		goto out;
 
+	if (sbi->s_mb_stats)
+		start_ns = ktime_get_ns();
+
 	/*
 	 * ac->ac2_order is set only if the fe_len is a power of 2
 	 * if ac2_order is set we also set criteria to 0 so that we
@@ -2168,9 +2423,11 @@ repeat:
 		 * from the goal value specified
 		 */
 		group = ac->ac_g_ex.fe_group;
+		linear = ngroups;
+		if (ext4_mb_should_optimize_scan(ac, cr, ngroups))
+			linear = sbi->s_mb_max_linear_groups;
 
 		for (i = 0; i < ngroups; group++, i++) {
-			int ret = 0;
 			cond_resched();
 			/*
 			 * Artificially restricted ngroups for non-extent
@@ -2179,48 +2436,53 @@ repeat:
 			if (group >= ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				if (!first_err)
-					first_err = ret;
-				continue;
+			if (i == linear) {
+				ext4_group_t pick;
+				unsigned int nth = 0;
+				int order = -1;
+
+				/*
+				 * The groups close to the goal didn't do, go
+				 * through the ones the group lists say are
+				 * suitable.  Only fall back to scanning the
+				 * rest while there are groups the lists know
+				 * nothing about.
+				 */
+				while (ext4_mb_choose_next_group(ac, cr, ngroups,
+								 &order, &nth,
+								 &pick)) {
+					cond_resched();
+					if (sbi->s_mb_stats)
+						atomic_inc(&sbi->s_bal_index_picks);
+					err = ext4_mb_scan_group(ac, pick, cr,
+								 &first_err);
+					if (err)
+						goto out;
+					if (ac->ac_status != AC_STATUS_CONTINUE)
+						break;
+					if (sbi->s_mb_stats)
+						atomic_inc(&sbi->s_bal_index_bad_picks);
+				}
+				if (ac->ac_status != AC_STATUS_CONTINUE)
+					break;
+				if (!atomic_read(&sbi->s_mb_groups_need_init))
+					break;
 			}
 
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr, &first_err);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
+
+		if (sbi->s_mb_stats) {
+			if (ac->ac_status != AC_STATUS_CONTINUE)
+				atomic_inc(&sbi->s_bal_cX_hits[cr]);
+			else
+				atomic_inc(&sbi->s_bal_cX_failed[cr]);
+		}
 	}
 
 	if (ac->ac_b_ex.fe_len > 0 && ac->ac_status != AC_STATUS_FOUND &&
@@ -2249,6 +2511,11 @@ repeat:
 		}
 	}
 out:
+	if (start_ns) {
+		atomic_inc(&sbi->s_bal_regular_calls);
+		atomic64_add(ktime_get_ns() - start_ns,
+			     &sbi->s_bal_regular_ns);
+	}
 	if (!err && ac->ac_status != AC_STATUS_FOUND && first_err)
 		err = first_err;
 	return err;
@@ -2339,6 +2606,64 @@ const struct seq_operations ext4_mb_seq_groups_ops = {
 	.show   = ext4_mb_seq_groups_show,
 };
 
+int ext4_seq_mb_stats_show(struct seq_file *seq, void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int calls = atomic_read(&sbi->s_bal_regular_calls);
+	u64 ns = atomic64_read(&sbi->s_bal_regular_ns);
+	int cr;
+
+	seq_puts(seq, "mballoc:\n");
+	if (!sbi->s_mb_stats) {
+		seq_puts(seq, "\tmb stats collection turned off.\n");
+		seq_puts(seq, "\tTo enable, please write \"1\" to sysfs file mb_stats.\n");
+		return 0;
+	}
+	seq_printf(seq, "\treqs: %u\n", atomic_read(&sbi->s_bal_reqs));
+	seq_printf(seq, "\tsuccess: %u\n", atomic_read(&sbi->s_bal_success));
+	seq_printf(seq, "\tgroups_scanned: %u\n",
+		   atomic_read(&sbi->s_bal_groups_scanned));
+	seq_printf(seq, "\tgroups_need_init: %u\n",
+		   atomic_read(&sbi->s_mb_groups_need_init));
+	seq_printf(seq, "\toptimize_scan: %u\n", sbi->s_mb_optimize_scan);
+
+	for (cr = 0; cr < 4; cr++) {
+		seq_printf(seq, "\tcr%d_stats:\n", cr);
+		seq_printf(seq, "\t\thits: %u\n",
+			   atomic_read(&sbi->s_bal_cX_hits[cr]));
+		seq_printf(seq, "\t\tgroups_considered: %llu\n",
+			   (unsigned long long)atomic64_read(
+				&sbi->s_bal_cX_groups_considered[cr]));
+		seq_printf(seq, "\t\tuseless_loops: %u\n",
+			   atomic_read(&sbi->s_bal_cX_failed[cr]));
+	}
+
+	seq_printf(seq, "\tlist_picks: %u\n",
+		   atomic_read(&sbi->s_bal_index_picks));
+	seq_printf(seq, "\tbad_list_picks: %u\n",
+		   atomic_read(&sbi->s_bal_index_bad_picks));
+	seq_printf(seq, "\tregular_allocs: %u\n", calls);
+	seq_printf(seq, "\tregular_alloc_avg_ns: %llu\n",
+		   calls ? (unsigned long long)div_u64(ns, calls) : 0ULL);
+	seq_printf(seq, "\textents_scanned: %u\n",
+		   atomic_read(&sbi->s_bal_ex_scanned));
+	seq_printf(seq, "\tgoal_hits: %u\n", atomic_read(&sbi->s_bal_goals));
+	seq_printf(seq, "\t2^n_hits: %u\n", atomic_read(&sbi->s_bal_2orders));
+	seq_printf(seq, "\tbreaks: %u\n", atomic_read(&sbi->s_bal_breaks));
+	seq_printf(seq, "\tlost: %u\n", atomic_read(&sbi->s_mb_lost_chunks));
+
+	seq_printf(seq, "\tbuddies_generated: %lu\n",
+		   sbi->s_mb_buddies_generated);
+	seq_printf(seq, "\tbuddies_time_used: %llu\n",
+		   sbi->s_mb_generation_time);
+	seq_printf(seq, "\tpreallocated: %u\n",
+		   atomic_read(&sbi->s_mb_preallocated));
+	seq_printf(seq, "\tdiscarded: %u\n",
+		   atomic_read(&sbi->s_mb_discarded));
+	return 0;
+}
+
 static struct kmem_cache *get_groupinfo_cache(int blocksize_bits)
 {
 	int cache_index = blocksize_bits - EXT4_MIN_BLOCK_LOG_SIZE;
@@ -2420,6 +2745,7 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 	set_bit(EXT4_GROUP_INFO_NEED_INIT_BIT,
 		&(meta_group_info[i]->bb_state));
+	atomic_inc(&sbi->s_mb_groups_need_init);
 
 	/*
 	 * initialize bb_free to be able to skip
@@ -2438,6 +2764,10 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_avg_fragment_size_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_avg_fragment_size_node);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2586,6 +2916,30 @@ int ext4_mb_init(struct super_block *sb)
 		goto out;
 	}
 
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc_array(i, sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc_array(i, sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size =
+		kmalloc_array(i, sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size_locks =
+		kmalloc_array(i, sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_avg_fragment_size ||
+	    !sbi->s_mb_avg_fragment_size_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (j = 0; j < i; j++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[j]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[j]);
+		INIT_LIST_HEAD(&sbi->s_mb_avg_fragment_size[j]);
+		rwlock_init(&sbi->s_mb_avg_fragment_size_locks[j]);
+	}
+	atomic_set(&sbi->s_mb_groups_need_init, 0);
+
 	ret = ext4_groupinfo_create_slab(sb->s_blocksize);
 	if (ret < 0)
 		goto out;
@@ -2617,6 +2971,8 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
+	sbi->s_mb_max_linear_groups = MB_DEFAULT_LINEAR_LIMIT;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2669,6 +3025,14 @@ out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	kfree(sbi->s_mb_avg_fragment_size);
+	sbi->s_mb_avg_fragment_size = NULL;
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	sbi->s_mb_avg_fragment_size_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2721,6 +3085,10 @@ int ext4_mb_release(struct super_block *sb)
 			kfree(sbi->s_group_info[i]);
 		kvfree(sbi->s_group_info);
 	}
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_avg_fragment_size);
+	kfree(sbi->s_mb_avg_fragment_size_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	iput(sbi->s_buddy_cache);
@@ -2994,6 +3362,8 @@ ext4_mb_mark_diskspace_used(struct ext4_allocation_context *ac,
 		      ac->ac_b_ex.fe_len);
 	if (ext4_has_group_desc_csum(sb) &&
 	    (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))) {
+		/* Fast commit replay can't initialize the bitmap */
+		ext4_fc_mark_ineligible(sb, handle);
 		gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
 		ext4_free_group_clusters_set(sb, gdp,
 					     ext4_free_clusters_after_init(sb,
@@ -3260,6 +3630,7 @@ static void ext4_mb_collect_stats(struct ext4_allocation_context *ac)
 		if (ac->ac_b_ex.fe_len >= ac->ac_o_ex.fe_len)
 			atomic_inc(&sbi->s_bal_success);
 		atomic_add(ac->ac_found, &sbi->s_bal_ex_scanned);
+		atomic_add(ac->ac_groups_scanned, &sbi->s_bal_groups_scanned);
 		if (ac->ac_g_ex.fe_start == ac->ac_b_ex.fe_start &&
 				ac->ac_g_ex.fe_group == ac->ac_b_ex.fe_group)
 			atomic_inc(&sbi->s_bal_goals);
@@ -4725,6 +5096,7 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 	}
 
 	sbi = EXT4_SB(sb);
+	ext4_fc_mark_ineligible(sb, handle);
 	if (!(flags & EXT4_FREE_BLOCKS_VALIDATED) &&
 	    !ext4_data_block_valid(sbi, block, count)) {
 		ext4_error(sb, "Freeing blocks not in datazone - "
@@ -77,6 +77,22 @@ do {									\
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * use the per-order group lists to pick groups for cr 0 and 1
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * number of groups around the goal that are still scanned linearly before
+ * the per-order group lists are used, to keep some locality
+ */
+#define MB_DEFAULT_LINEAR_LIMIT		4
+
+/*
+ * number of buddy orders, order 0 being the bitmap itself
+ */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from sb_info */
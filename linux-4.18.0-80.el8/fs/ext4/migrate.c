@@ -314,6 +314,7 @@ static int ext4_ext_swap_inode_data(handle_t *handle, struct inode *inode,
 	struct ext4_inode_info *ei = EXT4_I(inode);
 	struct ext4_inode_info *tmp_ei = EXT4_I(tmp_inode);
 
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 	/*
 	 * One credit accounted for writing the
 	 * i_data field of the original inode
@@ -276,6 +276,8 @@ again:
 		*err = PTR_ERR(handle);
 		return 0;
 	}
+	/* The donor inode's half of the swap is not in orig's image */
+	ext4_fc_mark_ineligible(orig_inode->i_sb, handle);
 
 	orig_blk_offset = orig_page_offset * blocks_per_page +
 		data_offset_in_page;
@@ -2043,6 +2043,8 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	ext4_lblk_t block, blocks;
 	int	csum_size = 0;
 
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
+
 	if (ext4_has_metadata_csum(inode->i_sb))
 		csum_size = sizeof(struct ext4_dir_entry_tail);
 
@@ -2343,6 +2345,7 @@ static int ext4_delete_entry(handle_t *handle,
 {
 	int err, csum_size = 0;
 
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 	if (ext4_has_inline_data(dir)) {
 		int has_inline_data = 1;
 		err = ext4_delete_inline_entry(handle, dir, de_del, bh,
@@ -2755,6 +2758,7 @@ int ext4_orphan_add(handle_t *handle, struct inode *inode)
 	if (!sbi->s_journal || is_bad_inode(inode))
 		return 0;
 
+	ext4_fc_mark_ineligible(sb, handle);
 	WARN_ON_ONCE(!(inode->i_state & (I_NEW | I_FREEING)) &&
 		     !inode_is_locked(inode));
 	/*
@@ -2839,6 +2843,7 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 	if (!sbi->s_journal && !(sbi->s_mount_state & EXT4_ORPHAN_FS))
 		return 0;
 
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 	WARN_ON_ONCE(!(inode->i_state & (I_NEW | I_FREEING)) &&
 		     !inode_is_locked(inode));
 	/* Do this quick check before taking global s_orphan_lock. */
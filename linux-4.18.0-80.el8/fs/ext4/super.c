@@ -915,6 +915,10 @@ static void ext4_put_super(struct super_block *sb)
 
 	if (sbi->s_journal) {
 		aborted = is_journal_aborted(sbi->s_journal);
+		/* The final commit supersedes anything in the fc area */
+		if (sbi->s_fc_blocks && !aborted)
+			jbd2_journal_clear_features(sbi->s_journal, 0, 0,
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
 		err = jbd2_journal_destroy(sbi->s_journal);
 		sbi->s_journal = NULL;
 		if ((err < 0) && !aborted)
@@ -4123,6 +4127,7 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 
 	INIT_LIST_HEAD(&sbi->s_orphan); /* unlinked but open files */
 	mutex_init(&sbi->s_orphan_lock);
+	mutex_init(&sbi->s_fc_lock);
 
 	sb->s_root = NULL;
 
@@ -4191,6 +4196,18 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		goto failed_mount_wq;
 	}
 
+	/*
+	 * Older kernels would ignore the fast commit area on recovery, so
+	 * keep them away from the journal while it may hold live entries.
+	 */
+	if (sbi->s_fc_blocks && !sb_rdonly(sb) &&
+	    !jbd2_journal_set_features(sbi->s_journal, 0, 0,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		ext4_msg(sb, KERN_ERR, "Failed to set fast commit journal "
+			 "feature");
+		goto failed_mount_wq;
+	}
+
 	/* We have now updated the journal if required, so we can
 	 * validate the data journaling mode. */
 	switch (test_opt(sb, DATA_FLAGS)) {
@@ -4785,6 +4802,14 @@ static int ext4_load_journal(struct super_block *sb,
 	EXT4_SB(sb)->s_journal = journal;
 	ext4_clear_journal_err(sb, es);
 
+	ext4_fc_init(sb, journal);
+	if (ext4_has_feature_journal_needs_recovery(sb) && !really_read_only) {
+		err = ext4_fc_replay(sb);
+		if (err)
+			ext4_msg(sb, KERN_WARNING, "fast commit replay "
+				 "incomplete (%d), run e2fsck", err);
+	}
+
 	if (!really_read_only && journal_devnum &&
 	    journal_devnum != le32_to_cpu(es->s_journal_dev)) {
 		es->s_journal_dev = cpu_to_le32(journal_devnum);
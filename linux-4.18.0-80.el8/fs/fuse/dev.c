@@ -21,6 +21,7 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -321,20 +322,171 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/*
+ * Request IDs of rings and bound input queues are above the ones of the
+ * common input queue, with a separate range for each, so that no shared
+ * counter is needed: rings use (cpu + 1) << FUSE_UNIQUE_SHIFT, bound
+ * queues additionally have FUSE_IQUEUE_UNIQUE_BIT set.
+ */
+#define FUSE_UNIQUE_SHIFT	40
+#define FUSE_UNIQUE_CTR_MASK	((1ULL << FUSE_UNIQUE_SHIFT) - 1)
+#define FUSE_IQUEUE_UNIQUE_BIT	(1ULL << 63)
+
 static u64 fuse_get_unique(struct fuse_iqueue *fiq)
 {
-	return ++fiq->reqctr;
+	/* Zero is what notifications use */
+	fiq->reqctr = (fiq->reqctr + 1) & FUSE_UNIQUE_CTR_MASK;
+	if (!fiq->reqctr)
+		fiq->reqctr = 1;
+	return fiq->unique_base | fiq->reqctr;
 }
 
 static void queue_request(struct fuse_iqueue *fiq, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+	req->iq = fiq;
 	list_add_tail(&req->list, &fiq->pending);
 	wake_up_locked(&fiq->waitq);
 	kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
 }
 
+static u64 fuse_ring_get_unique(struct fuse_ring *ring)
+{
+	ring->reqctr = (ring->reqctr + 1) & FUSE_UNIQUE_CTR_MASK;
+	return ((u64) (ring->cpu + 1) << FUSE_UNIQUE_SHIFT) | ring->reqctr;
+}
+
+/*
+ * Queue a request on the ring of the submitting cpu.  If there is no such
+ * ring or the request doesn't fit into a slot, false is returned and the
+ * request has to go to an input queue.
+ */
+static bool fuse_ring_queue(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_ring __rcu **rings = smp_load_acquire(&fc->rings);
+	struct fuse_ring *ring;
+	unsigned len;
+	bool queued = false;
+
+	if (!rings)
+		return false;
+
+	len = sizeof(struct fuse_in_header) +
+		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
+
+	rcu_read_lock();
+	ring = rcu_dereference(rings[raw_smp_processor_id()]);
+	if (ring && len <= ring->slot_size) {
+		spin_lock(&ring->waitq.lock);
+		if (ring->connected) {
+			req->in.h.len = len;
+			req->in.h.unique = fuse_ring_get_unique(ring);
+			req->ring = ring;
+			list_add_tail(&req->list, &ring->pending);
+			wake_up_locked(&ring->waitq);
+			queued = true;
+		}
+		spin_unlock(&ring->waitq.lock);
+	}
+	rcu_read_unlock();
+
+	return queued;
+}
+
+/*
+ * The input queue bound to the submitting cpu, or the common one.  Bound
+ * queues are freed after a grace period, so this has to be called under
+ * rcu_read_lock().
+ */
+static struct fuse_iqueue *fuse_iqueue_get(struct fuse_conn *fc)
+{
+	struct fuse_iqueue __rcu **iqs = smp_load_acquire(&fc->iqs);
+	struct fuse_iqueue *fiq = NULL;
+
+	if (iqs)
+		fiq = rcu_dereference(iqs[raw_smp_processor_id()]);
+
+	return fiq ?: &fc->iq;
+}
+
+/*
+ * Queue a request on the ring or the input queue of the submitting cpu,
+ * or on the common input queue.  Returns false if the queue the request
+ * would go to is disconnected.
+ */
+static bool fuse_queue_request(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_iqueue *fiq;
+	bool queued = false;
+
+	if (fuse_ring_queue(fc, req))
+		return true;
+
+	rcu_read_lock();
+	fiq = fuse_iqueue_get(fc);
+	spin_lock(&fiq->waitq.lock);
+	if (fiq->connected) {
+		req->in.h.unique = fuse_get_unique(fiq);
+		queue_request(fiq, req);
+		queued = true;
+	}
+	spin_unlock(&fiq->waitq.lock);
+	rcu_read_unlock();
+
+	return queued;
+}
+
+/*
+ * Take a request that userspace hasn't picked up yet off the queue it is
+ * on.  req->ring and req->iq are only set while the request is pending on
+ * a ring or an input queue; they change under the lock of that queue when
+ * the request is picked up or moved to another queue, in which case the
+ * lookup is repeated.
+ */
+static bool fuse_request_unqueue(struct fuse_req *req)
+{
+	struct fuse_iqueue *fiq;
+	struct fuse_ring *ring;
+	bool removed = false;
+	bool moved;
+
+ retry:
+	moved = false;
+	rcu_read_lock();
+	ring = READ_ONCE(req->ring);
+	if (ring) {
+		spin_lock(&ring->waitq.lock);
+		if (req->ring != ring) {
+			moved = true;
+		} else if (test_bit(FR_PENDING, &req->flags)) {
+			list_del(&req->list);
+			req->ring = NULL;
+			removed = true;
+		}
+		spin_unlock(&ring->waitq.lock);
+	}
+
+	fiq = READ_ONCE(req->iq);
+	if (!removed && fiq) {
+		spin_lock(&fiq->waitq.lock);
+		if (req->iq != fiq) {
+			moved = true;
+		} else if (test_bit(FR_PENDING, &req->flags)) {
+			list_del(&req->list);
+			req->iq = NULL;
+			removed = true;
+		}
+		spin_unlock(&fiq->waitq.lock);
+	}
+	rcu_read_unlock();
+
+	if (!removed && moved)
+		goto retry;
+
+	return removed;
+}
+
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
@@ -360,15 +512,11 @@ static void flush_bg_queue(struct fuse_conn *fc)
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
 		struct fuse_req *req;
-		struct fuse_iqueue *fiq = &fc->iq;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
-		spin_lock(&fiq->waitq.lock);
-		req->in.h.unique = fuse_get_unique(fiq);
-		queue_request(fiq, req);
-		spin_unlock(&fiq->waitq.lock);
+		fuse_queue_request(fc, req);
 	}
 }
 
@@ -387,9 +535,16 @@ static void request_end(struct fuse_conn *fc, struct fuse_req *req)
 	if (test_and_set_bit(FR_FINISHED, &req->flags))
 		goto put_request;
 
-	spin_lock(&fiq->waitq.lock);
-	list_del_init(&req->intr_entry);
-	spin_unlock(&fiq->waitq.lock);
+	/*
+	 * Only interrupted requests need the lock of the common input queue.
+	 * test_and_set_bit() implies smp_mb() between setting FR_FINISHED and
+	 * the check below, pairs with smp_mb() in queue_interrupt().
+	 */
+	if (!list_empty(&req->intr_entry)) {
+		spin_lock(&fiq->waitq.lock);
+		list_del_init(&req->intr_entry);
+		spin_unlock(&fiq->waitq.lock);
+	}
 	WARN_ON(test_bit(FR_PENDING, &req->flags));
 	WARN_ON(test_bit(FR_SENT, &req->flags));
 	if (test_bit(FR_BACKGROUND, &req->flags)) {
@@ -434,6 +589,16 @@ static void queue_interrupt(struct fuse_iqueue *fiq, struct fuse_req *req)
 	}
 	if (list_empty(&req->intr_entry)) {
 		list_add_tail(&req->intr_entry, &fiq->interrupts);
+		/*
+		 * Pairs with smp_mb() implied by test_and_set_bit() in
+		 * request_end()
+		 */
+		smp_mb();
+		if (test_bit(FR_FINISHED, &req->flags)) {
+			list_del_init(&req->intr_entry);
+			spin_unlock(&fiq->waitq.lock);
+			return;
+		}
 		wake_up_locked(&fiq->waitq);
 	}
 	spin_unlock(&fiq->waitq.lock);
@@ -466,16 +631,12 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 		if (!err)
 			return;
 
-		spin_lock(&fiq->waitq.lock);
 		/* Request is not yet in userspace, bail out */
-		if (test_bit(FR_PENDING, &req->flags)) {
-			list_del(&req->list);
-			spin_unlock(&fiq->waitq.lock);
+		if (fuse_request_unqueue(req)) {
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
 			return;
 		}
-		spin_unlock(&fiq->waitq.lock);
 	}
 
 	/*
@@ -487,25 +648,19 @@ static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
-	struct fuse_iqueue *fiq = &fc->iq;
-
 	BUG_ON(test_bit(FR_BACKGROUND, &req->flags));
-	spin_lock(&fiq->waitq.lock);
-	if (!fiq->connected) {
-		spin_unlock(&fiq->waitq.lock);
+	/* acquire extra reference, since request is still needed
+	   after request_end() */
+	__fuse_get_request(req);
+	if (!fuse_queue_request(fc, req)) {
+		__fuse_put_request(req);
 		req->out.h.error = -ENOTCONN;
-	} else {
-		req->in.h.unique = fuse_get_unique(fiq);
-		queue_request(fiq, req);
-		/* acquire extra reference, since request is still needed
-		   after request_end() */
-		__fuse_get_request(req);
-		spin_unlock(&fiq->waitq.lock);
-
-		request_wait_answer(fc, req);
-		/* Pairs with smp_wmb() in request_end() */
-		smp_rmb();
+		return;
 	}
+
+	request_wait_answer(fc, req);
+	/* Pairs with smp_wmb() in request_end() */
+	smp_rmb();
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
@@ -1230,22 +1385,77 @@ __releases(fiq->waitq.lock)
 		return fuse_read_batch_forget(fiq, cs, nbytes);
 }
 
+/*
+ * Copy a request taken off the pending list of the input queue or of a
+ * ring to the userspace buffer.  If no reply is needed (FORGET) or
+ * request has been aborted or there was an error during the copying then
+ * it's finished by calling request_end().  Otherwise add it to the
+ * processing list, and set the 'sent' flag.
+ */
+static ssize_t fuse_dev_copy_request(struct fuse_dev *fud,
+				     struct fuse_copy_state *cs,
+				     struct fuse_req *req)
+{
+	ssize_t err;
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_pqueue *fpq = &fud->pq;
+	struct fuse_in *in = &req->in;
+	unsigned reqsize = in->h.len;
+
+	spin_lock(&fpq->lock);
+	list_add(&req->list, &fpq->io);
+	spin_unlock(&fpq->lock);
+	cs->req = req;
+	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
+	if (!err)
+		err = fuse_copy_args(cs, in->numargs, in->argpages,
+				     (struct fuse_arg *) in->args, 0);
+	fuse_copy_finish(cs);
+	spin_lock(&fpq->lock);
+	clear_bit(FR_LOCKED, &req->flags);
+	if (!fpq->connected) {
+		err = (fc->aborted && fc->abort_err) ? -ECONNABORTED : -ENODEV;
+		goto out_end;
+	}
+	if (err) {
+		req->out.h.error = -EIO;
+		goto out_end;
+	}
+	if (!test_bit(FR_ISREPLY, &req->flags)) {
+		err = reqsize;
+		goto out_end;
+	}
+	list_move_tail(&req->list, &fpq->processing);
+	__fuse_get_request(req);
+	set_bit(FR_SENT, &req->flags);
+	spin_unlock(&fpq->lock);
+	/* matches barrier in request_wait_answer() */
+	smp_mb__after_atomic();
+	if (test_bit(FR_INTERRUPTED, &req->flags))
+		queue_interrupt(&fc->iq, req);
+	fuse_put_request(fc, req);
+
+	return reqsize;
+
+out_end:
+	if (!test_bit(FR_PRIVATE, &req->flags))
+		list_del_init(&req->list);
+	spin_unlock(&fpq->lock);
+	request_end(fc, req);
+	return err;
+}
+
 /*
  * Read a single request into the userspace filesystem's buffer.  This
  * function waits until a request is available, then removes it from
- * the pending list and copies request data to userspace buffer.  If
- * no reply is needed (FORGET) or request has been aborted or there
- * was an error during the copying then it's finished by calling
- * request_end().  Otherwise add it to the processing list, and set
- * the 'sent' flag.
+ * the pending list and copies it with fuse_dev_copy_request().
  */
 static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	ssize_t err;
 	struct fuse_conn *fc = fud->fc;
-	struct fuse_iqueue *fiq = &fc->iq;
-	struct fuse_pqueue *fpq = &fud->pq;
+	struct fuse_iqueue *fiq = READ_ONCE(fud->iq);
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
@@ -1284,6 +1494,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 	req = list_entry(fiq->pending.next, struct fuse_req, list);
 	clear_bit(FR_PENDING, &req->flags);
 	list_del_init(&req->list);
+	req->iq = NULL;
 	spin_unlock(&fiq->waitq.lock);
 
 	in = &req->in;
@@ -1298,47 +1509,8 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_lock(&fpq->lock);
-	list_add(&req->list, &fpq->io);
-	spin_unlock(&fpq->lock);
-	cs->req = req;
-	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
-	if (!err)
-		err = fuse_copy_args(cs, in->numargs, in->argpages,
-				     (struct fuse_arg *) in->args, 0);
-	fuse_copy_finish(cs);
-	spin_lock(&fpq->lock);
-	clear_bit(FR_LOCKED, &req->flags);
-	if (!fpq->connected) {
-		err = (fc->aborted && fc->abort_err) ? -ECONNABORTED : -ENODEV;
-		goto out_end;
-	}
-	if (err) {
-		req->out.h.error = -EIO;
-		goto out_end;
-	}
-	if (!test_bit(FR_ISREPLY, &req->flags)) {
-		err = reqsize;
-		goto out_end;
-	}
-	list_move_tail(&req->list, &fpq->processing);
-	__fuse_get_request(req);
-	set_bit(FR_SENT, &req->flags);
-	spin_unlock(&fpq->lock);
-	/* matches barrier in request_wait_answer() */
-	smp_mb__after_atomic();
-	if (test_bit(FR_INTERRUPTED, &req->flags))
-		queue_interrupt(fiq, req);
-	fuse_put_request(fc, req);
-
-	return reqsize;
 
-out_end:
-	if (!test_bit(FR_PRIVATE, &req->flags))
-		list_del_init(&req->list);
-	spin_unlock(&fpq->lock);
-	request_end(fc, req);
-	return err;
+	return fuse_dev_copy_request(fud, cs, req);
 
  err_unlock:
 	spin_unlock(&fiq->waitq.lock);
@@ -2049,7 +2221,7 @@ static __poll_t fuse_dev_poll(struct file *file, poll_table *wait)
 	if (!fud)
 		return EPOLLERR;
 
-	fiq = &fud->fc->iq;
+	fiq = READ_ONCE(fud->iq);
 	poll_wait(file, &fiq->waitq, wait);
 
 	spin_lock(&fiq->waitq.lock);
@@ -2094,6 +2266,489 @@ static void end_polls(struct fuse_conn *fc)
 	}
 }
 
+/*
+ * Per-cpu request rings
+ *
+ * A daemon thread serving a ring passes a reply from its slot to the
+ * kernel and waits for the next request of the ring in one ioctl.  The
+ * request and the reply are copied straight between the fuse_req and the
+ * shared slot, through the same copy state that read() and write() use,
+ * with an iterator over the slot pages.
+ */
+
+/* Limits for FUSE_DEV_IOC_RING_SETUP */
+#define FUSE_RING_MAX_SLOTS	256
+#define FUSE_RING_MAX_SLOT_SIZE	(1 << 20)
+
+static void fuse_ring_free(struct fuse_ring *ring)
+{
+	kvfree(ring->bvec);
+	vfree(ring->buf);
+	kfree(ring);
+}
+
+static void fuse_ring_slot_iter(struct fuse_ring *ring, unsigned int slot,
+				int dir, struct iov_iter *iter, size_t count)
+{
+	unsigned int pages = ring->slot_size >> PAGE_SHIFT;
+
+	iov_iter_bvec(iter, ITER_BVEC | dir, ring->bvec + slot * pages,
+		      pages, count);
+}
+
+static long fuse_ring_setup(struct fuse_dev *fud, void __user *argp)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_ring __rcu **rings = NULL;
+	struct fuse_ring_setup setup;
+	struct fuse_ring *ring;
+	unsigned int i, nr_pages;
+	int err;
+
+	if (copy_from_user(&setup, argp, sizeof(setup)))
+		return -EFAULT;
+
+	if (setup.flags || setup.cpu >= nr_cpu_ids ||
+	    !cpu_possible(setup.cpu) ||
+	    !setup.nr_slots || setup.nr_slots > FUSE_RING_MAX_SLOTS ||
+	    setup.slot_size < FUSE_MIN_READ_BUFFER ||
+	    setup.slot_size > FUSE_RING_MAX_SLOT_SIZE ||
+	    !PAGE_ALIGNED(setup.slot_size))
+		return -EINVAL;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	nr_pages = setup.nr_slots * (setup.slot_size >> PAGE_SHIFT);
+	ring->buf = vmalloc_user((size_t) nr_pages << PAGE_SHIFT);
+	if (!ring->buf)
+		goto out_free;
+
+	ring->bvec = kvmalloc_array(nr_pages, sizeof(struct bio_vec),
+				    GFP_KERNEL);
+	if (!ring->bvec)
+		goto out_free;
+
+	for (i = 0; i < nr_pages; i++) {
+		ring->bvec[i].bv_page =
+			vmalloc_to_page(ring->buf + ((size_t) i << PAGE_SHIFT));
+		ring->bvec[i].bv_len = PAGE_SIZE;
+		ring->bvec[i].bv_offset = 0;
+	}
+
+	ring->fud = fud;
+	ring->cpu = setup.cpu;
+	ring->nr_slots = setup.nr_slots;
+	ring->slot_size = setup.slot_size;
+	ring->connected = 1;
+	init_waitqueue_head(&ring->waitq);
+	INIT_LIST_HEAD(&ring->pending);
+
+	/* fc->rings is never freed before the connection */
+	if (!smp_load_acquire(&fc->rings)) {
+		rings = kcalloc(nr_cpu_ids, sizeof(*rings), GFP_KERNEL);
+		if (!rings)
+			goto out_free;
+	}
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fc->connected)
+		goto out_unlock;
+
+	err = -EBUSY;
+	if (fud->ring || fud->iq != &fc->iq)
+		goto out_unlock;
+
+	if (!fc->rings) {
+		smp_store_release(&fc->rings, rings);
+		rings = NULL;
+	}
+	if (rcu_access_pointer(fc->rings[setup.cpu]))
+		goto out_unlock;
+
+	fud->ring = ring;
+	rcu_assign_pointer(fc->rings[setup.cpu], ring);
+	spin_unlock(&fc->lock);
+	kfree(rings);
+
+	return 0;
+
+out_unlock:
+	spin_unlock(&fc->lock);
+	kfree(rings);
+out_free:
+	fuse_ring_free(ring);
+	return err;
+}
+
+/* Pass the reply the daemon left in the slot to the request it answers */
+static ssize_t fuse_ring_commit(struct fuse_dev *fud, struct fuse_ring *ring,
+				unsigned int slot)
+{
+	struct fuse_out_header *oh = ring->buf + (size_t) slot * ring->slot_size;
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	unsigned nbytes = READ_ONCE(oh->len);
+
+	if (nbytes > ring->slot_size)
+		return -EINVAL;
+
+	fuse_ring_slot_iter(ring, slot, WRITE, &iter, nbytes);
+	fuse_copy_init(&cs, 0, &iter);
+
+	return fuse_dev_do_write(fud, &cs, nbytes);
+}
+
+/* Wait for the next request of the ring and copy it into the slot */
+static ssize_t fuse_ring_fetch(struct fuse_dev *fud, struct fuse_ring *ring,
+			       unsigned int slot)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	struct fuse_req *req;
+	int err;
+
+	spin_lock(&ring->waitq.lock);
+	err = wait_event_interruptible_exclusive_locked(ring->waitq,
+			!ring->connected || !list_empty(&ring->pending));
+	if (err)
+		goto err_unlock;
+
+	if (!ring->connected) {
+		err = (fc->aborted && fc->abort_err) ? -ECONNABORTED : -ENODEV;
+		goto err_unlock;
+	}
+
+	req = list_first_entry(&ring->pending, struct fuse_req, list);
+	clear_bit(FR_PENDING, &req->flags);
+	list_del_init(&req->list);
+	req->ring = NULL;
+	spin_unlock(&ring->waitq.lock);
+
+	fuse_ring_slot_iter(ring, slot, READ, &iter, ring->slot_size);
+	fuse_copy_init(&cs, 1, &iter);
+
+	return fuse_dev_copy_request(fud, &cs, req);
+
+ err_unlock:
+	spin_unlock(&ring->waitq.lock);
+	return err;
+}
+
+/*
+ * After an error the slot holds nothing that needs to be committed: the
+ * reply was either consumed or rejected.  A fetch interrupted by a signal
+ * is not restarted, since the restarted call would commit the same reply
+ * a second time.
+ */
+static long fuse_ring_cmd(struct fuse_dev *fud, void __user *argp)
+{
+	struct fuse_ring *ring = READ_ONCE(fud->ring);
+	struct fuse_ring_cmd cmd;
+	ssize_t ret;
+
+	if (!ring)
+		return -EINVAL;
+
+	if (copy_from_user(&cmd, argp, sizeof(cmd)))
+		return -EFAULT;
+
+	if (cmd.slot >= ring->nr_slots || (cmd.flags & ~FUSE_RING_COMMIT))
+		return -EINVAL;
+
+	if (cmd.flags & FUSE_RING_COMMIT) {
+		ret = fuse_ring_commit(fud, ring, cmd.slot);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = fuse_ring_fetch(fud, ring, cmd.slot);
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	return ret;
+}
+
+/*
+ * Disconnect all rings and move their pending requests to @to_end.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_rings_abort(struct fuse_conn *fc, struct list_head *to_end)
+{
+	struct fuse_ring *ring;
+	struct fuse_req *req;
+	int cpu;
+
+	if (!fc->rings)
+		return;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		ring = rcu_dereference_protected(fc->rings[cpu],
+						 lockdep_is_held(&fc->lock));
+		if (!ring)
+			continue;
+
+		spin_lock(&ring->waitq.lock);
+		ring->connected = 0;
+		list_for_each_entry(req, &ring->pending, list) {
+			clear_bit(FR_PENDING, &req->flags);
+			req->ring = NULL;
+		}
+		list_splice_tail_init(&ring->pending, to_end);
+		wake_up_all_locked(&ring->waitq);
+		spin_unlock(&ring->waitq.lock);
+	}
+}
+
+/*
+ * Unhook the ring of a device that is being released.  Requests still
+ * pending on it go to the input queue, which is served by the other
+ * devices of the connection.
+ */
+static void fuse_ring_release(struct fuse_dev *fud)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_ring *ring = fud->ring;
+	struct fuse_req *req, *next;
+	LIST_HEAD(to_end);
+
+	spin_lock(&fc->lock);
+	RCU_INIT_POINTER(fc->rings[ring->cpu], NULL);
+	spin_lock(&fiq->waitq.lock);
+	spin_lock(&ring->waitq.lock);
+	ring->connected = 0;
+	list_for_each_entry_safe(req, next, &ring->pending, list) {
+		list_del(&req->list);
+		req->ring = NULL;
+		if (fiq->connected) {
+			req->in.h.unique = fuse_get_unique(fiq);
+			queue_request(fiq, req);
+		} else {
+			clear_bit(FR_PENDING, &req->flags);
+			list_add_tail(&req->list, &to_end);
+		}
+	}
+	spin_unlock(&ring->waitq.lock);
+	spin_unlock(&fiq->waitq.lock);
+	spin_unlock(&fc->lock);
+
+	end_requests(fc, &to_end);
+
+	/* fuse_ring_queue() and fuse_request_unqueue() may still look at it */
+	synchronize_rcu();
+	fud->ring = NULL;
+	fuse_ring_free(ring);
+}
+
+/*
+ * Per-cpu and per-node input queues
+ *
+ * A bound queue is an input queue of its own, used for the requests
+ * submitted on its cpus and read by the devices bound to it.  Interrupts
+ * and forgets stay on the common input queue.  fc->iqs maps each cpu to
+ * its queue; a node queue appears once for every cpu of the node.
+ */
+static long fuse_iqueue_bind(struct fuse_dev *fud, void __user *argp)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue __rcu **iqs = NULL;
+	struct fuse_iqueue *fiq, *old, *q;
+	struct fuse_queue_bind bind;
+	const struct cpumask *mask;
+	unsigned int cpu;
+	int err;
+
+	if (copy_from_user(&bind, argp, sizeof(bind)))
+		return -EFAULT;
+
+	switch (bind.type) {
+	case FUSE_QUEUE_CPU:
+		if (bind.id >= nr_cpu_ids || !cpu_possible(bind.id))
+			return -EINVAL;
+		mask = cpumask_of(bind.id);
+		break;
+	case FUSE_QUEUE_NODE:
+		if (bind.id >= nr_node_ids || !node_online(bind.id))
+			return -EINVAL;
+		mask = cpumask_of_node(bind.id);
+		if (cpumask_empty(mask))
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	fiq = kmalloc(sizeof(*fiq), GFP_KERNEL);
+	if (!fiq)
+		return -ENOMEM;
+
+	fuse_iqueue_init(fiq);
+	fiq->unique_base = FUSE_IQUEUE_UNIQUE_BIT |
+		((u64) (cpumask_first(mask) + 1) << FUSE_UNIQUE_SHIFT);
+
+	/* fc->iqs is never freed before the connection */
+	err = -ENOMEM;
+	if (!smp_load_acquire(&fc->iqs)) {
+		iqs = kcalloc(nr_cpu_ids, sizeof(*iqs), GFP_KERNEL);
+		if (!iqs)
+			goto out_free;
+	}
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (!fc->connected)
+		goto out_unlock;
+
+	err = -EBUSY;
+	if (fud->ring || fud->iq != &fc->iq)
+		goto out_unlock;
+
+	if (!fc->iqs) {
+		smp_store_release(&fc->iqs, iqs);
+		iqs = NULL;
+	}
+
+	/*
+	 * Join the queue of exactly these cpus if there is one, else none of
+	 * the cpus may have a queue yet.
+	 */
+	old = rcu_dereference_protected(fc->iqs[cpumask_first(mask)],
+					lockdep_is_held(&fc->lock));
+	for_each_possible_cpu(cpu) {
+		q = rcu_dereference_protected(fc->iqs[cpu],
+					      lockdep_is_held(&fc->lock));
+		if (cpumask_test_cpu(cpu, mask) ? q != old : old && q == old)
+			goto out_unlock;
+	}
+
+	if (old) {
+		kfree(fiq);
+		fiq = old;
+	} else {
+		for_each_cpu(cpu, mask)
+			rcu_assign_pointer(fc->iqs[cpu], fiq);
+	}
+	fiq->nr_devs++;
+	WRITE_ONCE(fud->iq, fiq);
+	spin_unlock(&fc->lock);
+	kfree(iqs);
+
+	return 0;
+
+out_unlock:
+	spin_unlock(&fc->lock);
+	kfree(iqs);
+out_free:
+	kfree(fiq);
+	return err;
+}
+
+/*
+ * Disconnect all bound input queues and move their pending requests to
+ * @to_end.
+ *
+ * Called with fc->lock held
+ */
+static void fuse_iqueues_abort(struct fuse_conn *fc, struct list_head *to_end)
+{
+	struct fuse_iqueue *fiq;
+	struct fuse_req *req;
+	int cpu;
+
+	if (!fc->iqs)
+		return;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		fiq = rcu_dereference_protected(fc->iqs[cpu],
+						lockdep_is_held(&fc->lock));
+		if (!fiq)
+			continue;
+
+		spin_lock(&fiq->waitq.lock);
+		fiq->connected = 0;
+		list_for_each_entry(req, &fiq->pending, list) {
+			clear_bit(FR_PENDING, &req->flags);
+			req->iq = NULL;
+		}
+		list_splice_tail_init(&fiq->pending, to_end);
+		wake_up_all_locked(&fiq->waitq);
+		spin_unlock(&fiq->waitq.lock);
+		kill_fasync(&fiq->fasync, SIGIO, POLL_IN);
+	}
+}
+
+/*
+ * Unbind a device that is being released.  With the last device of the
+ * queue gone, the queue is unhooked and requests still pending on it go
+ * to the common input queue.
+ */
+static void fuse_iqueue_release(struct fuse_dev *fud)
+{
+	struct fuse_conn *fc = fud->fc;
+	struct fuse_iqueue *fiq = &fc->iq;
+	struct fuse_iqueue *biq = fud->iq;
+	struct fuse_req *req, *next;
+	unsigned int cpu;
+	LIST_HEAD(to_end);
+
+	spin_lock(&fc->lock);
+	WRITE_ONCE(fud->iq, fiq);
+	if (--biq->nr_devs) {
+		spin_unlock(&fc->lock);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		if (rcu_access_pointer(fc->iqs[cpu]) == biq)
+			RCU_INIT_POINTER(fc->iqs[cpu], NULL);
+	}
+
+	spin_lock(&fiq->waitq.lock);
+	spin_lock_nested(&biq->waitq.lock, SINGLE_DEPTH_NESTING);
+	biq->connected = 0;
+	list_for_each_entry_safe(req, next, &biq->pending, list) {
+		list_del(&req->list);
+		if (fiq->connected) {
+			req->in.h.unique = fuse_get_unique(fiq);
+			queue_request(fiq, req);
+		} else {
+			clear_bit(FR_PENDING, &req->flags);
+			req->iq = NULL;
+			list_add_tail(&req->list, &to_end);
+		}
+	}
+	spin_unlock(&biq->waitq.lock);
+	spin_unlock(&fiq->waitq.lock);
+	spin_unlock(&fc->lock);
+
+	end_requests(fc, &to_end);
+
+	/* fuse_iqueue_get() and fuse_request_unqueue() may still look at it */
+	synchronize_rcu();
+	kfree(biq);
+}
+
+static int fuse_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_ring *ring;
+
+	if (!fud)
+		return -EPERM;
+
+	ring = READ_ONCE(fud->ring);
+	if (!ring)
+		return -ENODEV;
+
+	return remap_vmalloc_range(vma, ring->buf, vma->vm_pgoff);
+}
+
 /*
  * Abort all requests.
  *
@@ -2148,6 +2803,8 @@ void fuse_abort_conn(struct fuse_conn *fc, bool is_abort)
 		}
 		fc->max_background = UINT_MAX;
 		flush_bg_queue(fc);
+		fuse_rings_abort(fc, &to_end2);
+		fuse_iqueues_abort(fc, &to_end2);
 
 		spin_lock(&fiq->waitq.lock);
 		fiq->connected = 0;
@@ -2191,6 +2848,11 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 		struct fuse_pqueue *fpq = &fud->pq;
 		LIST_HEAD(to_end);
 
+		if (fud->ring)
+			fuse_ring_release(fud);
+		if (fud->iq != &fc->iq)
+			fuse_iqueue_release(fud);
+
 		spin_lock(&fpq->lock);
 		WARN_ON(!list_empty(&fpq->io));
 		list_splice_init(&fpq->processing, &to_end);
@@ -2217,7 +2879,7 @@ static int fuse_dev_fasync(int fd, struct file *file, int on)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fud->fc->iq.fasync);
+	return fasync_helper(fd, file, on, &READ_ONCE(fud->iq)->fasync);
 }
 
 static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
@@ -2237,40 +2899,82 @@ static int fuse_device_clone(struct fuse_conn *fc, struct file *new)
 	return 0;
 }
 
+static long fuse_dev_ioctl_clone(struct file *file, __u32 __user *argp)
+{
+	int err = -EFAULT;
+	int oldfd;
+
+	if (!get_user(oldfd, argp)) {
+		struct file *old = fget(oldfd);
+
+		err = -EINVAL;
+		if (old) {
+			struct fuse_dev *fud = NULL;
+
+			/*
+			 * Check against file->f_op because CUSE
+			 * uses the same ioctl handler.
+			 */
+			if (old->f_op == file->f_op &&
+			    old->f_cred->user_ns == file->f_cred->user_ns)
+				fud = fuse_get_dev(old);
+
+			if (fud) {
+				mutex_lock(&fuse_mutex);
+				err = fuse_device_clone(fud->fc, file);
+				mutex_unlock(&fuse_mutex);
+			}
+			fput(old);
+		}
+	}
+	return err;
+}
+
 static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 			   unsigned long arg)
 {
-	int err = -ENOTTY;
+	void __user *argp = (void __user *) arg;
+	struct fuse_dev *fud;
 
-	if (cmd == FUSE_DEV_IOC_CLONE) {
-		int oldfd;
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		return fuse_dev_ioctl_clone(file, argp);
+	case FUSE_DEV_IOC_BACKING_OPEN:
+	case FUSE_DEV_IOC_BACKING_CLOSE:
+	case FUSE_DEV_IOC_RING_SETUP:
+	case FUSE_DEV_IOC_RING_CMD:
+	case FUSE_DEV_IOC_QUEUE_BIND:
+		break;
+	default:
+		return -ENOTTY;
+	}
 
-		err = -EFAULT;
-		if (!get_user(oldfd, (__u32 __user *) arg)) {
-			struct file *old = fget(oldfd);
+	fud = fuse_get_dev(file);
+	if (!fud)
+		return -EPERM;
 
-			err = -EINVAL;
-			if (old) {
-				struct fuse_dev *fud = NULL;
+	switch (cmd) {
+	case FUSE_DEV_IOC_BACKING_OPEN: {
+		struct fuse_backing_map map;
 
-				/*
-				 * Check against file->f_op because CUSE
-				 * uses the same ioctl handler.
-				 */
-				if (old->f_op == file->f_op &&
-				    old->f_cred->user_ns == file->f_cred->user_ns)
-					fud = fuse_get_dev(old);
+		if (copy_from_user(&map, argp, sizeof(map)))
+			return -EFAULT;
+		return fuse_backing_open(fud->fc, &map);
+	}
+	case FUSE_DEV_IOC_BACKING_CLOSE: {
+		int backing_id;
 
-				if (fud) {
-					mutex_lock(&fuse_mutex);
-					err = fuse_device_clone(fud->fc, file);
-					mutex_unlock(&fuse_mutex);
-				}
-				fput(old);
-			}
-		}
+		if (get_user(backing_id, (__u32 __user *) argp))
+			return -EFAULT;
+		return fuse_backing_close(fud->fc, backing_id);
+	}
+	case FUSE_DEV_IOC_RING_SETUP:
+		return fuse_ring_setup(fud, argp);
+	case FUSE_DEV_IOC_QUEUE_BIND:
+		return fuse_iqueue_bind(fud, argp);
+	default:
+		return fuse_ring_cmd(fud, argp);
 	}
-	return err;
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2282,6 +2986,7 @@ const struct file_operations fuse_dev_operations = {
 	.write_iter	= fuse_dev_write,
 	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
+	.mmap		= fuse_dev_mmap,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
 	.unlocked_ioctl = fuse_dev_ioctl,
@@ -27,6 +27,9 @@
 #include <linux/pid_namespace.h>
 #include <linux/refcount.h>
 #include <linux/user_namespace.h>
+#include <linux/idr.h>
+#include <linux/cred.h>
+#include <linux/bvec.h>
 
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
@@ -125,6 +128,18 @@ enum {
 
 struct fuse_conn;
 
+/** Backing file registered by the daemon for passthrough opens */
+struct fuse_backing {
+	/** The file opened by the daemon */
+	struct file *file;
+
+	/** Credentials of the daemon, used for all I/O on the file */
+	const struct cred *cred;
+
+	/** Refcount, one for the backing id and one per open file */
+	refcount_t count;
+};
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -157,6 +172,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file if opened with FOPEN_PASSTHROUGH */
+	struct fuse_backing *passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -385,6 +403,12 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Ring the request is queued on, NULL for the input queue */
+	struct fuse_ring *ring;
+
+	/** Input queue the request is pending on, NULL once picked up */
+	struct fuse_iqueue *iq;
 };
 
 struct fuse_iqueue {
@@ -412,6 +436,12 @@ struct fuse_iqueue {
 
 	/** O_ASYNC requests */
 	struct fasync_struct *fasync;
+
+	/** Request ids of a per-cpu queue carry its number in the high bits */
+	u64 unique_base;
+
+	/** Bound devices of a per-cpu queue, protected by fc->lock */
+	unsigned int nr_devs;
 };
 
 struct fuse_pqueue {
@@ -428,6 +458,43 @@ struct fuse_pqueue {
 	struct list_head io;
 };
 
+/**
+ * Per-cpu request ring
+ *
+ * Requests are queued on the ring of the submitting cpu and copied
+ * straight into a slot of the shared buffer by the daemon thread asking
+ * for the next request, see FUSE_DEV_IOC_RING_CMD.
+ */
+struct fuse_ring {
+	/** Device the ring belongs to, its pq holds the sent requests */
+	struct fuse_dev *fud;
+
+	/** The cpu whose requests go to this ring */
+	unsigned int cpu;
+
+	/** Daemon threads wait here, .lock protects the fields below */
+	wait_queue_head_t waitq;
+
+	/** Ring is accepting requests */
+	unsigned connected;
+
+	/** The next unique request id */
+	u64 reqctr;
+
+	/** Requests not yet picked up by the daemon */
+	struct list_head pending;
+
+	/** Number and size of slots */
+	unsigned int nr_slots;
+	unsigned int slot_size;
+
+	/** Slot buffer, mapped into the daemon */
+	void *buf;
+
+	/** One bio_vec per page of buf */
+	struct bio_vec *bvec;
+};
+
 /**
  * Fuse device instance
  */
@@ -440,6 +507,12 @@ struct fuse_dev {
 
 	/** list entry on fc->devices */
 	struct list_head entry;
+
+	/** Request ring served through this device, or NULL */
+	struct fuse_ring *ring;
+
+	/** Input queue read() takes requests from, fc->iq unless bound */
+	struct fuse_iqueue *iq;
 };
 
 /**
@@ -637,6 +710,9 @@ struct fuse_conn {
 	/** Check permissions based on the file mode or not? */
 	unsigned default_permissions:1;
 
+	/** Can files be opened in passthrough mode?  Only set in INIT */
+	unsigned passthrough:1;
+
 	/** Allow other than the mounter user to access the filesystem ? */
 	unsigned allow_other:1;
 
@@ -678,6 +754,15 @@ struct fuse_conn {
 
 	/** List of device instances belonging to this connection */
 	struct list_head devices;
+
+	/** Backing files for passthrough, indexed by backing id */
+	struct idr backing_files_map;
+
+	/** Request rings indexed by cpu, allocated on first ring setup */
+	struct fuse_ring __rcu **rings;
+
+	/** Bound input queues indexed by cpu, allocated on first bind */
+	struct fuse_iqueue __rcu **iqs;
 };
 
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
@@ -891,6 +976,8 @@ void fuse_conn_init(struct fuse_conn *fc, struct user_namespace *user_ns);
  */
 void fuse_conn_put(struct fuse_conn *fc);
 
+void fuse_iqueue_init(struct fuse_iqueue *fiq);
+
 struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
 void fuse_dev_free(struct fuse_dev *fud);
 
@@ -995,4 +1082,16 @@ struct posix_acl;
 struct posix_acl *fuse_get_acl(struct inode *inode, int type);
 int fuse_set_acl(struct inode *inode, struct posix_acl *acl, int type);
 
+/* passthrough.c */
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map);
+int fuse_backing_close(struct fuse_conn *fc, int backing_id);
+void fuse_backing_files_free(struct fuse_conn *fc);
+int fuse_passthrough_open(struct fuse_conn *fc, struct fuse_file *ff,
+			  struct fuse_open_out *outarg);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb,
+				    struct iov_iter *from);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
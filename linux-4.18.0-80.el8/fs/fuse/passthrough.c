@@ -0,0 +1,282 @@
+/*
+  FUSE: Filesystem in Userspace
+  Passthrough of file I/O to a backing file opened by the daemon
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+
+static void fuse_backing_put(struct fuse_backing *fb)
+{
+	if (refcount_dec_and_test(&fb->count)) {
+		fput(fb->file);
+		put_cred(fb->cred);
+		kfree(fb);
+	}
+}
+
+/*
+ * Register a file opened by the daemon as backing file and return its
+ * backing id.  Only regular files on a filesystem that isn't stacked
+ * itself are accepted, so that passthrough can't be nested or loop back
+ * to the fuse device.
+ */
+int fuse_backing_open(struct fuse_conn *fc, struct fuse_backing_map *map)
+{
+	struct fuse_backing *fb;
+	struct file *file;
+	int err;
+
+	err = -EOPNOTSUPP;
+	if (!fc->passthrough)
+		goto out;
+
+	/* The backing file is not visible anywhere once it is registered */
+	err = -EPERM;
+	if (!capable(CAP_SYS_ADMIN))
+		goto out;
+
+	err = -EINVAL;
+	if (map->flags || map->padding)
+		goto out;
+
+	err = -EBADF;
+	file = fget(map->fd);
+	if (!file)
+		goto out;
+
+	err = -EINVAL;
+	if (!S_ISREG(file_inode(file)->i_mode) ||
+	    !file->f_op->read_iter || !file->f_op->write_iter)
+		goto out_fput;
+
+	err = -ELOOP;
+	if (file_inode(file)->i_sb->s_stack_depth)
+		goto out_fput;
+
+	err = -ENOMEM;
+	fb = kmalloc(sizeof(*fb), GFP_KERNEL);
+	if (!fb)
+		goto out_fput;
+
+	fb->cred = prepare_creds();
+	if (!fb->cred) {
+		kfree(fb);
+		goto out_fput;
+	}
+	fb->file = file;
+	refcount_set(&fb->count, 1);
+
+	idr_preload(GFP_KERNEL);
+	spin_lock(&fc->lock);
+	err = idr_alloc_cyclic(&fc->backing_files_map, fb, 1, 0, GFP_ATOMIC);
+	spin_unlock(&fc->lock);
+	idr_preload_end();
+
+	if (err < 0)
+		fuse_backing_put(fb);
+	return err;
+
+out_fput:
+	fput(file);
+out:
+	return err;
+}
+
+int fuse_backing_close(struct fuse_conn *fc, int backing_id)
+{
+	struct fuse_backing *fb;
+
+	if (!fc->passthrough)
+		return -EOPNOTSUPP;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (backing_id <= 0)
+		return -EINVAL;
+
+	spin_lock(&fc->lock);
+	fb = idr_remove(&fc->backing_files_map, backing_id);
+	spin_unlock(&fc->lock);
+
+	if (!fb)
+		return -ENOENT;
+
+	fuse_backing_put(fb);
+	return 0;
+}
+
+static int fuse_backing_id_free(int id, void *p, void *data)
+{
+	fuse_backing_put(p);
+	return 0;
+}
+
+/* Called on final put of the connection */
+void fuse_backing_files_free(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->backing_files_map, fuse_backing_id_free, NULL);
+	idr_destroy(&fc->backing_files_map);
+}
+
+/*
+ * Attach the backing file to a file the daemon opened with
+ * FOPEN_PASSTHROUGH.  The caller has to release the file if this fails.
+ */
+int fuse_passthrough_open(struct fuse_conn *fc, struct fuse_file *ff,
+			  struct fuse_open_out *outarg)
+{
+	struct fuse_backing *fb;
+
+	if (!(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return 0;
+
+	if (!fc->passthrough || outarg->backing_id <= 0)
+		return -EIO;
+
+	spin_lock(&fc->lock);
+	fb = idr_find(&fc->backing_files_map, outarg->backing_id);
+	if (fb)
+		refcount_inc(&fb->count);
+	spin_unlock(&fc->lock);
+
+	if (!fb)
+		return -EIO;
+
+	ff->passthrough = fb;
+	return 0;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough) {
+		fuse_backing_put(ff->passthrough);
+		ff->passthrough = NULL;
+	}
+}
+
+static rwf_t fuse_iocb_to_rwf(struct kiocb *iocb)
+{
+	int ifl = iocb->ki_flags;
+	rwf_t flags = 0;
+
+	if (ifl & IOCB_NOWAIT)
+		flags |= RWF_NOWAIT;
+	if (ifl & IOCB_HIPRI)
+		flags |= RWF_HIPRI;
+	if (ifl & IOCB_DSYNC)
+		flags |= RWF_DSYNC;
+	if (ifl & IOCB_SYNC)
+		flags |= RWF_SYNC;
+	if (ifl & IOCB_APPEND)
+		flags |= RWF_APPEND;
+
+	return flags;
+}
+
+ssize_t fuse_passthrough_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct fuse_backing *fb = ff->passthrough;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	old_cred = override_creds(fb->cred);
+	ret = vfs_iter_read(fb->file, to, &iocb->ki_pos,
+			    fuse_iocb_to_rwf(iocb));
+	revert_creds(old_cred);
+
+	fuse_invalidate_atime(file_inode(file));
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_file *ff = file->private_data;
+	struct fuse_backing *fb = ff->passthrough;
+	const struct cred *old_cred;
+	loff_t pos;
+	ssize_t ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	inode_lock(inode);
+	old_cred = override_creds(fb->cred);
+	ret = vfs_iter_write(fb->file, from, &iocb->ki_pos,
+			     fuse_iocb_to_rwf(iocb));
+	revert_creds(old_cred);
+
+	if (ret > 0) {
+		/* For O_APPEND the write did not start at the old ki_pos */
+		pos = iocb->ki_pos - ret;
+
+		/* Drop pages cached through opens that don't pass through */
+		if (inode->i_mapping->nrpages)
+			invalidate_inode_pages2_range(inode->i_mapping,
+					pos >> PAGE_SHIFT,
+					(iocb->ki_pos - 1) >> PAGE_SHIFT);
+		fuse_write_update_size(inode, iocb->ki_pos);
+	}
+	/* Size, times and mode (suid clearing) changed underneath */
+	fuse_invalidate_attr(inode);
+	inode_unlock(inode);
+
+	return ret;
+}
+
+/*
+ * The mapping is set up on the backing file directly, so page faults
+ * never come back to fuse.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct fuse_backing *fb = ff->passthrough;
+	const struct cred *old_cred;
+	int ret;
+
+	if (!fb->file->f_op->mmap)
+		return -ENODEV;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	/* Don't allow writing to a backing file opened read-only */
+	if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE) &&
+	    !(fb->file->f_mode & FMODE_WRITE))
+		return -EACCES;
+
+	vma->vm_file = get_file(fb->file);
+
+	old_cred = override_creds(fb->cred);
+	ret = call_mmap(vma->vm_file, vma);
+	revert_creds(old_cred);
+
+	if (ret) {
+		/* Give the vma back its file, the caller drops that ref */
+		vma->vm_file = file;
+		/* Drop reference count from new vm_file value */
+		fput(fb->file);
+	} else {
+		/* Drop reference count from previous vm_file value */
+		fput(file);
+	}
+
+	return ret;
+}
@@ -178,6 +178,13 @@ extern const struct dentry_operations ns_dentry_operations;
 extern int do_vfs_ioctl(struct file *file, unsigned int fd, unsigned int cmd,
 		    unsigned long arg);
 
+/*
+ * fs/stat.c
+ */
+struct statx_batch;
+extern int ioctl_statx_batch(struct file *dir, unsigned int fd,
+			     struct statx_batch __user *argp);
+
 /*
  * iomap support:
  */
@@ -126,6 +126,9 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 	loff_t old_pos = 0;
 	loff_t new_pos = 0;
 	loff_t cloned;
+	loff_t data_pos = -1;
+	bool skip_hole = false;
+	bool copy_range;
 	int error = 0;
 
 	if (len == 0)
@@ -147,7 +150,18 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 		goto out;
 	/* Couldn't clone, so now we try to copy the data */
 
-	/* FIXME: copy up sparse files efficiently */
+	/*
+	 * Within the same fs, copy_file_range may still be able to offload
+	 * the copy.  This calls the method directly: we already hold write
+	 * access to the upper fs.
+	 */
+	copy_range = file_inode(old_file)->i_sb == file_inode(new_file)->i_sb &&
+		     new_file->f_op->copy_file_range;
+
+	/* Holes are skipped, ovl_set_size() restores a trailing one */
+	if ((old_file->f_mode & FMODE_LSEEK) && old_file->f_op->llseek)
+		skip_hole = true;
+
 	while (len) {
 		size_t this_len = OVL_COPY_UP_CHUNK_SIZE;
 		long bytes;
@@ -160,9 +174,34 @@ static int ovl_copy_up_data(struct path *old, struct path *new, loff_t len)
 			break;
 		}
 
-		bytes = do_splice_direct(old_file, &old_pos,
-					 new_file, &new_pos,
-					 this_len, SPLICE_F_MOVE);
+		if (skip_hole && data_pos < old_pos) {
+			data_pos = vfs_llseek(old_file, old_pos, SEEK_DATA);
+			if (data_pos > old_pos) {
+				len -= min(len, data_pos - old_pos);
+				old_pos = new_pos = data_pos;
+				continue;
+			} else if (data_pos == -ENXIO) {
+				break;
+			} else if (data_pos < 0) {
+				skip_hole = false;
+			}
+		}
+
+		bytes = 0;
+		if (copy_range) {
+			bytes = new_file->f_op->copy_file_range(old_file,
+					old_pos, new_file, new_pos, this_len, 0);
+			if (bytes > 0) {
+				old_pos += bytes;
+				new_pos += bytes;
+			} else {
+				copy_range = false;
+			}
+		}
+		if (bytes <= 0)
+			bytes = do_splice_direct(old_file, &old_pos,
+						 new_file, &new_pos,
+						 this_len, SPLICE_F_MOVE);
 		if (bytes <= 0) {
 			error = bytes;
 			break;
@@ -539,7 +578,7 @@ static int ovl_copy_up_inode(struct ovl_copy_up_ctx *c, struct dentry *temp)
 	}
 
 	inode_lock(temp->d_inode);
-	if (c->metacopy)
+	if (S_ISREG(c->stat.mode))
 		err = ovl_set_size(temp, &c->stat);
 	if (!err)
 		err = ovl_set_attr(temp, &c->stat);
@@ -849,11 +888,27 @@ static bool ovl_open_need_copy_up(struct dentry *dentry, int flags)
 	return true;
 }
 
+/*
+ * Opening for write only copies up the metadata if it can.  The data
+ * follows when it is first modified through the file, see
+ * ovl_copy_up_data_for_write().  Truncating opens have no data to copy.
+ */
+static bool ovl_open_defer_data_copy_up(struct dentry *dentry, int flags)
+{
+	if (flags & O_TRUNC)
+		return false;
+
+	return ovl_need_meta_copy_up(dentry, d_inode(dentry)->i_mode, 0);
+}
+
 int ovl_open_maybe_copy_up(struct dentry *dentry, unsigned int file_flags)
 {
 	int err = 0;
 
 	if (ovl_open_need_copy_up(dentry, file_flags)) {
+		if (ovl_open_defer_data_copy_up(dentry, file_flags))
+			file_flags = 0;
+
 		err = ovl_want_write(dentry);
 		if (!err) {
 			err = ovl_copy_up_flags(dentry, file_flags);
@@ -9,10 +9,20 @@
 #include <linux/cred.h>
 #include <linux/file.h>
 #include <linux/mount.h>
+#include <linux/slab.h>
 #include <linux/xattr.h>
 #include <linux/uio.h>
 #include "overlayfs.h"
 
+struct ovl_file {
+	struct file *realfile;
+	/*
+	 * Lower data file for reads of a file held for write whose data is
+	 * not copied up yet, opened on first use.
+	 */
+	struct file *lowerfile;
+};
+
 static char ovl_whatisit(struct inode *inode, struct inode *realinode)
 {
 	if (realinode != ovl_inode_upper(inode))
@@ -29,10 +39,15 @@ static struct file *ovl_open_realfile(const struct file *file,
 	struct inode *inode = file_inode(file);
 	struct file *realfile;
 	const struct cred *old_cred;
+	int flags = file->f_flags | O_NOATIME;
+
+	/* Data not copied up yet is only ever read from the lower file */
+	if (realinode != ovl_inode_upper(inode))
+		flags &= ~O_ACCMODE;
 
 	old_cred = ovl_override_creds(inode->i_sb);
-	realfile = open_with_fake_path(&file->f_path, file->f_flags | O_NOATIME,
-				       realinode, current_cred());
+	realfile = open_with_fake_path(&file->f_path, flags, realinode,
+				       current_cred());
 	revert_creds(old_cred);
 
 	pr_debug("open(%p[%pD2/%c], 0%o) -> (%p, 0%o)\n",
@@ -80,31 +95,73 @@ static int ovl_change_flags(struct file *file, unsigned int flags)
 	return 0;
 }
 
+/* Is this a file held for write whose data is still in the lower file? */
+static bool ovl_file_lacks_data(const struct file *file)
+{
+	struct ovl_file *of = file->private_data;
+	struct inode *inode = file_inode(file);
+
+	return file_inode(of->realfile) == ovl_inode_upper(inode) &&
+	       !ovl_has_upperdata(inode);
+}
+
+static struct file *ovl_lowerdata_file(const struct file *file)
+{
+	struct ovl_file *of = file->private_data;
+	struct file *lowerfile, *old;
+
+	lowerfile = smp_load_acquire(&of->lowerfile);
+	if (lowerfile)
+		return lowerfile;
+
+	lowerfile = ovl_open_realfile(file, ovl_inode_lowerdata(file_inode(file)));
+	if (IS_ERR(lowerfile))
+		return lowerfile;
+
+	old = cmpxchg_release(&of->lowerfile, NULL, lowerfile);
+	if (old) {
+		fput(lowerfile);
+		lowerfile = old;
+	}
+
+	return lowerfile;
+}
+
 static int ovl_real_fdget_meta(const struct file *file, struct fd *real,
 			       bool allow_meta)
 {
+	struct ovl_file *of = file->private_data;
 	struct inode *inode = file_inode(file);
+	unsigned int flags = file->f_flags;
 	struct inode *realinode;
 
 	real->flags = 0;
-	real->file = file->private_data;
+	real->file = of->realfile;
 
 	if (allow_meta)
 		realinode = ovl_inode_real(inode);
 	else
 		realinode = ovl_inode_realdata(inode);
 
-	/* Has it been copied up since we'd opened it? */
 	if (unlikely(file_inode(real->file) != realinode)) {
-		real->flags = FDPUT_FPUT;
-		real->file = ovl_open_realfile(file, realinode);
+		if (!ovl_file_lacks_data(file)) {
+			/* Has it been copied up since we'd opened it? */
+			real->flags = FDPUT_FPUT;
+			real->file = ovl_open_realfile(file, realinode);
+
+			return PTR_ERR_OR_ZERO(real->file);
+		}
 
-		return PTR_ERR_OR_ZERO(real->file);
+		/* The lower file is opened read-only */
+		real->file = ovl_lowerdata_file(file);
+		if (IS_ERR(real->file))
+			return PTR_ERR(real->file);
+		flags &= ~O_ACCMODE;
 	}
 
 	/* Did the flags change since open? */
-	if (unlikely((file->f_flags ^ real->file->f_flags) & ~O_NOATIME))
-		return ovl_change_flags(real->file, file->f_flags);
+	if (unlikely((flags ^ real->file->f_flags) & ~O_NOATIME))
+		return ovl_change_flags(real->file, flags);
 
 	return 0;
 }
@@ -114,10 +171,33 @@ static int ovl_real_fdget(const struct file *file, struct fd *real)
 	return ovl_real_fdget_meta(file, real, false);
 }
 
+/*
+ * The data copy-up of a file opened for write is deferred until the data
+ * is first modified, see ovl_open_maybe_copy_up().
+ */
+static int ovl_copy_up_data_for_write(struct file *file)
+{
+	struct dentry *dentry = file_dentry(file);
+	int err;
+
+	if (ovl_has_upperdata(d_inode(dentry)))
+		return 0;
+
+	err = ovl_want_write(dentry);
+	if (!err) {
+		err = ovl_copy_up_with_data(dentry);
+		ovl_drop_write(dentry);
+	}
+
+	return err;
+}
+
 static int ovl_open(struct inode *inode, struct file *file)
 {
 	struct dentry *dentry = file_dentry(file);
+	struct inode *realinode;
 	struct file *realfile;
+	struct ovl_file *of;
 	int err;
 
 	err = ovl_open_maybe_copy_up(dentry, file->f_flags);
@@ -127,18 +207,39 @@ static int ovl_open(struct inode *inode, struct file *file)
 	/* No longer need these flags, so don't pass them on to underlying fs */
 	file->f_flags &= ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
 
-	realfile = ovl_open_realfile(file, ovl_inode_realdata(inode));
-	if (IS_ERR(realfile))
+	of = kzalloc(sizeof(*of), GFP_KERNEL);
+	if (!of)
+		return -ENOMEM;
+
+	/*
+	 * A file opened for write holds the upper file, even while the data
+	 * is still read from the lower one, so that nothing needs to be
+	 * reopened once the data is copied up.
+	 */
+	realinode = ovl_inode_realdata(inode);
+	if (file->f_mode & FMODE_WRITE)
+		realinode = ovl_inode_upper(inode) ?: realinode;
+
+	realfile = ovl_open_realfile(file, realinode);
+	if (IS_ERR(realfile)) {
+		kfree(of);
 		return PTR_ERR(realfile);
+	}
 
-	file->private_data = realfile;
+	of->realfile = realfile;
+	file->private_data = of;
 
 	return 0;
 }
 
 static int ovl_release(struct inode *inode, struct file *file)
 {
-	fput(file->private_data);
+	struct ovl_file *of = file->private_data;
+
+	fput(of->realfile);
+	if (of->lowerfile)
+		fput(of->lowerfile);
+	kfree(of);
 
 	return 0;
 }
@@ -228,6 +329,10 @@ static ssize_t ovl_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 	if (!iov_iter_count(iter))
 		return 0;
 
+	ret = ovl_copy_up_data_for_write(file);
+	if (ret)
+		return ret;
+
 	inode_lock(inode);
 	/* Update mode */
 	ovl_copyattr(ovl_inode_real(inode), inode);
@@ -281,10 +386,28 @@ static int ovl_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 
 static int ovl_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	struct file *realfile = file->private_data;
+	struct ovl_file *of = file->private_data;
+	struct file *realfile = of->realfile;
 	const struct cred *old_cred;
 	int ret;
 
+	/*
+	 * The upper file held for write has no data of its own yet.  Only
+	 * shared writable mappings need it, others map the lower file.
+	 */
+	if (ovl_file_lacks_data(file)) {
+		if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+		    (VM_SHARED | VM_MAYWRITE)) {
+			ret = ovl_copy_up_data_for_write(file);
+			if (ret)
+				return ret;
+		} else {
+			realfile = ovl_lowerdata_file(file);
+			if (IS_ERR(realfile))
+				return PTR_ERR(realfile);
+		}
+	}
+
 	if (!realfile->f_op->mmap)
 		return -ENODEV;
 
@@ -317,6 +440,10 @@ static long ovl_fallocate(struct file *file, int mode, loff_t offset, loff_t len
 	const struct cred *old_cred;
 	int ret;
 
+	ret = ovl_copy_up_data_for_write(file);
+	if (ret)
+		return ret;
+
 	ret = ovl_real_fdget(file, &real);
 	if (ret)
 		return ret;
@@ -443,6 +570,12 @@ static loff_t ovl_copyfile(struct file *file_in, loff_t pos_in,
 	const struct cred *old_cred;
 	loff_t ret;
 
+	if (op != OVL_DEDUPE) {
+		ret = ovl_copy_up_data_for_write(file_out);
+		if (ret)
+			return ret;
+	}
+
 	ret = ovl_real_fdget(file_out, &real_out);
 	if (ret)
 		return ret;
@@ -509,8 +642,8 @@ static loff_t ovl_remap_file_range(struct file *file_in, loff_t pos_in,
 	 * most of the time (data would be duplicated instead of deduplicated).
 	 */
 	if (op == OVL_DEDUPE &&
-	    (!ovl_inode_upper(file_inode(file_in)) ||
-	     !ovl_inode_upper(file_inode(file_out))))
+	    (!ovl_has_upperdata(file_inode(file_in)) ||
+	     !ovl_has_upperdata(file_inode(file_out))))
 		return -EPERM;
 
 	return ovl_copyfile(file_in, pos_in, file_out, pos_out, len,
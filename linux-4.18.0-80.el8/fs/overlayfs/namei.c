@@ -11,6 +11,9 @@
 #include <linux/cred.h>
 #include <linux/ctype.h>
 #include <linux/namei.h>
+#include <linux/file.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
 #include <linux/xattr.h>
 #include <linux/ratelimit.h>
 #include <linux/mount.h>
@@ -313,6 +316,224 @@ static int ovl_lookup_layer(struct dentry *base, struct ovl_lookup_data *d,
 	return 0;
 }
 
+/*
+ * Names found in the lower dirs of a merge dir, with the lower layers each
+ * name was found in.  A cold lookup in a dir with many lower layers then
+ * only has to look in the layers that have an entry by that name, and a
+ * lookup of a name that is in none of them ends after the upper lookup.
+ *
+ * Lower layers must not change while the overlay is mounted, so the names
+ * stay valid for as long as the lower stack of the dir does and are freed
+ * with it.  Upper is always looked up, whiteouts and opaque dirs in upper
+ * stop the lookup before lower is reached as before.
+ */
+struct ovl_lower_name {
+	struct rb_node node;
+	const char *name;
+	unsigned int len;
+	unsigned long layers[];
+};
+
+struct ovl_lower_names {
+	struct rb_root root;
+	unsigned int count;
+};
+
+/*
+ * Build the names of a dir only after it has seen a few cold lookups, and
+ * give up on dirs that are too large to index.
+ */
+#define OVL_LOWER_NAMES_MIN_LOOKUPS	4
+#define OVL_LOWER_NAMES_MAX		65536
+
+struct ovl_lower_names_data {
+	struct dir_context ctx;
+	struct ovl_lower_names *names;
+	unsigned int numlower;
+	unsigned int layer;
+	int count;
+	int err;
+};
+
+static struct ovl_lower_name *ovl_lower_name_find(struct ovl_lower_names *names,
+						  const char *name,
+						  unsigned int len,
+						  struct rb_node ***link,
+						  struct rb_node **parent)
+{
+	struct rb_node **newp = &names->root.rb_node;
+
+	*parent = NULL;
+	while (*newp) {
+		struct ovl_lower_name *p;
+		int cmp;
+
+		*parent = *newp;
+		p = rb_entry(*parent, struct ovl_lower_name, node);
+		cmp = strncmp(name, p->name, len);
+		if (!cmp)
+			cmp = len - p->len;
+		if (cmp > 0)
+			newp = &(*parent)->rb_right;
+		else if (cmp < 0)
+			newp = &(*parent)->rb_left;
+		else
+			return p;
+	}
+	if (link)
+		*link = newp;
+	return NULL;
+}
+
+static int ovl_fill_lower_names(struct dir_context *ctx, const char *name,
+				int namelen, loff_t offset, u64 ino,
+				unsigned int d_type)
+{
+	struct ovl_lower_names_data *lnd =
+		container_of(ctx, struct ovl_lower_names_data, ctx);
+	struct ovl_lower_names *names = lnd->names;
+	size_t nlongs = BITS_TO_LONGS(lnd->numlower);
+	struct ovl_lower_name *p;
+	struct rb_node **link, *parent;
+	char *s;
+
+	lnd->count++;
+	if (name[0] == '.' &&
+	    (namelen == 1 || (namelen == 2 && name[1] == '.')))
+		return 0;
+
+	p = ovl_lower_name_find(names, name, namelen, &link, &parent);
+	if (!p) {
+		if (names->count >= OVL_LOWER_NAMES_MAX) {
+			lnd->err = -E2BIG;
+			return -E2BIG;
+		}
+		p = kzalloc(sizeof(*p) + nlongs * sizeof(long) + namelen + 1,
+			    GFP_KERNEL);
+		if (!p) {
+			lnd->err = -ENOMEM;
+			return -ENOMEM;
+		}
+		s = (char *) &p->layers[nlongs];
+		memcpy(s, name, namelen);
+		p->name = s;
+		p->len = namelen;
+		rb_link_node(&p->node, parent, link);
+		rb_insert_color(&p->node, &names->root);
+		names->count++;
+	}
+	__set_bit(lnd->layer, p->layers);
+
+	return 0;
+}
+
+void ovl_lower_names_free(struct ovl_lower_names *names)
+{
+	struct ovl_lower_name *p, *n;
+
+	if (IS_ERR_OR_NULL(names))
+		return;
+
+	rbtree_postorder_for_each_entry_safe(p, n, &names->root, node)
+		kfree(p);
+	kfree(names);
+}
+
+static struct ovl_lower_names *ovl_lower_names_build(struct ovl_entry *oe)
+{
+	struct ovl_lower_names_data lnd = {
+		.ctx.actor = ovl_fill_lower_names,
+		.numlower = oe->numlower,
+	};
+	struct file *realfile;
+	struct path realpath;
+	int err = -ENOMEM;
+
+	lnd.names = kzalloc(sizeof(struct ovl_lower_names), GFP_KERNEL);
+	if (!lnd.names)
+		return ERR_PTR(err);
+	lnd.names->root = RB_ROOT;
+
+	for (lnd.layer = 0; lnd.layer < oe->numlower; lnd.layer++) {
+		realpath.mnt = oe->lowerstack[lnd.layer].layer->mnt;
+		realpath.dentry = oe->lowerstack[lnd.layer].dentry;
+		realfile = ovl_path_open(&realpath, O_RDONLY | O_DIRECTORY);
+		if (IS_ERR(realfile)) {
+			err = PTR_ERR(realfile);
+			goto out_free;
+		}
+
+		lnd.ctx.pos = 0;
+		do {
+			lnd.count = 0;
+			lnd.err = 0;
+			err = iterate_dir(realfile, &lnd.ctx);
+			if (err >= 0)
+				err = lnd.err;
+		} while (!err && lnd.count);
+		fput(realfile);
+		if (err)
+			goto out_free;
+	}
+	return lnd.names;
+
+out_free:
+	ovl_lower_names_free(lnd.names);
+	return ERR_PTR(err);
+}
+
+/*
+ * Get the lower names of merge dir @dir, building them if the dir has been
+ * looked up in often enough.  Called with creds of mounter.
+ */
+static struct ovl_lower_names *ovl_lower_names_get(struct dentry *dir)
+{
+	struct ovl_entry *oe = dir->d_fsdata;
+	struct ovl_lower_names *names = READ_ONCE(oe->names);
+	unsigned int lookups;
+
+	if (names)
+		return IS_ERR(names) ? NULL : names;
+
+	if (oe->numlower < 2 || ovl_dentry_remote(dir))
+		return NULL;
+
+	/* Racy, it only decides when building is worth it */
+	lookups = READ_ONCE(oe->lookups) + 1;
+	WRITE_ONCE(oe->lookups, lookups);
+	if (lookups < OVL_LOWER_NAMES_MIN_LOOKUPS)
+		return NULL;
+
+	/*
+	 * Remember failure, so that a dir that is too large or can't be read
+	 * is not read again on every lookup.  Parallel lookups in the dir may
+	 * race to build, the first one wins.
+	 */
+	names = ovl_lower_names_build(oe);
+	if (names == ERR_PTR(-ENOMEM))
+		return NULL;
+	if (cmpxchg(&oe->names, NULL, names)) {
+		ovl_lower_names_free(names);
+		names = READ_ONCE(oe->names);
+	}
+	return IS_ERR(names) ? NULL : names;
+}
+
+/* Could the lower dir at @layer of the dir @names belongs to have @name? */
+static bool ovl_lower_names_may_have(struct ovl_lower_names *names,
+				     const struct qstr *name,
+				     unsigned int layer)
+{
+	struct ovl_lower_name *p;
+	struct rb_node *parent;
+
+	if (!names || name->name[0] == '/')
+		return true;
+
+	p = ovl_lower_name_find(names, name->name, name->len, NULL, &parent);
+	return p && test_bit(layer, p->layers);
+}
+
 
 int ovl_check_origin_fh(struct ovl_fs *ofs, struct ovl_fh *fh, bool connected,
 			struct dentry *upperdentry, struct ovl_path **stackp)
@@ -806,6 +1027,7 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 	struct ovl_fs *ofs = dentry->d_sb->s_fs_info;
 	struct ovl_entry *poe = dentry->d_parent->d_fsdata;
 	struct ovl_entry *roe = dentry->d_sb->s_root->d_fsdata;
+	struct ovl_lower_names *names = NULL;
 	struct ovl_path *stack = NULL, *origin_path = NULL;
 	struct dentry *upperdir, *upperdentry = NULL;
 	struct dentry *origin = NULL;
@@ -882,6 +1104,9 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 				GFP_KERNEL);
 		if (!stack)
 			goto out_put_upper;
+		/* Not after an absolute redirect in upper */
+		if (poe == dentry->d_parent->d_fsdata)
+			names = ovl_lower_names_get(dentry->d_parent);
 	}
 
 	for (i = 0; !d.stop && i < poe->numlower; i++) {
@@ -892,6 +1117,9 @@ struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 		else
 			d.last = lower.layer->idx == roe->numlower;
 
+		if (!ovl_lower_names_may_have(names, &d.name, i))
+			continue;
+
 		err = ovl_lookup_layer(lower.dentry, &d, &this);
 		if (err)
 			goto out_put;
@@ -1103,6 +1331,7 @@ out:
 bool ovl_lower_positive(struct dentry *dentry)
 {
 	struct ovl_entry *poe = dentry->d_parent->d_fsdata;
+	struct ovl_lower_names *names = READ_ONCE(poe->names);
 	const struct qstr *name = &dentry->d_name;
 	const struct cred *old_cred;
 	unsigned int i;
@@ -1126,6 +1355,11 @@ bool ovl_lower_positive(struct dentry *dentry)
 		struct dentry *this;
 		struct dentry *lowerdir = poe->lowerstack[i].dentry;
 
+		/* Use the lower names if the dir has them, don't build them */
+		if (!IS_ERR(names) &&
+		    !ovl_lower_names_may_have(names, name, i))
+			continue;
+
 		this = lookup_one_len_unlocked(name->name, lowerdir,
 					       name->len);
 		if (IS_ERR(this)) {
@@ -309,6 +309,7 @@ int ovl_path_next(int idx, struct dentry *dentry, struct path *path);
 struct dentry *ovl_lookup(struct inode *dir, struct dentry *dentry,
 			  unsigned int flags);
 bool ovl_lower_positive(struct dentry *dentry);
+void ovl_lower_names_free(struct ovl_lower_names *names);
 
 static inline int ovl_verify_origin(struct dentry *upper,
 				    struct dentry *origin, bool set)
@@ -69,6 +69,8 @@ struct ovl_fs {
 	unsigned int xino_bits;
 };
 
+struct ovl_lower_names;
+
 /* private information held for every overlayfs dentry */
 struct ovl_entry {
 	union {
@@ -78,6 +80,9 @@ struct ovl_entry {
 		struct rcu_head rcu;
 	};
 	unsigned numlower;
+	/* Lower names of a merge dir, see ovl_lower_names_get() */
+	struct ovl_lower_names *names;
+	unsigned int lookups;
 	struct ovl_path lowerstack[];
 };
 
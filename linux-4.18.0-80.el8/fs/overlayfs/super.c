@@ -62,6 +62,7 @@ static void ovl_entry_stack_free(struct ovl_entry *oe)
 
 	for (i = 0; i < oe->numlower; i++)
 		dput(oe->lowerstack[i].dentry);
+	ovl_lower_names_free(oe->names);
 }
 
 static bool ovl_metacopy_def = IS_ENABLED(CONFIG_OVERLAY_FS_METACOPY);
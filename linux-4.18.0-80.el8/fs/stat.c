@@ -17,10 +17,13 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/compat.h>
+#include <linux/sched/signal.h>
 
 #include <linux/uaccess.h>
 #include <asm/unistd.h>
 
+#include "internal.h"
+
 /**
  * generic_fillattr - Fill in the basic attributes from the inode struct
  * @inode: Inode to use as the source
@@ -518,37 +521,41 @@ SYSCALL_DEFINE4(fstatat64, int, dfd, const char __user *, filename,
 }
 #endif /* __ARCH_WANT_STAT64 || __ARCH_WANT_COMPAT_STAT64 */
 
+static void init_statx(const struct kstat *stat, struct statx *tmp)
+{
+	memset(tmp, 0, sizeof(*tmp));
+
+	tmp->stx_mask = stat->result_mask;
+	tmp->stx_blksize = stat->blksize;
+	tmp->stx_attributes = stat->attributes;
+	tmp->stx_nlink = stat->nlink;
+	tmp->stx_uid = from_kuid_munged(current_user_ns(), stat->uid);
+	tmp->stx_gid = from_kgid_munged(current_user_ns(), stat->gid);
+	tmp->stx_mode = stat->mode;
+	tmp->stx_ino = stat->ino;
+	tmp->stx_size = stat->size;
+	tmp->stx_blocks = stat->blocks;
+	tmp->stx_attributes_mask = stat->attributes_mask;
+	tmp->stx_atime.tv_sec = stat->atime.tv_sec;
+	tmp->stx_atime.tv_nsec = stat->atime.tv_nsec;
+	tmp->stx_btime.tv_sec = stat->btime.tv_sec;
+	tmp->stx_btime.tv_nsec = stat->btime.tv_nsec;
+	tmp->stx_ctime.tv_sec = stat->ctime.tv_sec;
+	tmp->stx_ctime.tv_nsec = stat->ctime.tv_nsec;
+	tmp->stx_mtime.tv_sec = stat->mtime.tv_sec;
+	tmp->stx_mtime.tv_nsec = stat->mtime.tv_nsec;
+	tmp->stx_rdev_major = MAJOR(stat->rdev);
+	tmp->stx_rdev_minor = MINOR(stat->rdev);
+	tmp->stx_dev_major = MAJOR(stat->dev);
+	tmp->stx_dev_minor = MINOR(stat->dev);
+}
+
 static noinline_for_stack int
 cp_statx(const struct kstat *stat, struct statx __user *buffer)
 {
 	struct statx tmp;
 
-	memset(&tmp, 0, sizeof(tmp));
-
-	tmp.stx_mask = stat->result_mask;
-	tmp.stx_blksize = stat->blksize;
-	tmp.stx_attributes = stat->attributes;
-	tmp.stx_nlink = stat->nlink;
-	tmp.stx_uid = from_kuid_munged(current_user_ns(), stat->uid);
-	tmp.stx_gid = from_kgid_munged(current_user_ns(), stat->gid);
-	tmp.stx_mode = stat->mode;
-	tmp.stx_ino = stat->ino;
-	tmp.stx_size = stat->size;
-	tmp.stx_blocks = stat->blocks;
-	tmp.stx_attributes_mask = stat->attributes_mask;
-	tmp.stx_atime.tv_sec = stat->atime.tv_sec;
-	tmp.stx_atime.tv_nsec = stat->atime.tv_nsec;
-	tmp.stx_btime.tv_sec = stat->btime.tv_sec;
-	tmp.stx_btime.tv_nsec = stat->btime.tv_nsec;
-	tmp.stx_ctime.tv_sec = stat->ctime.tv_sec;
-	tmp.stx_ctime.tv_nsec = stat->ctime.tv_nsec;
-	tmp.stx_mtime.tv_sec = stat->mtime.tv_sec;
-	tmp.stx_mtime.tv_nsec = stat->mtime.tv_nsec;
-	tmp.stx_rdev_major = MAJOR(stat->rdev);
-	tmp.stx_rdev_minor = MINOR(stat->rdev);
-	tmp.stx_dev_major = MAJOR(stat->dev);
-	tmp.stx_dev_minor = MINOR(stat->dev);
-
+	init_statx(stat, &tmp);
 	return copy_to_user(buffer, &tmp, sizeof(tmp)) ? -EFAULT : 0;
 }
 
@@ -583,6 +590,128 @@ SYSCALL_DEFINE5(statx,
 	return cp_statx(&stat, buffer);
 }
 
+/*
+ * Stat one name of a batch.  A plain name in the directory is looked up
+ * directly in it, sharing the walk to the directory with the rest of the
+ * batch; everything else (paths, dot names, mount points, symlinks to
+ * follow, automounts, stale handles) goes through a full vfs_statx()
+ * relative to the directory.
+ */
+static int statx_batch_one(struct file *dir, unsigned int fd,
+			   const char __user *uname, unsigned int flags,
+			   u32 mask, struct kstat *stat)
+{
+	struct filename *name;
+	struct dentry *dentry;
+	struct path path;
+	int len, error;
+
+	if (flags & AT_EMPTY_PATH)
+		goto slow;
+
+	name = getname(uname);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+	len = strlen(name->name);
+	if (len > NAME_MAX || strchr(name->name, '/') ||
+	    (name->name[0] == '.' &&
+	     (len == 1 || (len == 2 && name->name[1] == '.')))) {
+		putname(name);
+		goto slow;
+	}
+	dentry = lookup_one_len_unlocked(name->name, dir->f_path.dentry, len);
+	putname(name);
+	if (IS_ERR(dentry))
+		return PTR_ERR(dentry);
+
+	if (d_is_negative(dentry)) {
+		dput(dentry);
+		return -ENOENT;
+	}
+	if (d_managed(dentry) ||
+	    (d_is_symlink(dentry) && !(flags & AT_SYMLINK_NOFOLLOW))) {
+		dput(dentry);
+		goto slow;
+	}
+
+	path.mnt = dir->f_path.mnt;
+	path.dentry = dentry;
+	error = vfs_getattr(&path, stat, mask, flags);
+	dput(dentry);
+	if (error != -ESTALE)
+		return error;
+slow:
+	return vfs_statx(fd, uname, flags, stat, mask);
+}
+
+/**
+ * ioctl_statx_batch - statx() many names relative to a directory
+ * @dir: The directory the names are relative to
+ * @fd: The file descriptor of @dir
+ * @argp: The struct statx_batch describing the names and the results
+ *
+ * Saves the syscall, the lookup of the directory and the copy out of the
+ * unused tail of struct statx for each name.  Stops early on a fatal
+ * signal; the number of entries done is returned in argp->count.
+ */
+int ioctl_statx_batch(struct file *dir, unsigned int fd,
+		      struct statx_batch __user *argp)
+{
+	struct statx_batch_entry __user *ue;
+	struct statx_batch batch;
+	struct kstat stat;
+	struct statx tmp;
+	u32 i;
+	int error = 0;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+	if (batch.__spare || batch.mask & STATX__RESERVED)
+		return -EINVAL;
+	if (batch.flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT |
+			    AT_EMPTY_PATH | KSTAT_QUERY_FLAGS))
+		return -EINVAL;
+	if ((batch.flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if (!d_can_lookup(dir->f_path.dentry))
+		return -ENOTDIR;
+
+	ue = u64_to_user_ptr(batch.entries);
+	for (i = 0; i < batch.count; i++, ue++) {
+		u64 uname;
+		int res;
+
+		if (fatal_signal_pending(current)) {
+			error = -EINTR;
+			break;
+		}
+		if (get_user(uname, &ue->name)) {
+			error = -EFAULT;
+			break;
+		}
+		res = statx_batch_one(dir, fd, u64_to_user_ptr(uname),
+				      batch.flags, batch.mask, &stat);
+		if (!res) {
+			init_statx(&stat, &tmp);
+			if (copy_to_user(&ue->stx, &tmp,
+					 offsetof(struct statx, __spare2))) {
+				error = -EFAULT;
+				break;
+			}
+		}
+		if (put_user(res, &ue->error)) {
+			error = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+
+	/* Partial success if anything was done */
+	if (i && put_user(i, &argp->count))
+		return -EFAULT;
+	return i ? 0 : error;
+}
+
 #ifdef CONFIG_COMPAT
 static int cp_compat_stat(struct kstat *stat, struct compat_stat __user *ubuf)
 {
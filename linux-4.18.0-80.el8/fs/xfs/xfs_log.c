@@ -566,12 +566,27 @@ xfs_log_notify(
 	return abortflg;
 }
 
+/*
+ * Drop a reference to an iclog. With @sync set, an iclog that is still open
+ * for further log writes is switched out first, so that it is written when
+ * the last reference goes rather than when it fills up or the log is forced.
+ */
 int
 xfs_log_release_iclog(
 	struct xfs_mount	*mp,
-	struct xlog_in_core	*iclog)
+	struct xlog_in_core	*iclog,
+	bool			sync)
 {
-	if (xlog_state_release_iclog(mp->m_log, iclog)) {
+	struct xlog		*log = mp->m_log;
+
+	if (sync) {
+		spin_lock(&log->l_icloglock);
+		if (iclog->ic_state == XLOG_STATE_ACTIVE)
+			xlog_state_switch_iclogs(log, iclog, 0);
+		spin_unlock(&log->l_icloglock);
+	}
+
+	if (xlog_state_release_iclog(log, iclog)) {
 		xfs_force_shutdown(mp, SHUTDOWN_LOG_IO_ERROR);
 		return -EIO;
 	}
@@ -107,6 +107,7 @@ static inline xfs_lsn_t	_lsn_cmp(xfs_lsn_t lsn1, xfs_lsn_t lsn2)
 
 /* Log manager interfaces */
 struct xfs_mount;
+struct xlog;
 struct xlog_in_core;
 struct xlog_ticket;
 struct xfs_log_item;
@@ -132,7 +133,8 @@ void	  xfs_log_space_wake(struct xfs_mount *mp);
 int	  xfs_log_notify(struct xlog_in_core	*iclog,
 			 struct xfs_log_callback *callback_entry);
 int	  xfs_log_release_iclog(struct xfs_mount *mp,
-			 struct xlog_in_core	 *iclog);
+			 struct xlog_in_core	 *iclog,
+			 bool		 sync);
 int	  xfs_log_reserve(struct xfs_mount *mp,
 			  int		   length,
 			  int		   count,
@@ -149,6 +151,7 @@ void	  xfs_log_ticket_put(struct xlog_ticket *ticket);
 void	xfs_log_commit_cil(struct xfs_mount *mp, struct xfs_trans *tp,
 				xfs_lsn_t *commit_lsn, bool regrant);
 bool	xfs_log_item_in_current_chkpt(struct xfs_log_item *lip);
+void	xlog_cil_flush(struct xlog *log);
 
 void	xfs_log_work_queue(struct xfs_mount *mp);
 void	xfs_log_quiesce(struct xfs_mount *mp);
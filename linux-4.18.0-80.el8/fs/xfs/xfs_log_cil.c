@@ -384,6 +384,10 @@ insert:
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * The items, busy extents and space accounting go to the per-cpu part of the
+ * CIL so that concurrent commits on different cpus don't share cachelines;
+ * xlog_cil_push() merges them back together.
  */
 static void
 xlog_cil_insert_items(
@@ -392,11 +396,14 @@ xlog_cil_insert_items(
 {
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+	struct xlog_cil_pcp	*cilpcp;
 	struct xfs_log_item	*lip;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
 	int			iovhdr_res = 0, split_res = 0, ctx_res = 0;
+	int			space_used;
+	uint32_t		order;
 
 	ASSERT(tp);
 
@@ -406,44 +413,68 @@ xlog_cil_insert_items(
 	 */
 	xlog_cil_insert_format_items(log, tp, &len, &diff_iovecs);
 
-	spin_lock(&cil->xc_cil_lock);
-
 	/* account for space used by new iovec headers  */
 	iovhdr_res = diff_iovecs * sizeof(xlog_op_header_t);
 	len += iovhdr_res;
-	ctx->nvecs += diff_iovecs;
-
-	/* attach the transaction to the CIL if it has any busy extents */
-	if (!list_empty(&tp->t_busy))
-		list_splice_init(&tp->t_busy, &ctx->busy_extents);
 
 	/*
 	 * Now transfer enough transaction reservation to the context ticket
 	 * for the checkpoint. The context ticket is special - the unit
 	 * reservation has to grow as well as the current reservation as we
 	 * steal from tickets so we can correctly determine the space used
-	 * during the transaction commit.
+	 * during the transaction commit. Only the first commit into an empty
+	 * context does this; the test_bit keeps the others from dirtying the
+	 * cacheline.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) &&
+	    test_and_clear_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		ctx_res = ctx->ticket->t_unit_res;
 		ctx->ticket->t_curr_res = ctx_res;
 		tp->t_ticket->t_curr_res -= ctx_res;
 	}
 
-	/* do we need space for more log record headers? */
+	cilpcp = get_cpu_ptr(cil->xc_pcp);
+
+	/* attach the transaction to the CIL if it has any busy extents */
+	if (!list_empty(&tp->t_busy))
+		list_splice_init(&tp->t_busy, &cilpcp->busy_extents);
+
+	/*
+	 * Do we need space for more log record headers? Each cpu only sees
+	 * the iclog boundaries within its own share of the checkpoint, so the
+	 * first commit on every cpu reserves one more header, except for the
+	 * commit that took the context ticket reservation above. Summed up
+	 * over all cpus that covers every boundary in the whole checkpoint.
+	 * The split reservation is added to the context ticket at push time.
+	 */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
+	if (len > 0 && ((!cilpcp->space_acct && !ctx_res) ||
+			cilpcp->space_acct / iclog_space !=
+				(cilpcp->space_acct + len) / iclog_space)) {
 		split_res = (len + iclog_space - 1) / iclog_space;
 		/* need to take into account split region headers, too */
 		split_res *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += split_res;
-		ctx->ticket->t_curr_res += split_res;
+		cilpcp->split_res += split_res;
 		tp->t_ticket->t_curr_res -= split_res;
 		ASSERT(tp->t_ticket->t_curr_res >= len);
 	}
 	tp->t_ticket->t_curr_res -= len;
-	ctx->space_used += len;
+	cilpcp->space_acct += len;
+	cilpcp->space_used += len;
+
+	/*
+	 * Fold the space used on this cpu into the context once it is more
+	 * than this cpu's share of what is left before a background push is
+	 * due, so the push is never triggered more than one limit late. Once
+	 * over the limit, every commit folds so that it sees the push is due.
+	 */
+	space_used = atomic_read(&ctx->space_used);
+	if (space_used >= XLOG_CIL_SPACE_LIMIT(log) ||
+	    cilpcp->space_used > (XLOG_CIL_SPACE_LIMIT(log) - space_used) /
+				 num_online_cpus()) {
+		atomic_add(cilpcp->space_used, &ctx->space_used);
+		cilpcp->space_used = 0;
+	}
 
 	/*
 	 * If we've overrun the reservation, dump the tx details before we move
@@ -461,26 +492,24 @@ xlog_cil_insert_items(
 	}
 
 	/*
-	 * Now (re-)position everything modified at the tail of the CIL.
-	 * We do this here so we only need to take the CIL lock once during
-	 * the transaction commit.
+	 * Now add everything modified to this cpu's CIL list. Items that are
+	 * already in the CIL stay on whatever list they are on; the order id
+	 * records that they were relogged, and the push sorts on it so that the
+	 * checkpoint still has the items in the order they were last modified.
 	 */
+	order = atomic_inc_return(&ctx->order_id);
 	list_for_each_entry(lip, &tp->t_items, li_trans) {
 
 		/* Skip items which aren't dirty in this transaction. */
 		if (!test_bit(XFS_LI_DIRTY, &lip->li_flags))
 			continue;
 
-		/*
-		 * Only move the item if it isn't already at the tail. This is
-		 * to prevent a transient list_empty() state when reinserting
-		 * an item that is already the only item in the CIL.
-		 */
-		if (!list_is_last(&lip->li_cil, &cil->xc_cil))
-			list_move_tail(&lip->li_cil, &cil->xc_cil);
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &cilpcp->log_items);
 	}
 
-	spin_unlock(&cil->xc_cil_lock);
+	put_cpu_ptr(cilpcp);
 
 	if (tp->t_ticket->t_curr_res < 0)
 		xfs_force_shutdown(log->l_mp, SHUTDOWN_LOG_IO_ERROR);
@@ -609,6 +638,56 @@ xlog_cil_committed(
 		kmem_free(ctx);
 }
 
+/*
+ * Callback for list_sort to put the CIL items back into commit order.
+ */
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*l1,
+	struct list_head	*l2)
+{
+	struct xfs_log_item	*lip1 = container_of(l1, struct xfs_log_item,
+						     li_cil);
+	struct xfs_log_item	*lip2 = container_of(l2, struct xfs_log_item,
+						     li_cil);
+
+	return lip1->li_order_id > lip2->li_order_id;
+}
+
+/*
+ * Move the per-cpu CIL state into @ctx and the log items onto @items, sorted
+ * in the order they were last committed. Must be called with the context lock
+ * held exclusively so that no commit can modify the per-cpu state.
+ *
+ * Offline cpus may still hold items committed before they went down, so walk
+ * all possible cpus.
+ */
+static void
+xlog_cil_pcp_aggregate(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx,
+	struct list_head	*items)
+{
+	struct xlog_cil_pcp	*cilpcp;
+	int			cpu;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		ctx->ticket->t_unit_res += cilpcp->split_res;
+		ctx->ticket->t_curr_res += cilpcp->split_res;
+		atomic_add(cilpcp->space_used, &ctx->space_used);
+		list_splice_init(&cilpcp->log_items, items);
+		list_splice_init(&cilpcp->busy_extents, &ctx->busy_extents);
+
+		cilpcp->split_res = 0;
+		cilpcp->space_used = 0;
+		cilpcp->space_acct = 0;
+	}
+	list_sort(NULL, items, xlog_cil_order_cmp);
+}
+
 /*
  * Push the Committed Item List to the log. If @push_seq flag is zero, then it
  * is a background flush and so we can chose to ignore it. Otherwise, if the
@@ -640,6 +719,8 @@ xlog_cil_push(
 	struct xfs_log_vec	lvhdr = { NULL };
 	xfs_lsn_t		commit_lsn;
 	xfs_lsn_t		push_seq;
+	bool			push_async;
+	LIST_HEAD(items);
 
 	if (!cil)
 		return 0;
@@ -653,13 +734,15 @@ xlog_cil_push(
 	spin_lock(&cil->xc_push_lock);
 	push_seq = cil->xc_push_seq;
 	ASSERT(push_seq <= ctx->sequence);
+	push_async = cil->xc_push_async;
+	cil->xc_push_async = false;
 
 	/*
 	 * Check if we've anything to push. If there is nothing, then we don't
 	 * move on to a new sequence number and so we have to be able to push
 	 * this sequence again later.
 	 */
-	if (list_empty(&cil->xc_cil)) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_push_lock);
 		goto out_skip;
@@ -701,16 +784,17 @@ xlog_cil_push(
 
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL. The per-cpu CIL state is only
+	 * modified on the transaction commit side which is currently locked
+	 * out by the flush lock.
 	 */
+	xlog_cil_pcp_aggregate(cil, ctx, &items);
 	lv = NULL;
 	num_iovecs = 0;
-	while (!list_empty(&cil->xc_cil)) {
+	while (!list_empty(&items)) {
 		struct xfs_log_item	*item;
 
-		item = list_first_entry(&cil->xc_cil,
+		item = list_first_entry(&items,
 					struct xfs_log_item, li_cil);
 		list_del_init(&item->li_cil);
 		if (!ctx->lv_chain)
@@ -761,6 +845,7 @@ xlog_cil_push(
 	 */
 	spin_lock(&cil->xc_push_lock);
 	cil->xc_current_sequence = new_ctx->sequence;
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 	spin_unlock(&cil->xc_push_lock);
 	up_write(&cil->xc_ctx_lock);
 
@@ -847,8 +932,12 @@ restart:
 	wake_up_all(&cil->xc_commit_wait);
 	spin_unlock(&cil->xc_push_lock);
 
-	/* release the hounds! */
-	return xfs_log_release_iclog(log->l_mp, commit_iclog);
+	/*
+	 * Release the hounds! Nobody is going to force the log for an async
+	 * push, so make sure the commit record goes out with the iclog rather
+	 * than waiting in it until the log worker comes along.
+	 */
+	return xfs_log_release_iclog(log->l_mp, commit_iclog, push_async);
 
 out_skip:
 	up_write(&cil->xc_ctx_lock);
@@ -889,13 +978,13 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(!test_bit(XLOG_CIL_EMPTY, &cil->xc_flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
 	 * space available yet.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log))
+	if (atomic_read(&cil->xc_ctx->space_used) < XLOG_CIL_SPACE_LIMIT(log))
 		return;
 
 	spin_lock(&cil->xc_push_lock);
@@ -912,11 +1001,17 @@ xlog_cil_push_background(
  * number that is passed. When it returns, the work will be queued for
  * @push_seq, but it won't be completed. The caller is expected to do any
  * waiting for push_seq to complete if it is required.
+ *
+ * Unless @async is set, any pending background push is started and waited for
+ * first, so that a caller that is going to wait anyway doesn't have to go
+ * through two pushes. An async push writes out the iclog holding its commit
+ * record itself, as no log force is going to follow it.
  */
 static void
 xlog_cil_push_now(
 	struct xlog	*log,
-	xfs_lsn_t	push_seq)
+	xfs_lsn_t	push_seq,
+	bool		async)
 {
 	struct xfs_cil	*cil = log->l_cilp;
 
@@ -926,19 +1021,22 @@ xlog_cil_push_now(
 	ASSERT(push_seq && push_seq <= cil->xc_current_sequence);
 
 	/* start on any pending background push to minimise wait time on it */
-	flush_work(&cil->xc_push_work);
+	if (!async)
+		flush_work(&cil->xc_push_work);
 
 	/*
 	 * If the CIL is empty or we've already pushed the sequence then
 	 * there's no work we need to do.
 	 */
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) ||
+	    push_seq <= cil->xc_push_seq) {
 		spin_unlock(&cil->xc_push_lock);
 		return;
 	}
 
 	cil->xc_push_seq = push_seq;
+	cil->xc_push_async = async;
 	queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
 	spin_unlock(&cil->xc_push_lock);
 }
@@ -951,12 +1049,35 @@ xlog_cil_empty(
 	bool		empty = false;
 
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil))
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		empty = true;
 	spin_unlock(&cil->xc_push_lock);
 	return empty;
 }
 
+/*
+ * Start a push of the current CIL context without waiting for it, e.g. because
+ * the AIL has run into pinned items. If the CIL is empty, the previous
+ * checkpoint may still be sitting in an iclog that has not been written, so
+ * kick that out instead.
+ */
+void
+xlog_cil_flush(
+	struct xlog	*log)
+{
+	struct xfs_cil	*cil = log->l_cilp;
+	xfs_lsn_t	seq;
+
+	spin_lock(&cil->xc_push_lock);
+	seq = cil->xc_current_sequence;
+	spin_unlock(&cil->xc_push_lock);
+
+	xlog_cil_push_now(log, seq, true);
+
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
+		xfs_log_force(log->l_mp, 0);
+}
+
 /*
  * Commit a transaction with the given vector to the Committed Item List.
  *
@@ -1046,7 +1167,7 @@ xlog_cil_force_lsn(
 	 * so no need to deal with it here.
 	 */
 restart:
-	xlog_cil_push_now(log, sequence);
+	xlog_cil_push_now(log, sequence, false);
 
 	/*
 	 * See if we can find a previous sequence still committing.
@@ -1095,7 +1216,7 @@ restart:
 	 * we would have found the context on the committing list.
 	 */
 	if (sequence == cil->xc_current_sequence &&
-	    !list_empty(&cil->xc_cil)) {
+	    !test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		spin_unlock(&cil->xc_push_lock);
 		goto restart;
 	}
@@ -1154,21 +1275,29 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	struct xlog_cil_pcp *cilpcp;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
 	if (!cil)
 		return -ENOMEM;
 
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp)
+		goto out_free_cil;
+
 	ctx = kmem_zalloc(sizeof(*ctx), KM_SLEEP|KM_MAYFAIL);
-	if (!ctx) {
-		kmem_free(cil);
-		return -ENOMEM;
+	if (!ctx)
+		goto out_free_pcp;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+		INIT_LIST_HEAD(&cilpcp->busy_extents);
+		INIT_LIST_HEAD(&cilpcp->log_items);
 	}
 
 	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
-	INIT_LIST_HEAD(&cil->xc_cil);
 	INIT_LIST_HEAD(&cil->xc_committing);
-	spin_lock_init(&cil->xc_cil_lock);
 	spin_lock_init(&cil->xc_push_lock);
 	init_rwsem(&cil->xc_ctx_lock);
 	init_waitqueue_head(&cil->xc_commit_wait);
@@ -1179,10 +1308,17 @@ xlog_cil_init(
 	ctx->cil = cil;
 	cil->xc_ctx = ctx;
 	cil->xc_current_sequence = ctx->sequence;
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 
 	cil->xc_log = log;
 	log->l_cilp = cil;
 	return 0;
+
+out_free_pcp:
+	free_percpu(cil->xc_pcp);
+out_free_cil:
+	kmem_free(cil);
+	return -ENOMEM;
 }
 
 void
@@ -1195,7 +1331,8 @@ xlog_cil_destroy(
 		kmem_free(log->l_cilp->xc_ctx);
 	}
 
-	ASSERT(list_empty(&log->l_cilp->xc_cil));
+	ASSERT(test_bit(XLOG_CIL_EMPTY, &log->l_cilp->xc_flags));
+	free_percpu(log->l_cilp->xc_pcp);
 	kmem_free(log->l_cilp);
 }
 
@@ -239,8 +239,8 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		start_lsn;	/* first LSN of chkpt commit */
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
-	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* last item order id handed out */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
@@ -248,6 +248,27 @@ struct xfs_cil_ctx {
 	struct work_struct	discard_endio_work;
 };
 
+/*
+ * Per-cpu part of the CIL.
+ *
+ * Transaction commits only modify the state of the cpu they run on, under the
+ * CIL context lock held shared. The push folds all of it into the context
+ * being checkpointed while it holds the context lock exclusively.
+ *
+ * space_used is the part of the space used by this cpu that has not been
+ * folded into ctx->space_used yet, space_acct all the space used by this cpu
+ * in the current context; the latter determines when another iclog header
+ * has to be reserved. split_res is the iclog header reservation that has been
+ * taken from transactions and still has to be added to the context ticket.
+ */
+struct xlog_cil_pcp {
+	int			space_used;
+	int			space_acct;
+	int			split_res;
+	struct list_head	busy_extents;
+	struct list_head	log_items;
+};
+
 /*
  * Committed Item List structure
  *
@@ -266,20 +287,24 @@ struct xfs_cil_ctx {
  */
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	unsigned long		xc_flags;
+	struct xlog_cil_pcp __percpu *xc_pcp;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
 
 	spinlock_t		xc_push_lock ____cacheline_aligned_in_smp;
 	xfs_lsn_t		xc_push_seq;
+	bool			xc_push_async;
 	struct list_head	xc_committing;
 	wait_queue_head_t	xc_commit_wait;
 	xfs_lsn_t		xc_current_sequence;
 	struct work_struct	xc_push_work;
 } ____cacheline_aligned_in_smp;
 
+/* xc_flags bit values */
+#define	XLOG_CIL_EMPTY		0	/* no items in the current context */
+
 /*
  * The amount of log space we allow the CIL to aggregate is difficult to size.
  * Whatever we choose, we have to make sure we can get a reservation for the
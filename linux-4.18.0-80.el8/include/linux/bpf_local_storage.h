@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * BPF local storage: per-object map values that hang off the object they
+ * belong to (a socket, a task) instead of living in the map.
+ *
+ * Every owner object has at most one struct bpf_local_storage, a short list
+ * of elements, one per map, and a small cache indexed by the map's
+ * cache_idx so that the common case takes no list walk at all. The map only
+ * keeps its elements on bucket lists so that it can free them when it goes
+ * away; lookups never touch the map. Owners free their storage when they
+ * die.
+ */
+#ifndef _BPF_LOCAL_STORAGE_H
+#define _BPF_LOCAL_STORAGE_H
+
+#include <linux/bpf.h>
+#include <linux/rculist.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/types.h>
+
+#define BPF_LOCAL_STORAGE_CACHE_SIZE	16
+
+struct bpf_local_storage_map_bucket {
+	struct hlist_head list;
+	raw_spinlock_t lock;
+};
+
+struct bpf_local_storage_map {
+	struct bpf_map map;
+	/* elements of all owners, only walked when the map is freed */
+	struct bpf_local_storage_map_bucket *buckets;
+	u32 bucket_log;
+	u16 elem_size;
+	u16 cache_idx;
+};
+
+struct bpf_local_storage_data {
+	/* the key an owner's storage is searched by, next to the data so
+	 * that a cache hit touches a single cacheline
+	 */
+	struct bpf_local_storage_map __rcu *smap;
+	u8 data[0] __aligned(8);
+};
+
+/* Linked to both the owner's bpf_local_storage and the map */
+struct bpf_local_storage_elem {
+	struct hlist_node map_node;	/* linked to bpf_local_storage_map */
+	struct hlist_node snode;	/* linked to bpf_local_storage */
+	struct bpf_local_storage __rcu *local_storage;
+	struct rcu_head rcu;
+	struct bpf_local_storage_data sdata ____cacheline_aligned;
+};
+
+struct bpf_local_storage {
+	struct bpf_local_storage_data __rcu *cache[BPF_LOCAL_STORAGE_CACHE_SIZE];
+	struct hlist_head list;		/* of bpf_local_storage_elem */
+	void *owner;			/* NULL once the list became empty */
+	struct rcu_head rcu;
+	raw_spinlock_t lock;		/* protects list and cache updates */
+};
+
+/* U16_MAX is much more than enough for sk and task local storage,
+ * bpf_local_storage_elem has to fit into a kmalloc()ed block as well.
+ */
+#define BPF_LOCAL_STORAGE_MAX_VALUE_SIZE				      \
+	min_t(u32,							      \
+	      (KMALLOC_MAX_SIZE - MAX_BPF_STACK -			      \
+	       sizeof(struct bpf_local_storage_elem)),			      \
+	      (U16_MAX - sizeof(struct bpf_local_storage_elem)))
+
+#define SELEM(_SDATA)							      \
+	container_of((_SDATA), struct bpf_local_storage_elem, sdata)
+#define SDATA(_SELEM) (&(_SELEM)->sdata)
+
+/* Hands out the cache slots of an owner type's maps, least used first. */
+struct bpf_local_storage_cache {
+	spinlock_t idx_lock;
+	u64 idx_usage_counts[BPF_LOCAL_STORAGE_CACHE_SIZE];
+};
+
+#define DEFINE_BPF_STORAGE_CACHE(name)					      \
+static struct bpf_local_storage_cache name = {				      \
+	.idx_lock = __SPIN_LOCK_UNLOCKED(name.idx_lock),		      \
+}
+
+u16 bpf_local_storage_cache_idx_get(struct bpf_local_storage_cache *cache);
+void bpf_local_storage_cache_idx_free(struct bpf_local_storage_cache *cache,
+				      u16 idx);
+
+int bpf_local_storage_map_alloc_check(union bpf_attr *attr);
+struct bpf_local_storage_map *
+bpf_local_storage_map_alloc(union bpf_attr *attr);
+void bpf_local_storage_map_free(struct bpf_local_storage_map *smap,
+				int __percpu *busy_counter);
+
+struct bpf_local_storage_data *
+bpf_local_storage_lookup(struct bpf_local_storage *local_storage,
+			 struct bpf_local_storage_map *smap,
+			 bool cacheit_lockit);
+struct bpf_local_storage_data *
+bpf_local_storage_update(void *owner, struct bpf_local_storage_map *smap,
+			 void *value, u64 map_flags);
+void bpf_selem_unlink(struct bpf_local_storage_elem *selem);
+void bpf_local_storage_destroy(struct bpf_local_storage *local_storage);
+
+int bpf_local_storage_map_get_next_key(struct bpf_map *map, void *key,
+				       void *next_key);
+
+#endif /* _BPF_LOCAL_STORAGE_H */
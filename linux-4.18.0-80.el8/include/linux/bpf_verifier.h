@@ -52,6 +52,9 @@ struct bpf_reg_state {
 		 */
 		struct bpf_map *map_ptr;
 
+		/* valid when type == PTR_TO_MEM | PTR_TO_MEM_OR_NULL */
+		u32 mem_size;
+
 		/* Max size from any of the above. */
 		unsigned long raw;
 	};
@@ -63,6 +66,12 @@ struct bpf_reg_state {
 	 * came from, when one is tested for != NULL.
 	 */
 	u32 id;
+	/* Non-zero when the register holds a reference that was handed out by
+	 * a helper and must be given back before the program exits, e.g. a
+	 * ring buffer record from bpf_ringbuf_reserve().  All copies of the
+	 * pointer share it, so releasing one of them invalidates the others.
+	 */
+	u32 ref_obj_id;
 	/* For scalar types (SCALAR_VALUE), this represents our knowledge of
 	 * the actual value.
 	 * For pointer types, this represents the variable part of the offset
@@ -89,6 +98,11 @@ struct bpf_reg_state {
 	 */
 	u32 frameno;
 	enum bpf_reg_liveness live;
+	/* For scalars: the exact value (or range) of this register was used
+	 * to prove the program safe, e.g. as a map value offset or to decide
+	 * a branch.  Imprecise scalars may be anything when comparing states.
+	 */
+	bool precise;
 };
 
 enum bpf_stack_slot_type {
@@ -127,18 +141,59 @@ struct bpf_func_state {
 	struct bpf_stack_state *stack;
 };
 
+struct bpf_reference_state {
+	/* Track each reference created with a unique id, even if the same
+	 * instruction creates the reference multiple times (eg, via CALL).
+	 */
+	int id;
+	/* Instruction where the allocation of this reference occurred. This
+	 * is used purely to inform the user of a reference leak.
+	 */
+	int insn_idx;
+};
+
+struct bpf_idx_pair {
+	u32 prev_idx;
+	u32 idx;
+};
+
 #define MAX_CALL_FRAMES 8
 struct bpf_verifier_state {
 	/* call stack tracking */
 	struct bpf_func_state *frame[MAX_CALL_FRAMES];
+	/* explored state this one was derived from, NULL for the first one */
+	struct bpf_verifier_state *parent;
+	/* Number of paths that descend from this state and are still being
+	 * explored, including the state itself while it is current.  States
+	 * with branches > 0 are (part of) a loop that is still being walked,
+	 * so they must not be used to prune other paths yet.
+	 */
+	u32 branches;
 	u32 curframe;
 	bool speculative;
+	/* references acquired by helpers and not yet released; they belong
+	 * to the program as a whole rather than to any one call frame
+	 */
+	u32 acquired_refs;
+	struct bpf_reference_state *refs;
+	/* id of the map value pointer whose bpf_spin_lock is held, 0 if none */
+	u32 active_spin_lock;
+
+	/* first and last insn idx of the straight-line code walked since
+	 * the parent state, and the jumps taken in between.  Used to walk
+	 * the instructions backwards when marking scalars precise.
+	 */
+	u32 first_insn_idx;
+	u32 last_insn_idx;
+	struct bpf_idx_pair *jmp_history;
+	u32 jmp_history_cnt;
 };
 
 /* linked list of verifier states used to prune search */
 struct bpf_verifier_state_list {
 	struct bpf_verifier_state state;
 	struct bpf_verifier_state_list *next;
+	int miss_cnt, hit_cnt;
 };
 
 /* Possible states for alu_state member. */
@@ -204,6 +259,7 @@ struct bpf_verifier_env {
 	bool strict_alignment;		/* perform strict pointer alignment checks */
 	struct bpf_verifier_state *cur_state; /* current verifier state */
 	struct bpf_verifier_state_list **explored_states; /* search pruning optimization */
+	struct bpf_verifier_state_list *free_list; /* evicted, but maybe still a parent */
 	struct bpf_map *used_maps[MAX_USED_MAPS]; /* array of map's used by eBPF program */
 	u32 used_map_cnt;		/* number of used maps */
 	u32 id_gen;			/* used to generate unique reg IDs */
@@ -213,6 +269,21 @@ struct bpf_verifier_env {
 	struct bpf_verifier_log log;
 	struct bpf_subprog_info subprog_info[BPF_MAX_SUBPROGS + 1];
 	u32 subprog_cnt;
+	/* number of instructions analyzed by the verifier */
+	u32 insn_processed;
+	/* and jumps among them */
+	u32 jmps_processed;
+	/* both of the above when the last state was added to explored_states */
+	u32 prev_insn_processed, prev_jmps_processed;
+	/* maximum number of verifier states kept in 'branching' instructions */
+	u32 max_states_per_insn;
+	/* total number of allocated verifier states */
+	u32 total_states;
+	/* some states are freed during program analysis, these are the ones
+	 * still allocated and the peak of that number, which dominates kernel
+	 * memory consumption during verification
+	 */
+	u32 cur_states, peak_states;
 };
 
 __printf(2, 0) void bpf_verifier_vlog(struct bpf_verifier_log *log,
@@ -8,6 +8,8 @@
 
 struct btf;
 struct btf_type;
+struct btf_func_model;
+struct bpf_verifier_env;
 union bpf_attr;
 
 extern const struct file_operations btf_fops;
@@ -44,6 +46,14 @@ const struct btf_type *btf_type_id_size(const struct btf *btf,
 					u32 *ret_size);
 void btf_type_seq_show(const struct btf *btf, u32 type_id, void *obj,
 		       struct seq_file *m);
+int btf_find_spin_lock(const struct btf *btf, const struct btf_type *t);
+/* Fill @m with the argument and return value sizes of the BTF_KIND_FUNC
+ * @func_id and set @func_name to its name.  Fails, with the reason in
+ * the verifier log, if they don't all fit in registers.
+ */
+int btf_distill_func_proto(struct bpf_verifier_env *env,
+			   const struct btf *btf, u32 func_id,
+			   const char **func_name, struct btf_func_model *m);
 int btf_get_fd_by_id(u32 id);
 u32 btf_id(const struct btf *btf);
 
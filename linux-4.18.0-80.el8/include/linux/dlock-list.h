@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Distributed and locked list
+ *
+ * A dlock-list is a set of per-cpu lists, each protected by its own
+ * spinlock.  Insertion always goes to the list of the local cpu, so
+ * concurrent adds from different cpus never touch the same lock or
+ * cacheline.  Deletion goes to whichever list the node was put on, which
+ * is recorded in the node itself.  Walking the whole set visits the
+ * per-cpu lists one after the other with only that list's lock held.
+ *
+ * It is meant for big object lists that are modified all the time but
+ * only walked rarely (e.g. the inodes of a superblock).  There is no
+ * ordering between entries on different per-cpu lists.
+ */
+#ifndef __LINUX_DLOCK_LIST_H
+#define __LINUX_DLOCK_LIST_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+
+/*
+ * One of the per-cpu lists.  Kept on its own cacheline so that the lock
+ * of one cpu does not bounce with its neighbours.
+ */
+struct dlock_list_head {
+	struct list_head list;
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp;
+
+struct dlock_list_heads {
+	struct dlock_list_head *heads;
+};
+
+/*
+ * The list node embedded in the objects; @head points to the per-cpu list
+ * the node is on, NULL when it is not on any list.
+ */
+struct dlock_list_node {
+	struct list_head list;
+	struct dlock_list_head *head;
+};
+
+/*
+ * Iteration state.  @entry is the per-cpu list currently being walked,
+ * its lock is held for the duration of the loop body.
+ */
+struct dlock_list_iter {
+	int index;
+	struct dlock_list_head *head, *entry;
+};
+
+#define DLOCK_LIST_ITER_INIT(dlist)		\
+	{					\
+		.index = -1,			\
+		.head = (dlist)->heads,		\
+	}
+
+#define DEFINE_DLOCK_LIST_ITER(s, heads)	\
+	struct dlock_list_iter s = DLOCK_LIST_ITER_INIT(heads)
+
+static inline void init_dlock_list_iter(struct dlock_list_iter *iter,
+					struct dlock_list_heads *heads)
+{
+	*iter = (struct dlock_list_iter)DLOCK_LIST_ITER_INIT(heads);
+}
+
+static inline void init_dlock_list_node(struct dlock_list_node *node)
+{
+	INIT_LIST_HEAD(&node->list);
+	node->head = NULL;
+}
+
+/*
+ * The lock of the list being walked may be dropped inside the loop body
+ * to do something that sleeps.  The caller must make sure that the
+ * current entry stays on the list (e.g. by holding a reference to it) and
+ * retake the lock before going on with the walk.  Breaking out of the
+ * loop leaves the lock held, it has to be dropped with dlock_list_unlock().
+ */
+static inline void dlock_list_unlock(struct dlock_list_iter *iter)
+{
+	spin_unlock(&iter->entry->lock);
+}
+
+static inline void dlock_list_relock(struct dlock_list_iter *iter)
+{
+	spin_lock(&iter->entry->lock);
+}
+
+extern int __alloc_dlock_list_heads(struct dlock_list_heads *dlist,
+				    struct lock_class_key *key);
+extern void free_dlock_list_heads(struct dlock_list_heads *dlist);
+
+/*
+ * One lock class per allocation site, so that lists of different kinds
+ * can nest without lockdep complaining.
+ */
+#define alloc_dlock_list_heads(dlist)					\
+({									\
+	static struct lock_class_key _key;				\
+	__alloc_dlock_list_heads(dlist, &_key);				\
+})
+
+extern bool dlock_lists_empty(struct dlock_list_heads *dlist);
+extern void dlock_lists_add(struct dlock_list_node *node,
+			    struct dlock_list_heads *dlist);
+extern void dlock_lists_del(struct dlock_list_node *node);
+
+extern struct dlock_list_node *
+__dlock_list_next_list(struct dlock_list_iter *iter);
+
+/**
+ * __dlock_list_next_entry - iterate to the next entry of the dlock lists
+ * @curr: the current entry, NULL to start the walk
+ * @iter: the dlock list iterator
+ *
+ * Return the next entry or NULL once all the lists have been walked.
+ */
+static inline struct dlock_list_node *
+__dlock_list_next_entry(struct dlock_list_node *curr,
+			struct dlock_list_iter *iter)
+{
+	if (!curr || curr->list.next == &iter->entry->list)
+		return __dlock_list_next_list(iter);
+
+	return list_next_entry(curr, list);
+}
+
+#define dlock_list_first_entry(iter, type, member)			\
+({									\
+	struct dlock_list_node *_n;					\
+	_n = __dlock_list_next_entry(NULL, iter);			\
+	_n ? list_entry(_n, type, member) : NULL;			\
+})
+
+#define dlock_list_next_entry(pos, iter, member)			\
+({									\
+	struct dlock_list_node *_n;					\
+	_n = __dlock_list_next_entry(&(pos)->member, iter);		\
+	_n ? list_entry(_n, typeof(*(pos)), member) : NULL;		\
+})
+
+/**
+ * dlist_for_each_entry - iterate over all the entries of a dlock list set
+ * @pos:    the type * to use as a loop cursor
+ * @iter:   the dlock list iterator
+ * @member: the name of the dlock_list_node within the struct
+ *
+ * The current entry must not be deleted inside the loop body.  Entries
+ * added or deleted concurrently on lists other than the one being walked
+ * may or may not be seen.
+ */
+#define dlist_for_each_entry(pos, iter, member)				\
+	for (pos = dlock_list_first_entry(iter, typeof(*(pos)), member);\
+	     pos != NULL;						\
+	     pos = dlock_list_next_entry(pos, iter, member))
+
+#endif /* __LINUX_DLOCK_LIST_H */
@@ -16,9 +16,26 @@
 #define __IF_TUN_H
 
 #include <uapi/linux/if_tun.h>
+#include <uapi/linux/virtio_net.h>
 
 #define TUN_XDP_FLAG 0x1UL
 
+/* msg_control of sendmsg() on a tun or tap socket, from vhost-net */
+#define TUN_MSG_UBUF 1	/* ptr is the ubuf_info of a zerocopy packet */
+#define TUN_MSG_PTR  2	/* ptr is an array of num xdp_buffs, tun only */
+struct tun_msg_ctl {
+	unsigned short type;
+	unsigned short num;
+	void *ptr;
+};
+
+/* At data_hard_start of each xdp_buff of a TUN_MSG_PTR batch. The
+ * buffer holds one page reference, which tun takes over. */
+struct tun_xdp_hdr {
+	int buflen;
+	struct virtio_net_hdr gso;
+};
+
 #if defined(CONFIG_TUN) || defined(CONFIG_TUN_MODULE)
 struct socket *tun_get_socket(struct file *);
 struct ptr_ring *tun_get_tx_ring(struct file *file);
@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KVM_DIRTY_RING_H
+#define KVM_DIRTY_RING_H
+
+#include <linux/kvm.h>
+#include <linux/kvm_types.h>
+
+/*
+ * Ring of the pages dirtied by one vcpu, see KVM_CAP_DIRTY_LOG_RING.
+ *
+ * dirty_index:  next entry KVM pushes a page to
+ * reset_index:  next entry to be reset by KVM_RESET_DIRTY_RINGS
+ * size:         number of entries, a power of 2
+ * soft_limit:   number of used entries at which the vcpu exits to userspace,
+ *               leaving room for the pages it may still dirty before that
+ */
+struct kvm_dirty_ring {
+	u32 dirty_index;
+	u32 reset_index;
+	u32 size;
+	u32 soft_limit;
+	struct kvm_dirty_gfn *dirty_gfns;
+	int index;
+};
+
+/*
+ * Entries kept free past the soft limit: a vcpu may dirty a few pages
+ * between noticing the ring is full and exiting, plus whatever the CPU
+ * logged on its own (see kvm_cpu_dirty_log_size()).
+ */
+#define KVM_DIRTY_RING_RSVD_ENTRIES	64
+
+/* 64K entries, 1MB of ring per vcpu */
+#define KVM_DIRTY_RING_MAX_ENTRIES	65536
+
+#ifndef CONFIG_HAVE_KVM_DIRTY_RING
+
+static inline u32 kvm_dirty_ring_get_rsvd_entries(void)
+{
+	return 0;
+}
+
+static inline int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring,
+				       int index, u32 size)
+{
+	return 0;
+}
+
+static inline struct kvm_dirty_ring *kvm_dirty_ring_get(struct kvm *kvm)
+{
+	return NULL;
+}
+
+static inline int kvm_dirty_ring_reset(struct kvm *kvm,
+				       struct kvm_dirty_ring *ring)
+{
+	return 0;
+}
+
+static inline void kvm_dirty_ring_push(struct kvm_dirty_ring *ring,
+				       u32 slot, u64 offset)
+{
+}
+
+static inline struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+						   u32 offset)
+{
+	return NULL;
+}
+
+static inline void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+}
+
+static inline bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return false;
+}
+
+#else /* CONFIG_HAVE_KVM_DIRTY_RING */
+
+int kvm_cpu_dirty_log_size(void);
+u32 kvm_dirty_ring_get_rsvd_entries(void);
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, int index, u32 size);
+struct kvm_dirty_ring *kvm_dirty_ring_get(struct kvm *kvm);
+
+/*
+ * Called with kvm->slots_lock held, returns the number of entries
+ * that have been reset.
+ */
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring);
+
+/* Only the vcpu owning the ring pushes to it */
+void kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset);
+
+/* For mmap of the ring by userspace, offset in pages */
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset);
+
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring);
+bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring);
+
+#endif /* CONFIG_HAVE_KVM_DIRTY_RING */
+
+#endif /* KVM_DIRTY_RING_H */
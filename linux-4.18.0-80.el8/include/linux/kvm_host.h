@@ -34,6 +34,7 @@
 #include <linux/kvm_para.h>
 
 #include <linux/kvm_types.h>
+#include <linux/kvm_dirty_ring.h>
 
 #include <asm/kvm_host.h>
 
@@ -215,6 +216,26 @@ struct kvm_mmio_fragment {
 	unsigned len;
 };
 
+/*
+ * Recent valid wakeups of a halted vCPU, by how long it was blocked.
+ * Bucket i counts blocks shorter than 2^(KVM_HALT_POLL_HIST_SHIFT + i) ns,
+ * and longer than half that, the last one all longer blocks. The weights
+ * are halved every KVM_HALT_POLL_HIST_DECAY wakeups, so that the poll
+ * window follows changes of the guest workload.
+ */
+#define KVM_HALT_POLL_HIST_SHIFT	10
+#define KVM_HALT_POLL_HIST_BUCKETS	16
+#define KVM_HALT_POLL_HIST_DECAY	64
+
+struct kvm_halt_poll_stat {
+	u32 hist[KVM_HALT_POLL_HIST_BUCKETS];
+	u32 samples;		/* sum of hist[] */
+	u32 since_decay;
+	u64 success_ns;		/* polled until woken */
+	u64 fail_ns;		/* polled in vain, then slept */
+	u64 wait_ns;		/* slept */
+};
+
 struct kvm_vcpu {
 	struct kvm *kvm;
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -240,6 +261,7 @@ struct kvm_vcpu {
 	sigset_t sigset;
 	struct kvm_vcpu_stat stat;
 	unsigned int halt_poll_ns;
+	struct kvm_halt_poll_stat halt_poll_stat;
 	bool valid_wakeup;
 
 #ifdef CONFIG_HAS_IOMEM
@@ -275,6 +297,7 @@ struct kvm_vcpu {
 	bool preempted;
 	struct kvm_vcpu_arch arch;
 	struct dentry *debugfs_dentry;
+	struct kvm_dirty_ring dirty_ring;
 };
 
 static inline int kvm_vcpu_exiting_guest_mode(struct kvm_vcpu *vcpu)
@@ -302,6 +325,7 @@ struct kvm_memory_slot {
 	unsigned long userspace_addr;
 	u32 flags;
 	short id;
+	u16 as_id;
 };
 
 static inline unsigned long kvm_dirty_bitmap_bytes(struct kvm_memory_slot *memslot)
@@ -454,6 +478,12 @@ struct kvm {
 	struct srcu_struct srcu;
 	struct srcu_struct irq_srcu;
 	pid_t userspace_pid;
+	/* Bounds of halt polling set with KVM_CAP_HALT_POLL */
+	bool override_halt_poll_ns;
+	unsigned int min_halt_poll_ns;
+	unsigned int max_halt_poll_ns;
+	/* Size in bytes of the dirty ring of each vcpu, 0 if not in use */
+	u32 dirty_ring_size;
 };
 
 #define kvm_err(fmt, ...) \
@@ -543,6 +573,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu);
 
 void vcpu_load(struct kvm_vcpu *vcpu);
 void vcpu_put(struct kvm_vcpu *vcpu);
+struct kvm_vcpu *kvm_get_running_vcpu(void);
 
 #ifdef __KVM_HAVE_IOAPIC
 void kvm_arch_post_irq_ack_notifier_list_update(struct kvm *kvm);
@@ -117,6 +117,17 @@ static inline void hlist_bl_del_init(struct hlist_bl_node *n)
 	}
 }
 
+/* after that we'll appear to be on some hlist_bl and hlist_bl_del will work */
+static inline void hlist_bl_add_fake(struct hlist_bl_node *n)
+{
+	n->pprev = &n->next;
+}
+
+static inline bool hlist_bl_fake(struct hlist_bl_node *n)
+{
+	return n->pprev == &n->next;
+}
+
 static inline void hlist_bl_lock(struct hlist_bl_head *b)
 {
 	bit_spin_lock(0, (unsigned long *)b);
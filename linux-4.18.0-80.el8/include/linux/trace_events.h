@@ -332,6 +332,7 @@ enum {
 	EVENT_FILE_FL_TRIGGER_COND_BIT,
 	EVENT_FILE_FL_PID_FILTER_BIT,
 	EVENT_FILE_FL_WAS_ENABLED_BIT,
+	EVENT_FILE_FL_NO_OVERWRITE_BIT,
 };
 
 /*
@@ -348,6 +349,8 @@ enum {
  *  TRIGGER_COND  - When set, one or more triggers has an associated filter
  *  PID_FILTER    - When set, the event is filtered based on pid
  *  WAS_ENABLED   - Set when enabled to know to clear trace on module removal
+ *  NO_OVERWRITE  - When set, the event is dropped when the buffer is full
+ *                   instead of overwriting older events
  */
 enum {
 	EVENT_FILE_FL_ENABLED		= (1 << EVENT_FILE_FL_ENABLED_BIT),
@@ -361,6 +364,7 @@ enum {
 	EVENT_FILE_FL_TRIGGER_COND	= (1 << EVENT_FILE_FL_TRIGGER_COND_BIT),
 	EVENT_FILE_FL_PID_FILTER	= (1 << EVENT_FILE_FL_PID_FILTER_BIT),
 	EVENT_FILE_FL_WAS_ENABLED	= (1 << EVENT_FILE_FL_WAS_ENABLED_BIT),
+	EVENT_FILE_FL_NO_OVERWRITE	= (1 << EVENT_FILE_FL_NO_OVERWRITE_BIT),
 };
 
 struct trace_event_file {
@@ -391,6 +395,7 @@ struct trace_event_file {
 	unsigned long		flags;
 	atomic_t		sm_ref;	/* soft-mode reference counter */
 	atomic_t		tm_ref;	/* trigger-mode reference counter */
+	atomic_long_t		lost;	/* events the buffer had no room for */
 };
 
 #define __TRACE_EVENT_FLAGS(name, value)				\
@@ -426,6 +431,7 @@ enum event_trigger_type {
 	ETT_EVENT_ENABLE	= (1 << 3),
 	ETT_EVENT_HIST		= (1 << 4),
 	ETT_HIST_ENABLE		= (1 << 5),
+	ETT_EVENT_LATENCY	= (1 << 6),
 };
 
 extern int filter_match_preds(struct event_filter *filter, void *rec);
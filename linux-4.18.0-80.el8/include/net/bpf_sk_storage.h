@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BPF_SK_STORAGE_H
+#define _BPF_SK_STORAGE_H
+
+struct sock;
+
+#ifdef CONFIG_BPF_SYSCALL
+void bpf_sk_storage_free(struct sock *sk);
+
+extern const struct bpf_func_proto bpf_sk_storage_get_proto;
+extern const struct bpf_func_proto bpf_sk_storage_delete_proto;
+extern const struct bpf_func_proto bpf_sock_ops_sk_storage_get_proto;
+extern const struct bpf_func_proto bpf_sock_ops_sk_storage_delete_proto;
+extern const struct bpf_func_proto bpf_sock_sk_storage_get_proto;
+extern const struct bpf_func_proto bpf_sock_sk_storage_delete_proto;
+#else
+static inline void bpf_sk_storage_free(struct sock *sk)
+{
+}
+#endif
+
+#endif /* _BPF_SK_STORAGE_H */
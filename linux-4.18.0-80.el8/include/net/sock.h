@@ -320,6 +320,7 @@ struct sock_common {
   *	@sk_backlog_rcv: callback to process the backlog
   *	@sk_destruct: called at sock freeing time, i.e. when all refcnt == 0
   *	@sk_reuseport_cb: reuseport group container
+  *	@sk_bpf_storage: ptr to cache and control for bpf_sk_storage
   *	@sk_rcu: used during RCU grace period
   *	@sk_clockid: clockid used by time-based scheduling (SO_TXTIME)
   *	@sk_txtime_deadline_mode: set deadline mode for SO_TXTIME
@@ -506,6 +507,9 @@ struct sock {
 #endif
 	void                    (*sk_destruct)(struct sock *sk);
 	RH_KABI_EXCLUDE(struct sock_reuseport __rcu	*sk_reuseport_cb)
+#ifdef CONFIG_BPF_SYSCALL
+	RH_KABI_EXCLUDE(struct bpf_local_storage __rcu	*sk_bpf_storage)
+#endif
 	struct rcu_head		sk_rcu;
 
 	RH_KABI_RESERVE(1)
@@ -819,6 +823,7 @@ enum sock_flags {
 	SOCK_SELECT_ERR_QUEUE, /* Wake select on error queue */
 	SOCK_RCU_FREE, /* wait rcu grace period in sk_destruct() */
 	SOCK_TXTIME,
+	SOCK_XDP, /* sendmsg() takes batches of XDP buffers, see tun_msg_ctl */
 };
 
 #define SK_FLAGS_TIMESTAMP ((1UL << SOCK_TIMESTAMP) | (1UL << SOCK_TIMESTAMPING_RX_SOFTWARE))
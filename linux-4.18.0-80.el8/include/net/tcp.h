@@ -1778,6 +1778,9 @@ struct tcp_iter_state {
 	struct sock		*syn_wait_sk;
 	int			bucket, offset, sbucket, num;
 	loff_t			last_pos;
+#ifdef CONFIG_BPF_SYSCALL
+	struct tcp_seq_afinfo	*bpf_seq_afinfo;
+#endif
 };
 
 extern struct request_sock_ops tcp_request_sock_ops;
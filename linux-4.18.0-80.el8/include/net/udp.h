@@ -426,6 +426,9 @@ struct udp_seq_afinfo {
 struct udp_iter_state {
 	struct seq_net_private  p;
 	int			bucket;
+#ifdef CONFIG_BPF_SYSCALL
+	struct udp_seq_afinfo	*bpf_seq_afinfo;
+#endif
 };
 
 void *udp_seq_start(struct seq_file *seq, loff_t *pos);
@@ -98,6 +98,18 @@ enum bpf_cmd {
 	BPF_BTF_LOAD,
 	BPF_BTF_GET_FD_BY_ID,
 	BPF_TASK_FD_QUERY,
+	/* Commands added to this kernel take their mainline values, those
+	 * of mainline commands it does not have are left unused.
+	 */
+	BPF_MAP_FREEZE = 22,
+	BPF_MAP_LOOKUP_BATCH = 24,
+	BPF_MAP_LOOKUP_AND_DELETE_BATCH,
+	BPF_MAP_UPDATE_BATCH,
+	BPF_MAP_DELETE_BATCH,
+	/* Commands only this kernel has are numbered from 256, well clear
+	 * of mainline's.
+	 */
+	BPF_PROG_ITER_CREATE = 256,
 };
 
 enum bpf_map_type {
@@ -120,6 +132,15 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_CPUMAP,
 	BPF_MAP_TYPE_XSKMAP,
 	BPF_MAP_TYPE_SOCKHASH,
+	/* Map types added to this kernel take their mainline values, those
+	 * of mainline map types it does not have are left unused.
+	 */
+	BPF_MAP_TYPE_SK_STORAGE = 24,
+	BPF_MAP_TYPE_RINGBUF = 27,
+	/* Map types only this kernel has are numbered from 256, well clear
+	 * of mainline's.
+	 */
+	BPF_MAP_TYPE_PID_TASK_STORAGE = 256,
 };
 
 enum bpf_prog_type {
@@ -144,6 +165,10 @@ enum bpf_prog_type {
 	BPF_PROG_TYPE_CGROUP_SOCK_ADDR,
 	BPF_PROG_TYPE_LWT_SEG6LOCAL,
 	BPF_PROG_TYPE_LIRC_MODE2,
+	/* Program types added to this kernel take their mainline values,
+	 * those of mainline program types it does not have are left unused.
+	 */
+	BPF_PROG_TYPE_TRACING = 26,
 };
 
 enum bpf_attach_type {
@@ -164,6 +189,12 @@ enum bpf_attach_type {
 	BPF_CGROUP_UDP4_SENDMSG,
 	BPF_CGROUP_UDP6_SENDMSG,
 	BPF_LIRC_MODE2,
+	/* Attach types added to this kernel take their mainline values,
+	 * those of mainline attach types it does not have are left unused.
+	 */
+	BPF_TRACE_FENTRY = 24,
+	BPF_TRACE_FEXIT,
+	BPF_TRACE_ITER = 28,
 	__MAX_BPF_ATTACH_TYPE
 };
 
@@ -230,6 +261,7 @@ enum bpf_attach_type {
 #define BPF_ANY		0 /* create new element or update existing */
 #define BPF_NOEXIST	1 /* create new element if it didn't exist */
 #define BPF_EXIST	2 /* update existing element */
+#define BPF_F_LOCK	4 /* spin_lock-ed map_lookup/map_update */
 
 /* flags for BPF_MAP_CREATE command */
 #define BPF_F_NO_PREALLOC	(1U << 0)
@@ -255,6 +287,12 @@ enum bpf_attach_type {
 /* Flag for stack_map, store build_id+offset instead of pointer */
 #define BPF_F_STACK_BUILD_ID	(1U << 5)
 
+/* Enable memory-mapping BPF map, BPF_MAP_TYPE_ARRAY only. The mapping
+ * starts with the value of element 0, values are laid out back to back,
+ * each rounded up to 8 bytes.
+ */
+#define BPF_F_MMAPABLE		(1U << 10)
+
 enum bpf_stack_build_id_status {
 	/* user space need an empty entry to identify end of a trace */
 	BPF_STACK_BUILD_ID_EMPTY = 0,
@@ -304,6 +342,23 @@ union bpf_attr {
 		__u64		flags;
 	};
 
+	struct { /* struct used by BPF_MAP_*_BATCH commands */
+		__aligned_u64	in_batch;	/* start batch,
+						 * NULL to start from beginning
+						 */
+		__aligned_u64	out_batch;	/* output: next start batch */
+		__aligned_u64	keys;
+		__aligned_u64	values;
+		__u32		count;		/* input/output:
+						 * input: # of key/value
+						 * elements
+						 * output: # of filled elements
+						 */
+		__u32		map_fd;
+		__u64		elem_flags;
+		__u64		flags;
+	} batch;
+
 	struct { /* anonymous struct used by BPF_PROG_LOAD command */
 		__u32		prog_type;	/* one of enum bpf_prog_type */
 		__u32		insn_cnt;
@@ -321,6 +376,22 @@ union bpf_attr {
 		 * (context accesses, allowed helpers, etc).
 		 */
 		__u32		expected_attach_type;
+		/* This kernel has no BTF func and line info: prog_btf_fd
+		 * and the *_info_cnt fields must be 0.
+		 */
+		__u32		prog_btf_fd;	/* fd pointing to BTF type data */
+		__u32		func_info_rec_size;	/* userspace bpf_func_info size */
+		__aligned_u64	func_info;	/* func info */
+		__u32		func_info_cnt;	/* number of bpf_func_info records */
+		__u32		line_info_rec_size;	/* userspace bpf_line_info size */
+		__aligned_u64	line_info;	/* line info */
+		__u32		line_info_cnt;	/* number of bpf_line_info records */
+		/* BPF_PROG_TYPE_TRACING programs attach to the
+		 * BTF_KIND_FUNC attach_btf_id of the BTF attach_btf_obj_fd.
+		 * There is no vmlinux BTF, so attach_btf_obj_fd is required.
+		 */
+		__u32		attach_btf_id;	/* BTF FUNC to attach to */
+		__u32		attach_btf_obj_fd; /* BTF object of attach_btf_id */
 	};
 
 	struct { /* anonymous struct used by BPF_OBJ_* commands */
@@ -374,7 +445,7 @@ union bpf_attr {
 	} query;
 
 	struct {
-		__u64 name;
+		__u64 name;	/* 0 to attach a BPF_PROG_TYPE_TRACING prog */
 		__u32 prog_fd;
 	} raw_tracepoint;
 
@@ -401,6 +472,14 @@ union bpf_attr {
 		__u64		probe_offset;	/* output: probe_offset */
 		__u64		probe_addr;	/* output: probe_addr */
 	} task_fd_query;
+
+	struct { /* struct used by BPF_PROG_ITER_CREATE command */
+		__u32		prog_fd;	/* BPF_TRACE_ITER program */
+		__u32		flags;
+		__u32		map_fd;		/* map to iterate, if the
+						 * target needs one
+						 */
+	} prog_iter_create;
 } __attribute__((aligned(8)));
 
 /* The description below is an attempt at providing documentation to eBPF
@@ -2077,96 +2156,286 @@ union bpf_attr {
  * 	Return
  * 		A 64-bit integer containing the current cgroup id based
  * 		on the cgroup within which the current task is running.
+ *
+ * int bpf_ringbuf_output(void *ringbuf, void *data, u64 size, u64 flags)
+ * 	Description
+ * 		Copy *size* bytes from *data* into a ring buffer *ringbuf*.
+ * 		If **BPF_RB_NO_WAKEUP** is specified in *flags*, no notification
+ * 		of new data availability is sent.
+ * 		If **BPF_RB_FORCE_WAKEUP** is specified in *flags*, notification
+ * 		of new data availability is sent unconditionally.
+ * 		Without either flag, the consumer is only woken up if it has
+ * 		caught up with the producers, i.e. if it may be waiting.
+ * 	Return
+ * 		0 on success, or a negative error in case of failure.
+ *
+ * void *bpf_ringbuf_reserve(void *ringbuf, u64 size, u64 flags)
+ * 	Description
+ * 		Reserve *size* bytes of payload in a ring buffer *ringbuf*.
+ * 		*size* must be a constant known to the verifier and *flags*
+ * 		must be 0. The record has to be passed to either
+ * 		**bpf_ringbuf_submit**\ () or **bpf_ringbuf_discard**\ ()
+ * 		on every path through the program.
+ * 	Return
+ * 		Valid pointer with *size* bytes of memory available; NULL,
+ * 		otherwise.
+ *
+ * void bpf_ringbuf_submit(void *data, u64 flags)
+ * 	Description
+ * 		Submit reserved ring buffer sample, pointed to by *data*.
+ * 		*flags* are the same as for **bpf_ringbuf_output**\ ().
+ * 	Return
+ * 		Nothing. Always succeeds.
+ *
+ * void bpf_ringbuf_discard(void *data, u64 flags)
+ * 	Description
+ * 		Discard reserved ring buffer sample, pointed to by *data*.
+ * 		The consumer skips it. *flags* are the same as for
+ * 		**bpf_ringbuf_output**\ ().
+ * 	Return
+ * 		Nothing. Always succeeds.
+ *
+ * u64 bpf_ringbuf_query(void *ringbuf, u64 flags)
+ * 	Description
+ * 		Query various characteristics of provided ring buffer. What
+ * 		exactly is queried is determined by *flags*:
+ *
+ * 		* **BPF_RB_AVAIL_DATA**: Amount of data not yet consumed.
+ * 		* **BPF_RB_RING_SIZE**: The size of ring buffer.
+ * 		* **BPF_RB_CONS_POS**: Consumer position (can wrap around).
+ * 		* **BPF_RB_PROD_POS**: Producer(s) position (can wrap around).
+ *
+ * 		Data returned is just a momentary snapshot of actual values
+ * 		and could be inaccurate, so this facility should be used to
+ * 		power heuristics and for reporting, not to make 100% correct
+ * 		calculation.
+ * 	Return
+ * 		Requested value, or 0, if *flags* are not recognized.
+ *
+ * int bpf_spin_lock(struct bpf_spin_lock *lock)
+ * 	Description
+ * 		Acquire a spinlock represented by the pointer *lock*, which is
+ * 		stored as part of a value of a map. Taking the lock allows to
+ * 		safely update the rest of the fields in that value. The
+ * 		spinlock can (and must) later be released with a call to
+ * 		**bpf_spin_unlock**\ (\ *lock*\ ).
+ *
+ * 		Spinlocks in BPF programs come with a number of restrictions
+ * 		and constraints:
+ *
+ * 		* **bpf_spin_lock** objects are only allowed inside maps of
+ * 		  types **BPF_MAP_TYPE_HASH** and **BPF_MAP_TYPE_ARRAY** (this
+ * 		  list could be extended in the future).
+ * 		* BTF description of the map is mandatory.
+ * 		* The BPF program can take ONE lock at a time, since taking two
+ * 		  or more could cause dead locks.
+ * 		* Only one **struct bpf_spin_lock** is allowed per map element.
+ * 		* When the lock is taken, calls (either BPF to BPF or helpers)
+ * 		  are not allowed.
+ * 		* The **BPF_LD_ABS** and **BPF_LD_IND** instructions are not
+ * 		  allowed inside a spinlock-ed region.
+ * 		* The BPF program MUST call **bpf_spin_unlock**\ () to release
+ * 		  the lock, on all execution paths, before it returns.
+ * 		* The BPF program can access **struct bpf_spin_lock** only via
+ * 		  the **bpf_spin_lock**\ () and **bpf_spin_unlock**\ ()
+ * 		  helpers. Loading or storing data into the **struct
+ * 		  bpf_spin_lock** *lock*\ **;** field of a map is not allowed.
+ * 		* To use the **bpf_spin_lock**\ () helper, the BTF description
+ * 		  of the map value must be a struct and have **struct
+ * 		  bpf_spin_lock** *anyname*\ **;** field at the top level.
+ * 		  Nested lock inside another struct is not allowed.
+ * 		* The **struct bpf_spin_lock** *lock* field in a map value must
+ * 		  be aligned on a multiple of 4 bytes in that value.
+ * 		* Syscall with command **BPF_MAP_LOOKUP_ELEM** does not copy
+ * 		  the **bpf_spin_lock** field to user space.
+ * 		* Syscall with command **BPF_MAP_UPDATE_ELEM**, or update from
+ * 		  a BPF program, do not update the **bpf_spin_lock** field.
+ * 		* **bpf_spin_lock** cannot be on the stack or inside a
+ * 		  networking packet (it can only be inside of a map values).
+ * 		* **bpf_spin_lock** is available to root only.
+ * 		* Tracing programs and socket filter programs cannot use
+ * 		  **bpf_spin_lock**\ () due to insufficient preemption checks
+ * 		  (but this may change in the future).
+ * 	Return
+ * 		0
+ *
+ * int bpf_spin_unlock(struct bpf_spin_lock *lock)
+ * 	Description
+ * 		Release the *lock* previously locked by a call to
+ * 		**bpf_spin_lock**\ (\ *lock*\ ).
+ * 	Return
+ * 		0
+ *
+ * int bpf_iter_seq_write(void *ctx, const void *data, u32 len)
+ * 	Description
+ * 		Append *len* bytes from *data* to the output of the
+ * 		**BPF_TRACE_ITER** program's iterator. *ctx* is the context
+ * 		the program was called with. What one call of the program
+ * 		writes ends up in the same **read**\ (2) of the iterator fd.
+ * 	Return
+ * 		0 on success, or **-EOVERFLOW** if the output of this call
+ * 		of the program does not fit into the iterator's buffer.
+ *
+ * void *bpf_ctx_sk_storage_get(struct bpf_map *map, void *ctx, void *value, u64 flags)
+ * 	Description
+ * 		Get the storage of a **BPF_MAP_TYPE_SK_STORAGE** *map* for
+ * 		the socket *ctx* refers to: the full socket of the packet
+ * 		for programs working on a **struct __sk_buff**, the socket of
+ * 		a **struct bpf_sock_ops** for which *is_fullsock* is set, or
+ * 		the socket itself for **BPF_PROG_TYPE_CGROUP_SOCK** programs.
+ *
+ * 		The storage hangs off the socket, so getting it takes no hash
+ * 		lookup, and it is freed along with the socket.
+ *
+ * 		If the socket has no storage for *map* yet and
+ * 		**BPF_SK_STORAGE_GET_F_CREATE** is set in *flags*, it is
+ * 		created, initialized with *value* or with zeroes if *value*
+ * 		is NULL.
+ * 	Return
+ * 		A pointer to the storage, or NULL if there is none or it
+ * 		could not be created.
+ *
+ * int bpf_ctx_sk_storage_delete(struct bpf_map *map, void *ctx)
+ * 	Description
+ * 		Delete the storage of *map* of the socket *ctx* refers to,
+ * 		as for **bpf_ctx_sk_storage_get**\ ().
+ * 	Return
+ * 		0 on success, **-ENOENT** if there was no storage, or
+ * 		**-EINVAL** if *ctx* refers to no full socket.
+ *
+ * void *bpf_current_task_storage_get(struct bpf_map *map, void *value, u64 flags)
+ * 	Description
+ * 		Get the storage of a **BPF_MAP_TYPE_PID_TASK_STORAGE** *map*
+ * 		for the current task, creating it as
+ * 		**bpf_ctx_sk_storage_get**\ () does if
+ * 		**BPF_LOCAL_STORAGE_GET_F_CREATE** is set in *flags*.
+ * 		The storage is freed along with the task.
+ * 	Return
+ * 		A pointer to the storage, or NULL if there is none, it could
+ * 		not be created or the helper was called while the current
+ * 		CPU is already working on task storage.
+ *
+ * int bpf_current_task_storage_delete(struct bpf_map *map)
+ * 	Description
+ * 		Delete the storage of *map* of the current task.
+ * 	Return
+ * 		0 on success, **-ENOENT** if there was no storage, or
+ * 		**-EBUSY** if the current CPU is already working on task
+ * 		storage.
+ */
+#define ___BPF_FUNC_MAPPER(FN, ctx...)			\
+	FN(unspec, 0, ##ctx)				\
+	FN(map_lookup_elem, 1, ##ctx)			\
+	FN(map_update_elem, 2, ##ctx)			\
+	FN(map_delete_elem, 3, ##ctx)			\
+	FN(probe_read, 4, ##ctx)			\
+	FN(ktime_get_ns, 5, ##ctx)			\
+	FN(trace_printk, 6, ##ctx)			\
+	FN(get_prandom_u32, 7, ##ctx)			\
+	FN(get_smp_processor_id, 8, ##ctx)		\
+	FN(skb_store_bytes, 9, ##ctx)			\
+	FN(l3_csum_replace, 10, ##ctx)			\
+	FN(l4_csum_replace, 11, ##ctx)			\
+	FN(tail_call, 12, ##ctx)			\
+	FN(clone_redirect, 13, ##ctx)			\
+	FN(get_current_pid_tgid, 14, ##ctx)		\
+	FN(get_current_uid_gid, 15, ##ctx)		\
+	FN(get_current_comm, 16, ##ctx)			\
+	FN(get_cgroup_classid, 17, ##ctx)		\
+	FN(skb_vlan_push, 18, ##ctx)			\
+	FN(skb_vlan_pop, 19, ##ctx)			\
+	FN(skb_get_tunnel_key, 20, ##ctx)		\
+	FN(skb_set_tunnel_key, 21, ##ctx)		\
+	FN(perf_event_read, 22, ##ctx)			\
+	FN(redirect, 23, ##ctx)				\
+	FN(get_route_realm, 24, ##ctx)			\
+	FN(perf_event_output, 25, ##ctx)		\
+	FN(skb_load_bytes, 26, ##ctx)			\
+	FN(get_stackid, 27, ##ctx)			\
+	FN(csum_diff, 28, ##ctx)			\
+	FN(skb_get_tunnel_opt, 29, ##ctx)		\
+	FN(skb_set_tunnel_opt, 30, ##ctx)		\
+	FN(skb_change_proto, 31, ##ctx)			\
+	FN(skb_change_type, 32, ##ctx)			\
+	FN(skb_under_cgroup, 33, ##ctx)			\
+	FN(get_hash_recalc, 34, ##ctx)			\
+	FN(get_current_task, 35, ##ctx)			\
+	FN(probe_write_user, 36, ##ctx)			\
+	FN(current_task_under_cgroup, 37, ##ctx)	\
+	FN(skb_change_tail, 38, ##ctx)			\
+	FN(skb_pull_data, 39, ##ctx)			\
+	FN(csum_update, 40, ##ctx)			\
+	FN(set_hash_invalid, 41, ##ctx)			\
+	FN(get_numa_node_id, 42, ##ctx)			\
+	FN(skb_change_head, 43, ##ctx)			\
+	FN(xdp_adjust_head, 44, ##ctx)			\
+	FN(probe_read_str, 45, ##ctx)			\
+	FN(get_socket_cookie, 46, ##ctx)		\
+	FN(get_socket_uid, 47, ##ctx)			\
+	FN(set_hash, 48, ##ctx)				\
+	FN(setsockopt, 49, ##ctx)			\
+	FN(skb_adjust_room, 50, ##ctx)			\
+	FN(redirect_map, 51, ##ctx)			\
+	FN(sk_redirect_map, 52, ##ctx)			\
+	FN(sock_map_update, 53, ##ctx)			\
+	FN(xdp_adjust_meta, 54, ##ctx)			\
+	FN(perf_event_read_value, 55, ##ctx)		\
+	FN(perf_prog_read_value, 56, ##ctx)		\
+	FN(getsockopt, 57, ##ctx)			\
+	FN(override_return, 58, ##ctx)			\
+	FN(sock_ops_cb_flags_set, 59, ##ctx)		\
+	FN(msg_redirect_map, 60, ##ctx)			\
+	FN(msg_apply_bytes, 61, ##ctx)			\
+	FN(msg_cork_bytes, 62, ##ctx)			\
+	FN(msg_pull_data, 63, ##ctx)			\
+	FN(bind, 64, ##ctx)				\
+	FN(xdp_adjust_tail, 65, ##ctx)			\
+	FN(skb_get_xfrm_state, 66, ##ctx)		\
+	FN(get_stack, 67, ##ctx)			\
+	FN(skb_load_bytes_relative, 68, ##ctx)		\
+	FN(fib_lookup, 69, ##ctx)			\
+	FN(sock_hash_update, 70, ##ctx)			\
+	FN(msg_redirect_hash, 71, ##ctx)		\
+	FN(sk_redirect_hash, 72, ##ctx)			\
+	FN(lwt_push_encap, 73, ##ctx)			\
+	FN(lwt_seg6_store_bytes, 74, ##ctx)		\
+	FN(lwt_seg6_adjust_srh, 75, ##ctx)		\
+	FN(lwt_seg6_action, 76, ##ctx)			\
+	FN(rc_repeat, 77, ##ctx)			\
+	FN(rc_keydown, 78, ##ctx)			\
+	FN(skb_cgroup_id, 79, ##ctx)			\
+	FN(get_current_cgroup_id, 80, ##ctx)		\
+	FN(spin_lock, 93, ##ctx)			\
+	FN(spin_unlock, 94, ##ctx)			\
+	FN(ringbuf_output, 130, ##ctx)			\
+	FN(ringbuf_reserve, 131, ##ctx)			\
+	FN(ringbuf_submit, 132, ##ctx)			\
+	FN(ringbuf_discard, 133, ##ctx)			\
+	FN(ringbuf_query, 134, ##ctx)			\
+	FN(iter_seq_write, 256, ##ctx)			\
+	FN(ctx_sk_storage_get, 257, ##ctx)		\
+	FN(ctx_sk_storage_delete, 258, ##ctx)		\
+	FN(current_task_storage_get, 259, ##ctx)	\
+	FN(current_task_storage_delete, 260, ##ctx)	\
+	/* */
+
+/* backwards-compatibility macros for users of __BPF_FUNC_MAPPER that don't
+ * know or care about integer value that is now passed as second argument
  */
-#define __BPF_FUNC_MAPPER(FN)		\
-	FN(unspec),			\
-	FN(map_lookup_elem),		\
-	FN(map_update_elem),		\
-	FN(map_delete_elem),		\
-	FN(probe_read),			\
-	FN(ktime_get_ns),		\
-	FN(trace_printk),		\
-	FN(get_prandom_u32),		\
-	FN(get_smp_processor_id),	\
-	FN(skb_store_bytes),		\
-	FN(l3_csum_replace),		\
-	FN(l4_csum_replace),		\
-	FN(tail_call),			\
-	FN(clone_redirect),		\
-	FN(get_current_pid_tgid),	\
-	FN(get_current_uid_gid),	\
-	FN(get_current_comm),		\
-	FN(get_cgroup_classid),		\
-	FN(skb_vlan_push),		\
-	FN(skb_vlan_pop),		\
-	FN(skb_get_tunnel_key),		\
-	FN(skb_set_tunnel_key),		\
-	FN(perf_event_read),		\
-	FN(redirect),			\
-	FN(get_route_realm),		\
-	FN(perf_event_output),		\
-	FN(skb_load_bytes),		\
-	FN(get_stackid),		\
-	FN(csum_diff),			\
-	FN(skb_get_tunnel_opt),		\
-	FN(skb_set_tunnel_opt),		\
-	FN(skb_change_proto),		\
-	FN(skb_change_type),		\
-	FN(skb_under_cgroup),		\
-	FN(get_hash_recalc),		\
-	FN(get_current_task),		\
-	FN(probe_write_user),		\
-	FN(current_task_under_cgroup),	\
-	FN(skb_change_tail),		\
-	FN(skb_pull_data),		\
-	FN(csum_update),		\
-	FN(set_hash_invalid),		\
-	FN(get_numa_node_id),		\
-	FN(skb_change_head),		\
-	FN(xdp_adjust_head),		\
-	FN(probe_read_str),		\
-	FN(get_socket_cookie),		\
-	FN(get_socket_uid),		\
-	FN(set_hash),			\
-	FN(setsockopt),			\
-	FN(skb_adjust_room),		\
-	FN(redirect_map),		\
-	FN(sk_redirect_map),		\
-	FN(sock_map_update),		\
-	FN(xdp_adjust_meta),		\
-	FN(perf_event_read_value),	\
-	FN(perf_prog_read_value),	\
-	FN(getsockopt),			\
-	FN(override_return),		\
-	FN(sock_ops_cb_flags_set),	\
-	FN(msg_redirect_map),		\
-	FN(msg_apply_bytes),		\
-	FN(msg_cork_bytes),		\
-	FN(msg_pull_data),		\
-	FN(bind),			\
-	FN(xdp_adjust_tail),		\
-	FN(skb_get_xfrm_state),		\
-	FN(get_stack),			\
-	FN(skb_load_bytes_relative),	\
-	FN(fib_lookup),			\
-	FN(sock_hash_update),		\
-	FN(msg_redirect_hash),		\
-	FN(sk_redirect_hash),		\
-	FN(lwt_push_encap),		\
-	FN(lwt_seg6_store_bytes),	\
-	FN(lwt_seg6_adjust_srh),	\
-	FN(lwt_seg6_action),		\
-	FN(rc_repeat),			\
-	FN(rc_keydown),			\
-	FN(skb_cgroup_id),		\
-	FN(get_current_cgroup_id),
+#define __BPF_FUNC_MAPPER_APPLY(name, value, FN) FN(name),
+#define __BPF_FUNC_MAPPER(FN) ___BPF_FUNC_MAPPER(__BPF_FUNC_MAPPER_APPLY, FN)
 
 /* integer value in 'imm' field of BPF_CALL instruction selects which helper
  * function eBPF program intends to call
+ *
+ * Helpers keep the ids mainline gives them, so that programs built against
+ * mainline headers call the same helper here. Ids of mainline helpers this
+ * kernel does not have are left unused. Helpers only this kernel has are
+ * numbered from 256, past the last id mainline gave out.
  */
-#define __BPF_ENUM_FN(x) BPF_FUNC_ ## x
+#define __BPF_ENUM_FN(x, y) BPF_FUNC_ ## x = y,
 enum bpf_func_id {
-	__BPF_FUNC_MAPPER(__BPF_ENUM_FN)
+	___BPF_FUNC_MAPPER(__BPF_ENUM_FN)
 	__BPF_FUNC_MAX_ID,
 };
 #undef __BPF_ENUM_FN
@@ -2215,6 +2484,45 @@ enum bpf_func_id {
 /* BPF_FUNC_perf_event_output for sk_buff input context. */
 #define BPF_F_CTXLEN_MASK		(0xfffffULL << 32)
 
+/* BPF_FUNC_ringbuf_output, BPF_FUNC_ringbuf_submit and
+ * BPF_FUNC_ringbuf_discard flags.
+ */
+enum {
+	BPF_RB_NO_WAKEUP		= (1ULL << 0),
+	BPF_RB_FORCE_WAKEUP		= (1ULL << 1),
+};
+
+/* BPF_FUNC_ringbuf_query flags */
+enum {
+	BPF_RB_AVAIL_DATA = 0,
+	BPF_RB_RING_SIZE = 1,
+	BPF_RB_CONS_POS = 2,
+	BPF_RB_PROD_POS = 3,
+};
+
+/* BPF_FUNC_ctx_sk_storage_get and BPF_FUNC_current_task_storage_get flags */
+enum {
+	BPF_LOCAL_STORAGE_GET_F_CREATE	= (1ULL << 0),
+	/* the same flag, named after the socket helper */
+	BPF_SK_STORAGE_GET_F_CREATE	= BPF_LOCAL_STORAGE_GET_F_CREATE,
+};
+
+/* BPF ring buffer constants.
+ *
+ * A BPF_MAP_TYPE_RINGBUF map is mmap()ed by the consumer: the first page
+ * holds the consumer position and is writable, the second page holds the
+ * producer position, followed by the data area mapped twice in a row so
+ * that records wrapping around the end can be read contiguously. Every
+ * record starts with an 8-byte header: a 32-bit length, whose top two bits
+ * are the busy and discard bits, and a 32-bit page offset used by the
+ * kernel. Records are padded to 8 bytes.
+ */
+enum {
+	BPF_RINGBUF_BUSY_BIT		= (1U << 31),
+	BPF_RINGBUF_DISCARD_BIT		= (1U << 30),
+	BPF_RINGBUF_HDR_SZ		= 8,
+};
+
 /* Mode for BPF_FUNC_skb_adjust_room helper. */
 enum bpf_adj_room_mode {
 	BPF_ADJ_ROOM_NET,
@@ -2675,6 +2983,10 @@ struct bpf_fib_lookup {
 	__u8	dmac[6];     /* ETH_ALEN */
 };
 
+struct bpf_spin_lock {
+	__u32	val;
+};
+
 enum bpf_task_fd_type {
 	BPF_FD_TYPE_RAW_TRACEPOINT,	/* tp name */
 	BPF_FD_TYPE_TRACEPOINT,		/* tp name */
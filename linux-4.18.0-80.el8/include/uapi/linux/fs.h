@@ -241,9 +241,24 @@ struct fsxattr {
 #define FICLONE		_IOW(0x94, 9, int)
 #define FICLONERANGE	_IOW(0x94, 13, struct file_clone_range)
 #define FIDEDUPERANGE	_IOWR(0x94, 54, struct file_dedupe_range)
+#define FS_IOC_STATX_BATCH	_IOWR(0x94, 64, struct statx_batch)
 
 #define FSLABEL_MAX 256	/* Max chars for the interface; each fs may differ */
 
+/*
+ * statx() each name of an array of struct statx_batch_entry (linux/stat.h)
+ * relative to the directory the ioctl is issued on, with the same flags and
+ * mask for all of them.  On return count holds the number of entries done;
+ * a failing entry only sets its error.
+ */
+struct statx_batch {
+	__u32	flags;		/* in: AT_* flags as for statx() */
+	__u32	mask;		/* in: STATX_* mask as for statx() */
+	__u32	count;		/* in/out: entries in the array / done */
+	__u32	__spare;
+	__u64	entries;	/* in: pointer to struct statx_batch_entry[] */
+};
+
 #define	FS_IOC_GETFLAGS			_IOR('f', 1, long)
 #define	FS_IOC_SETFLAGS			_IOW('f', 2, long)
 #define	FS_IOC_GETVERSION		_IOR('v', 1, long)
@@ -116,6 +116,15 @@
  *
  *  7.27
  *  - add FUSE_ABORT_ERROR
+ *
+ *  Extensions of this kernel, negotiated by INIT flags and device ioctls
+ *  alone.  They don't have a minor version of their own, later minor
+ *  versions are assigned by mainline:
+ *  - add FUSE_INIT_EXT, fuse_init_in.flags2 and fuse_init_out.flags2
+ *  - add FUSE_PASSTHROUGH, FOPEN_PASSTHROUGH and fuse_open_out.backing_id
+ *  - add FUSE_DEV_IOC_BACKING_OPEN and FUSE_DEV_IOC_BACKING_CLOSE
+ *  - add FUSE_DEV_IOC_RING_SETUP and FUSE_DEV_IOC_RING_CMD
+ *  - add FUSE_DEV_IOC_QUEUE_BIND
  */
 
 #ifndef _LINUX_FUSE_H
@@ -219,10 +228,13 @@ struct fuse_file_lock {
  * FOPEN_DIRECT_IO: bypass page cache for this open file
  * FOPEN_KEEP_CACHE: don't invalidate the data cache on open
  * FOPEN_NONSEEKABLE: the file is not seekable
+ * FOPEN_PASSTHROUGH: do read, write and mmap on the backing file given by
+ *		      fuse_open_out.backing_id
  */
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
+#define FOPEN_PASSTHROUGH	(1 << 7)
 
 /**
  * INIT request/reply flags
@@ -249,6 +261,12 @@ struct fuse_file_lock {
  * FUSE_HANDLE_KILLPRIV: fs handles killing suid/sgid/cap on write/chown/trunc
  * FUSE_POSIX_ACL: filesystem supports posix acls
  * FUSE_ABORT_ERROR: reading the device after abort returns ECONNABORTED
+ * FUSE_INIT_EXT: extended fuse_init_in request, flags2 is valid
+ *
+ * Flags in flags2, valid with FUSE_INIT_EXT only, are numbered from 32 on
+ * and allocated from the top down:
+ *
+ * FUSE_PASSTHROUGH: filesystem may open files in passthrough mode
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -272,6 +290,9 @@ struct fuse_file_lock {
 #define FUSE_HANDLE_KILLPRIV	(1 << 19)
 #define FUSE_POSIX_ACL		(1 << 20)
 #define FUSE_ABORT_ERROR	(1 << 21)
+#define FUSE_INIT_EXT		(1 << 30)
+
+#define FUSE_PASSTHROUGH	(1ULL << 63)
 
 /**
  * CUSE INIT request/reply flags
@@ -503,7 +524,7 @@ struct fuse_create_in {
 struct fuse_open_out {
 	uint64_t	fh;
 	uint32_t	open_flags;
-	uint32_t	padding;
+	int32_t		backing_id;
 };
 
 struct fuse_release_in {
@@ -596,6 +617,8 @@ struct fuse_init_in {
 	uint32_t	minor;
 	uint32_t	max_readahead;
 	uint32_t	flags;
+	uint32_t	flags2;
+	uint32_t	unused[11];
 };
 
 #define FUSE_COMPAT_INIT_OUT_SIZE 8
@@ -610,7 +633,9 @@ struct fuse_init_out {
 	uint16_t	congestion_threshold;
 	uint32_t	max_write;
 	uint32_t	time_gran;
-	uint32_t	unused[9];
+	uint32_t	padding;
+	uint32_t	flags2;
+	uint32_t	unused[7];
 };
 
 #define CUSE_INIT_INFO_MAX 4096
@@ -778,9 +803,92 @@ struct fuse_notify_retrieve_in {
 	uint64_t	dummy4;
 };
 
+/**
+ * Backing file for passthrough opens
+ *
+ * The daemon registers an open file descriptor with
+ * FUSE_DEV_IOC_BACKING_OPEN and gets back a backing id, which it can then
+ * return in fuse_open_out.backing_id together with FOPEN_PASSTHROUGH.  The
+ * id stays valid until FUSE_DEV_IOC_BACKING_CLOSE; files already opened
+ * with it keep the backing file until they are released.
+ */
+struct fuse_backing_map {
+	int32_t		fd;
+	uint32_t	flags;
+	uint64_t	padding;
+};
+
+/**
+ * Per-cpu request ring
+ *
+ * A cloned device fd can be turned into the request ring of one cpu with
+ * FUSE_DEV_IOC_RING_SETUP.  Requests submitted on that cpu which fit into
+ * a slot are then queued on the ring instead of the common input queue.
+ * The slots are mapped into the daemon with mmap() of the device fd, slot
+ * i at offset i * slot_size.
+ *
+ * FUSE_DEV_IOC_RING_CMD takes a fuse_ring_cmd.  With FUSE_RING_COMMIT the
+ * slot holds a reply (fuse_out_header and arguments, as written to the
+ * device) that is passed to the kernel first.  The call then waits for the
+ * next request of the ring, copies it into the slot (fuse_in_header and
+ * arguments, as read from the device) and returns its length.
+ *
+ * Interrupts, forgets and requests that do not fit into a slot still go
+ * through read() of the device.
+ */
+struct fuse_ring_setup {
+	uint32_t	cpu;
+	uint32_t	nr_slots;
+	uint32_t	slot_size;
+	uint32_t	flags;
+};
+
+#define FUSE_RING_COMMIT	(1 << 0)
+
+struct fuse_ring_cmd {
+	uint32_t	slot;
+	uint32_t	flags;
+};
+
+/**
+ * Per-cpu and per-node input queues
+ *
+ * A cloned device fd can be bound with FUSE_DEV_IOC_QUEUE_BIND to the
+ * input queue of one cpu (FUSE_QUEUE_CPU) or of all cpus of a NUMA node
+ * (FUSE_QUEUE_NODE).  Requests submitted on those cpus are then queued
+ * there instead of the common input queue, and read() of a bound fd only
+ * returns requests of its queue.  Any number of fds can be bound to the
+ * same queue; the daemon threads serving it should run on its cpus.
+ *
+ * Interrupts and forgets always go to the common input queue, which has
+ * to be served by at least one unbound fd.
+ */
+#define FUSE_QUEUE_CPU		0
+#define FUSE_QUEUE_NODE		1
+
+struct fuse_queue_bind {
+	uint32_t	type;
+	uint32_t	id;
+};
+
 /* Device ioctls: */
 #define FUSE_DEV_IOC_CLONE	_IOR(229, 0, uint32_t)
 
+/* Device ioctls of the extensions above use a magic of their own, so that
+ * they can't clash with numbers mainline assigns under 229
+ */
+#define FUSE_DEV_IOC_EXT_MAGIC		230
+#define FUSE_DEV_IOC_BACKING_OPEN	_IOW(FUSE_DEV_IOC_EXT_MAGIC, 0,	\
+					     struct fuse_backing_map)
+#define FUSE_DEV_IOC_BACKING_CLOSE	_IOW(FUSE_DEV_IOC_EXT_MAGIC, 1,	\
+					     uint32_t)
+#define FUSE_DEV_IOC_RING_SETUP		_IOW(FUSE_DEV_IOC_EXT_MAGIC, 2,	\
+					     struct fuse_ring_setup)
+#define FUSE_DEV_IOC_RING_CMD		_IOW(FUSE_DEV_IOC_EXT_MAGIC, 3,	\
+					     struct fuse_ring_cmd)
+#define FUSE_DEV_IOC_QUEUE_BIND		_IOW(FUSE_DEV_IOC_EXT_MAGIC, 4,	\
+					     struct fuse_queue_bind)
+
 struct fuse_lseek_in {
 	uint64_t	fh;
 	uint64_t	offset;
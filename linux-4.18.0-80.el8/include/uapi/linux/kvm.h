@@ -235,6 +235,7 @@ struct kvm_hyperv_exit {
 #define KVM_EXIT_S390_STSI        25
 #define KVM_EXIT_IOAPIC_EOI       26
 #define KVM_EXIT_HYPERV           27
+#define KVM_EXIT_DIRTY_RING_FULL  31
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 /* Emulate instruction failed. */
@@ -965,6 +966,8 @@ struct kvm_ppc_resize_hpt {
 #define KVM_CAP_MSR_PLATFORM_INFO 159
 #define KVM_CAP_PPC_NESTED_HV 160
 #define KVM_CAP_ARM_VM_IPA_SIZE 165
+#define KVM_CAP_HALT_POLL 182
+#define KVM_CAP_DIRTY_LOG_RING 192
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1411,6 +1414,9 @@ struct kvm_enc_region {
 #define KVM_GET_NESTED_STATE         _IOWR(KVMIO, 0xbe, struct kvm_nested_state)
 #define KVM_SET_NESTED_STATE         _IOW(KVMIO,  0xbf, struct kvm_nested_state)
 
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_RESET_DIRTY_RINGS		_IO(KVMIO, 0xc7)
+
 /* Secure Encrypted Virtualization command */
 enum sev_cmd_id {
 	/* Guest initialization commands */
@@ -1561,4 +1567,36 @@ struct kvm_hyperv_eventfd {
 #define KVM_HYPERV_CONN_ID_MASK		0x00ffffff
 #define KVM_HYPERV_EVENTFD_DEASSIGN	(1 << 0)
 
+/*
+ * With KVM_CAP_DIRTY_LOG_RING enabled, KVM logs the pages dirtied by each
+ * vcpu in a ring of struct kvm_dirty_gfn, mmapped from the vcpu fd at
+ * KVM_DIRTY_LOG_PAGE_OFFSET * PAGE_SIZE, instead of the dirty bitmaps of
+ * KVM_GET_DIRTY_LOG. The flags of an entry go through:
+ *
+ *   0 --(KVM logs a page)--> DIRTY --(userspace collects it)--> RESET
+ *     <------------------(KVM_RESET_DIRTY_RINGS)-------------------
+ *
+ * KVM pushes entries as pages get dirtied. Userspace reads entries in
+ * ring order until it finds one that is not DIRTY, and sets RESET on
+ * each, after reading slot and offset. KVM_RESET_DIRTY_RINGS then
+ * write protects the collected pages again, so that the next write to
+ * them is logged, and makes their entries free. A vcpu whose ring is
+ * close to full exits with KVM_EXIT_DIRTY_RING_FULL, and does not
+ * enter the guest again until its ring has been collected and reset.
+ *
+ * slot is as in struct kvm_userspace_memory_region (address space id
+ * in the upper 16 bits), offset the page within the slot.
+ */
+#define KVM_DIRTY_LOG_PAGE_OFFSET	64
+
+#define KVM_DIRTY_GFN_F_DIRTY		(1 << 0)
+#define KVM_DIRTY_GFN_F_RESET		(1 << 1)
+#define KVM_DIRTY_GFN_F_MASK		0x3
+
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot;
+	__u64 offset;
+};
+
 #endif /* __LINUX_KVM_H */
@@ -127,6 +127,17 @@ struct statx {
 	/* 0x100 */
 };
 
+/*
+ * Entry of the array passed to FS_IOC_STATX_BATCH, see linux/fs.h.  Only the
+ * fields up to __spare2 of stx are written.
+ */
+struct statx_batch_entry {
+	__u64	name;		/* in: pointer to the name to look up */
+	__s32	error;		/* out: 0 or negative errno as from statx() */
+	__u32	__spare;
+	struct statx stx;	/* out: result if error is 0 */
+};
+
 /*
  * Flags to be stx_mask
  *
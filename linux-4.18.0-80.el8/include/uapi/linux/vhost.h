@@ -48,6 +48,22 @@ struct vhost_vring_addr {
 	__u64 log_guest_addr;
 };
 
+struct vhost_worker_state {
+	/* Returned by VHOST_NEW_WORKER, the worker to free otherwise. */
+	unsigned int worker_id;
+};
+
+struct vhost_worker_cpu {
+	unsigned int worker_id;
+	/* CPU to run the worker on, or -1 for the affinity of the owner. */
+	int cpu;
+};
+
+struct vhost_vring_worker {
+	unsigned int index;
+	unsigned int worker_id;
+};
+
 /* no alignment requirement */
 struct vhost_iotlb_msg {
 	__u64 iova;
@@ -160,6 +176,23 @@ struct vhost_memory {
 #define VHOST_GET_VRING_BUSYLOOP_TIMEOUT _IOW(VHOST_VIRTIO, 0x24,	\
 					 struct vhost_vring_state)
 
+/* Worker threads. Each device starts with one worker, with id 0, serving
+ * all its virtqueues. More can be created and virtqueues attached to them,
+ * so that they run in parallel. Only vhost-net supports these. New workers
+ * get the affinity of the owner. */
+/* Create a worker and return its id */
+#define VHOST_NEW_WORKER _IOR(VHOST_VIRTIO, 0x8, struct vhost_worker_state)
+/* Free a worker no virtqueue is attached to */
+#define VHOST_FREE_WORKER _IOW(VHOST_VIRTIO, 0x9, struct vhost_worker_state)
+/* Attach a virtqueue to a worker, and get the one it is attached to */
+#define VHOST_ATTACH_VRING_WORKER _IOW(VHOST_VIRTIO, 0x15,	\
+				       struct vhost_vring_worker)
+#define VHOST_GET_VRING_WORKER _IOWR(VHOST_VIRTIO, 0x16,	\
+				     struct vhost_vring_worker)
+/* Move a worker to another CPU. Mainline has no such ioctl, so it is
+ * numbered from 0xf0, clear of the numbers mainline uses. */
+#define VHOST_SET_WORKER_CPU _IOW(VHOST_VIRTIO, 0xf0, struct vhost_worker_cpu)
+
 /* VHOST_NET specific defines */
 
 /* Attach virtio net ring to a raw socket, or tap device.
@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF iterators: dump kernel objects through a BPF_TRACE_ITER program.
+ *
+ * A target (tasks, files, sockets, map elements, ...) registers the
+ * seq_operations that walk its objects. BPF_PROG_ITER_CREATE turns a
+ * program verified against a target into an fd whose read() walks the
+ * objects and runs the program on each of them; whatever the program writes
+ * with bpf_iter_seq_write() is what user space reads.
+ */
+#include <linux/anon_inodes.h>
+#include <linux/filter.h>
+#include <linux/fs.h>
+#include <linux/nsproxy.h>
+#include <linux/seq_file_net.h>
+#include <linux/slab.h>
+#include <linux/bpf.h>
+#include <net/net_namespace.h>
+
+struct bpf_iter_target_info {
+	struct list_head list;
+	const struct bpf_iter_reg *reg_info;
+};
+
+struct bpf_iter_priv_data {
+	const struct bpf_iter_reg *reg_info;
+	struct bpf_prog *prog;
+	struct bpf_map *map;
+	u64 session_id;
+	u64 seq_num;
+	bool done_stop;
+	u8 target_private[] __aligned(8);
+};
+
+static LIST_HEAD(targets);
+static DEFINE_MUTEX(targets_mutex);
+
+/* incremented for every iterator fd */
+static atomic64_t session_id;
+
+static struct bpf_iter_priv_data *bpf_iter_priv(struct seq_file *seq)
+{
+	return container_of(seq->private, struct bpf_iter_priv_data,
+			    target_private);
+}
+
+static void bpf_iter_inc_seq_num(struct seq_file *seq)
+{
+	bpf_iter_priv(seq)->seq_num++;
+}
+
+static void bpf_iter_done_stop(struct seq_file *seq)
+{
+	bpf_iter_priv(seq)->done_stop = true;
+}
+
+/* Like seq_read(), except that the output of one object is never split
+ * between the buffer and the next read(), and that the stop() call that
+ * ends the walk, which runs the program with a NULL object, is made
+ * before the buffer is copied out and only once per fd.
+ */
+static ssize_t bpf_seq_read(struct file *file, char __user *buf, size_t size,
+			    loff_t *ppos)
+{
+	struct seq_file *seq = file->private_data;
+	size_t n, offs, copied = 0;
+	int err = 0;
+	void *p;
+
+	mutex_lock(&seq->lock);
+
+	if (!seq->buf) {
+		seq->size = PAGE_SIZE << 3;
+		seq->buf = kvmalloc(seq->size, GFP_KERNEL);
+		if (!seq->buf) {
+			err = -ENOMEM;
+			goto done;
+		}
+	}
+
+	/* hand out what the previous read() did not take first */
+	if (seq->count) {
+		n = min(seq->count, size);
+		if (copy_to_user(buf, seq->buf + seq->from, n)) {
+			err = -EFAULT;
+			goto done;
+		}
+		seq->count -= n;
+		seq->from += n;
+		copied = n;
+		goto done;
+	}
+
+	seq->from = 0;
+	p = seq->op->start(seq, &seq->index);
+	if (!p)
+		goto stop;
+	if (IS_ERR(p)) {
+		err = PTR_ERR(p);
+		seq->op->stop(seq, p);
+		seq->count = 0;
+		goto done;
+	}
+
+	err = seq->op->show(seq, p);
+	if (err > 0) {
+		/* SEQ_SKIP */
+		seq->count = 0;
+	} else if (err < 0 || seq_has_overflowed(seq)) {
+		/* a single object does not fit into the buffer */
+		if (!err)
+			err = -E2BIG;
+		seq->op->stop(seq, p);
+		seq->count = 0;
+		goto done;
+	} else {
+		bpf_iter_inc_seq_num(seq);
+	}
+
+	while (1) {
+		loff_t pos = seq->index;
+
+		offs = seq->count;
+		p = seq->op->next(seq, p, &seq->index);
+		if (pos == seq->index) {
+			pr_info_ratelimited("buggy seq_file .next function %ps did not update position index\n",
+					    seq->op->next);
+			seq->index++;
+		}
+
+		if (IS_ERR_OR_NULL(p))
+			break;
+
+		if (seq->count >= size)
+			break;
+
+		err = seq->op->show(seq, p);
+		if (err > 0) {
+			seq->count = offs;
+		} else if (err < 0 || seq_has_overflowed(seq)) {
+			/* the object is shown again by the next read() */
+			seq->count = offs;
+			if (offs == 0) {
+				if (!err)
+					err = -E2BIG;
+				seq->op->stop(seq, p);
+				goto done;
+			}
+			break;
+		} else {
+			bpf_iter_inc_seq_num(seq);
+		}
+	}
+stop:
+	offs = seq->count;
+	seq->op->stop(seq, p);
+	if (!p) {
+		if (!seq_has_overflowed(seq)) {
+			bpf_iter_done_stop(seq);
+		} else {
+			/* stop() runs the program again on the next read() */
+			seq->count = offs;
+			if (offs == 0) {
+				err = -E2BIG;
+				goto done;
+			}
+		}
+	}
+
+	n = min(seq->count, size);
+	if (copy_to_user(buf, seq->buf, n)) {
+		err = -EFAULT;
+		goto done;
+	}
+	copied = n;
+	seq->count -= n;
+	seq->from = n;
+done:
+	if (!copied)
+		copied = err;
+	else
+		*ppos += copied;
+	mutex_unlock(&seq->lock);
+	return copied;
+}
+
+static int iter_release(struct inode *inode, struct file *file)
+{
+	struct bpf_iter_priv_data *iter_priv;
+	struct seq_file *seq;
+
+	seq = file->private_data;
+	if (!seq)
+		return 0;
+
+	iter_priv = bpf_iter_priv(seq);
+	if (iter_priv->reg_info->fini_seq_private)
+		iter_priv->reg_info->fini_seq_private(seq->private);
+	bpf_prog_put(iter_priv->prog);
+	if (iter_priv->map)
+		bpf_map_put(iter_priv->map);
+	kfree(iter_priv);
+
+	return seq_release(inode, file);
+}
+
+static const struct file_operations bpf_iter_fops = {
+	.llseek		= no_llseek,
+	.read		= bpf_seq_read,
+	.release	= iter_release,
+};
+
+int bpf_iter_reg_target(const struct bpf_iter_reg *reg_info)
+{
+	struct bpf_iter_target_info *tinfo;
+
+	tinfo = kmalloc(sizeof(*tinfo), GFP_KERNEL);
+	if (!tinfo)
+		return -ENOMEM;
+
+	tinfo->reg_info = reg_info;
+	INIT_LIST_HEAD(&tinfo->list);
+
+	mutex_lock(&targets_mutex);
+	list_add(&tinfo->list, &targets);
+	mutex_unlock(&targets_mutex);
+
+	return 0;
+}
+
+const struct bpf_iter_reg *bpf_iter_find_target(const char *func_name)
+{
+	const struct bpf_iter_reg *reg_info = NULL;
+	struct bpf_iter_target_info *tinfo;
+	size_t prefix_len = strlen(BPF_ITER_FUNC_PREFIX);
+
+	if (strncmp(func_name, BPF_ITER_FUNC_PREFIX, prefix_len))
+		return NULL;
+
+	mutex_lock(&targets_mutex);
+	list_for_each_entry(tinfo, &targets, list) {
+		if (!strcmp(func_name + prefix_len, tinfo->reg_info->target)) {
+			reg_info = tinfo->reg_info;
+			break;
+		}
+	}
+	mutex_unlock(&targets_mutex);
+
+	return reg_info;
+}
+
+/* Consumes the references to prog and map on success. */
+int bpf_iter_new_fd(struct bpf_prog *prog, struct bpf_map *map)
+{
+	const struct bpf_iter_reg *reg_info = prog->aux->iter_reg;
+	struct bpf_iter_priv_data *iter_priv;
+	struct seq_file *seq;
+	struct file *file;
+	int fd, err;
+
+	if (!reg_info || reg_info->needs_map != !!map)
+		return -EINVAL;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	iter_priv = kzalloc(sizeof(*iter_priv) + reg_info->seq_priv_size,
+			    GFP_USER | __GFP_NOWARN);
+	if (!iter_priv) {
+		err = -ENOMEM;
+		goto put_fd;
+	}
+
+	if (reg_info->init_seq_private) {
+		err = reg_info->init_seq_private(iter_priv->target_private,
+						 map);
+		if (err)
+			goto free_priv;
+	}
+
+	file = anon_inode_getfile("bpf_iter", &bpf_iter_fops, NULL,
+				  O_RDONLY | O_CLOEXEC);
+	if (IS_ERR(file)) {
+		err = PTR_ERR(file);
+		goto fini_priv;
+	}
+
+	err = seq_open(file, reg_info->seq_ops);
+	if (err) {
+		fput(file);
+		goto fini_priv;
+	}
+
+	iter_priv->reg_info = reg_info;
+	iter_priv->prog = prog;
+	iter_priv->map = map;
+	iter_priv->session_id = atomic64_inc_return(&session_id);
+
+	seq = file->private_data;
+	seq->private = iter_priv->target_private;
+
+	fd_install(fd, file);
+	return fd;
+
+fini_priv:
+	if (reg_info->fini_seq_private)
+		reg_info->fini_seq_private(iter_priv->target_private);
+free_priv:
+	kfree(iter_priv);
+put_fd:
+	put_unused_fd(fd);
+	return err;
+}
+
+/* Fill in the meta data for a call of the program from a target's show()
+ * or stop(), and return the program, or NULL if stop() already ran it.
+ */
+struct bpf_prog *bpf_iter_get_info(struct bpf_iter_meta *meta, bool in_stop)
+{
+	struct bpf_iter_priv_data *iter_priv = bpf_iter_priv(meta->seq);
+
+	if (in_stop && iter_priv->done_stop)
+		return NULL;
+
+	meta->session_id = iter_priv->session_id;
+	meta->seq_num = iter_priv->seq_num;
+
+	return iter_priv->prog;
+}
+
+/* A program returns 0 to keep what it wrote for the object, or 1 to
+ * drop it.
+ */
+int bpf_iter_run_prog(struct bpf_prog *prog, void *ctx)
+{
+	int ret;
+
+	rcu_read_lock();
+	preempt_disable();
+	ret = BPF_PROG_RUN(prog, ctx);
+	preempt_enable();
+	rcu_read_unlock();
+
+	return ret ? SEQ_SKIP : 0;
+}
+
+/* init_seq_private for targets whose iterator state starts with a
+ * struct seq_net_private: walk the network namespace of the creator.
+ */
+int bpf_iter_init_seq_net(void *priv_data, struct bpf_map *map)
+{
+#ifdef CONFIG_NET_NS
+	struct seq_net_private *p = priv_data;
+
+	p->net = get_net(current->nsproxy->net_ns);
+#endif
+	return 0;
+}
+
+void bpf_iter_fini_seq_net(void *priv_data)
+{
+#ifdef CONFIG_NET_NS
+	struct seq_net_private *p = priv_data;
+
+	put_net(p->net);
+#endif
+}
+
+BPF_CALL_3(bpf_iter_seq_write, void *, ctx, const void *, data, u32, len)
+{
+	struct bpf_iter_meta *meta = *(struct bpf_iter_meta **)ctx;
+
+	return seq_write(meta->seq, data, len) ? -EOVERFLOW : 0;
+}
+
+const struct bpf_func_proto bpf_iter_seq_write_proto = {
+	.func		= bpf_iter_seq_write,
+	.gpl_only	= true,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_PTR_TO_MEM,
+	.arg3_type	= ARG_CONST_SIZE_OR_ZERO,
+};
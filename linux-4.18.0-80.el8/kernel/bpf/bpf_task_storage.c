@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF_MAP_TYPE_PID_TASK_STORAGE: BPF local storage hanging off task_struct.
+ *
+ * Programs get at the storage of the current task. From user space the key
+ * is a pid in the caller's pid namespace. The storage is freed along with
+ * the task_struct.
+ *
+ * Tracing programs may run in the middle of a storage update on the same
+ * CPU, from a tracepoint, an fentry program or an NMI, and would deadlock
+ * on its locks. A per-CPU busy count makes the helpers fail instead.
+ */
+#include <linux/rculist.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/bpf.h>
+#include <linux/bpf_local_storage.h>
+#include <linux/filter.h>
+#include <linux/hardirq.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
+#include <linux/sched/task.h>
+
+DEFINE_BPF_STORAGE_CACHE(task_cache);
+
+static DEFINE_PER_CPU(int, bpf_task_storage_busy);
+
+static void bpf_task_storage_lock(void)
+{
+	preempt_disable();
+	__this_cpu_inc(bpf_task_storage_busy);
+}
+
+static void bpf_task_storage_unlock(void)
+{
+	__this_cpu_dec(bpf_task_storage_busy);
+	preempt_enable();
+}
+
+static bool bpf_task_storage_trylock(void)
+{
+	preempt_disable();
+	if (unlikely(__this_cpu_inc_return(bpf_task_storage_busy) != 1)) {
+		__this_cpu_dec(bpf_task_storage_busy);
+		preempt_enable();
+		return false;
+	}
+	return true;
+}
+
+static struct bpf_local_storage __rcu **task_storage_ptr(void *owner)
+{
+	struct task_struct *task = owner;
+
+	return &task->bpf_storage;
+}
+
+static struct bpf_local_storage_data *
+task_storage_lookup(struct task_struct *task, struct bpf_map *map,
+		    bool cacheit_lockit)
+{
+	struct bpf_local_storage *task_storage;
+	struct bpf_local_storage_map *smap;
+
+	task_storage = rcu_dereference(task->bpf_storage);
+	if (!task_storage)
+		return NULL;
+
+	smap = (struct bpf_local_storage_map *)map;
+	return bpf_local_storage_lookup(task_storage, smap, cacheit_lockit);
+}
+
+/* Called by __put_task_struct() once nothing can reach the task anymore. */
+void bpf_task_storage_free(struct task_struct *task)
+{
+	struct bpf_local_storage *local_storage;
+
+	rcu_read_lock();
+
+	local_storage = rcu_dereference(task->bpf_storage);
+	if (!local_storage) {
+		rcu_read_unlock();
+		return;
+	}
+
+	bpf_task_storage_lock();
+	bpf_local_storage_destroy(local_storage);
+	bpf_task_storage_unlock();
+	rcu_read_unlock();
+}
+
+/* The syscall side runs under rcu_read_lock(), see bpf_map_copy_value(). */
+static struct task_struct *task_storage_get_task(void *key)
+{
+	return get_pid_task(find_vpid(*(u32 *)key), PIDTYPE_PID);
+}
+
+static void *bpf_pid_task_storage_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_local_storage_data *sdata;
+	struct task_struct *task;
+
+	task = task_storage_get_task(key);
+	if (!task)
+		return NULL;
+
+	bpf_task_storage_lock();
+	sdata = task_storage_lookup(task, map, true);
+	bpf_task_storage_unlock();
+	put_task_struct(task);
+	return sdata ? sdata->data : NULL;
+}
+
+static int bpf_pid_task_storage_update_elem(struct bpf_map *map, void *key,
+					    void *value, u64 map_flags)
+{
+	struct bpf_local_storage_data *sdata;
+	struct task_struct *task;
+
+	task = task_storage_get_task(key);
+	if (!task)
+		return -ESRCH;
+
+	bpf_task_storage_lock();
+	sdata = bpf_local_storage_update(
+		task, (struct bpf_local_storage_map *)map, value, map_flags);
+	bpf_task_storage_unlock();
+	put_task_struct(task);
+	return PTR_ERR_OR_ZERO(sdata);
+}
+
+static int task_storage_delete(struct task_struct *task, struct bpf_map *map)
+{
+	struct bpf_local_storage_data *sdata;
+
+	sdata = task_storage_lookup(task, map, false);
+	if (!sdata)
+		return -ENOENT;
+
+	bpf_selem_unlink(SELEM(sdata));
+
+	return 0;
+}
+
+static int bpf_pid_task_storage_delete_elem(struct bpf_map *map, void *key)
+{
+	struct task_struct *task;
+	int err;
+
+	task = task_storage_get_task(key);
+	if (!task)
+		return -ESRCH;
+
+	bpf_task_storage_lock();
+	err = task_storage_delete(task, map);
+	bpf_task_storage_unlock();
+	put_task_struct(task);
+	return err;
+}
+
+BPF_CALL_3(bpf_task_storage_get, struct bpf_map *, map, void *, value,
+	   u64, flags)
+{
+	struct task_struct *task = current;
+	struct bpf_local_storage_data *sdata;
+
+	if (flags & ~BPF_LOCAL_STORAGE_GET_F_CREATE)
+		return (unsigned long)NULL;
+
+	if (!bpf_task_storage_trylock())
+		return (unsigned long)NULL;
+
+	sdata = task_storage_lookup(task, map, true);
+	if (sdata)
+		goto unlock;
+
+	/* The current task is alive, so its storage will be freed later by
+	 * bpf_task_storage_free(). Memory can't be allocated from NMI.
+	 */
+	if ((flags & BPF_LOCAL_STORAGE_GET_F_CREATE) && !in_nmi())
+		sdata = bpf_local_storage_update(
+			task, (struct bpf_local_storage_map *)map, value,
+			BPF_NOEXIST);
+
+unlock:
+	bpf_task_storage_unlock();
+	return IS_ERR_OR_NULL(sdata) ? (unsigned long)NULL :
+		(unsigned long)sdata->data;
+}
+
+BPF_CALL_1(bpf_task_storage_delete, struct bpf_map *, map)
+{
+	int ret;
+
+	if (!bpf_task_storage_trylock())
+		return -EBUSY;
+
+	ret = task_storage_delete(current, map);
+	bpf_task_storage_unlock();
+	return ret;
+}
+
+static struct bpf_map *task_storage_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_local_storage_map *smap;
+
+	smap = bpf_local_storage_map_alloc(attr);
+	if (IS_ERR(smap))
+		return ERR_CAST(smap);
+
+	smap->cache_idx = bpf_local_storage_cache_idx_get(&task_cache);
+	return &smap->map;
+}
+
+static void task_storage_map_free(struct bpf_map *map)
+{
+	struct bpf_local_storage_map *smap;
+
+	smap = (struct bpf_local_storage_map *)map;
+	bpf_local_storage_cache_idx_free(&task_cache, smap->cache_idx);
+	bpf_local_storage_map_free(smap, &bpf_task_storage_busy);
+}
+
+const struct bpf_map_ops task_storage_map_ops = {
+	.map_alloc_check = bpf_local_storage_map_alloc_check,
+	.map_alloc = task_storage_map_alloc,
+	.map_free = task_storage_map_free,
+	.map_get_next_key = bpf_local_storage_map_get_next_key,
+	.map_lookup_elem = bpf_pid_task_storage_lookup_elem,
+	.map_update_elem = bpf_pid_task_storage_update_elem,
+	.map_delete_elem = bpf_pid_task_storage_delete_elem,
+	.map_owner_storage_ptr = task_storage_ptr,
+};
+
+const struct bpf_func_proto bpf_task_storage_get_proto = {
+	.func		= bpf_task_storage_get,
+	.gpl_only	= false,
+	.ret_type	= RET_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg3_type	= ARG_ANYTHING,
+};
+
+const struct bpf_func_proto bpf_task_storage_delete_proto = {
+	.func		= bpf_task_storage_delete,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+};
@@ -259,6 +259,8 @@ static const char * const btf_kind_str[NR_BTF_KINDS] = {
 	[BTF_KIND_VOLATILE]	= "VOLATILE",
 	[BTF_KIND_CONST]	= "CONST",
 	[BTF_KIND_RESTRICT]	= "RESTRICT",
+	[BTF_KIND_FUNC]		= "FUNC",
+	[BTF_KIND_FUNC_PROTO]	= "FUNC_PROTO",
 };
 
 struct btf_kind_operations {
@@ -342,6 +344,27 @@ static bool btf_type_is_int(const struct btf_type *t)
 	return BTF_INFO_KIND(t->info) == BTF_KIND_INT;
 }
 
+static bool btf_type_is_enum(const struct btf_type *t)
+{
+	return BTF_INFO_KIND(t->info) == BTF_KIND_ENUM;
+}
+
+static bool btf_type_is_func(const struct btf_type *t)
+{
+	return BTF_INFO_KIND(t->info) == BTF_KIND_FUNC;
+}
+
+static bool btf_type_is_func_proto(const struct btf_type *t)
+{
+	return BTF_INFO_KIND(t->info) == BTF_KIND_FUNC_PROTO;
+}
+
+/* What a modifier or ptr may legitimately end up at without a size */
+static bool btf_type_is_sizeless(const struct btf_type *t)
+{
+	return btf_type_is_void_or_null(t) || btf_type_is_func_proto(t);
+}
+
 /* What types need to be resolved?
  *
  * btf_type_is_modifier() is an obvious one.
@@ -415,6 +438,11 @@ static const struct btf_enum *btf_type_enum(const struct btf_type *t)
 	return (const struct btf_enum *)(t + 1);
 }
 
+static const struct btf_param *btf_type_params(const struct btf_type *t)
+{
+	return (const struct btf_param *)(t + 1);
+}
+
 static const struct btf_kind_operations *btf_type_ops(const struct btf_type *t)
 {
 	return kind_ops[BTF_INFO_KIND(t->info)];
@@ -835,6 +863,10 @@ const struct btf_type *btf_type_id_size(const struct btf *btf,
 		size = btf->resolved_sizes[size_type_id];
 	} else if (btf_type_is_ptr(size_type)) {
 		size = sizeof(void *);
+	} else if (btf_type_is_func(size_type) ||
+		   btf_type_is_func_proto(size_type)) {
+		/* a function has no size, only a pointer to it has */
+		return NULL;
 	} else {
 		if (WARN_ON_ONCE(!btf_type_is_modifier(size_type)))
 			return NULL;
@@ -842,7 +874,8 @@ const struct btf_type *btf_type_id_size(const struct btf *btf,
 		size = btf->resolved_sizes[size_type_id];
 		size_type_id = btf->resolved_ids[size_type_id];
 		size_type = btf_type_by_id(btf, size_type_id);
-		if (btf_type_is_void(size_type))
+		if (btf_type_is_void(size_type) ||
+		    btf_type_is_func_proto(size_type))
 			return NULL;
 	}
 
@@ -1163,8 +1196,11 @@ static int btf_modifier_resolve(struct btf_verifier_env *env,
 		return -EINVAL;
 	}
 
-	/* "typedef void new_void", "const void"...etc */
-	if (btf_type_is_void(next_type))
+	/* "typedef void new_void", "const void"...etc.
+	 * "typedef void fn_t(int)" is resolved to the function
+	 * prototype, which has no size either.
+	 */
+	if (btf_type_is_void(next_type) || btf_type_is_func_proto(next_type))
 		goto resolved;
 
 	if (!env_type_is_resolve_sink(env, next_type) &&
@@ -1178,7 +1214,7 @@ static int btf_modifier_resolve(struct btf_verifier_env *env,
 	 * pretty print).
 	 */
 	if (!btf_type_id_size(btf, &next_type_id, &next_type_size) &&
-	    !btf_type_is_void(btf_type_id_resolve(btf, &next_type_id))) {
+	    !btf_type_is_sizeless(btf_type_id_resolve(btf, &next_type_id))) {
 		btf_verifier_log_type(env, v->t, "Invalid type_id");
 		return -EINVAL;
 	}
@@ -1204,8 +1240,8 @@ static int btf_ptr_resolve(struct btf_verifier_env *env,
 		return -EINVAL;
 	}
 
-	/* "void *" */
-	if (btf_type_is_void(next_type))
+	/* "void *" and function pointers */
+	if (btf_type_is_void(next_type) || btf_type_is_func_proto(next_type))
 		goto resolved;
 
 	if (!env_type_is_resolve_sink(env, next_type) &&
@@ -1235,7 +1271,7 @@ static int btf_ptr_resolve(struct btf_verifier_env *env,
 	}
 
 	if (!btf_type_id_size(btf, &next_type_id, &next_type_size) &&
-	    !btf_type_is_void(btf_type_id_resolve(btf, &next_type_id))) {
+	    !btf_type_is_sizeless(btf_type_id_resolve(btf, &next_type_id))) {
 		btf_verifier_log_type(env, v->t, "Invalid type_id");
 		return -EINVAL;
 	}
@@ -1780,6 +1816,153 @@ static struct btf_kind_operations enum_ops = {
 	.seq_show = btf_enum_seq_show,
 };
 
+static s32 btf_func_proto_check_meta(struct btf_verifier_env *env,
+				     const struct btf_type *t,
+				     u32 meta_left)
+{
+	const struct btf_param *args = btf_type_params(t);
+	struct btf *btf = env->btf;
+	u16 i, nr_args;
+	u32 meta_needed;
+
+	nr_args = btf_type_vlen(t);
+	meta_needed = nr_args * sizeof(*args);
+
+	if (meta_left < meta_needed) {
+		btf_verifier_log_basic(env, t,
+				       "meta_left:%u meta_needed:%u",
+				       meta_left, meta_needed);
+		return -EINVAL;
+	}
+
+	if (t->name_off) {
+		btf_verifier_log_type(env, t, "Invalid name");
+		return -EINVAL;
+	}
+
+	if (!BTF_TYPE_ID_VALID(t->type)) {
+		btf_verifier_log_type(env, t, "Invalid type_id");
+		return -EINVAL;
+	}
+
+	btf_verifier_log_type(env, t, NULL);
+
+	for (i = 0; i < nr_args; i++) {
+		if (!btf_name_offset_valid(btf, args[i].name_off)) {
+			btf_verifier_log(env, "\tInvalid name_offset:%u",
+					 args[i].name_off);
+			return -EINVAL;
+		}
+
+		if (!BTF_TYPE_ID_VALID(args[i].type)) {
+			btf_verifier_log(env, "\tInvalid type_id:%u",
+					 args[i].type);
+			return -EINVAL;
+		}
+
+		btf_verifier_log(env, "\t%s type_id=%u\n",
+				 btf_name_by_offset(btf, args[i].name_off),
+				 args[i].type);
+	}
+
+	return meta_needed;
+}
+
+static void btf_func_proto_log(struct btf_verifier_env *env,
+			       const struct btf_type *t)
+{
+	btf_verifier_log(env, "return=%u vlen=%u", t->type, btf_type_vlen(t));
+}
+
+/* Runs once all the types are resolved, as the return and argument
+ * types may be modifiers that come later in the type section.
+ */
+static int btf_func_proto_check(struct btf_verifier_env *env,
+				const struct btf_type *t)
+{
+	const struct btf_param *args = btf_type_params(t);
+	u16 i, nr_args = btf_type_vlen(t);
+	struct btf *btf = env->btf;
+	u32 type_id;
+
+	type_id = t->type;
+	if (type_id && !btf_type_id_size(btf, &type_id, NULL)) {
+		btf_verifier_log_type(env, t, "Invalid return type");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nr_args; i++) {
+		/* "..." */
+		if (i == nr_args - 1 && !args[i].type && !args[i].name_off)
+			break;
+
+		type_id = args[i].type;
+		if (!btf_type_id_size(btf, &type_id, NULL)) {
+			btf_verifier_log_type(env, t, "Invalid arg#%u", i + 1);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static struct btf_kind_operations func_proto_ops = {
+	.check_meta = btf_func_proto_check_meta,
+	.resolve = btf_df_resolve,
+	/* A function cannot be a struct member or an array element,
+	 * only a pointer to it can.
+	 */
+	.check_member = btf_df_check_member,
+	.log_details = btf_func_proto_log,
+	.seq_show = btf_df_seq_show,
+};
+
+static s32 btf_func_check_meta(struct btf_verifier_env *env,
+			       const struct btf_type *t,
+			       u32 meta_left)
+{
+	if (!t->name_off) {
+		btf_verifier_log_type(env, t, "Invalid name");
+		return -EINVAL;
+	}
+
+	if (btf_type_vlen(t)) {
+		btf_verifier_log_type(env, t, "vlen != 0");
+		return -EINVAL;
+	}
+
+	if (!BTF_TYPE_ID_VALID(t->type)) {
+		btf_verifier_log_type(env, t, "Invalid type_id");
+		return -EINVAL;
+	}
+
+	btf_verifier_log_type(env, t, NULL);
+
+	return 0;
+}
+
+static int btf_func_check(struct btf_verifier_env *env,
+			  const struct btf_type *t)
+{
+	const struct btf_type *proto;
+
+	proto = btf_type_by_id(env->btf, t->type);
+	if (!proto || !btf_type_is_func_proto(proto)) {
+		btf_verifier_log_type(env, t, "Invalid type_id");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static struct btf_kind_operations func_ops = {
+	.check_meta = btf_func_check_meta,
+	.resolve = btf_df_resolve,
+	.check_member = btf_df_check_member,
+	.log_details = btf_ref_type_log,
+	.seq_show = btf_df_seq_show,
+};
+
 static const struct btf_kind_operations * const kind_ops[NR_BTF_KINDS] = {
 	[BTF_KIND_INT] = &int_ops,
 	[BTF_KIND_PTR] = &ptr_ops,
@@ -1792,6 +1975,8 @@ static const struct btf_kind_operations * const kind_ops[NR_BTF_KINDS] = {
 	[BTF_KIND_VOLATILE] = &modifier_ops,
 	[BTF_KIND_CONST] = &modifier_ops,
 	[BTF_KIND_RESTRICT] = &modifier_ops,
+	[BTF_KIND_FUNC] = &func_ops,
+	[BTF_KIND_FUNC_PROTO] = &func_proto_ops,
 };
 
 static s32 btf_check_meta(struct btf_verifier_env *env,
@@ -1949,6 +2134,18 @@ static int btf_check_all_types(struct btf_verifier_env *env)
 		}
 	}
 
+	for (type_id = 1; type_id <= btf->nr_types; type_id++) {
+		const struct btf_type *t = btf_type_by_id(btf, type_id);
+
+		env->log_type_id = type_id;
+		if (btf_type_is_func_proto(t))
+			err = btf_func_proto_check(env, t);
+		else if (btf_type_is_func(t))
+			err = btf_func_check(env, t);
+		if (err)
+			return err;
+	}
+
 	return 0;
 }
 
@@ -2226,6 +2423,121 @@ errout:
 	return ERR_PTR(err);
 }
 
+/* Find the 'struct bpf_spin_lock' at the top level of the map value type t.
+ * Returns its offset, -ENOENT if there is none, -E2BIG if there is more
+ * than one and -EINVAL if t isn't a struct or the lock is misplaced.
+ */
+int btf_find_spin_lock(const struct btf *btf, const struct btf_type *t)
+{
+	const struct btf_member *member;
+	u32 i, off = -ENOENT;
+
+	if (BTF_INFO_KIND(t->info) != BTF_KIND_STRUCT)
+		return -EINVAL;
+
+	for_each_member(i, t, member) {
+		const struct btf_type *member_type = btf_type_by_id(btf,
+								member->type);
+
+		if (BTF_INFO_KIND(member_type->info) != BTF_KIND_STRUCT)
+			continue;
+		if (member_type->size != sizeof(struct bpf_spin_lock))
+			continue;
+		if (strcmp(btf_name_by_offset(btf, member_type->name_off),
+			   "bpf_spin_lock"))
+			continue;
+		if (off != -ENOENT)
+			/* only one 'struct bpf_spin_lock' is allowed */
+			return -E2BIG;
+		off = member->offset;
+		if (off % 8)
+			/* valid C code cannot generate such BTF */
+			return -EINVAL;
+		off /= 8;
+		if (off % __alignof__(struct bpf_spin_lock))
+			/* valid struct bpf_spin_lock will be 4 byte aligned */
+			return -EINVAL;
+	}
+	return off;
+}
+
+/* Size of an argument or return value as a trampoline passes it on:
+ * 0 for void, up to 8 bytes for integers, enums and pointers.  Anything
+ * else does not fit in a register.
+ */
+static int btf_func_model_size(const struct btf *btf, u32 type_id)
+{
+	const struct btf_type *t;
+	u32 size;
+
+	if (!type_id)
+		return 0;
+
+	t = btf_type_id_size(btf, &type_id, &size);
+	if (!t || size > sizeof(u64))
+		return -EINVAL;
+	if (btf_type_is_int(t) && !btf_type_int_is_regular(t))
+		return -EINVAL;
+	if (!btf_type_is_int(t) && !btf_type_is_enum(t) && !btf_type_is_ptr(t))
+		return -EINVAL;
+
+	return size;
+}
+
+int btf_distill_func_proto(struct bpf_verifier_env *env,
+			   const struct btf *btf, u32 func_id,
+			   const char **func_name, struct btf_func_model *m)
+{
+	const struct btf_param *args;
+	const struct btf_type *t;
+	const char *name;
+	u32 i, nr_args;
+	int size;
+
+	t = btf_type_by_id(btf, func_id);
+	if (!t || !btf_type_is_func(t)) {
+		bpf_verifier_log_write(env, "btf_id %u is not a function\n",
+				       func_id);
+		return -EINVAL;
+	}
+	name = btf_name_by_offset(btf, t->name_off);
+
+	/* btf_func_check() made sure this is a FUNC_PROTO */
+	t = btf_type_by_id(btf, t->type);
+	args = btf_type_params(t);
+	nr_args = btf_type_vlen(t);
+	if (nr_args > MAX_BPF_FUNC_ARGS) {
+		bpf_verifier_log_write(env,
+				       "function %s has %u args, at most %u are supported\n",
+				       name, nr_args, MAX_BPF_FUNC_ARGS);
+		return -E2BIG;
+	}
+
+	size = btf_func_model_size(btf, t->type);
+	if (size < 0) {
+		bpf_verifier_log_write(env,
+				       "function %s doesn't return a scalar or pointer\n",
+				       name);
+		return size;
+	}
+	m->ret_size = size;
+
+	for (i = 0; i < nr_args; i++) {
+		size = btf_func_model_size(btf, args[i].type);
+		if (size <= 0) {
+			bpf_verifier_log_write(env,
+					       "function %s arg%u is not a scalar or pointer\n",
+					       name, i);
+			return -EINVAL;
+		}
+		m->arg_size[i] = size;
+	}
+	m->nr_args = nr_args;
+	*func_name = name;
+
+	return 0;
+}
+
 void btf_type_seq_show(const struct btf *btf, u32 type_id, void *obj,
 		       struct seq_file *m)
 {
@@ -27,6 +27,7 @@
 #include <linux/random.h>
 #include <linux/moduleloader.h>
 #include <linux/bpf.h>
+#include <linux/btf.h>
 #include <linux/frame.h>
 #include <linux/rbtree_latch.h>
 #include <linux/kallsyms.h>
@@ -1732,6 +1733,11 @@ static void bpf_prog_free_deferred(struct work_struct *work)
 #ifdef CONFIG_PERF_EVENTS
 	if (aux->prog->has_callchain_buf)
 		put_callchain_buffers();
+#endif
+	bpf_trampoline_put(aux->trampoline);
+#ifdef CONFIG_BPF_SYSCALL
+	if (aux->attach_btf)
+		btf_put(aux->attach_btf);
 #endif
 	for (i = 0; i < aux->func_cnt; i++)
 		bpf_jit_free(aux->func[i]);
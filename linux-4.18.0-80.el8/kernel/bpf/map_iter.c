@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF iterator target "bpf_map_elem": every element of the map given to
+ * BPF_PROG_ITER_CREATE, walked with the map's get_next_key and lookup ops.
+ */
+#include <linux/init.h>
+#include <linux/filter.h>
+#include <linux/slab.h>
+#include <linux/bpf.h>
+
+struct bpf_iter_seq_map_elem_info {
+	struct bpf_map *map;
+	/* key of the element returned by the last start() or next() */
+	void *key;
+	bool have_key;
+	bool done;
+};
+
+/* Return the value of the first element after info->key, or of the very
+ * first element if there is no key yet, and update info->key. Called
+ * under rcu_read_lock().
+ */
+static void *map_elem_seq_get_next(struct bpf_iter_seq_map_elem_info *info)
+{
+	struct bpf_map *map = info->map;
+	void *value;
+
+	while (!info->done) {
+		if (map->ops->map_get_next_key(map,
+					       info->have_key ? info->key : NULL,
+					       info->key)) {
+			info->done = true;
+			break;
+		}
+		info->have_key = true;
+		/* the element may be gone already, try the one after it */
+		value = map->ops->map_lookup_elem(map, info->key);
+		if (value)
+			return value;
+	}
+	return NULL;
+}
+
+static void *map_elem_seq_start(struct seq_file *seq, loff_t *pos)
+	__acquires(RCU)
+{
+	struct bpf_iter_seq_map_elem_info *info = seq->private;
+	void *value;
+
+	rcu_read_lock();
+	if (info->done)
+		return NULL;
+
+	/* A read() that ended on an element shows it again. If it was
+	 * deleted in between, a hash map starts over from its first element.
+	 */
+	if (info->have_key) {
+		value = info->map->ops->map_lookup_elem(info->map, info->key);
+		if (value)
+			return value;
+	}
+
+	value = map_elem_seq_get_next(info);
+	if (value && *pos == 0)
+		++*pos;
+	return value;
+}
+
+static void *map_elem_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct bpf_iter_seq_map_elem_info *info = seq->private;
+
+	++*pos;
+	return map_elem_seq_get_next(info);
+}
+
+/* context of "bpf_map_elem" programs */
+struct bpf_iter__bpf_map_elem {
+	struct bpf_iter_meta *meta;
+	struct bpf_map *map;
+	void *key;
+	void *value;
+};
+
+static int __map_elem_seq_show(struct seq_file *seq, void *value,
+			       bool in_stop)
+{
+	struct bpf_iter_seq_map_elem_info *info = seq->private;
+	struct bpf_iter__bpf_map_elem ctx;
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+
+	meta.seq = seq;
+	prog = bpf_iter_get_info(&meta, in_stop);
+	if (!prog)
+		return 0;
+
+	ctx.meta = &meta;
+	ctx.map = info->map;
+	ctx.key = value ? info->key : NULL;
+	ctx.value = value;
+	return bpf_iter_run_prog(prog, &ctx);
+}
+
+static int map_elem_seq_show(struct seq_file *seq, void *v)
+{
+	return __map_elem_seq_show(seq, v, false);
+}
+
+static void map_elem_seq_stop(struct seq_file *seq, void *v)
+	__releases(RCU)
+{
+	if (!v)
+		(void)__map_elem_seq_show(seq, v, true);
+
+	rcu_read_unlock();
+}
+
+/* Values are handed to the program as they are stored, which is only a
+ * plain copy of the value for these map types.
+ */
+static int init_seq_map_elem(void *priv_data, struct bpf_map *map)
+{
+	struct bpf_iter_seq_map_elem_info *info = priv_data;
+
+	switch (map->map_type) {
+	case BPF_MAP_TYPE_HASH:
+	case BPF_MAP_TYPE_LRU_HASH:
+	case BPF_MAP_TYPE_ARRAY:
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	info->key = kmalloc(map->key_size, GFP_USER | __GFP_NOWARN);
+	if (!info->key)
+		return -ENOMEM;
+	info->map = map;
+	return 0;
+}
+
+static void fini_seq_map_elem(void *priv_data)
+{
+	struct bpf_iter_seq_map_elem_info *info = priv_data;
+
+	kfree(info->key);
+}
+
+static const struct seq_operations map_elem_seq_ops = {
+	.start	= map_elem_seq_start,
+	.next	= map_elem_seq_next,
+	.stop	= map_elem_seq_stop,
+	.show	= map_elem_seq_show,
+};
+
+static const struct bpf_iter_reg map_elem_reg_info = {
+	.target			= "bpf_map_elem",
+	.seq_ops		= &map_elem_seq_ops,
+	.init_seq_private	= init_seq_map_elem,
+	.fini_seq_private	= fini_seq_map_elem,
+	.seq_priv_size		= sizeof(struct bpf_iter_seq_map_elem_info),
+	.ctx_arg_cnt		= 4,
+	.needs_map		= true,
+};
+
+static int __init bpf_map_iter_init(void)
+{
+	return bpf_iter_reg_target(&map_elem_reg_info);
+}
+late_initcall(bpf_map_iter_init);
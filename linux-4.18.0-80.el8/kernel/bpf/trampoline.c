@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF trampolines: BPF_PROG_TYPE_TRACING programs attached to the entry
+ * (fentry) or exit (fexit) of a kernel function.
+ *
+ * All programs attached to one function share a trampoline. The fentry
+ * call-site of the function, normally a nop patched by ftrace, is turned
+ * into a direct call to an image generated by the arch code that saves the
+ * arguments, calls the fentry programs, optionally calls the function
+ * itself and then calls the fexit programs. Every update generates a new
+ * image, since tasks may still be executing the old one.
+ *
+ * An image that calls the traced function can be returned into long after
+ * the call-site stopped pointing at it: the task may sleep in the function.
+ * Such images count the tasks inside the function in a percpu_ref, taken
+ * by __bpf_tramp_enter() before the call and dropped by __bpf_tramp_exit()
+ * in the epilogue, and are only freed once it drops to zero.
+ */
+#include <linux/hash.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/ftrace.h>
+#include <linux/moduleloader.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <asm/set_memory.h>
+
+/* one trampoline per traced function, 1k buckets are plenty */
+#define TRAMPOLINE_HASH_BITS 10
+#define TRAMPOLINE_TABLE_SIZE (1 << TRAMPOLINE_HASH_BITS)
+
+static struct hlist_head trampoline_table[TRAMPOLINE_TABLE_SIZE];
+
+/* serializes access to trampoline_table */
+static DEFINE_MUTEX(trampoline_mutex);
+
+struct bpf_trampoline *bpf_trampoline_lookup(void *addr,
+					     const struct btf_func_model *m)
+{
+	u64 key = (unsigned long)addr;
+	struct bpf_trampoline *tr;
+	struct hlist_head *head;
+	int i;
+
+	mutex_lock(&trampoline_mutex);
+	head = &trampoline_table[hash_64(key, TRAMPOLINE_HASH_BITS)];
+	hlist_for_each_entry(tr, head, hlist) {
+		if (tr->func.addr == addr) {
+			/* every program attached to the function must see
+			 * the same arguments
+			 */
+			if (memcmp(&tr->func.model, m, sizeof(*m))) {
+				tr = ERR_PTR(-EINVAL);
+				goto out;
+			}
+			refcount_inc(&tr->refcnt);
+			goto out;
+		}
+	}
+	tr = kzalloc(sizeof(*tr), GFP_KERNEL);
+	if (!tr) {
+		tr = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+
+	tr->func.addr = addr;
+	tr->func.model = *m;
+	INIT_HLIST_NODE(&tr->hlist);
+	hlist_add_head(&tr->hlist, head);
+	refcount_set(&tr->refcnt, 1);
+	mutex_init(&tr->mutex);
+	for (i = 0; i < BPF_TRAMP_MAX; i++)
+		INIT_HLIST_HEAD(&tr->progs_hlist[i]);
+out:
+	mutex_unlock(&trampoline_mutex);
+	return tr;
+}
+
+static int bpf_trampoline_patch(struct bpf_trampoline *tr, void *old_image,
+				void *new_image)
+{
+	unsigned long ip = (unsigned long)tr->func.addr;
+	int err;
+
+	if (old_image)
+		return bpf_arch_text_poke(tr->func.addr, BPF_MOD_CALL,
+					  old_image, new_image);
+
+	/* first program: take the call-site away from ftrace */
+	err = ftrace_location_reserve(ip);
+	if (err)
+		return err;
+	err = bpf_arch_text_poke(tr->func.addr, BPF_MOD_CALL, NULL, new_image);
+	if (err)
+		ftrace_location_release(ip);
+	return err;
+}
+
+static void bpf_tramp_image_free(struct bpf_tramp_image *im)
+{
+	set_memory_rw((unsigned long)im->image, 1);
+	module_memfree(im->image);
+	percpu_ref_exit(&im->pcref);
+	kfree(im);
+}
+
+static void bpf_tramp_image_free_deferred(struct work_struct *work)
+{
+	bpf_tramp_image_free(container_of(work, struct bpf_tramp_image, work));
+}
+
+/* the epilogue after __bpf_tramp_exit() is done too, free from a worker
+ * since set_memory_rw() and module_memfree() may sleep
+ */
+static void bpf_tramp_image_free_rcu(struct rcu_head *rcu)
+{
+	struct bpf_tramp_image *im = container_of(rcu, struct bpf_tramp_image,
+						  rcu);
+
+	INIT_WORK(&im->work, bpf_tramp_image_free_deferred);
+	schedule_work(&im->work);
+}
+
+/* the last task returned from the traced function into the image */
+static void bpf_tramp_image_release(struct percpu_ref *pcref)
+{
+	struct bpf_tramp_image *im = container_of(pcref, struct bpf_tramp_image,
+						  pcref);
+
+	call_rcu_tasks(&im->rcu, bpf_tramp_image_free_rcu);
+}
+
+static struct bpf_tramp_image *bpf_tramp_image_alloc(void)
+{
+	struct bpf_tramp_image *im;
+
+	im = kzalloc(sizeof(*im), GFP_KERNEL);
+	if (!im)
+		return ERR_PTR(-ENOMEM);
+
+	/* module_alloc() keeps the image within rel32 reach of kernel text */
+	im->image = module_alloc(PAGE_SIZE);
+	if (!im->image) {
+		kfree(im);
+		return ERR_PTR(-ENOMEM);
+	}
+	if (percpu_ref_init(&im->pcref, bpf_tramp_image_release, 0,
+			    GFP_KERNEL)) {
+		module_memfree(im->image);
+		kfree(im);
+		return ERR_PTR(-ENOMEM);
+	}
+	return im;
+}
+
+/* Called once the call-site no longer points to im and an RCU tasks grace
+ * period has passed, so no task is left in the image before the call of
+ * the traced function or in the programs.
+ */
+static void bpf_tramp_image_put(struct bpf_tramp_image *im)
+{
+	if (!im->ip_after_call) {
+		bpf_tramp_image_free(im);
+		return;
+	}
+	/* tasks sleeping in the traced function return to the epilogue */
+	percpu_ref_kill(&im->pcref);
+}
+
+static int bpf_trampoline_update(struct bpf_trampoline *tr)
+{
+	struct bpf_tramp_image *old_im = tr->cur_image;
+	struct bpf_prog *progs_to_run[BPF_MAX_TRAMP_PROGS];
+	int fentry_cnt = tr->progs_cnt[BPF_TRAMP_FENTRY];
+	int fexit_cnt = tr->progs_cnt[BPF_TRAMP_FEXIT];
+	struct bpf_prog **progs, **fentry, **fexit;
+	u32 flags = BPF_TRAMP_F_RESTORE_REGS;
+	struct bpf_tramp_image *im = NULL;
+	struct bpf_prog_aux *aux;
+	int err;
+
+	if (fentry_cnt + fexit_cnt == 0) {
+		err = bpf_arch_text_poke(tr->func.addr, BPF_MOD_CALL,
+					 old_im->image, NULL);
+		if (err)
+			return err;
+		ftrace_location_release((unsigned long)tr->func.addr);
+		goto out;
+	}
+
+	im = bpf_tramp_image_alloc();
+	if (IS_ERR(im))
+		return PTR_ERR(im);
+
+	/* populate fentry progs */
+	fentry = progs = progs_to_run;
+	hlist_for_each_entry(aux, &tr->progs_hlist[BPF_TRAMP_FENTRY], tramp_hlist)
+		*progs++ = aux->prog;
+
+	/* populate fexit progs */
+	fexit = progs;
+	hlist_for_each_entry(aux, &tr->progs_hlist[BPF_TRAMP_FEXIT], tramp_hlist)
+		*progs++ = aux->prog;
+
+	if (fexit_cnt)
+		flags = BPF_TRAMP_F_CALL_ORIG | BPF_TRAMP_F_SKIP_FRAME;
+
+	err = arch_prepare_bpf_trampoline(im, im->image,
+					  im->image + PAGE_SIZE,
+					  &tr->func.model, flags,
+					  fentry, fentry_cnt,
+					  fexit, fexit_cnt,
+					  tr->func.addr);
+	if (err)
+		goto out_free;
+	set_memory_ro((unsigned long)im->image, 1);
+
+	err = bpf_trampoline_patch(tr, old_im ? old_im->image : NULL,
+				   im->image);
+	if (err)
+		goto out_free;
+out:
+	tr->cur_image = im;
+	if (!old_im)
+		return 0;
+
+	/* Tasks still sleeping in the traced function skip the fexit
+	 * programs of the old image, which may be about to be freed.
+	 */
+	if (old_im->ip_after_call)
+		WARN_ON_ONCE(bpf_arch_text_poke(old_im->ip_after_call,
+						BPF_MOD_JUMP, NULL,
+						old_im->ip_epilogue));
+	/* A task preempted before it reached __bpf_prog_enter() or
+	 * __bpf_tramp_enter() in the old image may still run it. Wait for
+	 * every task to pass through a voluntary context switch, so that
+	 * unlinked programs can be freed and the image can be put.
+	 */
+	synchronize_rcu_tasks();
+	bpf_tramp_image_put(old_im);
+	return 0;
+
+out_free:
+	bpf_tramp_image_free(im);
+	return err;
+}
+
+static enum bpf_tramp_prog_type bpf_attach_type_to_tramp(enum bpf_attach_type t)
+{
+	switch (t) {
+	case BPF_TRACE_FENTRY:
+		return BPF_TRAMP_FENTRY;
+	default:
+		return BPF_TRAMP_FEXIT;
+	}
+}
+
+int bpf_trampoline_link_prog(struct bpf_prog *prog)
+{
+	enum bpf_tramp_prog_type kind;
+	struct bpf_trampoline *tr;
+	int err = 0;
+
+	tr = prog->aux->trampoline;
+	kind = bpf_attach_type_to_tramp(prog->expected_attach_type);
+	mutex_lock(&tr->mutex);
+	if (tr->progs_cnt[BPF_TRAMP_FENTRY] + tr->progs_cnt[BPF_TRAMP_FEXIT]
+	    >= BPF_MAX_TRAMP_PROGS) {
+		err = -E2BIG;
+		goto out;
+	}
+	if (!hlist_unhashed(&prog->aux->tramp_hlist)) {
+		/* prog already linked */
+		err = -EBUSY;
+		goto out;
+	}
+	hlist_add_head(&prog->aux->tramp_hlist, &tr->progs_hlist[kind]);
+	tr->progs_cnt[kind]++;
+	err = bpf_trampoline_update(tr);
+	if (err) {
+		hlist_del_init(&prog->aux->tramp_hlist);
+		tr->progs_cnt[kind]--;
+	}
+out:
+	mutex_unlock(&tr->mutex);
+	return err;
+}
+
+/* bpf_trampoline_unlink_prog() should never fail. */
+int bpf_trampoline_unlink_prog(struct bpf_prog *prog)
+{
+	enum bpf_tramp_prog_type kind;
+	struct bpf_trampoline *tr;
+	int err;
+
+	tr = prog->aux->trampoline;
+	kind = bpf_attach_type_to_tramp(prog->expected_attach_type);
+	mutex_lock(&tr->mutex);
+	hlist_del_init(&prog->aux->tramp_hlist);
+	tr->progs_cnt[kind]--;
+	err = bpf_trampoline_update(tr);
+	mutex_unlock(&tr->mutex);
+	return err;
+}
+
+void bpf_trampoline_put(struct bpf_trampoline *tr)
+{
+	if (!tr)
+		return;
+	mutex_lock(&trampoline_mutex);
+	if (!refcount_dec_and_test(&tr->refcnt))
+		goto out;
+	WARN_ON_ONCE(mutex_is_locked(&tr->mutex));
+	if (WARN_ON_ONCE(!hlist_empty(&tr->progs_hlist[BPF_TRAMP_FENTRY])))
+		goto out;
+	if (WARN_ON_ONCE(!hlist_empty(&tr->progs_hlist[BPF_TRAMP_FEXIT])))
+		goto out;
+	/* the last image, if any, is freed on its own once unused */
+	WARN_ON_ONCE(tr->cur_image);
+	hlist_del(&tr->hlist);
+	kfree(tr);
+out:
+	mutex_unlock(&trampoline_mutex);
+}
+
+/* The logic is similar to BPF_PROG_RUN, but with explicit rcu and preempt
+ * that are needed by the trampoline. Recursion into a BPF program running
+ * on the same cpu is skipped the same way kprobe programs are, through
+ * bpf_prog_active; the return value tells __bpf_prog_exit() whether the
+ * program was run.
+ */
+u64 notrace __bpf_prog_enter(void)
+{
+	preempt_disable_notrace();
+	if (unlikely(__this_cpu_inc_return(bpf_prog_active) != 1))
+		return 0;
+	rcu_read_lock();
+	return 1;
+}
+
+void notrace __bpf_prog_exit(u64 active)
+{
+	if (active)
+		rcu_read_unlock();
+	__this_cpu_dec(bpf_prog_active);
+	preempt_enable_notrace();
+}
+
+void notrace __bpf_tramp_enter(struct bpf_tramp_image *im)
+{
+	percpu_ref_get(&im->pcref);
+}
+
+void notrace __bpf_tramp_exit(struct bpf_tramp_image *im)
+{
+	percpu_ref_put(&im->pcref);
+}
+
+int __weak
+arch_prepare_bpf_trampoline(struct bpf_tramp_image *im,
+			    void *image, void *image_end,
+			    const struct btf_func_model *m, u32 flags,
+			    struct bpf_prog **fentry_progs, int fentry_cnt,
+			    struct bpf_prog **fexit_progs, int fexit_cnt,
+			    void *orig_call)
+{
+	return -ENOTSUPP;
+}
+
+int __weak bpf_arch_text_poke(void *ip, enum bpf_text_poke_type t,
+			      void *old_addr, void *new_addr)
+{
+	return -ENOTSUPP;
+}
@@ -568,6 +568,20 @@ tracing_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 	case BPF_FUNC_get_current_cgroup_id:
 		return &bpf_get_current_cgroup_id_proto;
 #endif
+	case BPF_FUNC_ringbuf_output:
+		return &bpf_ringbuf_output_proto;
+	case BPF_FUNC_ringbuf_reserve:
+		return &bpf_ringbuf_reserve_proto;
+	case BPF_FUNC_ringbuf_submit:
+		return &bpf_ringbuf_submit_proto;
+	case BPF_FUNC_ringbuf_discard:
+		return &bpf_ringbuf_discard_proto;
+	case BPF_FUNC_ringbuf_query:
+		return &bpf_ringbuf_query_proto;
+	case BPF_FUNC_current_task_storage_get:
+		return &bpf_task_storage_get_proto;
+	case BPF_FUNC_current_task_storage_delete:
+		return &bpf_task_storage_delete_proto;
 	default:
 		return NULL;
 	}
@@ -874,6 +888,51 @@ const struct bpf_verifier_ops raw_tracepoint_verifier_ops = {
 const struct bpf_prog_ops raw_tracepoint_prog_ops = {
 };
 
+static const struct bpf_func_proto *
+tracing_prog_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
+{
+	switch (func_id) {
+	case BPF_FUNC_iter_seq_write:
+		return prog->expected_attach_type == BPF_TRACE_ITER ?
+		       &bpf_iter_seq_write_proto : NULL;
+	default:
+		return tracing_func_proto(func_id, prog);
+	}
+}
+
+static bool tracing_prog_is_valid_access(int off, int size,
+					 enum bpf_access_type type,
+					 const struct bpf_prog *prog,
+					 struct bpf_insn_access_aux *info)
+{
+	const struct btf_func_model *m = &prog->aux->attach_model;
+	u32 nr_slots = m->nr_args;
+
+	/* fexit programs see the return value in the slot after the args */
+	if (prog->expected_attach_type == BPF_TRACE_FEXIT && m->ret_size)
+		nr_slots++;
+
+	/* arguments are widened to u64 by the trampoline */
+	if (off < 0 || off >= sizeof(__u64) * nr_slots)
+		return false;
+	if (type != BPF_READ)
+		return false;
+	if (size != sizeof(__u64) || off % size != 0)
+		return false;
+	return true;
+}
+
+const struct bpf_verifier_ops tracing_verifier_ops = {
+	.get_func_proto  = tracing_prog_func_proto,
+	.is_valid_access = tracing_prog_is_valid_access,
+};
+
+const struct bpf_prog_ops tracing_prog_ops = {
+#ifdef CONFIG_NET
+	.test_run = bpf_prog_test_run_tracing,
+#endif
+};
+
 static bool pe_prog_is_valid_access(int off, int size, enum bpf_access_type type,
 				    const struct bpf_prog *prog,
 				    struct bpf_insn_access_aux *info)
@@ -1587,22 +1587,10 @@ static int ftrace_cmp_recs(const void *a, const void *b)
 	return 0;
 }
 
-/**
- * ftrace_location_range - return the first address of a traced location
- *	if it touches the given ip range
- * @start: start of range to search.
- * @end: end of range to search (inclusive). @end points to the last byte
- *	to check.
- *
- * Returns rec->ip if the related ftrace location is a least partly within
- * the given address range. That is, the first address of the instruction
- * that is either a NOP or call to the function tracer. It checks the ftrace
- * internal tables to determine if the address belongs or not.
- */
-unsigned long ftrace_location_range(unsigned long start, unsigned long end)
+static struct dyn_ftrace *lookup_rec(unsigned long start, unsigned long end)
 {
 	struct ftrace_page *pg;
-	struct dyn_ftrace *rec;
+	struct dyn_ftrace *rec = NULL;
 	struct dyn_ftrace key;
 
 	key.ip = start;
@@ -1616,8 +1604,30 @@ unsigned long ftrace_location_range(unsigned long start, unsigned long end)
 			      sizeof(struct dyn_ftrace),
 			      ftrace_cmp_recs);
 		if (rec)
-			return rec->ip;
+			break;
 	}
+	return rec;
+}
+
+/**
+ * ftrace_location_range - return the first address of a traced location
+ *	if it touches the given ip range
+ * @start: start of range to search.
+ * @end: end of range to search (inclusive). @end points to the last byte
+ *	to check.
+ *
+ * Returns rec->ip if the related ftrace location is a least partly within
+ * the given address range. That is, the first address of the instruction
+ * that is either a NOP or call to the function tracer. It checks the ftrace
+ * internal tables to determine if the address belongs or not.
+ */
+unsigned long ftrace_location_range(unsigned long start, unsigned long end)
+{
+	struct dyn_ftrace *rec;
+
+	rec = lookup_rec(start, end);
+	if (rec)
+		return rec->ip;
 
 	return 0;
 }
@@ -2107,7 +2117,7 @@ static int ftrace_check_record(struct dyn_ftrace *rec, int enable, int update)
 
 	ftrace_bug_type = FTRACE_BUG_UNKNOWN;
 
-	if (rec->flags & FTRACE_FL_DISABLED)
+	if (rec->flags & (FTRACE_FL_DISABLED | FTRACE_FL_BPF))
 		return FTRACE_UPDATE_IGNORE;
 
 	/*
@@ -2673,6 +2683,57 @@ static void ftrace_run_update_code(int command)
 	FTRACE_WARN_ON(ret);
 }
 
+/**
+ * ftrace_location_reserve - hand a traced location over to BPF
+ * @ip: the address of the mcount/fentry call-site
+ *
+ * Marks the record at @ip with FTRACE_FL_BPF so that ftrace no longer
+ * patches the call-site, leaving it to the BPF trampoline code. Fails with
+ * -EBUSY if ftrace is using the location or it is already reserved.
+ */
+int ftrace_location_reserve(unsigned long ip)
+{
+	struct dyn_ftrace *rec;
+	int ret = 0;
+
+	mutex_lock(&ftrace_lock);
+	rec = lookup_rec(ip, ip);
+	if (!rec || rec->ip != ip) {
+		ret = -ENOENT;
+		goto out;
+	}
+	if (rec->flags & (FTRACE_FL_DISABLED | FTRACE_FL_BPF |
+			  FTRACE_FL_ENABLED) || ftrace_rec_count(rec)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	rec->flags |= FTRACE_FL_BPF;
+ out:
+	mutex_unlock(&ftrace_lock);
+	return ret;
+}
+
+/**
+ * ftrace_location_release - give a location reserved for BPF back to ftrace
+ * @ip: the address of the mcount/fentry call-site
+ *
+ * The caller must have restored the call-site to a nop. Any ftrace_ops
+ * that registered for the function meanwhile are enabled now.
+ */
+void ftrace_location_release(unsigned long ip)
+{
+	struct dyn_ftrace *rec;
+
+	mutex_lock(&ftrace_lock);
+	rec = lookup_rec(ip, ip);
+	if (!WARN_ON_ONCE(!rec || !(rec->flags & FTRACE_FL_BPF))) {
+		rec->flags &= ~FTRACE_FL_BPF;
+		if (ftrace_enabled && ftrace_rec_count(rec))
+			ftrace_run_update_code(FTRACE_UPDATE_CALLS);
+	}
+	mutex_unlock(&ftrace_lock);
+}
+
 static void ftrace_run_modify_code(struct ftrace_ops *ops, int command,
 				   struct ftrace_ops_hash *old_hash)
 {
@@ -430,6 +430,14 @@ struct rb_irq_work {
 	bool				wakeup_full;
 };
 
+/*
+ * Number of pages given back by ring_buffer_free_read_page() that are
+ * kept per cpu for reuse. Splicing trace_pipe_raw moves up to a pipe
+ * worth of pages at a time, this lets a reader that keeps up with the
+ * writers recycle them without going through the page allocator.
+ */
+#define RB_NR_FREE_PAGES	16
+
 /*
  * Structure to hold event state and handle nested events.
  */
@@ -439,6 +447,7 @@ struct rb_event_info {
 	unsigned long		length;
 	struct buffer_page	*tail_page;
 	int			add_timestamp;
+	bool			drop;		/* never overwrite when full */
 };
 
 /*
@@ -468,7 +477,9 @@ struct ring_buffer_per_cpu {
 	raw_spinlock_t			reader_lock;	/* serialize readers */
 	arch_spinlock_t			lock;
 	struct lock_class_key		lock_key;
-	struct buffer_data_page		*free_page;
+	/* spare pages for ring_buffer_alloc_read_page() */
+	struct buffer_data_page		*free_pages[RB_NR_FREE_PAGES];
+	unsigned int			nr_free_pages;
 	unsigned long			nr_pages;
 	unsigned int			current_context;
 	struct list_head		*pages;
@@ -1322,6 +1333,10 @@ static void rb_free_cpu_buffer(struct ring_buffer_per_cpu *cpu_buffer)
 	struct list_head *head = cpu_buffer->pages;
 	struct buffer_page *bpage, *tmp;
 
+	while (cpu_buffer->nr_free_pages)
+		free_page((unsigned long)
+			  cpu_buffer->free_pages[--cpu_buffer->nr_free_pages]);
+
 	free_buffer_page(cpu_buffer->reader_page);
 
 	rb_head_page_deactivate(cpu_buffer);
@@ -2218,10 +2233,11 @@ rb_move_tail(struct ring_buffer_per_cpu *cpu_buffer,
 		 */
 		if (!rb_is_reader_page(cpu_buffer->commit_page)) {
 			/*
-			 * If we are not in overwrite mode,
+			 * If we are not in overwrite mode, or this
+			 * event must not overwrite older ones,
 			 * this is easy, just stop here.
 			 */
-			if (!(buffer->flags & RB_FL_OVERWRITE)) {
+			if (!(buffer->flags & RB_FL_OVERWRITE) || info->drop) {
 				local_inc(&cpu_buffer->dropped_events);
 				goto out_reset;
 			}
@@ -2827,7 +2843,7 @@ __rb_reserve_next(struct ring_buffer_per_cpu *cpu_buffer,
 static __always_inline struct ring_buffer_event *
 rb_reserve_next_event(struct ring_buffer *buffer,
 		      struct ring_buffer_per_cpu *cpu_buffer,
-		      unsigned long length)
+		      unsigned long length, bool drop)
 {
 	struct ring_buffer_event *event;
 	struct rb_event_info info;
@@ -2852,6 +2868,7 @@ rb_reserve_next_event(struct ring_buffer *buffer,
 #endif
 
 	info.length = rb_calculate_event_length(length);
+	info.drop = drop;
  again:
 	info.add_timestamp = 0;
 	info.delta = 0;
@@ -2902,23 +2919,9 @@ rb_reserve_next_event(struct ring_buffer *buffer,
 	return NULL;
 }
 
-/**
- * ring_buffer_lock_reserve - reserve a part of the buffer
- * @buffer: the ring buffer to reserve from
- * @length: the length of the data to reserve (excluding event header)
- *
- * Returns a reserved event on the ring buffer to copy directly to.
- * The user of this interface will need to get the body to write into
- * and can use the ring_buffer_event_data() interface.
- *
- * The length is the length of the data needed, not the event length
- * which also includes the event header.
- *
- * Must be paired with ring_buffer_unlock_commit, unless NULL is returned.
- * If NULL is returned, then nothing has been allocated or locked.
- */
-struct ring_buffer_event *
-ring_buffer_lock_reserve(struct ring_buffer *buffer, unsigned long length)
+static __always_inline struct ring_buffer_event *
+__ring_buffer_lock_reserve(struct ring_buffer *buffer, unsigned long length,
+			   bool drop)
 {
 	struct ring_buffer_per_cpu *cpu_buffer;
 	struct ring_buffer_event *event;
@@ -2946,7 +2949,7 @@ ring_buffer_lock_reserve(struct ring_buffer *buffer, unsigned long length)
 	if (unlikely(trace_recursive_lock(cpu_buffer)))
 		goto out;
 
-	event = rb_reserve_next_event(buffer, cpu_buffer, length);
+	event = rb_reserve_next_event(buffer, cpu_buffer, length, drop);
 	if (!event)
 		goto out_unlock;
 
@@ -2958,8 +2961,47 @@ ring_buffer_lock_reserve(struct ring_buffer *buffer, unsigned long length)
 	preempt_enable_notrace();
 	return NULL;
 }
+
+/**
+ * ring_buffer_lock_reserve - reserve a part of the buffer
+ * @buffer: the ring buffer to reserve from
+ * @length: the length of the data to reserve (excluding event header)
+ *
+ * Returns a reserved event on the ring buffer to copy directly to.
+ * The user of this interface will need to get the body to write into
+ * and can use the ring_buffer_event_data() interface.
+ *
+ * The length is the length of the data needed, not the event length
+ * which also includes the event header.
+ *
+ * Must be paired with ring_buffer_unlock_commit, unless NULL is returned.
+ * If NULL is returned, then nothing has been allocated or locked.
+ */
+struct ring_buffer_event *
+ring_buffer_lock_reserve(struct ring_buffer *buffer, unsigned long length)
+{
+	return __ring_buffer_lock_reserve(buffer, length, false);
+}
 EXPORT_SYMBOL_GPL(ring_buffer_lock_reserve);
 
+/**
+ * ring_buffer_lock_reserve_drop - reserve a part of the buffer, never overwrite
+ * @buffer: the ring buffer to reserve from
+ * @length: the length of the data to reserve (excluding event header)
+ *
+ * Like ring_buffer_lock_reserve(), but if the buffer is full the event
+ * is dropped and accounted as such, even if the buffer is in overwrite
+ * mode. This lets events that matter more than the newest ones, say
+ * the ones that start a flight recording, share a buffer with events
+ * that may push out older data.
+ */
+struct ring_buffer_event *
+ring_buffer_lock_reserve_drop(struct ring_buffer *buffer, unsigned long length)
+{
+	return __ring_buffer_lock_reserve(buffer, length, true);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_lock_reserve_drop);
+
 /*
  * Decrement the entries to the page that an event is on.
  * The event does not even need to exist, only the pointer
@@ -3101,7 +3143,7 @@ int ring_buffer_write(struct ring_buffer *buffer,
 	if (unlikely(trace_recursive_lock(cpu_buffer)))
 		goto out;
 
-	event = rb_reserve_next_event(buffer, cpu_buffer, length);
+	event = rb_reserve_next_event(buffer, cpu_buffer, length, false);
 	if (!event)
 		goto out_unlock;
 
@@ -4554,10 +4596,8 @@ void *ring_buffer_alloc_read_page(struct ring_buffer *buffer, int cpu)
 	local_irq_save(flags);
 	arch_spin_lock(&cpu_buffer->lock);
 
-	if (cpu_buffer->free_page) {
-		bpage = cpu_buffer->free_page;
-		cpu_buffer->free_page = NULL;
-	}
+	if (cpu_buffer->nr_free_pages)
+		bpage = cpu_buffer->free_pages[--cpu_buffer->nr_free_pages];
 
 	arch_spin_unlock(&cpu_buffer->lock);
 	local_irq_restore(flags);
@@ -4601,8 +4641,8 @@ void ring_buffer_free_read_page(struct ring_buffer *buffer, int cpu, void *data)
 	local_irq_save(flags);
 	arch_spin_lock(&cpu_buffer->lock);
 
-	if (!cpu_buffer->free_page) {
-		cpu_buffer->free_page = bpage;
+	if (cpu_buffer->nr_free_pages < RB_NR_FREE_PAGES) {
+		cpu_buffer->free_pages[cpu_buffer->nr_free_pages++] = bpage;
 		bpage = NULL;
 	}
 
@@ -59,6 +59,26 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, int, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
+enum {
+	MODE_DROP,
+	MODE_OVERWRITE,
+	MODE_MIXED,
+};
+
+static unsigned int write_mode = MODE_OVERWRITE;
+module_param(write_mode, uint, 0444);
+MODULE_PARM_DESC(write_mode, "0 = drop when full, 1 = overwrite, 2 = overwrite with every other write dropped when full");
+
+enum {
+	READ_ALTERNATE,
+	READ_EVENTS,
+	READ_PAGES,
+};
+
+static unsigned int read_mode = READ_ALTERNATE;
+module_param(read_mode, uint, 0644);
+MODULE_PARM_DESC(read_mode, "0 = alternate between events and pages, 1 = events, 2 = pages");
+
 static int read_events;
 
 static int test_error;
@@ -180,8 +200,11 @@ static enum event_status read_page(int cpu)
 
 static void ring_buffer_consumer(void)
 {
-	/* toggle between reading pages and events */
-	read_events ^= 1;
+	if (read_mode == READ_ALTERNATE)
+		/* toggle between reading pages and events */
+		read_events ^= 1;
+	else
+		read_events = read_mode == READ_EVENTS;
 
 	read = 0;
 	/*
@@ -232,10 +255,12 @@ static void ring_buffer_producer(void)
 	unsigned long long time;
 	unsigned long long entries;
 	unsigned long long overruns;
+	unsigned long long dropped = 0;
 	unsigned long missed = 0;
 	unsigned long hit = 0;
 	unsigned long avg;
 	int cnt = 0;
+	int cpu;
 
 	/*
 	 * Hammer the buffer for 10 secs (this may
@@ -250,7 +275,10 @@ static void ring_buffer_producer(void)
 		int i;
 
 		for (i = 0; i < write_iteration; i++) {
-			event = ring_buffer_lock_reserve(buffer, 10);
+			if (write_mode == MODE_MIXED && (i & 1))
+				event = ring_buffer_lock_reserve_drop(buffer, 10);
+			else
+				event = ring_buffer_lock_reserve(buffer, 10);
 			if (!event) {
 				missed++;
 			} else {
@@ -297,6 +325,8 @@ static void ring_buffer_producer(void)
 
 	entries = ring_buffer_entries(buffer);
 	overruns = ring_buffer_overruns(buffer);
+	for_each_online_cpu(cpu)
+		dropped += ring_buffer_dropped_events_cpu(buffer, cpu);
 
 	if (test_error)
 		trace_printk("ERROR!\n");
@@ -321,8 +351,12 @@ static void ring_buffer_producer(void)
 	    producer_nice == MAX_NICE && consumer_nice == MAX_NICE)
 		trace_printk("WARNING!!! This test is running at lowest priority.\n");
 
+	trace_printk("Mode:     %s\n",
+		     write_mode == MODE_DROP ? "drop" :
+		     write_mode == MODE_OVERWRITE ? "overwrite" : "mixed");
 	trace_printk("Time:     %lld (usecs)\n", time);
 	trace_printk("Overruns: %lld\n", overruns);
+	trace_printk("Dropped:  %lld\n", dropped);
 	if (disable_reader)
 		trace_printk("Read:     (reader disabled)\n");
 	else
@@ -342,6 +376,10 @@ static void ring_buffer_producer(void)
 
 	trace_printk("Entries per millisec: %ld\n", hit);
 
+	if (!disable_reader && time)
+		trace_printk("Read per millisec: %lld\n",
+			     div64_u64(read, time));
+
 	if (hit) {
 		/* Calculate the average time in nanosecs */
 		avg = NSEC_PER_MSEC / hit;
@@ -430,8 +468,12 @@ static int __init ring_buffer_benchmark_init(void)
 {
 	int ret;
 
-	/* make a one meg buffer in overwite mode */
-	buffer = ring_buffer_alloc(1000000, RB_FL_OVERWRITE);
+	if (write_mode > MODE_MIXED)
+		return -EINVAL;
+
+	/* make a one meg buffer, in overwrite mode unless asked not to */
+	buffer = ring_buffer_alloc(1000000, write_mode == MODE_DROP ?
+				   0 : RB_FL_OVERWRITE);
 	if (!buffer)
 		return -ENOMEM;
 
@@ -2281,8 +2281,13 @@ trace_event_buffer_lock_reserve(struct ring_buffer **current_rb,
 
 	*current_rb = trace_file->tr->trace_buffer.buffer;
 
+	/*
+	 * Events that must not overwrite are reserved directly, the per cpu
+	 * buffer would be copied in later with ring_buffer_write().
+	 */
 	if (!ring_buffer_time_stamp_abs(*current_rb) && (trace_file->flags &
 	     (EVENT_FILE_FL_SOFT_DISABLED | EVENT_FILE_FL_FILTERED)) &&
+	    !(trace_file->flags & EVENT_FILE_FL_NO_OVERWRITE) &&
 	    (entry = this_cpu_read(trace_buffered_event))) {
 		/* Try to use the per cpu buffer first */
 		val = this_cpu_inc_return(trace_buffered_event_cnt);
@@ -2294,8 +2299,18 @@ trace_event_buffer_lock_reserve(struct ring_buffer **current_rb,
 		this_cpu_dec(trace_buffered_event_cnt);
 	}
 
-	entry = __trace_buffer_lock_reserve(*current_rb,
-					    type, len, flags, pc);
+	if (unlikely(trace_file->flags & EVENT_FILE_FL_NO_OVERWRITE)) {
+		entry = ring_buffer_lock_reserve_drop(*current_rb, len);
+		if (entry)
+			trace_event_setup(entry, type, flags, pc);
+	} else
+		entry = __trace_buffer_lock_reserve(*current_rb,
+						    type, len, flags, pc);
+
+	/* Only count what was lost while the buffer was recording */
+	if (unlikely(!entry) && ring_buffer_record_is_on(*current_rb))
+		atomic_long_inc(&trace_file->lost);
+
 	/*
 	 * If tracing is off, but we have triggers enabled
 	 * we still need to look at the event data. Use the temp_buffer
@@ -1475,9 +1475,11 @@ extern const struct file_operations event_hist_fops;
 #ifdef CONFIG_HIST_TRIGGERS
 extern int register_trigger_hist_cmd(void);
 extern int register_trigger_hist_enable_disable_cmds(void);
+extern int register_trigger_latency_cmd(void);
 #else
 static inline int register_trigger_hist_cmd(void) { return 0; }
 static inline int register_trigger_hist_enable_disable_cmds(void) { return 0; }
+static inline int register_trigger_latency_cmd(void) { return 0; }
 #endif
 
 extern int register_trigger_cmds(void);
@@ -1553,6 +1555,8 @@ get_named_trigger_data(struct event_trigger_data *data);
 extern int register_event_command(struct event_command *cmd);
 extern int unregister_event_command(struct event_command *cmd);
 extern int register_trigger_hist_enable_disable_cmds(void);
+extern void latency_trigger_show(struct seq_file *m,
+				 struct event_trigger_data *data, int n);
 
 /**
  * struct event_trigger_ops - callbacks for trace event triggers
@@ -2,6 +2,7 @@
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/kthread.h>
+#include <linux/math64.h>
 #include <linux/trace_clock.h>
 
 #define CREATE_TRACE_POINTS
@@ -22,6 +23,12 @@ static u64 bm_stddev;
 static unsigned int bm_avg;
 static unsigned int bm_std;
 
+/* keys of the pair events, a power of two */
+#define BENCHMARK_PAIR_KEYS	1024
+
+static u64 bm_pair_total;
+static u64 bm_pair_cnt;
+
 static bool ok_to_run;
 
 /*
@@ -144,6 +151,35 @@ static void trace_do_benchmark(void)
 	bm_stddev = stddev;
 }
 
+/*
+ * Time writing benchmark_pair_start and benchmark_pair_end back to
+ * back. The key cycles through BENCHMARK_PAIR_KEYS values so that a
+ * latency pair on the two events sees a bounded key space. Comparing
+ * the reported avg with and without triggers on the events gives
+ * their cost per pair.
+ */
+static void trace_do_pair_benchmark(void)
+{
+	u64 key = bm_pair_cnt & (BENCHMARK_PAIR_KEYS - 1);
+	u64 start;
+	u64 avg;
+
+	if (!(trace_benchmark_pair_start_enabled() ||
+	      trace_benchmark_pair_end_enabled()) || !tracing_is_on())
+		return;
+
+	avg = bm_pair_cnt ? div64_u64(bm_pair_total, bm_pair_cnt) : 0;
+
+	local_irq_disable();
+	start = trace_clock_local();
+	trace_benchmark_pair_start(key);
+	trace_benchmark_pair_end(key, avg);
+	bm_pair_total += trace_clock_local() - start;
+	local_irq_enable();
+
+	bm_pair_cnt++;
+}
+
 static int benchmark_event_kthread(void *arg)
 {
 	/* sleep a bit to make sure the tracepoint gets activated */
@@ -152,6 +188,7 @@ static int benchmark_event_kthread(void *arg)
 	while (!kthread_should_stop()) {
 
 		trace_do_benchmark();
+		trace_do_pair_benchmark();
 
 		/*
 		 * We don't go to sleep, but let others run as well.
@@ -212,6 +249,8 @@ void trace_benchmark_unreg(void)
 	bm_max = 0;
 	bm_min = 0;
 	bm_cnt = 0;
+	bm_pair_total = 0;
+	bm_pair_cnt = 0;
 	/* These don't need to be reset but reset them anyway */
 	bm_first = 0;
 	bm_std = 0;
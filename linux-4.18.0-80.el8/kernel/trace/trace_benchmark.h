@@ -31,6 +31,48 @@ TRACE_EVENT_FN(benchmark_event,
 	trace_benchmark_reg, trace_benchmark_unreg
 );
 
+/*
+ * Written back to back by the benchmark thread (which runs while
+ * benchmark_event is enabled) to measure the cost of triggers such as
+ * latency pairs attached to them. avg is the average time in ns it
+ * took to write the pair so far.
+ */
+TRACE_EVENT(benchmark_pair_start,
+
+	TP_PROTO(u64 key),
+
+	TP_ARGS(key),
+
+	TP_STRUCT__entry(
+		__field(	u64,	key	)
+	),
+
+	TP_fast_assign(
+		__entry->key = key;
+	),
+
+	TP_printk("key=%llu", __entry->key)
+);
+
+TRACE_EVENT(benchmark_pair_end,
+
+	TP_PROTO(u64 key, u64 avg),
+
+	TP_ARGS(key, avg),
+
+	TP_STRUCT__entry(
+		__field(	u64,	key	)
+		__field(	u64,	avg	)
+	),
+
+	TP_fast_assign(
+		__entry->key = key;
+		__entry->avg = avg;
+	),
+
+	TP_printk("key=%llu avg=%llu", __entry->key, __entry->avg)
+);
+
 #endif /* _TRACE_BENCHMARK_H */
 
 #undef TRACE_INCLUDE_FILE
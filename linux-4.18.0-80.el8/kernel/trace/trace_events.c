@@ -1093,6 +1093,125 @@ event_enable_write(struct file *filp, const char __user *ubuf, size_t cnt,
 	return ret ? ret : cnt;
 }
 
+static ssize_t
+event_overwrite_read(struct file *filp, char __user *ubuf, size_t cnt,
+		     loff_t *ppos)
+{
+	struct trace_event_file *file;
+	unsigned long flags;
+	char buf[4] = "1\n";
+
+	mutex_lock(&event_mutex);
+	file = event_file_data(filp);
+	if (likely(file))
+		flags = file->flags;
+	mutex_unlock(&event_mutex);
+
+	if (!file)
+		return -ENODEV;
+
+	if (flags & EVENT_FILE_FL_NO_OVERWRITE)
+		strcpy(buf, "0\n");
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+/*
+ * Writing 0 makes the event drop itself when the buffer is full, rather
+ * than overwrite the oldest events as the instance's overwrite option
+ * would. Writing 1 makes it follow that option again.
+ */
+static ssize_t
+event_overwrite_write(struct file *filp, const char __user *ubuf, size_t cnt,
+		      loff_t *ppos)
+{
+	struct trace_event_file *file;
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul_from_user(ubuf, cnt, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > 1)
+		return -EINVAL;
+
+	ret = -ENODEV;
+	mutex_lock(&event_mutex);
+	file = event_file_data(filp);
+	if (likely(file)) {
+		if (val)
+			clear_bit(EVENT_FILE_FL_NO_OVERWRITE_BIT, &file->flags);
+		else
+			set_bit(EVENT_FILE_FL_NO_OVERWRITE_BIT, &file->flags);
+		ret = 0;
+	}
+	mutex_unlock(&event_mutex);
+
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
+static ssize_t
+event_lost_read(struct file *filp, char __user *ubuf, size_t cnt,
+		loff_t *ppos)
+{
+	struct trace_event_file *file;
+	unsigned long lost = 0;
+	char buf[32];
+	int len;
+
+	mutex_lock(&event_mutex);
+	file = event_file_data(filp);
+	if (likely(file))
+		lost = atomic_long_read(&file->lost);
+	mutex_unlock(&event_mutex);
+
+	if (!file)
+		return -ENODEV;
+
+	len = snprintf(buf, sizeof(buf), "%lu\n", lost);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, len);
+}
+
+/* Writing 0 resets the count */
+static ssize_t
+event_lost_write(struct file *filp, const char __user *ubuf, size_t cnt,
+		 loff_t *ppos)
+{
+	struct trace_event_file *file;
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul_from_user(ubuf, cnt, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val)
+		return -EINVAL;
+
+	ret = -ENODEV;
+	mutex_lock(&event_mutex);
+	file = event_file_data(filp);
+	if (likely(file)) {
+		atomic_long_set(&file->lost, 0);
+		ret = 0;
+	}
+	mutex_unlock(&event_mutex);
+
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
 static ssize_t
 system_enable_read(struct file *filp, char __user *ubuf, size_t cnt,
 		   loff_t *ppos)
@@ -1724,6 +1843,20 @@ static const struct file_operations ftrace_enable_fops = {
 	.llseek = default_llseek,
 };
 
+static const struct file_operations ftrace_event_overwrite_fops = {
+	.open = tracing_open_generic,
+	.read = event_overwrite_read,
+	.write = event_overwrite_write,
+	.llseek = default_llseek,
+};
+
+static const struct file_operations ftrace_event_lost_fops = {
+	.open = tracing_open_generic,
+	.read = event_lost_read,
+	.write = event_lost_write,
+	.llseek = default_llseek,
+};
+
 static const struct file_operations ftrace_event_format_fops = {
 	.open = trace_format_open,
 	.read = seq_read,
@@ -2018,6 +2151,12 @@ event_create_dir(struct dentry *parent, struct trace_event_file *file)
 
 		trace_create_file("trigger", 0644, file->dir, file,
 				  &event_trigger_fops);
+
+		trace_create_file("overwrite", 0644, file->dir, file,
+				  &ftrace_event_overwrite_fops);
+
+		trace_create_file("lost", 0644, file->dir, file,
+				  &ftrace_event_lost_fops);
 	}
 
 #ifdef CONFIG_HIST_TRIGGERS
@@ -2264,6 +2403,7 @@ trace_create_new_event(struct trace_event_call *call,
 	file->tr = tr;
 	atomic_set(&file->sm_ref, 0);
 	atomic_set(&file->tm_ref, 0);
+	atomic_long_set(&file->lost, 0);
 	INIT_LIST_HEAD(&file->triggers);
 	list_add(&file->list, &tr->events);
 
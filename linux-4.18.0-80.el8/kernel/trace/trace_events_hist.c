@@ -4874,6 +4874,8 @@ static int hist_show(struct seq_file *m, void *v)
 	list_for_each_entry_rcu(data, &event_file->triggers, list) {
 		if (data->cmd_ops->trigger_type == ETT_EVENT_HIST)
 			hist_trigger_show(m, data, n++);
+		else if (data->cmd_ops->trigger_type == ETT_EVENT_LATENCY)
+			latency_trigger_show(m, data, n++);
 	}
 
 	if (have_hist_err()) {
@@ -0,0 +1,852 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * trace_events_latency - latency histograms for pairs of trace events
+ *
+ * A latency pair correlates a start event with an end event by a key
+ * field of each and keeps a histogram of the time in between:
+ *
+ *   echo 'latency:start=io:key=tag' > events/block/foo_issue/trigger
+ *   echo 'latency:end=io:key=tag:per_key' > events/block/foo_done/trigger
+ *   cat events/block/foo_done/hist
+ *
+ * The start side owns a tracing_map keyed by the start key, holding the
+ * time stamp of the last start in a variable.  The end side looks the
+ * key up, consumes the time stamp and counts the delta in per-cpu log2
+ * (or, with linear=WIDTH, fixed width) buckets, and optionally per key.
+ *
+ * The map is preallocated and lock-free but entries are never deleted,
+ * so the key space must be bounded (pids, request tags...) and sized
+ * with size=; starts that don't find a free entry are counted as drops.
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+
+#include "tracing_map.h"
+#include "trace.h"
+
+#define LATENCY_LOG2_BUCKETS		64
+#define LATENCY_LINEAR_BUCKETS		64
+#define LATENCY_BUCKETS_MAX		1024
+
+/* tracing_map fields of the per-key map on the end side */
+#define LATENCY_HITCOUNT		0
+#define LATENCY_TOTAL			1
+
+struct latency_pair {
+	struct list_head		list;
+	char				*name;
+	unsigned int			ref;
+	struct tracing_map		*map;
+	struct event_trigger_data	*start;
+	struct event_trigger_data	*end;
+};
+
+struct latency_stats {
+	u64				count;
+	u64				sum;
+	u64				max;
+	u64				missed;
+	u64				buckets[];
+};
+
+struct latency_trigger {
+	struct latency_pair		*pair;
+	struct ftrace_event_field	*key_field;
+	char				*name;
+	char				*key_name;
+	bool				end;
+	bool				per_key;
+	unsigned int			map_bits;
+	unsigned int			n_buckets;
+	u64				width;
+	struct latency_stats __percpu	*stats;
+	struct tracing_map		*key_map;
+};
+
+/* Protected by event_mutex */
+static LIST_HEAD(latency_pairs);
+
+static struct latency_pair *find_latency_pair(const char *name)
+{
+	struct latency_pair *pair;
+
+	lockdep_assert_held(&event_mutex);
+
+	list_for_each_entry(pair, &latency_pairs, list) {
+		if (strcmp(pair->name, name) == 0)
+			return pair;
+	}
+
+	return NULL;
+}
+
+static struct latency_pair *create_latency_pair(const char *name,
+						unsigned int map_bits)
+{
+	struct latency_pair *pair;
+	int ret = -ENOMEM;
+
+	pair = kzalloc(sizeof(*pair), GFP_KERNEL);
+	if (!pair)
+		return ERR_PTR(-ENOMEM);
+
+	pair->name = kstrdup(name, GFP_KERNEL);
+	if (!pair->name)
+		goto free;
+
+	pair->map = tracing_map_create(map_bits, sizeof(u64), NULL, NULL);
+	if (IS_ERR(pair->map)) {
+		ret = PTR_ERR(pair->map);
+		pair->map = NULL;
+		goto free;
+	}
+
+	/* tracing_map wants a value besides the key; the start time is a var */
+	if (tracing_map_add_sum_field(pair->map) < 0 ||
+	    tracing_map_add_key_field(pair->map, 0,
+				      tracing_map_cmp_num(sizeof(u64), 0)) < 0 ||
+	    tracing_map_add_var(pair->map) < 0) {
+		ret = -EINVAL;
+		goto free;
+	}
+
+	ret = tracing_map_init(pair->map);
+	if (ret)
+		goto free;
+
+	pair->ref = 1;
+	list_add(&pair->list, &latency_pairs);
+
+	return pair;
+ free:
+	if (pair->map)
+		tracing_map_destroy(pair->map);
+	kfree(pair->name);
+	kfree(pair);
+
+	return ERR_PTR(ret);
+}
+
+static void put_latency_pair(struct latency_pair *pair)
+{
+	if (--pair->ref)
+		return;
+
+	list_del(&pair->list);
+	tracing_map_destroy(pair->map);
+	kfree(pair->name);
+	kfree(pair);
+}
+
+static u64 latency_read_key(struct ftrace_event_field *field, void *rec)
+{
+	void *addr = rec + field->offset;
+
+	switch (field->size) {
+	case 1:
+		return *(u8 *)addr;
+	case 2:
+		return *(u16 *)addr;
+	case 4:
+		return *(u32 *)addr;
+	default:
+		return *(u64 *)addr;
+	}
+}
+
+static unsigned int latency_bucket(struct latency_trigger *lt, u64 delta)
+{
+	u64 idx;
+
+	/* bucket n > 0 holds [2^(n-1), 2^n) */
+	if (!lt->width)
+		return min(fls64(delta), LATENCY_LOG2_BUCKETS - 1);
+
+	idx = div64_u64(delta, lt->width);
+
+	return min_t(u64, idx, lt->n_buckets - 1);
+}
+
+static void latency_start_trigger(struct event_trigger_data *data, void *rec,
+				  struct ring_buffer_event *rbe)
+{
+	struct latency_trigger *lt = data->private_data;
+	struct tracing_map_elt *elt;
+	u64 key;
+
+	key = latency_read_key(lt->key_field, rec);
+
+	elt = tracing_map_insert(lt->pair->map, &key);
+	if (elt)
+		tracing_map_set_var(elt, 0, ktime_get_mono_fast_ns());
+}
+
+static void latency_end_trigger(struct event_trigger_data *data, void *rec,
+				struct ring_buffer_event *rbe)
+{
+	struct latency_trigger *lt = data->private_data;
+	struct latency_stats __percpu *stats = lt->stats;
+	struct tracing_map_elt *elt;
+	u64 key, now, start, delta;
+	unsigned int idx;
+
+	now = ktime_get_mono_fast_ns();
+	key = latency_read_key(lt->key_field, rec);
+
+	elt = tracing_map_lookup(lt->pair->map, &key);
+	if (!elt || !tracing_map_var_set(elt, 0)) {
+		this_cpu_inc(stats->missed);
+		return;
+	}
+
+	start = tracing_map_read_var_once(elt, 0);
+	delta = now > start ? now - start : 0;
+	idx = latency_bucket(lt, delta);
+
+	this_cpu_inc(stats->count);
+	this_cpu_add(stats->sum, delta);
+	this_cpu_inc(stats->buckets[idx]);
+	if (delta > this_cpu_read(stats->max))
+		this_cpu_write(stats->max, delta);
+
+	if (!lt->key_map)
+		return;
+
+	elt = tracing_map_insert(lt->key_map, &key);
+	if (!elt)
+		return;
+
+	tracing_map_update_sum(elt, LATENCY_HITCOUNT, 1);
+	tracing_map_update_sum(elt, LATENCY_TOTAL, delta);
+	atomic64_inc((atomic64_t *)elt->private_data + idx);
+}
+
+static int latency_key_elt_alloc(struct tracing_map_elt *elt)
+{
+	struct latency_trigger *lt = elt->map->private_data;
+
+	elt->private_data = kcalloc(lt->n_buckets, sizeof(atomic64_t),
+				    GFP_KERNEL);
+	if (!elt->private_data)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void latency_key_elt_free(struct tracing_map_elt *elt)
+{
+	kfree(elt->private_data);
+}
+
+static const struct tracing_map_ops latency_key_map_ops = {
+	.elt_alloc	= latency_key_elt_alloc,
+	.elt_free	= latency_key_elt_free,
+};
+
+static int create_latency_key_map(struct latency_trigger *lt)
+{
+	struct tracing_map *map;
+	int ret;
+
+	map = tracing_map_create(lt->map_bits, sizeof(u64),
+				 &latency_key_map_ops, lt);
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	if (tracing_map_add_sum_field(map) != LATENCY_HITCOUNT ||
+	    tracing_map_add_sum_field(map) != LATENCY_TOTAL ||
+	    tracing_map_add_key_field(map, 0,
+				      tracing_map_cmp_num(sizeof(u64), 0)) < 0) {
+		ret = -EINVAL;
+		goto free;
+	}
+
+	ret = tracing_map_init(map);
+	if (ret)
+		goto free;
+
+	lt->key_map = map;
+
+	return 0;
+ free:
+	tracing_map_destroy(map);
+
+	return ret;
+}
+
+static void destroy_latency_trigger(struct latency_trigger *lt)
+{
+	if (lt->key_map)
+		tracing_map_destroy(lt->key_map);
+	free_percpu(lt->stats);
+	if (lt->pair)
+		put_latency_pair(lt->pair);
+	kfree(lt->name);
+	kfree(lt->key_name);
+	kfree(lt);
+}
+
+static int parse_latency_map_size(char *str)
+{
+	unsigned long size, map_bits;
+	int ret;
+
+	ret = kstrtoul(str, 0, &size);
+	if (ret)
+		return ret;
+
+	map_bits = ilog2(roundup_pow_of_two(size));
+	if (map_bits < TRACING_MAP_BITS_MIN ||
+	    map_bits > TRACING_MAP_BITS_MAX)
+		return -EINVAL;
+
+	return map_bits;
+}
+
+/* start=NAME:key=FIELD[:size=N] or end=NAME:key=FIELD[:linear=NS[:buckets=N]][:per_key][:size=N] */
+static struct latency_trigger *parse_latency_trigger(char *str)
+{
+	struct latency_trigger *lt;
+	char *tok, *val;
+	int ret = -EINVAL;
+
+	lt = kzalloc(sizeof(*lt), GFP_KERNEL);
+	if (!lt)
+		return ERR_PTR(-ENOMEM);
+
+	lt->map_bits = TRACING_MAP_BITS_DEFAULT;
+
+	while ((tok = strsep(&str, ":")) != NULL) {
+		val = tok;
+		tok = strsep(&val, "=");
+
+		if (strcmp(tok, "per_key") == 0 && !val) {
+			lt->per_key = true;
+			continue;
+		}
+
+		if (!val || !*val)
+			goto free;
+
+		if (strcmp(tok, "start") == 0 || strcmp(tok, "end") == 0) {
+			if (lt->name)
+				goto free;
+			lt->end = tok[0] == 'e';
+			lt->name = kstrdup(val, GFP_KERNEL);
+			if (!lt->name) {
+				ret = -ENOMEM;
+				goto free;
+			}
+		} else if (strcmp(tok, "key") == 0) {
+			if (lt->key_name)
+				goto free;
+			lt->key_name = kstrdup(val, GFP_KERNEL);
+			if (!lt->key_name) {
+				ret = -ENOMEM;
+				goto free;
+			}
+		} else if (strcmp(tok, "size") == 0) {
+			ret = parse_latency_map_size(val);
+			if (ret < 0)
+				goto free;
+			lt->map_bits = ret;
+			ret = -EINVAL;
+		} else if (strcmp(tok, "linear") == 0) {
+			if (kstrtou64(val, 0, &lt->width) || !lt->width)
+				goto free;
+		} else if (strcmp(tok, "buckets") == 0) {
+			if (kstrtouint(val, 0, &lt->n_buckets) ||
+			    !lt->n_buckets || lt->n_buckets > LATENCY_BUCKETS_MAX)
+				goto free;
+		} else
+			goto free;
+	}
+
+	if (!lt->name || !lt->key_name)
+		goto free;
+
+	if (!lt->end && (lt->per_key || lt->width || lt->n_buckets))
+		goto free;
+
+	if (lt->width) {
+		if (!lt->n_buckets)
+			lt->n_buckets = LATENCY_LINEAR_BUCKETS;
+	} else {
+		if (lt->n_buckets)
+			goto free;
+		lt->n_buckets = LATENCY_LOG2_BUCKETS;
+	}
+
+	return lt;
+ free:
+	destroy_latency_trigger(lt);
+
+	return ERR_PTR(ret);
+}
+
+static int setup_latency_trigger(struct latency_trigger *lt,
+				 struct trace_event_file *file)
+{
+	struct ftrace_event_field *field;
+	struct latency_pair *pair;
+	int ret;
+
+	field = trace_find_event_field(file->event_call, lt->key_name);
+	if (!field || is_string_field(field))
+		return -EINVAL;
+
+	switch (field->size) {
+	case 1: case 2: case 4: case 8:
+		break;
+	default:
+		return -EINVAL;
+	}
+	lt->key_field = field;
+
+	pair = find_latency_pair(lt->name);
+
+	if (!lt->end) {
+		/* the end side may have outlived a cleared start */
+		if (pair) {
+			if (pair->start)
+				return -EEXIST;
+			pair->ref++;
+		} else {
+			pair = create_latency_pair(lt->name, lt->map_bits);
+			if (IS_ERR(pair))
+				return PTR_ERR(pair);
+		}
+		lt->pair = pair;
+
+		return 0;
+	}
+
+	if (!pair || !pair->start)
+		return -ENOENT;
+	if (pair->end)
+		return -EEXIST;
+
+	pair->ref++;
+	lt->pair = pair;
+
+	lt->stats = __alloc_percpu(struct_size(lt->stats, buckets,
+					       lt->n_buckets),
+				   __alignof__(u64));
+	if (!lt->stats)
+		return -ENOMEM;
+
+	if (lt->per_key) {
+		ret = create_latency_key_map(lt);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int latency_trigger_print(struct seq_file *m,
+				 struct event_trigger_ops *ops,
+				 struct event_trigger_data *data)
+{
+	struct latency_trigger *lt = data->private_data;
+
+	seq_printf(m, "latency:%s=%s:key=%s", lt->end ? "end" : "start",
+		   lt->name, lt->key_name);
+
+	if (lt->width)
+		seq_printf(m, ":linear=%llu:buckets=%u",
+			   lt->width, lt->n_buckets);
+
+	if (lt->per_key)
+		seq_puts(m, ":per_key");
+
+	if (!lt->end || lt->per_key)
+		seq_printf(m, ":size=%u", 1 << lt->map_bits);
+
+	if (data->filter_str)
+		seq_printf(m, " if %s", data->filter_str);
+
+	seq_putc(m, '\n');
+
+	return 0;
+}
+
+static void latency_trigger_free(struct event_trigger_ops *ops,
+				 struct event_trigger_data *data)
+{
+	struct latency_trigger *lt = data->private_data;
+
+	if (WARN_ON_ONCE(data->ref <= 0))
+		return;
+
+	data->ref--;
+	if (!data->ref) {
+		if (lt->pair->start == data)
+			lt->pair->start = NULL;
+		if (lt->pair->end == data)
+			lt->pair->end = NULL;
+		/* waits for running triggers before the maps go */
+		trigger_data_free(data);
+		destroy_latency_trigger(lt);
+	}
+}
+
+static struct event_trigger_ops latency_start_trigger_ops = {
+	.func			= latency_start_trigger,
+	.print			= latency_trigger_print,
+	.init			= event_trigger_init,
+	.free			= latency_trigger_free,
+};
+
+static struct event_trigger_ops latency_end_trigger_ops = {
+	.func			= latency_end_trigger,
+	.print			= latency_trigger_print,
+	.init			= event_trigger_init,
+	.free			= latency_trigger_free,
+};
+
+static struct event_trigger_ops *latency_get_trigger_ops(char *cmd,
+							 char *param)
+{
+	if (param && strncmp(param, "end=", 4) == 0)
+		return &latency_end_trigger_ops;
+
+	return &latency_start_trigger_ops;
+}
+
+static struct event_trigger_data *
+find_latency_trigger(struct trace_event_file *file,
+		     struct latency_trigger *lt)
+{
+	struct event_trigger_data *test;
+	struct latency_trigger *test_lt;
+
+	list_for_each_entry_rcu(test, &file->triggers, list) {
+		if (test->cmd_ops->trigger_type != ETT_EVENT_LATENCY)
+			continue;
+
+		test_lt = test->private_data;
+		if (test_lt->end == lt->end &&
+		    (!lt->name || strcmp(test_lt->name, lt->name) == 0))
+			return test;
+	}
+
+	return NULL;
+}
+
+/*
+ * An event can be the start of one pair and the end of another (or the
+ * same) pair, but can't start or end two pairs.
+ */
+static int latency_register_trigger(char *glob, struct event_trigger_ops *ops,
+				    struct event_trigger_data *data,
+				    struct trace_event_file *file)
+{
+	struct latency_trigger *lt = data->private_data;
+	struct latency_trigger side = { .end = lt->end };
+	int ret = 0;
+
+	if (find_latency_trigger(file, &side)) {
+		ret = -EEXIST;
+		goto out;
+	}
+
+	if (data->ops->init) {
+		ret = data->ops->init(data->ops, data);
+		if (ret < 0)
+			goto out;
+	}
+
+	list_add_rcu(&data->list, &file->triggers);
+	ret++;
+
+	update_cond_flag(file);
+	if (trace_event_trigger_enable_disable(file, 1) < 0) {
+		list_del_rcu(&data->list);
+		update_cond_flag(file);
+		ret--;
+	}
+ out:
+	return ret;
+}
+
+static void latency_unregister_trigger(char *glob,
+				       struct event_trigger_ops *ops,
+				       struct event_trigger_data *test,
+				       struct trace_event_file *file)
+{
+	struct event_trigger_data *data;
+
+	data = find_latency_trigger(file, test->private_data);
+	if (!data)
+		return;
+
+	list_del_rcu(&data->list);
+	trace_event_trigger_enable_disable(file, 0);
+	update_cond_flag(file);
+
+	if (data->ops->free)
+		data->ops->free(data->ops, data);
+}
+
+/* Clear the end triggers first so the starts they depend on can go too */
+static void latency_unreg_all(struct trace_event_file *file)
+{
+	struct event_trigger_data *test, *n;
+	struct latency_trigger *lt;
+	int end;
+
+	for (end = 1; end >= 0; end--) {
+		list_for_each_entry_safe(test, n, &file->triggers, list) {
+			if (test->cmd_ops->trigger_type != ETT_EVENT_LATENCY)
+				continue;
+
+			lt = test->private_data;
+			if (lt->end != end || (!end && lt->pair->end))
+				continue;
+
+			list_del_rcu(&test->list);
+			trace_event_trigger_enable_disable(file, 0);
+			update_cond_flag(file);
+			if (test->ops->free)
+				test->ops->free(test->ops, test);
+		}
+	}
+}
+
+static int latency_trigger_func(struct event_command *cmd_ops,
+				struct trace_event_file *file,
+				char *glob, char *cmd, char *param)
+{
+	struct event_trigger_data *trigger_data, *test;
+	struct event_trigger_ops *trigger_ops;
+	struct latency_trigger *lt;
+	char *trigger;
+	int ret;
+
+	if (!param)
+		return -EINVAL;
+
+	/* separate the trigger from the filter (s=n:key=f [if filter]) */
+	trigger = strsep(&param, " \t");
+	if (param) {
+		param = skip_spaces(param);
+		if (!*param)
+			param = NULL;
+	}
+
+	trigger_ops = cmd_ops->get_trigger_ops(cmd, trigger);
+
+	lt = parse_latency_trigger(trigger);
+	if (IS_ERR(lt))
+		return PTR_ERR(lt);
+
+	ret = -ENOMEM;
+	trigger_data = kzalloc(sizeof(*trigger_data), GFP_KERNEL);
+	if (!trigger_data)
+		goto out_destroy;
+
+	trigger_data->count = -1;
+	trigger_data->ops = trigger_ops;
+	trigger_data->cmd_ops = cmd_ops;
+	trigger_data->private_data = lt;
+	INIT_LIST_HEAD(&trigger_data->list);
+	INIT_LIST_HEAD(&trigger_data->named_list);
+
+	if (glob[0] == '!') {
+		test = find_latency_trigger(file, lt);
+		if (!test)
+			ret = -ENOENT;
+		else if (!lt->end &&
+			 ((struct latency_trigger *)test->private_data)->pair->end)
+			ret = -EBUSY;
+		else {
+			cmd_ops->unreg(glob+1, trigger_ops, trigger_data, file);
+			ret = 0;
+		}
+		kfree(trigger_data);
+		goto out_destroy;
+	}
+
+	ret = setup_latency_trigger(lt, file);
+	if (ret)
+		goto out_free;
+
+	if (param) {
+		ret = cmd_ops->set_filter(param, trigger_data, file);
+		if (ret < 0)
+			goto out_free;
+	}
+
+	ret = cmd_ops->reg(glob, trigger_ops, trigger_data, file);
+	if (!ret)
+		ret = -ENOENT;
+	if (ret < 0)
+		goto out_free;
+
+	if (lt->end)
+		lt->pair->end = trigger_data;
+	else
+		lt->pair->start = trigger_data;
+
+	return 0;
+ out_free:
+	trigger_data_free(trigger_data);
+ out_destroy:
+	destroy_latency_trigger(lt);
+
+	return ret;
+}
+
+static void latency_print_bucket(struct seq_file *m,
+				 struct latency_trigger *lt, unsigned int i)
+{
+	u64 lo, hi;
+
+	if (lt->width) {
+		lo = lt->width * i;
+		hi = lo + lt->width - 1;
+	} else {
+		lo = i ? 1ULL << (i - 1) : 0;
+		hi = i ? (1ULL << i) - 1 : 0;
+	}
+
+	if (i == lt->n_buckets - 1)
+		seq_printf(m, "[ %10llu - %10s ]", lo, "max");
+	else
+		seq_printf(m, "[ %10llu - %10llu ]", lo, hi);
+}
+
+static void latency_show_per_key(struct seq_file *m,
+				 struct latency_trigger *lt)
+{
+	struct tracing_map_sort_key sort_key = {
+		.field_idx	= LATENCY_HITCOUNT,
+		.descending	= true,
+	};
+	struct tracing_map_sort_entry **entries;
+	struct tracing_map_elt *elt;
+	atomic64_t *buckets;
+	u64 hits, total, n;
+	int i, n_entries;
+	unsigned int b;
+
+	n_entries = tracing_map_sort_entries(lt->key_map, &sort_key, 1,
+					     &entries);
+	if (n_entries <= 0)
+		return;
+
+	seq_puts(m, "\nPer key:\n");
+
+	for (i = 0; i < n_entries; i++) {
+		elt = entries[i]->elt;
+		hits = tracing_map_read_sum(elt, LATENCY_HITCOUNT);
+		total = tracing_map_read_sum(elt, LATENCY_TOTAL);
+
+		seq_printf(m, "\n{ %s: %10llu } hitcount: %10llu avg: %llu\n",
+			   lt->key_name, *(u64 *)entries[i]->key, hits,
+			   hits ? div64_u64(total, hits) : 0);
+
+		buckets = elt->private_data;
+		for (b = 0; b < lt->n_buckets; b++) {
+			n = atomic64_read(&buckets[b]);
+			if (!n)
+				continue;
+			seq_puts(m, "    ");
+			latency_print_bucket(m, lt, b);
+			seq_printf(m, " %10llu\n", n);
+		}
+	}
+
+	tracing_map_destroy_sort_entries(entries, n_entries);
+}
+
+/**
+ * latency_trigger_show - Print a latency trigger into an event's hist file
+ * @m: The seq_file of the hist file
+ * @data: The latency trigger
+ * @n: The number of triggers already printed
+ *
+ * The end side prints the histogram of its pair, the start side only
+ * how full the map correlating the pair is.  Called with event_mutex
+ * held.
+ */
+void latency_trigger_show(struct seq_file *m,
+			  struct event_trigger_data *data, int n)
+{
+	struct latency_trigger *lt = data->private_data;
+	struct tracing_map *map = lt->pair->map;
+	struct latency_stats *stats;
+	u64 count = 0, sum = 0, max = 0, missed = 0, val;
+	unsigned int i;
+	int cpu;
+
+	if (n > 0)
+		seq_puts(m, "\n\n");
+
+	seq_puts(m, "# event latency\n#\n# trigger info: ");
+	data->ops->print(m, data->ops, data);
+	seq_puts(m, "#\n\n");
+
+	if (!lt->end) {
+		seq_printf(m, "Totals:\n    Entries: %u\n    Max entries: %u\n    Dropped: %llu\n",
+			   min_t(unsigned int, atomic_read(&map->next_elt) + 1,
+				 map->max_elts),
+			   map->max_elts, (u64)atomic64_read(&map->drops));
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(lt->stats, cpu);
+		count += stats->count;
+		sum += stats->sum;
+		missed += stats->missed;
+		if (stats->max > max)
+			max = stats->max;
+	}
+
+	for (i = 0; i < lt->n_buckets; i++) {
+		val = 0;
+		for_each_possible_cpu(cpu)
+			val += per_cpu_ptr(lt->stats, cpu)->buckets[i];
+		if (!val)
+			continue;
+		latency_print_bucket(m, lt, i);
+		seq_printf(m, " %10llu\n", val);
+	}
+
+	if (lt->key_map)
+		latency_show_per_key(m, lt);
+
+	seq_printf(m, "\nTotals:\n    Count: %llu\n    Avg: %llu\n    Max: %llu\n    Missed: %llu\n    Dropped: %llu\n",
+		   count, count ? div64_u64(sum, count) : 0, max, missed,
+		   (u64)atomic64_read(&map->drops));
+}
+
+static struct event_command trigger_latency_cmd = {
+	.name			= "latency",
+	.trigger_type		= ETT_EVENT_LATENCY,
+	.flags			= EVENT_CMD_FL_NEEDS_REC,
+	.func			= latency_trigger_func,
+	.reg			= latency_register_trigger,
+	.unreg			= latency_unregister_trigger,
+	.unreg_all		= latency_unreg_all,
+	.get_trigger_ops	= latency_get_trigger_ops,
+	.set_filter		= set_trigger_filter,
+};
+
+__init int register_trigger_latency_cmd(void)
+{
+	int ret;
+
+	ret = register_event_command(&trigger_latency_cmd);
+	WARN_ON(ret < 0);
+
+	return ret;
+}
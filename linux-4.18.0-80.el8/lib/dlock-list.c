@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Distributed and locked list
+ *
+ * See include/linux/dlock-list.h for the description.
+ */
+#include <linux/dlock-list.h>
+#include <linux/lockdep.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/export.h>
+
+/**
+ * __alloc_dlock_list_heads - allocate and initialize the per-cpu lists
+ * @dlist: pointer to the dlock_list_heads structure to be initialized
+ * @key:   the lock class key to be used for the list locks
+ *
+ * One list is allocated for every possible cpu, each on its own cacheline.
+ *
+ * Return: 0 if successful, -ENOMEM if memory allocation error
+ */
+int __alloc_dlock_list_heads(struct dlock_list_heads *dlist,
+			     struct lock_class_key *key)
+{
+	int idx;
+
+	dlist->heads = kcalloc(nr_cpu_ids, sizeof(struct dlock_list_head),
+			       GFP_KERNEL);
+	if (!dlist->heads)
+		return -ENOMEM;
+
+	for (idx = 0; idx < nr_cpu_ids; idx++) {
+		struct dlock_list_head *head = &dlist->heads[idx];
+
+		INIT_LIST_HEAD(&head->list);
+		spin_lock_init(&head->lock);
+		lockdep_set_class(&head->lock, key);
+	}
+	return 0;
+}
+EXPORT_SYMBOL(__alloc_dlock_list_heads);
+
+/**
+ * free_dlock_list_heads - free the per-cpu lists
+ * @dlist: pointer to the dlock_list_heads structure
+ *
+ * The lists are expected to be empty.
+ */
+void free_dlock_list_heads(struct dlock_list_heads *dlist)
+{
+	kfree(dlist->heads);
+	dlist->heads = NULL;
+}
+EXPORT_SYMBOL(free_dlock_list_heads);
+
+/**
+ * dlock_lists_empty - check if all the per-cpu lists are empty
+ * @dlist: pointer to the dlock_list_heads structure
+ *
+ * This is done without taking any lock, so the answer is only stable if
+ * nothing can be added concurrently.
+ */
+bool dlock_lists_empty(struct dlock_list_heads *dlist)
+{
+	int idx;
+
+	for (idx = 0; idx < nr_cpu_ids; idx++)
+		if (!list_empty(&dlist->heads[idx].list))
+			return false;
+	return true;
+}
+EXPORT_SYMBOL(dlock_lists_empty);
+
+/**
+ * dlock_lists_add - add a node to the list of the local cpu
+ * @node : pointer to the node to be added
+ * @dlist: pointer to the dlock_list_heads structure
+ *
+ * The node may be migrated away from the cpu while this runs, which only
+ * costs some locality: the node remembers which list it went to.
+ */
+void dlock_lists_add(struct dlock_list_node *node,
+		     struct dlock_list_heads *dlist)
+{
+	struct dlock_list_head *head = &dlist->heads[raw_smp_processor_id()];
+
+	spin_lock(&head->lock);
+	WRITE_ONCE(node->head, head);
+	list_add(&node->list, &head->list);
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL(dlock_lists_add);
+
+/**
+ * dlock_lists_del - delete a node from the list it is on
+ * @node: pointer to the node to be deleted
+ *
+ * The node is reinitialized so that it can be tested with list_empty()
+ * and added again.
+ */
+void dlock_lists_del(struct dlock_list_node *node)
+{
+	struct dlock_list_head *head = READ_ONCE(node->head);
+
+	if (WARN_ONCE(!head, "%s: node 0x%lx has no associated head\n",
+		      __func__, (unsigned long)node))
+		return;
+
+	spin_lock(&head->lock);
+	list_del_init(&node->list);
+	WRITE_ONCE(node->head, NULL);
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL(dlock_lists_del);
+
+/**
+ * __dlock_list_next_list - lock the next non-empty per-cpu list
+ * @iter: pointer to the dlock list iterator structure
+ *
+ * Drops the lock of the list that was being walked, if any, then takes the
+ * lock of the next list that has entries on it.
+ *
+ * Return: the first entry of that list or NULL once all lists are done.
+ */
+struct dlock_list_node *__dlock_list_next_list(struct dlock_list_iter *iter)
+{
+	struct dlock_list_head *head;
+
+	if (iter->entry) {
+		spin_unlock(&iter->entry->lock);
+		iter->entry = NULL;
+	}
+
+	while (++iter->index < nr_cpu_ids) {
+		head = &iter->head[iter->index];
+
+		/* Skip empty lists without touching their lock */
+		if (list_empty(&head->list))
+			continue;
+
+		spin_lock(&head->lock);
+		if (list_empty(&head->list)) {
+			spin_unlock(&head->lock);
+			continue;
+		}
+		iter->entry = head;
+		return list_first_entry(&head->list, struct dlock_list_node,
+					list);
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(__dlock_list_next_list);
@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * BPF_MAP_TYPE_SK_STORAGE: BPF local storage hanging off struct sock.
+ *
+ * Programs reach the storage of the socket their context belongs to. From
+ * user space the key is a socket fd. The storage is charged to the
+ * socket's optmem and freed along with the socket.
+ */
+#include <linux/rculist.h>
+#include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/bpf.h>
+#include <linux/bpf_local_storage.h>
+#include <linux/filter.h>
+#include <linux/net.h>
+#include <net/sock.h>
+#include <net/inet_sock.h>
+#include <net/bpf_sk_storage.h>
+
+DEFINE_BPF_STORAGE_CACHE(sk_cache);
+
+static int sk_storage_charge(struct bpf_local_storage_map *smap,
+			     void *owner, u32 size)
+{
+	struct sock *sk = owner;
+
+	/* same limit as sock_kmalloc() */
+	if (size <= sysctl_optmem_max &&
+	    atomic_read(&sk->sk_omem_alloc) + size < sysctl_optmem_max) {
+		atomic_add(size, &sk->sk_omem_alloc);
+		return 0;
+	}
+
+	return -ENOMEM;
+}
+
+static void sk_storage_uncharge(struct bpf_local_storage_map *smap,
+				void *owner, u32 size)
+{
+	struct sock *sk = owner;
+
+	atomic_sub(size, &sk->sk_omem_alloc);
+}
+
+static struct bpf_local_storage __rcu **sk_storage_ptr(void *owner)
+{
+	struct sock *sk = owner;
+
+	return &sk->sk_bpf_storage;
+}
+
+static struct bpf_local_storage_data *
+sk_storage_lookup(struct sock *sk, struct bpf_map *map, bool cacheit_lockit)
+{
+	struct bpf_local_storage *sk_storage;
+	struct bpf_local_storage_map *smap;
+
+	sk_storage = rcu_dereference(sk->sk_bpf_storage);
+	if (!sk_storage)
+		return NULL;
+
+	smap = (struct bpf_local_storage_map *)map;
+	return bpf_local_storage_lookup(sk_storage, smap, cacheit_lockit);
+}
+
+static int sk_storage_delete(struct sock *sk, struct bpf_map *map)
+{
+	struct bpf_local_storage_data *sdata;
+
+	sdata = sk_storage_lookup(sk, map, false);
+	if (!sdata)
+		return -ENOENT;
+
+	bpf_selem_unlink(SELEM(sdata));
+
+	return 0;
+}
+
+/* Called by __sk_destruct() once the socket's refcount dropped to zero. */
+void bpf_sk_storage_free(struct sock *sk)
+{
+	struct bpf_local_storage *sk_storage;
+
+	rcu_read_lock();
+	sk_storage = rcu_dereference(sk->sk_bpf_storage);
+	if (sk_storage)
+		bpf_local_storage_destroy(sk_storage);
+	rcu_read_unlock();
+}
+
+static void *bpf_fd_sk_storage_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_local_storage_data *sdata;
+	struct socket *sock;
+	int fd, err;
+
+	fd = *(int *)key;
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return NULL;
+
+	sdata = sk_storage_lookup(sock->sk, map, true);
+	sockfd_put(sock);
+	return sdata ? sdata->data : NULL;
+}
+
+static int bpf_fd_sk_storage_update_elem(struct bpf_map *map, void *key,
+					 void *value, u64 map_flags)
+{
+	struct bpf_local_storage_data *sdata;
+	struct socket *sock;
+	int fd, err;
+
+	fd = *(int *)key;
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+
+	sdata = bpf_local_storage_update(
+		sock->sk, (struct bpf_local_storage_map *)map, value,
+		map_flags);
+	sockfd_put(sock);
+	return PTR_ERR_OR_ZERO(sdata);
+}
+
+static int bpf_fd_sk_storage_delete_elem(struct bpf_map *map, void *key)
+{
+	struct socket *sock;
+	int fd, err;
+
+	fd = *(int *)key;
+	sock = sockfd_lookup(fd, &err);
+	if (!sock)
+		return err;
+
+	err = sk_storage_delete(sock->sk, map);
+	sockfd_put(sock);
+	return err;
+}
+
+static unsigned long __bpf_sk_storage_get(struct bpf_map *map,
+					  struct sock *sk, void *value,
+					  u64 flags)
+{
+	struct bpf_local_storage_data *sdata;
+
+	if (!sk || !sk_fullsock(sk) ||
+	    flags & ~BPF_LOCAL_STORAGE_GET_F_CREATE)
+		return (unsigned long)NULL;
+
+	sdata = sk_storage_lookup(sk, map, true);
+	if (sdata)
+		return (unsigned long)sdata->data;
+
+	/* A socket whose refcount already dropped to zero may have gone
+	 * through bpf_sk_storage_free(), so don't give it new storage.
+	 */
+	if ((flags & BPF_LOCAL_STORAGE_GET_F_CREATE) &&
+	    refcount_inc_not_zero(&sk->sk_refcnt)) {
+		sdata = bpf_local_storage_update(
+			sk, (struct bpf_local_storage_map *)map, value,
+			BPF_NOEXIST);
+		sock_put(sk);
+		return IS_ERR(sdata) ? (unsigned long)NULL :
+			(unsigned long)sdata->data;
+	}
+
+	return (unsigned long)NULL;
+}
+
+static unsigned long __bpf_sk_storage_delete(struct bpf_map *map,
+					     struct sock *sk)
+{
+	int err;
+
+	if (!sk || !sk_fullsock(sk))
+		return -EINVAL;
+
+	if (refcount_inc_not_zero(&sk->sk_refcnt)) {
+		err = sk_storage_delete(sk, map);
+		sock_put(sk);
+		return err;
+	}
+
+	return -ENOENT;
+}
+
+BPF_CALL_4(bpf_sk_storage_get, struct bpf_map *, map, struct sk_buff *, skb,
+	   void *, value, u64, flags)
+{
+	return __bpf_sk_storage_get(map, skb_to_full_sk(skb), value, flags);
+}
+
+BPF_CALL_2(bpf_sk_storage_delete, struct bpf_map *, map,
+	   struct sk_buff *, skb)
+{
+	return __bpf_sk_storage_delete(map, skb_to_full_sk(skb));
+}
+
+BPF_CALL_4(bpf_sock_ops_sk_storage_get, struct bpf_map *, map,
+	   struct bpf_sock_ops_kern *, bpf_sock, void *, value, u64, flags)
+{
+	struct sock *sk = bpf_sock->is_fullsock ? bpf_sock->sk : NULL;
+
+	return __bpf_sk_storage_get(map, sk, value, flags);
+}
+
+BPF_CALL_2(bpf_sock_ops_sk_storage_delete, struct bpf_map *, map,
+	   struct bpf_sock_ops_kern *, bpf_sock)
+{
+	struct sock *sk = bpf_sock->is_fullsock ? bpf_sock->sk : NULL;
+
+	return __bpf_sk_storage_delete(map, sk);
+}
+
+BPF_CALL_4(bpf_sock_sk_storage_get, struct bpf_map *, map, struct sock *, sk,
+	   void *, value, u64, flags)
+{
+	return __bpf_sk_storage_get(map, sk, value, flags);
+}
+
+BPF_CALL_2(bpf_sock_sk_storage_delete, struct bpf_map *, map,
+	   struct sock *, sk)
+{
+	return __bpf_sk_storage_delete(map, sk);
+}
+
+static struct bpf_map *sk_storage_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_local_storage_map *smap;
+
+	smap = bpf_local_storage_map_alloc(attr);
+	if (IS_ERR(smap))
+		return ERR_CAST(smap);
+
+	smap->cache_idx = bpf_local_storage_cache_idx_get(&sk_cache);
+	return &smap->map;
+}
+
+static void sk_storage_map_free(struct bpf_map *map)
+{
+	struct bpf_local_storage_map *smap;
+
+	smap = (struct bpf_local_storage_map *)map;
+	bpf_local_storage_cache_idx_free(&sk_cache, smap->cache_idx);
+	bpf_local_storage_map_free(smap, NULL);
+}
+
+const struct bpf_map_ops sk_storage_map_ops = {
+	.map_alloc_check = bpf_local_storage_map_alloc_check,
+	.map_alloc = sk_storage_map_alloc,
+	.map_free = sk_storage_map_free,
+	.map_get_next_key = bpf_local_storage_map_get_next_key,
+	.map_lookup_elem = bpf_fd_sk_storage_lookup_elem,
+	.map_update_elem = bpf_fd_sk_storage_update_elem,
+	.map_delete_elem = bpf_fd_sk_storage_delete_elem,
+	.map_local_storage_charge = sk_storage_charge,
+	.map_local_storage_uncharge = sk_storage_uncharge,
+	.map_owner_storage_ptr = sk_storage_ptr,
+};
+
+const struct bpf_func_proto bpf_sk_storage_get_proto = {
+	.func		= bpf_sk_storage_get,
+	.gpl_only	= false,
+	.ret_type	= RET_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_CTX,
+	.arg3_type	= ARG_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg4_type	= ARG_ANYTHING,
+};
+
+const struct bpf_func_proto bpf_sk_storage_delete_proto = {
+	.func		= bpf_sk_storage_delete,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_CTX,
+};
+
+const struct bpf_func_proto bpf_sock_ops_sk_storage_get_proto = {
+	.func		= bpf_sock_ops_sk_storage_get,
+	.gpl_only	= false,
+	.ret_type	= RET_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_CTX,
+	.arg3_type	= ARG_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg4_type	= ARG_ANYTHING,
+};
+
+const struct bpf_func_proto bpf_sock_ops_sk_storage_delete_proto = {
+	.func		= bpf_sock_ops_sk_storage_delete,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_CTX,
+};
+
+const struct bpf_func_proto bpf_sock_sk_storage_get_proto = {
+	.func		= bpf_sock_sk_storage_get,
+	.gpl_only	= false,
+	.ret_type	= RET_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_CTX,
+	.arg3_type	= ARG_PTR_TO_MAP_VALUE_OR_NULL,
+	.arg4_type	= ARG_ANYTHING,
+};
+
+const struct bpf_func_proto bpf_sock_sk_storage_delete_proto = {
+	.func		= bpf_sock_sk_storage_delete,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_CONST_MAP_PTR,
+	.arg2_type	= ARG_PTR_TO_CTX,
+};
@@ -68,6 +68,7 @@
 #include <linux/seg6_local.h>
 #include <net/seg6.h>
 #include <net/seg6_local.h>
+#include <net/bpf_sk_storage.h>
 
 #include <linux/rh_features.h>
 
@@ -4762,6 +4763,24 @@ bpf_base_func_proto(enum bpf_func_id func_id)
 		return &bpf_tail_call_proto;
 	case BPF_FUNC_ktime_get_ns:
 		return &bpf_ktime_get_ns_proto;
+	case BPF_FUNC_ringbuf_output:
+		return &bpf_ringbuf_output_proto;
+	case BPF_FUNC_ringbuf_reserve:
+		return &bpf_ringbuf_reserve_proto;
+	case BPF_FUNC_ringbuf_submit:
+		return &bpf_ringbuf_submit_proto;
+	case BPF_FUNC_ringbuf_discard:
+		return &bpf_ringbuf_discard_proto;
+	case BPF_FUNC_ringbuf_query:
+		return &bpf_ringbuf_query_proto;
+	case BPF_FUNC_spin_lock:
+		if (capable(CAP_SYS_ADMIN))
+			return &bpf_spin_lock_proto;
+		return NULL;
+	case BPF_FUNC_spin_unlock:
+		if (capable(CAP_SYS_ADMIN))
+			return &bpf_spin_unlock_proto;
+		return NULL;
 	case BPF_FUNC_trace_printk:
 		if (capable(CAP_SYS_ADMIN))
 			return bpf_get_trace_printk_proto();
@@ -4779,6 +4798,12 @@ sock_filter_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 	 */
 	case BPF_FUNC_get_current_uid_gid:
 		return &bpf_get_current_uid_gid_proto;
+#ifdef CONFIG_BPF_SYSCALL
+	case BPF_FUNC_ctx_sk_storage_get:
+		return &bpf_sock_sk_storage_get_proto;
+	case BPF_FUNC_ctx_sk_storage_delete:
+		return &bpf_sock_sk_storage_delete_proto;
+#endif
 	default:
 		return bpf_base_func_proto(func_id);
 	}
@@ -4823,6 +4848,21 @@ sk_filter_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 	}
 }
 
+static const struct bpf_func_proto *
+cg_skb_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
+{
+	switch (func_id) {
+#ifdef CONFIG_BPF_SYSCALL
+	case BPF_FUNC_ctx_sk_storage_get:
+		return &bpf_sk_storage_get_proto;
+	case BPF_FUNC_ctx_sk_storage_delete:
+		return &bpf_sk_storage_delete_proto;
+#endif
+	default:
+		return sk_filter_func_proto(func_id, prog);
+	}
+}
+
 static const struct bpf_func_proto *
 tc_cls_act_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 {
@@ -4896,6 +4936,12 @@ tc_cls_act_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 #ifdef CONFIG_SOCK_CGROUP_DATA
 	case BPF_FUNC_skb_cgroup_id:
 		return &bpf_skb_cgroup_id_proto;
+#endif
+#ifdef CONFIG_BPF_SYSCALL
+	case BPF_FUNC_ctx_sk_storage_get:
+		return &bpf_sk_storage_get_proto;
+	case BPF_FUNC_ctx_sk_storage_delete:
+		return &bpf_sk_storage_delete_proto;
 #endif
 	default:
 		return bpf_base_func_proto(func_id);
@@ -4943,6 +4989,12 @@ sock_ops_func_proto(enum bpf_func_id func_id, const struct bpf_prog *prog)
 		return &bpf_sock_map_update_proto;
 	case BPF_FUNC_sock_hash_update:
 		return &bpf_sock_hash_update_proto;
+#ifdef CONFIG_BPF_SYSCALL
+	case BPF_FUNC_ctx_sk_storage_get:
+		return &bpf_sock_ops_sk_storage_get_proto;
+	case BPF_FUNC_ctx_sk_storage_delete:
+		return &bpf_sock_ops_sk_storage_delete_proto;
+#endif
 	default:
 		return bpf_base_func_proto(func_id);
 	}
@@ -6793,7 +6845,7 @@ const struct bpf_prog_ops xdp_prog_ops = {
 };
 
 const struct bpf_verifier_ops cg_skb_verifier_ops = {
-	.get_func_proto		= sk_filter_func_proto,
+	.get_func_proto		= cg_skb_func_proto,
 	.is_valid_access	= sk_filter_is_valid_access,
 	.convert_ctx_access	= bpf_convert_ctx_access,
 };
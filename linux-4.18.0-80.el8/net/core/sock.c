@@ -137,6 +137,7 @@
 
 #include <linux/filter.h>
 #include <net/sock_reuseport.h>
+#include <net/bpf_sk_storage.h>
 
 #include <trace/events/sock.h>
 
@@ -1612,6 +1613,7 @@ static void __sk_destruct(struct rcu_head *head)
 	}
 	if (rcu_access_pointer(sk->sk_reuseport_cb))
 		reuseport_detach_sock(sk);
+	bpf_sk_storage_free(sk);
 
 	sock_disable_timestamp(sk, SK_FLAGS_TIMESTAMP);
 
@@ -1719,6 +1721,10 @@ struct sock *sk_clone_lock(const struct sock *sk, const gfp_t priority)
 		 */
 		refcount_set(&newsk->sk_wmem_alloc, 1);
 		atomic_set(&newsk->sk_omem_alloc, 0);
+#ifdef CONFIG_BPF_SYSCALL
+		/* the clone starts without any local storage */
+		RCU_INIT_POINTER(newsk->sk_bpf_storage, NULL);
+#endif
 		sk_init_common(newsk);
 
 		newsk->sk_dst_cache	= NULL;
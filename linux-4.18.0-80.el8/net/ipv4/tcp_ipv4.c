@@ -81,6 +81,7 @@
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/inetdevice.h>
+#include <linux/bpf.h>
 
 #include <crypto/hash.h>
 #include <linux/scatterlist.h>
@@ -2012,6 +2013,29 @@ EXPORT_SYMBOL(tcp_v4_destroy_sock);
 #ifdef CONFIG_PROC_FS
 /* Proc filesystem TCP sock list dumping. */
 
+static unsigned short seq_file_family(const struct seq_file *seq)
+{
+	const struct tcp_seq_afinfo *afinfo;
+
+#ifdef CONFIG_BPF_SYSCALL
+	/* walked by a BPF iterator, which sees all families */
+	afinfo = ((const struct tcp_iter_state *)seq->private)->bpf_seq_afinfo;
+	if (afinfo)
+		return afinfo->family;
+#endif
+	afinfo = PDE_DATA(file_inode(seq->file));
+	return afinfo->family;
+}
+
+static bool seq_sk_match(struct seq_file *seq, const struct sock *sk)
+{
+	unsigned short family = seq_file_family(seq);
+
+	/* AF_UNSPEC matches all families */
+	return (family == AF_UNSPEC || family == sk->sk_family) &&
+	       net_eq(sock_net(sk), seq_file_net(seq));
+}
+
 /*
  * Get next listener socket follow cur.  If cur is NULL, get first socket
  * starting from bucket given in st->bucket; when st->bucket is zero the
@@ -2019,9 +2043,7 @@ EXPORT_SYMBOL(tcp_v4_destroy_sock);
  */
 static void *listening_get_next(struct seq_file *seq, void *cur)
 {
-	struct tcp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
 	struct tcp_iter_state *st = seq->private;
-	struct net *net = seq_file_net(seq);
 	struct inet_listen_hashbucket *ilb;
 	struct sock *sk = cur;
 
@@ -2040,9 +2062,7 @@ get_head:
 	sk = sk_next(sk);
 get_sk:
 	sk_for_each_from(sk) {
-		if (!net_eq(sock_net(sk), net))
-			continue;
-		if (sk->sk_family == afinfo->family)
+		if (seq_sk_match(seq, sk))
 			return sk;
 	}
 	spin_unlock(&ilb->lock);
@@ -2079,9 +2099,7 @@ static inline bool empty_bucket(const struct tcp_iter_state *st)
  */
 static void *established_get_first(struct seq_file *seq)
 {
-	struct tcp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
 	struct tcp_iter_state *st = seq->private;
-	struct net *net = seq_file_net(seq);
 	void *rc = NULL;
 
 	st->offset = 0;
@@ -2096,10 +2114,8 @@ static void *established_get_first(struct seq_file *seq)
 
 		spin_lock_bh(lock);
 		sk_nulls_for_each(sk, node, &tcp_hashinfo.ehash[st->bucket].chain) {
-			if (sk->sk_family != afinfo->family ||
-			    !net_eq(sock_net(sk), net)) {
+			if (!seq_sk_match(seq, sk))
 				continue;
-			}
 			rc = sk;
 			goto out;
 		}
@@ -2111,11 +2127,9 @@ out:
 
 static void *established_get_next(struct seq_file *seq, void *cur)
 {
-	struct tcp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
 	struct sock *sk = cur;
 	struct hlist_nulls_node *node;
 	struct tcp_iter_state *st = seq->private;
-	struct net *net = seq_file_net(seq);
 
 	++st->num;
 	++st->offset;
@@ -2123,8 +2137,7 @@ static void *established_get_next(struct seq_file *seq, void *cur)
 	sk = sk_nulls_next(sk);
 
 	sk_nulls_for_each_from(sk, node) {
-		if (sk->sk_family == afinfo->family &&
-		    net_eq(sock_net(sk), net))
+		if (seq_sk_match(seq, sk))
 			return sk;
 	}
 
@@ -2412,6 +2425,102 @@ static struct tcp_seq_afinfo tcp4_seq_afinfo = {
 	.family		= AF_INET,
 };
 
+#ifdef CONFIG_BPF_SYSCALL
+/* Context of "tcp" iterator programs. sk_common is a full socket, a
+ * request sock or a timewait sock, as told by its skc_state.
+ */
+struct bpf_iter__tcp {
+	struct bpf_iter_meta *meta;
+	struct sock_common *sk_common;
+	u64 uid;
+};
+
+static int tcp_prog_seq_show(struct bpf_prog *prog, struct bpf_iter_meta *meta,
+			     struct sock_common *sk_common, uid_t uid)
+{
+	struct bpf_iter__tcp ctx;
+
+	ctx.meta = meta;
+	ctx.sk_common = sk_common;
+	ctx.uid = uid;
+	return bpf_iter_run_prog(prog, &ctx);
+}
+
+static int bpf_iter_tcp_seq_show(struct seq_file *seq, void *v)
+{
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+	struct sock *sk = v;
+	uid_t uid;
+
+	if (v == SEQ_START_TOKEN)
+		return SEQ_SKIP;
+
+	if (sk->sk_state == TCP_TIME_WAIT) {
+		uid = 0;
+	} else if (sk->sk_state == TCP_NEW_SYN_RECV) {
+		const struct request_sock *req = v;
+
+		uid = from_kuid_munged(seq_user_ns(seq),
+				       sock_i_uid(req->rsk_listener));
+	} else {
+		uid = from_kuid_munged(seq_user_ns(seq), sock_i_uid(sk));
+	}
+
+	meta.seq = seq;
+	prog = bpf_iter_get_info(&meta, false);
+	return tcp_prog_seq_show(prog, &meta, v, uid);
+}
+
+static void bpf_iter_tcp_seq_stop(struct seq_file *seq, void *v)
+{
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+
+	if (!v) {
+		meta.seq = seq;
+		prog = bpf_iter_get_info(&meta, true);
+		if (prog)
+			(void)tcp_prog_seq_show(prog, &meta, v, 0);
+	}
+
+	tcp_seq_stop(seq, v);
+}
+
+static const struct seq_operations bpf_iter_tcp_seq_ops = {
+	.show		= bpf_iter_tcp_seq_show,
+	.start		= tcp_seq_start,
+	.next		= tcp_seq_next,
+	.stop		= bpf_iter_tcp_seq_stop,
+};
+
+static struct tcp_seq_afinfo bpf_iter_tcp_afinfo = {
+	.family		= AF_UNSPEC,
+};
+
+static int bpf_iter_init_tcp(void *priv_data, struct bpf_map *map)
+{
+	struct tcp_iter_state *st = priv_data;
+	int ret;
+
+	ret = bpf_iter_init_seq_net(priv_data, map);
+	if (ret)
+		return ret;
+
+	st->bpf_seq_afinfo = &bpf_iter_tcp_afinfo;
+	return 0;
+}
+
+static const struct bpf_iter_reg tcp_reg_info = {
+	.target			= "tcp",
+	.seq_ops		= &bpf_iter_tcp_seq_ops,
+	.init_seq_private	= bpf_iter_init_tcp,
+	.fini_seq_private	= bpf_iter_fini_seq_net,
+	.seq_priv_size		= sizeof(struct tcp_iter_state),
+	.ctx_arg_cnt		= 3,
+};
+#endif
+
 static int __net_init tcp4_proc_init_net(struct net *net)
 {
 	if (!proc_create_net_data("tcp", 0444, net->proc_net, &tcp4_seq_ops,
@@ -2432,6 +2541,10 @@ static struct pernet_operations tcp4_net_ops = {
 
 int __init tcp4_proc_init(void)
 {
+#ifdef CONFIG_BPF_SYSCALL
+	if (bpf_iter_reg_target(&tcp_reg_info))
+		pr_warn("Warning: could not register bpf iterator tcp\n");
+#endif
 	return register_pernet_subsys(&tcp4_net_ops);
 }
 
@@ -102,6 +102,7 @@
 #include <linux/skbuff.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/bpf.h>
 #include <net/net_namespace.h>
 #include <net/icmp.h>
 #include <net/inet_hashtables.h>
@@ -2689,12 +2690,32 @@ EXPORT_SYMBOL(udp_prot);
 /* ------------------------------------------------------------------------ */
 #ifdef CONFIG_PROC_FS
 
+static struct udp_seq_afinfo *udp_iter_afinfo(struct seq_file *seq)
+{
+#ifdef CONFIG_BPF_SYSCALL
+	struct udp_iter_state *state = seq->private;
+
+	/* walked by a BPF iterator, which sees all families */
+	if (state->bpf_seq_afinfo)
+		return state->bpf_seq_afinfo;
+#endif
+	return PDE_DATA(file_inode(seq->file));
+}
+
+static bool seq_sk_match(struct seq_file *seq, const struct sock *sk)
+{
+	unsigned short family = udp_iter_afinfo(seq)->family;
+
+	/* AF_UNSPEC matches all families */
+	return (family == AF_UNSPEC || family == sk->sk_family) &&
+	       net_eq(sock_net(sk), seq_file_net(seq));
+}
+
 static struct sock *udp_get_first(struct seq_file *seq, int start)
 {
 	struct sock *sk;
-	struct udp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct udp_seq_afinfo *afinfo = udp_iter_afinfo(seq);
 	struct udp_iter_state *state = seq->private;
-	struct net *net = seq_file_net(seq);
 
 	for (state->bucket = start; state->bucket <= afinfo->udp_table->mask;
 	     ++state->bucket) {
@@ -2705,9 +2726,7 @@ static struct sock *udp_get_first(struct seq_file *seq, int start)
 
 		spin_lock_bh(&hslot->lock);
 		sk_for_each(sk, &hslot->head) {
-			if (!net_eq(sock_net(sk), net))
-				continue;
-			if (sk->sk_family == afinfo->family)
+			if (seq_sk_match(seq, sk))
 				goto found;
 		}
 		spin_unlock_bh(&hslot->lock);
@@ -2719,13 +2738,12 @@ found:
 
 static struct sock *udp_get_next(struct seq_file *seq, struct sock *sk)
 {
-	struct udp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct udp_seq_afinfo *afinfo = udp_iter_afinfo(seq);
 	struct udp_iter_state *state = seq->private;
-	struct net *net = seq_file_net(seq);
 
 	do {
 		sk = sk_next(sk);
-	} while (sk && (!net_eq(sock_net(sk), net) || sk->sk_family != afinfo->family));
+	} while (sk && !seq_sk_match(seq, sk));
 
 	if (!sk) {
 		if (state->bucket <= afinfo->udp_table->mask)
@@ -2770,7 +2788,7 @@ EXPORT_SYMBOL(udp_seq_next);
 
 void udp_seq_stop(struct seq_file *seq, void *v)
 {
-	struct udp_seq_afinfo *afinfo = PDE_DATA(file_inode(seq->file));
+	struct udp_seq_afinfo *afinfo = udp_iter_afinfo(seq);
 	struct udp_iter_state *state = seq->private;
 
 	if (state->bucket <= afinfo->udp_table->mask)
@@ -2829,6 +2847,94 @@ static struct udp_seq_afinfo udp4_seq_afinfo = {
 	.udp_table	= &udp_table,
 };
 
+#ifdef CONFIG_BPF_SYSCALL
+/* context of "udp" iterator programs */
+struct bpf_iter__udp {
+	struct bpf_iter_meta *meta;
+	struct udp_sock *udp_sk;
+	u64 uid;
+	u64 bucket;
+};
+
+static int udp_prog_seq_show(struct bpf_prog *prog, struct bpf_iter_meta *meta,
+			     struct udp_sock *udp_sk, uid_t uid, int bucket)
+{
+	struct bpf_iter__udp ctx;
+
+	ctx.meta = meta;
+	ctx.udp_sk = udp_sk;
+	ctx.uid = uid;
+	ctx.bucket = bucket;
+	return bpf_iter_run_prog(prog, &ctx);
+}
+
+static int bpf_iter_udp_seq_show(struct seq_file *seq, void *v)
+{
+	struct udp_iter_state *state = seq->private;
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+	struct sock *sk = v;
+	uid_t uid;
+
+	if (v == SEQ_START_TOKEN)
+		return SEQ_SKIP;
+
+	uid = from_kuid_munged(seq_user_ns(seq), sock_i_uid(sk));
+	meta.seq = seq;
+	prog = bpf_iter_get_info(&meta, false);
+	return udp_prog_seq_show(prog, &meta, v, uid, state->bucket);
+}
+
+static void bpf_iter_udp_seq_stop(struct seq_file *seq, void *v)
+{
+	struct bpf_iter_meta meta;
+	struct bpf_prog *prog;
+
+	if (!v) {
+		meta.seq = seq;
+		prog = bpf_iter_get_info(&meta, true);
+		if (prog)
+			(void)udp_prog_seq_show(prog, &meta, v, 0, 0);
+	}
+
+	udp_seq_stop(seq, v);
+}
+
+static const struct seq_operations bpf_iter_udp_seq_ops = {
+	.start		= udp_seq_start,
+	.next		= udp_seq_next,
+	.stop		= bpf_iter_udp_seq_stop,
+	.show		= bpf_iter_udp_seq_show,
+};
+
+static struct udp_seq_afinfo bpf_iter_udp_afinfo = {
+	.family		= AF_UNSPEC,
+	.udp_table	= &udp_table,
+};
+
+static int bpf_iter_init_udp(void *priv_data, struct bpf_map *map)
+{
+	struct udp_iter_state *state = priv_data;
+	int ret;
+
+	ret = bpf_iter_init_seq_net(priv_data, map);
+	if (ret)
+		return ret;
+
+	state->bpf_seq_afinfo = &bpf_iter_udp_afinfo;
+	return 0;
+}
+
+static const struct bpf_iter_reg udp_reg_info = {
+	.target			= "udp",
+	.seq_ops		= &bpf_iter_udp_seq_ops,
+	.init_seq_private	= bpf_iter_init_udp,
+	.fini_seq_private	= bpf_iter_fini_seq_net,
+	.seq_priv_size		= sizeof(struct udp_iter_state),
+	.ctx_arg_cnt		= 4,
+};
+#endif
+
 static int __net_init udp4_proc_init_net(struct net *net)
 {
 	if (!proc_create_net_data("udp", 0444, net->proc_net, &udp_seq_ops,
@@ -2849,6 +2955,10 @@ static struct pernet_operations udp4_net_ops = {
 
 int __init udp4_proc_init(void)
 {
+#ifdef CONFIG_BPF_SYSCALL
+	if (bpf_iter_reg_target(&udp_reg_info))
+		pr_warn("Warning: could not register bpf iterator udp\n");
+#endif
 	return register_pernet_subsys(&udp4_net_ops);
 }
 
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure the cost of dumping all TCP sockets, as a connection monitor
+ * would: by reading and parsing /proc/net/tcp and /proc/net/tcp6, and by
+ * reading a "tcp" BPF iterator whose program writes one fixed-size binary
+ * record per socket with bpf_iter_seq_write().
+ *
+ * The benchmark opens the given number of loopback connections first, so
+ * there are at least twice that many sockets plus the listener. For each
+ * method the time per dump, the time per socket and the number of sockets
+ * seen are printed.
+ *
+ *   iter_tcp_bench [-n connections] [-r rounds]
+ *
+ * The default is 1000 connections dumped 100 times.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/filter.h>
+#include <bpf/bpf.h>
+
+static unsigned int nr_conns = 1000, nr_rounds = 100;
+static char buf[1 << 20];
+
+/* what the program writes per socket: the start of its sock_common,
+ * addresses, ports, family and state, and the owner's uid
+ */
+struct tcp_rec {
+	__u8 sk_common[24];
+	__u64 uid;
+};
+
+/* int bpf_iter_tcp(void *meta, void *sk_common, u64 uid) */
+#define BTF_INFO_ENC(kind, vlen)	((kind) << 24 | (vlen))
+
+static const __u32 btf_types[] = {
+	/* [1] int */
+	1, BTF_INFO_ENC(BTF_KIND_INT, 0), 4, 32,
+	/* [2] u64 */
+	5, BTF_INFO_ENC(BTF_KIND_INT, 0), 8, 64,
+	/* [3] void * */
+	0, BTF_INFO_ENC(BTF_KIND_PTR, 0), 0,
+	/* [4] int (void *meta, void *sk_common, u64 uid) */
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 3), 1,
+		9, 3,
+		14, 3,
+		24, 2,
+	/* [5] bpf_iter_tcp */
+	28, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 4,
+};
+
+static const char btf_strings[] =
+	"\0int\0u64\0meta\0sk_common\0uid\0bpf_iter_tcp";
+
+#define BTF_ID_ITER_TCP	5
+
+static const struct bpf_insn prog[] = {
+	BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+	BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 8),
+	/* nothing to write for the final call */
+	BPF_JMP_IMM(BPF_JNE, BPF_REG_3, 0, 2),
+	BPF_MOV64_IMM(BPF_REG_0, 0),
+	BPF_EXIT_INSN(),
+	/* probe_read(fp - 32, 24, sk_common) */
+	BPF_MOV64_REG(BPF_REG_1, BPF_REG_10),
+	BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, -32),
+	BPF_MOV64_IMM(BPF_REG_2, 24),
+	BPF_EMIT_CALL(BPF_FUNC_probe_read),
+	BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 16),
+	BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_3, -8),
+	/* iter_seq_write(ctx, fp - 32, 32) */
+	BPF_MOV64_REG(BPF_REG_1, BPF_REG_6),
+	BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+	BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -32),
+	BPF_MOV64_IMM(BPF_REG_3, sizeof(struct tcp_rec)),
+	BPF_EMIT_CALL(BPF_FUNC_iter_seq_write),
+	BPF_MOV64_IMM(BPF_REG_0, 0),
+	BPF_EXIT_INSN(),
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static __u64 ptr_to_u64(const void *ptr)
+{
+	return (__u64) (unsigned long) ptr;
+}
+
+static void report(const char *name, unsigned long long start,
+		   unsigned long long socks)
+{
+	double ns = now_ns() - start;
+
+	printf("%-16s %12.0f %10.2f %10llu\n", name, ns / nr_rounds,
+	       socks ? ns / socks : 0, socks / nr_rounds);
+	fflush(stdout);
+}
+
+static int load_prog(void)
+{
+	char btf[sizeof(struct btf_header) + sizeof(btf_types) +
+		 sizeof(btf_strings)];
+	struct btf_header hdr = {
+		.magic = BTF_MAGIC,
+		.version = BTF_VERSION,
+		.hdr_len = sizeof(hdr),
+		.type_len = sizeof(btf_types),
+		.str_off = sizeof(btf_types),
+		.str_len = sizeof(btf_strings),
+	};
+	static char log[65536];
+	union bpf_attr attr;
+	int btf_fd, fd;
+
+	memcpy(btf, &hdr, sizeof(hdr));
+	memcpy(btf + sizeof(hdr), btf_types, sizeof(btf_types));
+	memcpy(btf + sizeof(hdr) + sizeof(btf_types), btf_strings,
+	       sizeof(btf_strings));
+	btf_fd = bpf_load_btf(btf, sizeof(btf), log, sizeof(log), false);
+	if (btf_fd < 0) {
+		fprintf(stderr, "bpf_load_btf: %s\n%s", strerror(errno), log);
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_TRACING;
+	attr.expected_attach_type = BPF_TRACE_ITER;
+	attr.insns = ptr_to_u64(prog);
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = ptr_to_u64("GPL");
+	attr.log_buf = ptr_to_u64(log);
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	attr.attach_btf_obj_fd = btf_fd;
+	attr.attach_btf_id = BTF_ID_ITER_TCP;
+	fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+	if (fd < 0)
+		fprintf(stderr, "BPF_PROG_LOAD: %s\n%s", strerror(errno), log);
+	close(btf_fd);
+	return fd;
+}
+
+/* Open nr_conns connections to a listener on the loopback device. */
+static int open_conns(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+	unsigned int i;
+	int lfd, fd;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(lfd, 128) ||
+	    getsockname(lfd, (struct sockaddr *)&addr, &len)) {
+		perror("listen");
+		return -1;
+	}
+
+	for (i = 0; i < nr_conns; i++) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0 ||
+		    connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+		    accept(lfd, NULL, NULL) < 0) {
+			perror("connect");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Count the lines after the header, as a parser of the table would. */
+static unsigned long long read_proc(const char *path)
+{
+	unsigned long long lines = 0;
+	ssize_t n, i;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		for (i = 0; i < n; i++)
+			lines += buf[i] == '\n';
+	fclose(f);
+	return lines ? lines - 1 : 0;
+}
+
+static void dump_proc(void)
+{
+	unsigned long long start = now_ns(), socks = 0;
+	unsigned int r;
+
+	for (r = 0; r < nr_rounds; r++) {
+		socks += read_proc("/proc/net/tcp");
+		socks += read_proc("/proc/net/tcp6");
+	}
+	report("/proc/net/tcp*", start, socks);
+}
+
+static void dump_iter(int prog_fd)
+{
+	unsigned long long start = now_ns(), socks = 0;
+	union bpf_attr attr;
+	unsigned int r;
+	ssize_t n;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_iter_create.prog_fd = prog_fd;
+
+	for (r = 0; r < nr_rounds; r++) {
+		fd = syscall(__NR_bpf, BPF_PROG_ITER_CREATE, &attr, sizeof(attr));
+		if (fd < 0) {
+			perror("BPF_PROG_ITER_CREATE");
+			return;
+		}
+		while ((n = read(fd, buf, sizeof(buf))) > 0)
+			socks += n / sizeof(struct tcp_rec);
+		close(fd);
+		if (n < 0) {
+			perror("read");
+			return;
+		}
+	}
+	report("bpf_iter", start, socks);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	int opt, prog_fd;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_conns = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n connections] [-r rounds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_rounds) {
+		fprintf(stderr, "need at least one round\n");
+		return 1;
+	}
+
+	setrlimit(RLIMIT_MEMLOCK, &r);
+	r.rlim_cur = r.rlim_max = 2 * nr_conns + 64;
+	if (setrlimit(RLIMIT_NOFILE, &r)) {
+		perror("setrlimit");
+		return 1;
+	}
+
+	prog_fd = load_prog();
+	if (prog_fd < 0 || open_conns())
+		return 1;
+
+	printf("%u connections, %u rounds\n", nr_conns, nr_rounds);
+	printf("%-16s %12s %10s %10s\n", "method", "ns/dump", "ns/socket",
+	       "sockets");
+
+	dump_proc();
+	dump_iter(prog_fd);
+
+	close(prog_fd);
+	return 0;
+}
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure the cost of finding per-task state from a BPF program: in a hash
+ * map keyed by thread id, sized and filled for the peak number of tasks as
+ * such maps have to be, and in task local storage.
+ *
+ * Both programs are attached to the task_rename raw tracepoint and bump a
+ * counter of the current task. The benchmark renames itself in a loop and
+ * prints the time per rename without any program, then with each of them.
+ *
+ *   local_storage_bench [-n hash entries] [-r renames]
+ *
+ * The default is 10000 hash entries and 1000000 renames.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <bpf/bpf.h>
+
+static unsigned int nr_entries = 10000, nr_renames = 1000000;
+static char comm[16];
+
+/* v = hash_lookup(map, &tid); if (v) (*v)++ */
+static struct bpf_insn hash_prog[] = {
+	BPF_EMIT_CALL(BPF_FUNC_get_current_pid_tgid),
+	BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -4),
+	BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+	BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4),
+	BPF_LD_MAP_FD(BPF_REG_1, 0),
+	BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+	BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+	BPF_MOV64_IMM(BPF_REG_1, 1),
+	BPF_STX_XADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0),
+	BPF_MOV64_IMM(BPF_REG_0, 0),
+	BPF_EXIT_INSN(),
+};
+
+/* v = current_task_storage_get(map, NULL, F_CREATE);
+ * if (v) (*v)++
+ */
+static struct bpf_insn storage_prog[] = {
+	BPF_LD_MAP_FD(BPF_REG_1, 0),
+	BPF_MOV64_IMM(BPF_REG_2, 0),
+	BPF_MOV64_IMM(BPF_REG_3, BPF_LOCAL_STORAGE_GET_F_CREATE),
+	BPF_EMIT_CALL(BPF_FUNC_current_task_storage_get),
+	BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+	BPF_MOV64_IMM(BPF_REG_1, 1),
+	BPF_STX_XADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0),
+	BPF_MOV64_IMM(BPF_REG_0, 0),
+	BPF_EXIT_INSN(),
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void run(const char *name)
+{
+	unsigned long long start = now_ns();
+	unsigned int i;
+
+	for (i = 0; i < nr_renames; i++)
+		prctl(PR_SET_NAME, comm, 0, 0, 0);
+	printf("%-16s %10.2f\n", name, (double)(now_ns() - start) / nr_renames);
+	fflush(stdout);
+}
+
+/* Load prog with map_fd patched into its first map load, attach and run. */
+static int run_prog(const char *name, struct bpf_insn *prog, int insn_cnt,
+		    int ld_map_insn, int map_fd)
+{
+	static char log[65536];
+	int prog_fd, efd;
+
+	prog[ld_map_insn].imm = map_fd;
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_RAW_TRACEPOINT, prog,
+				   insn_cnt, "GPL", 0, log, sizeof(log));
+	if (prog_fd < 0) {
+		fprintf(stderr, "load %s: %s\n%s", name, strerror(errno), log);
+		return -1;
+	}
+	efd = bpf_raw_tracepoint_open("task_rename", prog_fd);
+	if (efd < 0) {
+		fprintf(stderr, "attach %s: %s\n", name, strerror(errno));
+		close(prog_fd);
+		return -1;
+	}
+
+	run(name);
+
+	close(efd);
+	close(prog_fd);
+	return 0;
+}
+
+static int bench_hash(void)
+{
+	__u32 tid = syscall(__NR_gettid), key, i;
+	__u64 val = 0;
+	int map_fd, err;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(key), sizeof(val),
+				nr_entries, 0);
+	if (map_fd < 0) {
+		perror("create hash");
+		return -1;
+	}
+
+	/* as full as it would be at the peak task count */
+	for (i = 0, key = tid; i < nr_entries; i++, key++)
+		if (bpf_map_update_elem(map_fd, &key, &val, BPF_ANY)) {
+			perror("fill hash");
+			close(map_fd);
+			return -1;
+		}
+
+	err = run_prog("hash", hash_prog,
+		       sizeof(hash_prog) / sizeof(hash_prog[0]), 4, map_fd);
+	close(map_fd);
+	return err;
+}
+
+static int bench_storage(void)
+{
+	int map_fd, err;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PID_TASK_STORAGE, sizeof(int),
+				sizeof(__u64), 0, BPF_F_NO_PREALLOC);
+	if (map_fd < 0) {
+		perror("create task storage");
+		return -1;
+	}
+
+	err = run_prog("task_storage", storage_prog,
+		       sizeof(storage_prog) / sizeof(storage_prog[0]), 0,
+		       map_fd);
+	close(map_fd);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_renames = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n hash entries] [-r renames]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_entries || !nr_renames) {
+		fprintf(stderr, "need at least one entry and one rename\n");
+		return 1;
+	}
+
+	setrlimit(RLIMIT_MEMLOCK, &r);
+	prctl(PR_GET_NAME, comm, 0, 0, 0);
+
+	printf("%u hash entries, %u renames\n", nr_entries, nr_renames);
+	printf("%-16s %10s\n", "method", "ns/rename");
+
+	run("base");
+	if (bench_hash() || bench_storage())
+		return 1;
+	return 0;
+}
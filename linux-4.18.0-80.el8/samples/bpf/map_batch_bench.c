@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Dump a large hash map from user space, once element by element with
+ * BPF_MAP_GET_NEXT_KEY + BPF_MAP_LOOKUP_ELEM and once with
+ * BPF_MAP_LOOKUP_BATCH, then drain it with BPF_MAP_LOOKUP_AND_DELETE_BATCH.
+ * The map is filled with BPF_MAP_UPDATE_BATCH, which is timed as well.
+ *
+ * For each pass the number of elements, the time taken, the element rate and
+ * the number of bpf() calls are printed; every pass checks that it saw each
+ * element exactly once.
+ *
+ *   map_batch_bench [-n entries] [-b batch size] [-p]
+ *
+ * -p uses a per-cpu hash map, where every value is copied once per possible
+ * cpu. The default is 10M entries in batches of 10000.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include "bpf_util.h"
+
+static unsigned int nr_entries = 10000000, batch_size = 10000, nr_values = 1;
+static __u64 *keys, *values;
+static unsigned long long nr_calls;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static __u64 ptr_to_u64(const void *ptr)
+{
+	return (__u64) (unsigned long) ptr;
+}
+
+static int map_batch(int cmd, int fd, void *in_batch, void *out_batch,
+		     __u32 *count, __u64 elem_flags)
+{
+	union bpf_attr attr;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.batch.map_fd = fd;
+	attr.batch.in_batch = ptr_to_u64(in_batch);
+	attr.batch.out_batch = ptr_to_u64(out_batch);
+	attr.batch.keys = ptr_to_u64(keys);
+	attr.batch.values = ptr_to_u64(values);
+	attr.batch.count = *count;
+	attr.batch.elem_flags = elem_flags;
+
+	nr_calls++;
+	ret = syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+	*count = attr.batch.count;
+	return ret;
+}
+
+/* Every key k holds k on all cpus, so the sum over one dump is known. */
+static unsigned long long account(__u64 *seen, __u32 count)
+{
+	unsigned long long sum = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < count; i++) {
+		sum += keys[i];
+		for (j = 0; j < nr_values; j++)
+			if (values[i * nr_values + j] != keys[i])
+				return -1ull;
+	}
+	*seen += count;
+	return sum;
+}
+
+static void report(const char *name, unsigned long long start, __u64 seen,
+		   unsigned long long sum)
+{
+	unsigned long long ns = now_ns() - start;
+	unsigned long long want = (unsigned long long)nr_entries *
+				  (nr_entries - 1) / 2;
+
+	printf("%-22s %10llu %10.1f %12.0f %10llu %s\n", name, seen,
+	       ns / 1e6, seen * 1e9 / ns, nr_calls,
+	       seen == nr_entries && sum == want ? "ok" : "MISMATCH");
+	fflush(stdout);
+}
+
+static int fill(int fd)
+{
+	unsigned long long start = now_ns();
+	__u32 count, i, j, done = 0;
+	__u64 seen = 0;
+
+	nr_calls = 0;
+	while (done < nr_entries) {
+		count = nr_entries - done < batch_size ?
+			nr_entries - done : batch_size;
+		for (i = 0; i < count; i++) {
+			keys[i] = done + i;
+			for (j = 0; j < nr_values; j++)
+				values[i * nr_values + j] = done + i;
+		}
+		if (map_batch(BPF_MAP_UPDATE_BATCH, fd, NULL, NULL, &count,
+			      BPF_NOEXIST)) {
+			perror("BPF_MAP_UPDATE_BATCH");
+			return -1;
+		}
+		done += count;
+		seen += count;
+	}
+	report("update batch", start, seen,
+	       (unsigned long long)nr_entries * (nr_entries - 1) / 2);
+	return 0;
+}
+
+static void dump_one_by_one(int fd)
+{
+	unsigned long long start = now_ns(), sum = 0;
+	__u64 key, seen = 0;
+	void *prev = NULL;
+
+	nr_calls = 0;
+	while (!bpf_map_get_next_key(fd, prev, &key)) {
+		nr_calls += 2;
+		keys[0] = key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			break;
+		sum += account(&seen, 1);
+		prev = &key;
+	}
+	nr_calls++;
+	report("get_next_key+lookup", start, seen, sum);
+}
+
+static void dump_batch(int fd, int cmd, const char *name)
+{
+	unsigned long long start = now_ns(), sum = 0;
+	__u64 in_batch = 0, out_batch = 0, seen = 0;
+	bool first = true;
+	__u32 count;
+	int err;
+
+	nr_calls = 0;
+	do {
+		count = batch_size;
+		err = map_batch(cmd, fd, first ? NULL : &in_batch, &out_batch,
+				&count, 0);
+		if (err && errno != ENOENT) {
+			perror(name);
+			break;
+		}
+		sum += account(&seen, count);
+		in_batch = out_batch;
+		first = false;
+	} while (!err);
+	report(name, start, seen, sum);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	enum bpf_map_type type = BPF_MAP_TYPE_HASH;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:b:p")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			type = BPF_MAP_TYPE_PERCPU_HASH;
+			nr_values = bpf_num_possible_cpus();
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n entries] [-b batch size] [-p]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	/* a batch never splits a hash bucket, leave room for crowded ones */
+	if (!nr_entries || batch_size < 64) {
+		fprintf(stderr, "need at least one entry and a batch of 64\n");
+		return 1;
+	}
+
+	setrlimit(RLIMIT_MEMLOCK, &r);
+	fd = bpf_create_map(type, sizeof(__u64), sizeof(__u64), nr_entries, 0);
+	if (fd < 0) {
+		perror("bpf_create_map");
+		return 1;
+	}
+
+	keys = calloc(batch_size, sizeof(*keys));
+	values = calloc((size_t)batch_size * nr_values, sizeof(*values));
+	if (!keys || !values)
+		return 1;
+
+	printf("%s, %u entries, batches of %u\n",
+	       type == BPF_MAP_TYPE_HASH ? "hash" : "percpu hash", nr_entries,
+	       batch_size);
+	printf("%-22s %10s %10s %12s %10s\n", "pass", "elements", "ms",
+	       "elements/s", "bpf calls");
+
+	if (fill(fd))
+		return 1;
+	dump_one_by_one(fd);
+	dump_batch(fd, BPF_MAP_LOOKUP_BATCH, "lookup batch");
+	dump_batch(fd, BPF_MAP_LOOKUP_AND_DELETE_BATCH, "lookup+delete batch");
+	return 0;
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure the cost of scraping an array of u64 counters from user space, as
+ * a metrics exporter would: element by element with BPF_MAP_LOOKUP_ELEM,
+ * with BPF_MAP_LOOKUP_BATCH and by reading a BPF_F_MMAPABLE array through
+ * its mapping, which takes no bpf() call at all.
+ *
+ * For each method the time per scrape, the time per counter and the number
+ * of bpf() calls per scrape are printed; every scrape checks the sum of the
+ * counters.
+ *
+ *   map_scrape_bench [-n counters] [-r rounds] [-b batch size]
+ *
+ * The default is 65536 counters scraped 100 times in batches of 4096.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+
+static unsigned int nr_entries = 65536, nr_rounds = 100, batch_size = 4096;
+static unsigned long long nr_calls, want;
+static __u32 *keys;
+static __u64 *values;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static __u64 ptr_to_u64(const void *ptr)
+{
+	return (__u64) (unsigned long) ptr;
+}
+
+static void report(const char *name, unsigned long long start, bool ok)
+{
+	double ns = now_ns() - start;
+
+	printf("%-16s %12.0f %10.2f %12llu %s\n", name, ns / nr_rounds,
+	       ns / nr_rounds / nr_entries, nr_calls / nr_rounds,
+	       ok ? "ok" : "MISMATCH");
+	fflush(stdout);
+}
+
+static void scrape_lookup(int fd)
+{
+	unsigned long long start = now_ns(), sum;
+	unsigned int r;
+	bool ok = true;
+	__u32 key;
+	__u64 val;
+
+	nr_calls = 0;
+	for (r = 0; r < nr_rounds; r++) {
+		sum = 0;
+		for (key = 0; key < nr_entries; key++) {
+			nr_calls++;
+			if (bpf_map_lookup_elem(fd, &key, &val))
+				break;
+			sum += val;
+		}
+		ok &= sum == want;
+	}
+	report("lookup", start, ok);
+}
+
+static void scrape_batch(int fd)
+{
+	unsigned long long start = now_ns(), sum;
+	__u32 in_batch, out_batch, i;
+	union bpf_attr attr;
+	unsigned int r;
+	bool ok = true;
+	int err;
+
+	nr_calls = 0;
+	for (r = 0; r < nr_rounds; r++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.batch.map_fd = fd;
+		attr.batch.out_batch = ptr_to_u64(&out_batch);
+		attr.batch.keys = ptr_to_u64(keys);
+		attr.batch.values = ptr_to_u64(values);
+		sum = 0;
+		do {
+			attr.batch.count = batch_size;
+			nr_calls++;
+			err = syscall(__NR_bpf, BPF_MAP_LOOKUP_BATCH, &attr,
+				      sizeof(attr));
+			if (err && errno != ENOENT) {
+				perror("BPF_MAP_LOOKUP_BATCH");
+				return;
+			}
+			for (i = 0; i < attr.batch.count; i++)
+				sum += values[i];
+			in_batch = out_batch;
+			attr.batch.in_batch = ptr_to_u64(&in_batch);
+		} while (!err);
+		ok &= sum == want;
+	}
+	report("lookup batch", start, ok);
+}
+
+static void scrape_mmap(const volatile __u64 *map)
+{
+	unsigned long long start = now_ns(), sum;
+	unsigned int r, i;
+	bool ok = true;
+
+	nr_calls = 0;
+	for (r = 0; r < nr_rounds; r++) {
+		sum = 0;
+		for (i = 0; i < nr_entries; i++)
+			sum += map[i];
+		ok &= sum == want;
+	}
+	report("mmap", start, ok);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	size_t map_sz;
+	__u64 *map;
+	__u32 i;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:r:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n counters] [-r rounds] [-b batch size]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_entries || !nr_rounds || !batch_size) {
+		fprintf(stderr, "need at least one counter, round and batch\n");
+		return 1;
+	}
+
+	setrlimit(RLIMIT_MEMLOCK, &r);
+	fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(__u32), sizeof(__u64),
+			    nr_entries, BPF_F_MMAPABLE);
+	if (fd < 0) {
+		perror("bpf_create_map");
+		return 1;
+	}
+	map_sz = (size_t)nr_entries * sizeof(__u64);
+	map = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	keys = calloc(batch_size, sizeof(*keys));
+	values = calloc(batch_size, sizeof(*values));
+	if (!keys || !values)
+		return 1;
+
+	/* filled through the mapping as well, counter i holds i */
+	for (i = 0; i < nr_entries; i++)
+		map[i] = i;
+	want = (unsigned long long)nr_entries * (nr_entries - 1) / 2;
+
+	printf("%u counters, %u rounds, batches of %u\n", nr_entries,
+	       nr_rounds, batch_size);
+	printf("%-16s %12s %10s %12s\n", "method", "ns/scrape", "ns/counter",
+	       "bpf calls");
+
+	scrape_lookup(fd);
+	scrape_batch(fd);
+	scrape_mmap(map);
+
+	munmap(map, map_sz);
+	close(fd);
+	return 0;
+}
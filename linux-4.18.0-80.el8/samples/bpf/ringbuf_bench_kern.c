@@ -0,0 +1,103 @@
+/* This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/ptrace.h>
+#include <linux/version.h>
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+#define MAX_CPUS 128
+
+enum {
+	MODE_OFF,
+	MODE_PERF,
+	MODE_RINGBUF_OUTPUT,
+	MODE_RINGBUF_RESERVE,
+};
+
+struct event {
+	u64 ts;
+	u64 pid;
+	u64 payload[6];
+};
+
+struct bpf_map_def SEC("maps") perf_map = {
+	.type = BPF_MAP_TYPE_PERF_EVENT_ARRAY,
+	.key_size = sizeof(int),
+	.value_size = sizeof(u32),
+	.max_entries = MAX_CPUS,
+};
+
+struct bpf_map_def SEC("maps") ringbuf = {
+	.type = BPF_MAP_TYPE_RINGBUF,
+	.max_entries = 1 << 20,
+};
+
+struct bpf_map_def SEC("maps") mode_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u32),
+	.max_entries = 1,
+};
+
+/* [0] = events produced, [1] = events dropped */
+struct bpf_map_def SEC("maps") stats = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = 2,
+};
+
+static __always_inline void account(bool dropped)
+{
+	u32 key = dropped;
+	u64 *cnt;
+
+	cnt = bpf_map_lookup_elem(&stats, &key);
+	if (cnt)
+		(*cnt)++;
+}
+
+SEC("kprobe/sys_getpgid")
+int bench_prog(struct pt_regs *ctx)
+{
+	struct event e = {}, *r;
+	u32 key = 0, *mode;
+
+	mode = bpf_map_lookup_elem(&mode_map, &key);
+	if (!mode || *mode == MODE_OFF)
+		return 0;
+
+	account(false);
+	switch (*mode) {
+	case MODE_PERF:
+		e.ts = bpf_ktime_get_ns();
+		e.pid = bpf_get_current_pid_tgid();
+		if (bpf_perf_event_output(ctx, &perf_map, BPF_F_CURRENT_CPU,
+					  &e, sizeof(e)))
+			account(true);
+		break;
+	case MODE_RINGBUF_OUTPUT:
+		e.ts = bpf_ktime_get_ns();
+		e.pid = bpf_get_current_pid_tgid();
+		if (bpf_ringbuf_output(&ringbuf, &e, sizeof(e), 0))
+			account(true);
+		break;
+	case MODE_RINGBUF_RESERVE:
+		/* no copy: the event is built in place */
+		r = bpf_ringbuf_reserve(&ringbuf, sizeof(*r), 0);
+		if (!r) {
+			account(true);
+			break;
+		}
+		r->ts = bpf_ktime_get_ns();
+		r->pid = bpf_get_current_pid_tgid();
+		bpf_ringbuf_submit(r, 0);
+		break;
+	}
+	return 0;
+}
+
+char _license[] SEC("license") = "GPL";
+u32 _version SEC("version") = LINUX_VERSION_CODE;
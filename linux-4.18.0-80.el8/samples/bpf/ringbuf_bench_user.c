@@ -0,0 +1,312 @@
+/* This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * Compare streaming events to user space through per-cpu perf buffers
+ * against the shared BPF ring buffer, both with bpf_ringbuf_output() and
+ * with bpf_ringbuf_reserve()/bpf_ringbuf_submit().
+ *
+ * Producers are forked tasks, one per cpu by default, that call getpgid()
+ * in a loop; a kprobe on it emits one 64 byte event per call. A single
+ * consumer drains the buffers for the duration of the run. For each mode
+ * the produced, consumed and dropped event rates are printed along with
+ * the memory the buffers take up.
+ *
+ *   ringbuf_bench [-p producers] [-d seconds] [-P perf pages per cpu]
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+#include <bpf/bpf.h>
+#include <libbpf.h>
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "perf-sys.h"
+#include "trace_helpers.h"
+
+#define MAX_CPUS 128
+
+enum {
+	MODE_OFF,
+	MODE_PERF,
+	MODE_RINGBUF_OUTPUT,
+	MODE_RINGBUF_RESERVE,
+};
+
+static const char * const mode_names[] = {
+	[MODE_PERF]		= "perfbuf",
+	[MODE_RINGBUF_OUTPUT]	= "ringbuf-output",
+	[MODE_RINGBUF_RESERVE]	= "ringbuf-reserve",
+};
+
+static int nr_cpus, nr_producers, duration = 5, perf_pages = 64;
+static int page_size;
+
+struct perf_buf {
+	int fd;
+	void *base;
+};
+
+static struct perf_buf perf_bufs[MAX_CPUS];
+static struct ringbuf_reader ringbuf;
+static unsigned long long consumed, lost;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void producer(int cpu, unsigned long long deadline)
+{
+	cpu_set_t cpuset;
+	int i;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	sched_setaffinity(0, sizeof(cpuset), &cpuset);
+
+	do {
+		for (i = 0; i < 1024; i++)
+			syscall(__NR_getpgid, 0);
+	} while (now_ns() < deadline);
+	exit(0);
+}
+
+static int perf_bufs_open(void)
+{
+	struct perf_event_attr attr = {
+		.sample_type = PERF_SAMPLE_RAW,
+		.type = PERF_TYPE_SOFTWARE,
+		.config = PERF_COUNT_SW_BPF_OUTPUT,
+		.wakeup_events = 1,
+	};
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		struct perf_buf *pb = &perf_bufs[cpu];
+
+		pb->fd = sys_perf_event_open(&attr, -1, cpu, -1, 0);
+		if (pb->fd < 0)
+			return -errno;
+		if (bpf_map_update_elem(map_fd[0], &cpu, &pb->fd, BPF_ANY))
+			return -errno;
+		pb->base = mmap(NULL, page_size * (perf_pages + 1),
+				PROT_READ | PROT_WRITE, MAP_SHARED, pb->fd, 0);
+		if (pb->base == MAP_FAILED)
+			return -errno;
+		ioctl(pb->fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	return 0;
+}
+
+static enum bpf_perf_event_ret perf_event_count(void *event, void *priv)
+{
+	struct perf_event_header *hdr = event;
+
+	if (hdr->type == PERF_RECORD_SAMPLE) {
+		consumed++;
+	} else if (hdr->type == PERF_RECORD_LOST) {
+		struct {
+			struct perf_event_header header;
+			__u64 id;
+			__u64 lost;
+		} *l = event;
+
+		lost += l->lost;
+	}
+	return LIBBPF_PERF_EVENT_CONT;
+}
+
+static void perf_bufs_consume(int timeout_ms)
+{
+	struct pollfd pfds[MAX_CPUS];
+	static void *buf;
+	static size_t len;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		pfds[cpu].fd = perf_bufs[cpu].fd;
+		pfds[cpu].events = POLLIN;
+	}
+	poll(pfds, nr_cpus, timeout_ms);
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		bpf_perf_event_read_simple(perf_bufs[cpu].base,
+					   perf_pages * page_size, page_size,
+					   &buf, &len, perf_event_count, NULL);
+}
+
+static int ringbuf_count(void *ctx, void *data, __u32 size)
+{
+	consumed++;
+	return 0;
+}
+
+static void consume(int mode, int timeout_ms)
+{
+	if (mode == MODE_PERF)
+		perf_bufs_consume(timeout_ms);
+	else
+		ringbuf_reader_poll(&ringbuf, ringbuf_count, NULL, timeout_ms);
+}
+
+static void read_stats(unsigned long long *produced,
+		       unsigned long long *dropped)
+{
+	unsigned int nr_possible = bpf_num_possible_cpus();
+	__u64 values[nr_possible];
+	__u32 key;
+	int i;
+
+	for (key = 0; key < 2; key++) {
+		unsigned long long sum = 0;
+
+		memset(values, 0, sizeof(values));
+		bpf_map_lookup_elem(map_fd[3], &key, values);
+		for (i = 0; i < nr_possible; i++)
+			sum += values[i];
+		if (key)
+			*dropped = sum;
+		else
+			*produced = sum;
+	}
+}
+
+static void reset_stats(void)
+{
+	unsigned int nr_possible = bpf_num_possible_cpus();
+	__u64 values[nr_possible];
+	__u32 key;
+
+	memset(values, 0, sizeof(values));
+	for (key = 0; key < 2; key++)
+		bpf_map_update_elem(map_fd[3], &key, values, BPF_ANY);
+}
+
+static void run(int mode)
+{
+	unsigned long long produced, dropped, start, end, mem;
+	__u32 key = 0, val;
+	pid_t pids[nr_producers];
+	int i;
+
+	consumed = lost = 0;
+	reset_stats();
+	val = mode;
+	bpf_map_update_elem(map_fd[2], &key, &val, BPF_ANY);
+
+	start = now_ns();
+	end = start + duration * 1000000000ull;
+	for (i = 0; i < nr_producers; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0)
+			producer(i % nr_cpus, end);
+		if (pids[i] < 0) {
+			perror("fork");
+			exit(1);
+		}
+	}
+
+	while (now_ns() < end)
+		consume(mode, 100);
+
+	for (i = 0; i < nr_producers; i++)
+		waitpid(pids[i], NULL, 0);
+	val = MODE_OFF;
+	bpf_map_update_elem(map_fd[2], &key, &val, BPF_ANY);
+	end = now_ns();
+
+	/* whatever is still buffered was produced in time, count it */
+	consume(mode, 0);
+	read_stats(&produced, &dropped);
+
+	if (mode == MODE_PERF)
+		mem = (unsigned long long)nr_cpus * (perf_pages + 1) * page_size;
+	else
+		mem = (ringbuf.mask + 1) + 2 * page_size;
+
+	printf("%-16s %9d %12.0f %12.0f %10llu %10llu\n", mode_names[mode],
+	       nr_producers, produced * 1e9 / (end - start),
+	       consumed * 1e9 / (end - start), dropped + lost, mem >> 10);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	char filename[256];
+	int opt, mode, err;
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_cpus > MAX_CPUS)
+		nr_cpus = MAX_CPUS;
+	nr_producers = nr_cpus;
+	page_size = getpagesize();
+
+	while ((opt = getopt(argc, argv, "p:d:P:")) != -1) {
+		switch (opt) {
+		case 'p':
+			nr_producers = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'P':
+			perf_pages = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-p producers] [-d seconds] [-P perf pages per cpu]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_producers < 1 || duration < 1 ||
+	    perf_pages < 1 || (perf_pages & (perf_pages - 1))) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	setrlimit(RLIMIT_MEMLOCK, &r);
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+	if (load_bpf_file(filename)) {
+		printf("%s", bpf_log_buf);
+		return 1;
+	}
+
+	err = perf_bufs_open();
+	if (err) {
+		fprintf(stderr, "perf buffer setup failed: %s\n",
+			strerror(-err));
+		return 1;
+	}
+	err = ringbuf_reader_open(&ringbuf, map_fd[1]);
+	if (err) {
+		fprintf(stderr, "ring buffer setup failed: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	printf("%-16s %9s %12s %12s %10s %10s\n", "mode", "producers",
+	       "produced/s", "consumed/s", "dropped", "memory KB");
+	for (mode = MODE_PERF; mode <= MODE_RINGBUF_RESERVE; mode++)
+		run(mode);
+	return 0;
+}
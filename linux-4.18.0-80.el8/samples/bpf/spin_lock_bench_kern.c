@@ -0,0 +1,105 @@
+/* This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/version.h>
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+/* The layout must match the BTF spin_lock_bench_user.c builds for it. */
+struct flow_stats {
+	struct bpf_spin_lock lock;
+	u32 max_len;
+	u64 packets;
+	u64 bytes;
+	u64 last_ts;
+};
+
+/* one flow shared by all cpus, updated under its bpf_spin_lock */
+struct bpf_map_def SEC("maps") locked_map = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct flow_stats),
+	.max_entries = 1,
+};
+
+/* the same flow with a copy per cpu, summed up by whoever reads it */
+struct bpf_map_def SEC("maps") percpu_map = {
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct flow_stats),
+	.max_entries = 1,
+};
+
+/* the same flow shared by all cpus, counters bumped with atomic adds */
+struct bpf_map_def SEC("maps") atomic_map = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct flow_stats),
+	.max_entries = 1,
+};
+
+SEC("xdp_locked")
+int xdp_locked(struct xdp_md *ctx)
+{
+	u32 len = ctx->data_end - ctx->data, key = 0;
+	u64 ts = bpf_ktime_get_ns();
+	struct flow_stats *val;
+
+	val = bpf_map_lookup_elem(&locked_map, &key);
+	if (!val)
+		return XDP_ABORTED;
+
+	bpf_spin_lock(&val->lock);
+	val->packets++;
+	val->bytes += len;
+	if (len > val->max_len)
+		val->max_len = len;
+	val->last_ts = ts;
+	bpf_spin_unlock(&val->lock);
+	return XDP_PASS;
+}
+
+SEC("xdp_percpu")
+int xdp_percpu(struct xdp_md *ctx)
+{
+	u32 len = ctx->data_end - ctx->data, key = 0;
+	u64 ts = bpf_ktime_get_ns();
+	struct flow_stats *val;
+
+	val = bpf_map_lookup_elem(&percpu_map, &key);
+	if (!val)
+		return XDP_ABORTED;
+
+	val->packets++;
+	val->bytes += len;
+	if (len > val->max_len)
+		val->max_len = len;
+	val->last_ts = ts;
+	return XDP_PASS;
+}
+
+/* What could be done before: only the counters stay exact, max_len and
+ * last_ts race with the other cpus.
+ */
+SEC("xdp_atomic")
+int xdp_atomic(struct xdp_md *ctx)
+{
+	u32 len = ctx->data_end - ctx->data, key = 0;
+	u64 ts = bpf_ktime_get_ns();
+	struct flow_stats *val;
+
+	val = bpf_map_lookup_elem(&atomic_map, &key);
+	if (!val)
+		return XDP_ABORTED;
+
+	__sync_fetch_and_add(&val->packets, 1);
+	__sync_fetch_and_add(&val->bytes, len);
+	if (len > val->max_len)
+		val->max_len = len;
+	val->last_ts = ts;
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
+u32 _version SEC("version") = LINUX_VERSION_CODE;
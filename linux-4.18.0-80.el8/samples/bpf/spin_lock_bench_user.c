@@ -0,0 +1,375 @@
+/* This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * Contention benchmark for bpf_spin_lock. Every run of an XDP program
+ * updates one flow's statistics (packets, bytes, max length, timestamp),
+ * which is kept
+ *
+ *   locked:  in one shared hash value, all fields under its bpf_spin_lock
+ *   percpu:  in a per-cpu hash value, to be summed up by the reader
+ *   atomic:  in one shared hash value, counters bumped with atomic adds
+ *            and the other fields left to race
+ *
+ * The programs are driven with BPF_PROG_TEST_RUN from 1, 2, 4, ... up to
+ * -t threads, each pinned to its own cpu. For every mode and thread count
+ * the aggregate update rate and the average cost of one program run are
+ * printed, and the final counters are checked. Finally the cost of reading
+ * the flow from user space is compared: one BPF_F_LOCK lookup of the shared
+ * value against a lookup of all per-cpu copies plus their summation.
+ *
+ *   spin_lock_bench [-n runs per thread] [-t max threads]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <bpf/bpf.h>
+#include "bpf_load.h"
+#include "bpf_util.h"
+
+enum {
+	MODE_LOCKED,
+	MODE_PERCPU,
+	MODE_ATOMIC,
+	NR_MODES,
+};
+
+static const char * const mode_names[] = {
+	[MODE_LOCKED]	= "locked",
+	[MODE_PERCPU]	= "percpu",
+	[MODE_ATOMIC]	= "atomic",
+};
+
+static const char * const map_names[] = {
+	[MODE_LOCKED]	= "locked_map",
+	[MODE_PERCPU]	= "percpu_map",
+	[MODE_ATOMIC]	= "atomic_map",
+};
+
+/* must match spin_lock_bench_kern.c */
+struct flow_stats {
+	__u32 lock;
+	__u32 max_len;
+	__u64 packets;
+	__u64 bytes;
+	__u64 last_ts;
+};
+
+#define PKT_LEN		64
+#define READS		100000
+
+static unsigned int nr_runs = 1000000, nr_possible;
+static int flow_fd[NR_MODES];
+static pthread_barrier_t start_barrier;
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	int prog_fd;
+	int err;
+	__u32 duration;
+};
+
+/* bpf_load does not know about BTF, so spell out what the verifier needs
+ * to find the lock in locked_map's value:
+ *
+ *   [1] u32  [2] u64  [3] struct bpf_spin_lock { u32 val; }
+ *   [4] struct flow_stats { lock; max_len; packets; bytes; last_ts; }
+ */
+#define BTF_INFO_ENC(kind, vlen)	((kind) << 24 | (vlen))
+#define BTF_INT_ENC(bits)		(bits)
+
+static const __u32 btf_types[] = {
+	1, BTF_INFO_ENC(BTF_KIND_INT, 0), 4, BTF_INT_ENC(32),
+	5, BTF_INFO_ENC(BTF_KIND_INT, 0), 8, BTF_INT_ENC(64),
+	9, BTF_INFO_ENC(BTF_KIND_STRUCT, 1), 4,
+		23, 1, 0,
+	27, BTF_INFO_ENC(BTF_KIND_STRUCT, 5), sizeof(struct flow_stats),
+		38, 3, 0,
+		43, 1, 32,
+		51, 2, 64,
+		59, 2, 128,
+		65, 2, 192,
+};
+
+static const char btf_strings[] =
+	"\0u32\0u64\0bpf_spin_lock\0val\0flow_stats\0lock\0max_len\0packets"
+	"\0bytes\0last_ts";
+
+static int load_btf(void)
+{
+	char buf[sizeof(struct btf_header) + sizeof(btf_types) +
+		 sizeof(btf_strings)];
+	struct btf_header hdr = {
+		.magic = BTF_MAGIC,
+		.version = BTF_VERSION,
+		.hdr_len = sizeof(hdr),
+		.type_len = sizeof(btf_types),
+		.str_off = sizeof(btf_types),
+		.str_len = sizeof(btf_strings),
+	};
+	static char log[4096];
+	int fd;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), btf_types, sizeof(btf_types));
+	memcpy(buf + sizeof(hdr) + sizeof(btf_types), btf_strings,
+	       sizeof(btf_strings));
+
+	fd = bpf_load_btf(buf, sizeof(buf), log, sizeof(log), false);
+	if (fd < 0)
+		fprintf(stderr, "BTF load failed: %s\n%s", strerror(errno),
+			log);
+	return fd;
+}
+
+static void fixup_map(struct bpf_map_data *map, int idx)
+{
+	struct bpf_create_map_attr attr = {};
+	int btf_fd;
+
+	if (strcmp(map->name, map_names[MODE_LOCKED]))
+		return;
+
+	btf_fd = load_btf();
+	if (btf_fd < 0)
+		exit(1);
+
+	attr.name = map->name;
+	attr.map_type = map->def.type;
+	attr.key_size = map->def.key_size;
+	attr.value_size = map->def.value_size;
+	attr.max_entries = map->def.max_entries;
+	attr.btf_fd = btf_fd;
+	attr.btf_key_type_id = 1;
+	attr.btf_value_type_id = 4;
+
+	map->fd = bpf_create_map_xattr(&attr);
+	if (map->fd < 0) {
+		perror("locked_map");
+		exit(1);
+	}
+	close(btf_fd);
+}
+
+static __u64 ptr_to_u64(const void *ptr)
+{
+	return (__u64) (unsigned long) ptr;
+}
+
+static int lookup_locked(int fd, const void *key, void *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = ptr_to_u64(key);
+	attr.value = ptr_to_u64(value);
+	attr.flags = BPF_F_LOCK;
+
+	return syscall(__NR_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr));
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Zero the flow again; the per-cpu map takes one copy per possible cpu. */
+static void reset_flow(int mode)
+{
+	struct flow_stats zero[nr_possible];
+	__u32 key = 0;
+
+	memset(zero, 0, sizeof(zero));
+	if (bpf_map_update_elem(flow_fd[mode], &key, zero, BPF_ANY)) {
+		perror(map_names[mode]);
+		exit(1);
+	}
+}
+
+static int read_flow(int mode, struct flow_stats *sum)
+{
+	struct flow_stats values[nr_possible];
+	__u32 key = 0;
+	unsigned int i;
+
+	if (mode == MODE_LOCKED)
+		return lookup_locked(flow_fd[mode], &key, sum);
+	if (mode == MODE_ATOMIC)
+		return bpf_map_lookup_elem(flow_fd[mode], &key, sum);
+
+	if (bpf_map_lookup_elem(flow_fd[mode], &key, values))
+		return -1;
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < nr_possible; i++) {
+		sum->packets += values[i].packets;
+		sum->bytes += values[i].bytes;
+		if (values[i].max_len > sum->max_len)
+			sum->max_len = values[i].max_len;
+		if (values[i].last_ts > sum->last_ts)
+			sum->last_ts = values[i].last_ts;
+	}
+	return 0;
+}
+
+static void *worker_fn(void *arg)
+{
+	char pkt[PKT_LEN] = {};
+	struct worker *w = arg;
+	cpu_set_t cpuset;
+	__u32 retval;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(w->cpu, &cpuset);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+	pthread_barrier_wait(&start_barrier);
+	if (bpf_prog_test_run(w->prog_fd, nr_runs, pkt, sizeof(pkt), NULL,
+			      NULL, &retval, &w->duration) ||
+	    retval != XDP_PASS)
+		w->err = errno ? errno : EINVAL;
+	return NULL;
+}
+
+static int run(int mode, int nr_threads)
+{
+	struct worker workers[nr_threads];
+	unsigned long long start, elapsed, ns_per_run = 0;
+	unsigned long long want = (unsigned long long)nr_threads * nr_runs;
+	struct flow_stats sum;
+	int t, err = 0;
+
+	reset_flow(mode);
+	memset(workers, 0, sizeof(workers));
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (t = 0; t < nr_threads; t++) {
+		workers[t].cpu = t;
+		workers[t].prog_fd = prog_fd[mode];
+		if (pthread_create(&workers[t].thread, NULL, worker_fn,
+				   &workers[t])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	for (t = 0; t < nr_threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		if (workers[t].err)
+			err = workers[t].err;
+		ns_per_run += workers[t].duration;
+	}
+	elapsed = now_ns() - start;
+	pthread_barrier_destroy(&start_barrier);
+
+	if (err) {
+		fprintf(stderr, "%s, %d threads: %s\n", mode_names[mode],
+			nr_threads, strerror(err));
+		return -err;
+	}
+	if (read_flow(mode, &sum)) {
+		perror(map_names[mode]);
+		return -errno;
+	}
+
+	printf("%-8s %8d %14.0f %10llu %s\n", mode_names[mode], nr_threads,
+	       want * 1e9 / elapsed, ns_per_run / nr_threads,
+	       sum.packets == want && sum.bytes == want * PKT_LEN &&
+	       sum.max_len == PKT_LEN ? "ok" : "MISMATCH");
+	fflush(stdout);
+	return 0;
+}
+
+static void read_cost(int mode)
+{
+	unsigned long long start = now_ns();
+	struct flow_stats sum;
+	int i;
+
+	for (i = 0; i < READS; i++)
+		if (read_flow(mode, &sum)) {
+			perror(map_names[mode]);
+			return;
+		}
+	printf("%-8s %10.0f ns per read\n", mode_names[mode],
+	       (now_ns() - start) / (double)READS);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	int opt, mode, t, i, max_threads;
+	char filename[256];
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	nr_possible = bpf_num_possible_cpus();
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_runs = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n runs per thread] [-t max threads]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_runs || max_threads < 1) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	setrlimit(RLIMIT_MEMLOCK, &r);
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+	if (load_bpf_file_fixup_map(filename, fixup_map)) {
+		printf("%s", bpf_log_buf);
+		return 1;
+	}
+	for (mode = 0; mode < NR_MODES; mode++) {
+		flow_fd[mode] = -1;
+		for (i = 0; i < map_data_count; i++)
+			if (!strcmp(map_data[i].name, map_names[mode]))
+				flow_fd[mode] = map_data[i].fd;
+		if (flow_fd[mode] < 0) {
+			fprintf(stderr, "%s not found\n", map_names[mode]);
+			return 1;
+		}
+	}
+
+	printf("%u runs per thread, %d byte packets\n", nr_runs, PKT_LEN);
+	printf("%-8s %8s %14s %10s\n", "mode", "threads", "updates/s",
+	       "ns/run");
+	for (mode = 0; mode < NR_MODES; mode++) {
+		for (t = 1; t < max_threads; t *= 2)
+			if (run(mode, t))
+				return 1;
+		if (run(mode, max_threads))
+			return 1;
+	}
+
+	printf("\nreading the flow from user space, %d possible cpus\n",
+	       nr_possible);
+	read_cost(MODE_LOCKED);
+	read_cost(MODE_PERCPU);
+	return 0;
+}
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * File I/O throughput and latency benchmark, meant to be run on a mount
+ * of fuse-passthrough and on its source directory for comparison:
+ *
+ *   fuse-bench [-m seqread|seqwrite|randread|randwrite|create]
+ *		[-b block KiB] [-s file MiB] [-j threads] [-t seconds] [-d]
+ *		<file or directory>
+ *
+ * -d opens the file with O_DIRECT.  The file is created and filled first
+ * if it is smaller than -s.  Each thread does pread()/pwrite() of one
+ * block at a time, sequentially over its own share of the file or at
+ * random block aligned offsets.  In create mode one operation is the
+ * create, close and unlink of a file in the given directory.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SAMPLES	(1 << 20)
+
+static const char *path;
+static int write_mode, rand_mode, create_mode, open_flags, nr_threads = 1;
+static size_t block_size = 4096;
+static off_t file_size = 256 << 20;
+static double duration = 10;
+static pthread_barrier_t start_barrier;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int err;
+	unsigned long ops;
+	unsigned long nr_lat;
+	double *lat;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int prepare(void)
+{
+	struct stat st;
+	off_t off;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	if (fd < 0 || fstat(fd, &st))
+		return -errno;
+	if (st.st_size >= file_size) {
+		close(fd);
+		return 0;
+	}
+	buf = malloc(1 << 20);
+	if (!buf)
+		return -ENOMEM;
+	memset(buf, 0x5a, 1 << 20);
+	for (off = st.st_size; off < file_size; off += 1 << 20) {
+		if (pwrite(fd, buf, 1 << 20, off) != 1 << 20) {
+			free(buf);
+			close(fd);
+			return -EIO;
+		}
+	}
+	free(buf);
+	fsync(fd);
+	close(fd);
+	return 0;
+}
+
+static void *create_fn(struct worker *w)
+{
+	char name[4096];
+	unsigned long i;
+	double start;
+	int fd;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; !stop; i++) {
+		snprintf(name, sizeof(name), "%s/fuse-bench.%d.%d.%lu", path,
+			 getpid(), w->id, i);
+		start = now_us();
+		fd = open(name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+		if (fd < 0 || close(fd) || unlink(name)) {
+			w->err = errno;
+			break;
+		}
+		if (w->nr_lat < MAX_SAMPLES)
+			w->lat[w->nr_lat++] = now_us() - start;
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	off_t nr_blocks = file_size / block_size;
+	off_t first = nr_blocks / nr_threads * w->id, blk = 0;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL * (w->id + 1);
+	double start;
+	ssize_t ret;
+	void *buf;
+	int fd;
+
+	if (create_mode)
+		return create_fn(w);
+
+	fd = open(path, (write_mode ? O_WRONLY : O_RDONLY) | open_flags);
+	if (fd < 0 || posix_memalign(&buf, 4096, block_size)) {
+		w->err = errno;
+		pthread_barrier_wait(&start_barrier);
+		return NULL;
+	}
+	memset(buf, 0xa5, block_size);
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		off_t off;
+
+		if (rand_mode) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			off = (seed % nr_blocks) * block_size;
+		} else {
+			off = ((first + blk) % nr_blocks) * block_size;
+			blk++;
+		}
+
+		start = now_us();
+		if (write_mode)
+			ret = pwrite(fd, buf, block_size, off);
+		else
+			ret = pread(fd, buf, block_size, off);
+		if (ret != (ssize_t)block_size) {
+			w->err = ret < 0 ? errno : EIO;
+			break;
+		}
+		if (w->nr_lat < MAX_SAMPLES)
+			w->lat[w->nr_lat++] = now_us() - start;
+		w->ops++;
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *mode = "seqread";
+	unsigned long ops = 0, nr_lat = 0, i;
+	struct worker *workers;
+	double start, elapsed, total = 0, *lat;
+	int opt, err = 0, t;
+
+	while ((opt = getopt(argc, argv, "m:b:s:j:t:d")) != -1) {
+		switch (opt) {
+		case 'm':
+			mode = optarg;
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 's':
+			file_size = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		case 'd':
+			open_flags |= O_DIRECT;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 1)
+		goto usage;
+	path = argv[optind];
+
+	if (!strcmp(mode, "seqread")) {
+	} else if (!strcmp(mode, "seqwrite")) {
+		write_mode = 1;
+	} else if (!strcmp(mode, "randread")) {
+		rand_mode = 1;
+	} else if (!strcmp(mode, "randwrite")) {
+		write_mode = rand_mode = 1;
+	} else if (!strcmp(mode, "create")) {
+		create_mode = 1;
+	} else {
+		goto usage;
+	}
+	if (!block_size || nr_threads < 1 || file_size < (off_t)block_size) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	err = create_mode ? 0 : prepare();
+	if (err) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-err));
+		return 1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		return 1;
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (t = 0; t < nr_threads; t++) {
+		workers[t].id = t;
+		workers[t].lat = malloc(MAX_SAMPLES * sizeof(double));
+		if (!workers[t].lat ||
+		    pthread_create(&workers[t].thread, NULL, worker_fn,
+				   &workers[t])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = now_us();
+	usleep(duration * 1e6);
+	stop = 1;
+	for (t = 0; t < nr_threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		if (workers[t].err)
+			err = workers[t].err;
+		ops += workers[t].ops;
+		nr_lat += workers[t].nr_lat;
+	}
+	elapsed = (now_us() - start) / 1e6;
+	pthread_barrier_destroy(&start_barrier);
+
+	if (err) {
+		fprintf(stderr, "%s: %s\n", mode, strerror(err));
+		return 1;
+	}
+	if (!nr_lat) {
+		fprintf(stderr, "no I/O done\n");
+		return 1;
+	}
+
+	lat = malloc(nr_lat * sizeof(double));
+	if (!lat)
+		return 1;
+	for (nr_lat = 0, t = 0; t < nr_threads; t++) {
+		for (i = 0; i < workers[t].nr_lat; i++) {
+			lat[nr_lat++] = workers[t].lat[i];
+			total += workers[t].lat[i];
+		}
+		free(workers[t].lat);
+	}
+	qsort(lat, nr_lat, sizeof(*lat), cmp_double);
+
+	if (create_mode) {
+		printf("%s: %d threads\n", mode, nr_threads);
+		printf("throughput: %.0f creates/s\n", ops / elapsed);
+	} else {
+		printf("%s: %d threads, %zu KiB blocks%s\n", mode, nr_threads,
+		       block_size >> 10,
+		       open_flags & O_DIRECT ? ", O_DIRECT" : "");
+		printf("throughput: %.1f MB/s, %.0f IOPS\n",
+		       ops * block_size / elapsed / 1e6, ops / elapsed);
+	}
+	printf("latency us: avg %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+	       total / nr_lat, lat[nr_lat / 2], lat[nr_lat * 99 / 100],
+	       lat[nr_lat * 999 / 1000], lat[nr_lat - 1]);
+
+	free(lat);
+	free(workers);
+	return 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-m seqread|seqwrite|randread|randwrite|create] [-b KiB] [-s MiB] [-j threads] [-t seconds] [-d] <path>\n",
+		argv[0]);
+	return 1;
+}
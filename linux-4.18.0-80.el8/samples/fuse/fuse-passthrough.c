@@ -0,0 +1,736 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Minimal FUSE daemon mirroring a directory, talking the raw /dev/fuse
+ * protocol (no libfuse), to exercise and measure:
+ *
+ *   -p  passthrough: files are opened with FOPEN_PASSTHROUGH on a backing
+ *       fd registered with FUSE_DEV_IOC_BACKING_OPEN, so read, write and
+ *       mmap never reach the daemon
+ *   -r  per-cpu request rings: one thread per cpu serves its ring with
+ *       FUSE_DEV_IOC_RING_CMD instead of read()/write() on /dev/fuse
+ *   -t  number of additional /dev/fuse reader threads
+ *   -q  bind the additional reader threads to per-cpu input queues with
+ *       FUSE_DEV_IOC_QUEUE_BIND, round robin over the cpus, and pin them
+ *
+ *   fuse-passthrough [-p] [-r] [-q] [-t threads] <source dir> <mountpoint>
+ *
+ * Needs to run as root.  Unmount with umount(8) to stop it.  Only the
+ * basic operations are implemented; everything else gets ENOSYS.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fuse.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fsuid.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#define MAX_WRITE	(128 * 1024)
+#define BUF_SIZE	(MAX_WRITE + 4096)
+#define HASH_SIZE	4096
+
+static int opt_passthrough;
+static int opt_rings;
+static int opt_queues;
+static int dev_fd;
+static int passthrough_ok;
+
+struct node {
+	int fd;			/* O_PATH */
+	uint64_t nlookup;
+	dev_t dev;
+	ino_t ino;
+	struct node *next;
+};
+
+struct handle {
+	int fd;
+	int backing_id;
+};
+
+struct dir_handle {
+	DIR *dp;
+	off_t offset;
+};
+
+static struct node root;
+static struct node *node_hash[HASH_SIZE];
+static pthread_mutex_t node_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static struct node *get_node(uint64_t nodeid)
+{
+	return nodeid == FUSE_ROOT_ID ? &root :
+		(struct node *)(uintptr_t)nodeid;
+}
+
+static uint64_t node_id(struct node *n)
+{
+	return n == &root ? FUSE_ROOT_ID : (uint64_t)(uintptr_t)n;
+}
+
+/* Find or add the node for an O_PATH fd, takes over the fd */
+static struct node *node_lookup(int fd, const struct stat *st)
+{
+	unsigned int h = st->st_ino % HASH_SIZE;
+	struct node *n;
+
+	pthread_mutex_lock(&node_lock);
+	if (st->st_ino == root.ino && st->st_dev == root.dev) {
+		n = &root;
+		goto found;
+	}
+	for (n = node_hash[h]; n; n = n->next)
+		if (n->ino == st->st_ino && n->dev == st->st_dev)
+			goto found;
+
+	n = calloc(1, sizeof(*n));
+	if (!n)
+		die("calloc");
+	n->fd = fd;
+	n->dev = st->st_dev;
+	n->ino = st->st_ino;
+	n->next = node_hash[h];
+	node_hash[h] = n;
+	fd = -1;
+found:
+	n->nlookup++;
+	pthread_mutex_unlock(&node_lock);
+	if (fd >= 0)
+		close(fd);
+	return n;
+}
+
+static void node_forget(struct node *n, uint64_t nlookup)
+{
+	struct node **p;
+
+	pthread_mutex_lock(&node_lock);
+	n->nlookup -= nlookup;
+	if (n->nlookup || n == &root) {
+		pthread_mutex_unlock(&node_lock);
+		return;
+	}
+	for (p = &node_hash[n->ino % HASH_SIZE]; *p != n; p = &(*p)->next)
+		;
+	*p = n->next;
+	pthread_mutex_unlock(&node_lock);
+	close(n->fd);
+	free(n);
+}
+
+static void fill_attr(struct fuse_attr *attr, const struct stat *st)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = st->st_ino;
+	attr->size = st->st_size;
+	attr->blocks = st->st_blocks;
+	attr->atime = st->st_atim.tv_sec;
+	attr->mtime = st->st_mtim.tv_sec;
+	attr->ctime = st->st_ctim.tv_sec;
+	attr->atimensec = st->st_atim.tv_nsec;
+	attr->mtimensec = st->st_mtim.tv_nsec;
+	attr->ctimensec = st->st_ctim.tv_nsec;
+	attr->mode = st->st_mode;
+	attr->nlink = st->st_nlink;
+	attr->uid = st->st_uid;
+	attr->gid = st->st_gid;
+	attr->rdev = st->st_rdev;
+	attr->blksize = st->st_blksize;
+}
+
+static int do_getattr_node(struct node *n, struct fuse_attr_out *out)
+{
+	struct stat st;
+
+	if (fstatat(n->fd, "", &st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW))
+		return -errno;
+	memset(out, 0, sizeof(*out));
+	out->attr_valid = 1;
+	fill_attr(&out->attr, &st);
+	return sizeof(*out);
+}
+
+static int do_lookup(struct node *parent, const char *name,
+		     struct fuse_entry_out *out)
+{
+	struct stat st;
+	struct node *n;
+	int fd;
+
+	fd = openat(parent->fd, name, O_PATH | O_NOFOLLOW);
+	if (fd < 0)
+		return -errno;
+	if (fstatat(fd, "", &st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)) {
+		close(fd);
+		return -errno;
+	}
+	n = node_lookup(fd, &st);
+
+	memset(out, 0, sizeof(*out));
+	out->nodeid = node_id(n);
+	out->entry_valid = 1;
+	out->attr_valid = 1;
+	fill_attr(&out->attr, &st);
+	return sizeof(*out);
+}
+
+static int proc_path(char *buf, size_t size, int fd)
+{
+	return snprintf(buf, size, "/proc/self/fd/%d", fd);
+}
+
+static int do_setattr(struct node *n, struct fuse_setattr_in *in,
+		      struct fuse_attr_out *out)
+{
+	struct handle *fh = (struct handle *)(uintptr_t)in->fh;
+	char path[64];
+	int err;
+
+	proc_path(path, sizeof(path), n->fd);
+	if (in->valid & FATTR_MODE && chmod(path, in->mode))
+		return -errno;
+	if (in->valid & (FATTR_UID | FATTR_GID)) {
+		uid_t uid = in->valid & FATTR_UID ? in->uid : (uid_t)-1;
+		gid_t gid = in->valid & FATTR_GID ? in->gid : (gid_t)-1;
+
+		if (fchownat(n->fd, "", uid, gid,
+			     AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW))
+			return -errno;
+	}
+	if (in->valid & FATTR_SIZE) {
+		err = in->valid & FATTR_FH ? ftruncate(fh->fd, in->size) :
+			truncate(path, in->size);
+		if (err)
+			return -errno;
+	}
+	if (in->valid & (FATTR_ATIME | FATTR_MTIME)) {
+		struct timespec tv[2] = {
+			{ .tv_nsec = UTIME_OMIT }, { .tv_nsec = UTIME_OMIT }
+		};
+
+		if (in->valid & FATTR_ATIME_NOW)
+			tv[0].tv_nsec = UTIME_NOW;
+		else if (in->valid & FATTR_ATIME)
+			tv[0] = (struct timespec){ in->atime, in->atimensec };
+		if (in->valid & FATTR_MTIME_NOW)
+			tv[1].tv_nsec = UTIME_NOW;
+		else if (in->valid & FATTR_MTIME)
+			tv[1] = (struct timespec){ in->mtime, in->mtimensec };
+		if (utimensat(AT_FDCWD, path, tv, 0))
+			return -errno;
+	}
+	return do_getattr_node(n, out);
+}
+
+/* Open the real file and, with -p, register it as backing file */
+static int open_handle(int fd, struct fuse_open_out *out)
+{
+	struct fuse_backing_map map = { .fd = fd };
+	struct handle *fh;
+
+	fh = calloc(1, sizeof(*fh));
+	if (!fh)
+		die("calloc");
+	fh->fd = fd;
+
+	memset(out, 0, sizeof(*out));
+	if (passthrough_ok) {
+		fh->backing_id = ioctl(dev_fd, FUSE_DEV_IOC_BACKING_OPEN, &map);
+		if (fh->backing_id > 0) {
+			out->open_flags |= FOPEN_PASSTHROUGH;
+			out->backing_id = fh->backing_id;
+		} else {
+			fh->backing_id = 0;
+		}
+	}
+	out->fh = (uintptr_t)fh;
+	return sizeof(*out);
+}
+
+static int do_open(struct node *n, struct fuse_open_in *in,
+		   struct fuse_open_out *out)
+{
+	char path[64];
+	int fd;
+
+	proc_path(path, sizeof(path), n->fd);
+	fd = open(path, in->flags & ~(O_CREAT | O_EXCL | O_NOCTTY));
+	if (fd < 0)
+		return -errno;
+	return open_handle(fd, out);
+}
+
+static int do_create(struct fuse_in_header *h, struct node *parent,
+		     struct fuse_create_in *in, const char *name, void *out)
+{
+	struct fuse_entry_out *entry = out;
+	int fd, err;
+
+	setfsuid(h->uid);
+	setfsgid(h->gid);
+	fd = openat(parent->fd, name, (in->flags | O_CREAT) & ~O_NOCTTY,
+		    in->mode);
+	err = errno;
+	setfsuid(0);
+	setfsgid(0);
+	if (fd < 0)
+		return -err;
+
+	err = do_lookup(parent, name, entry);
+	if (err < 0) {
+		close(fd);
+		return err;
+	}
+	open_handle(fd, (struct fuse_open_out *)(entry + 1));
+	return sizeof(*entry) + sizeof(struct fuse_open_out);
+}
+
+static void release_handle(struct handle *fh)
+{
+	if (fh->backing_id)
+		ioctl(dev_fd, FUSE_DEV_IOC_BACKING_CLOSE, &fh->backing_id);
+	close(fh->fd);
+	free(fh);
+}
+
+static int do_opendir(struct node *n, struct fuse_open_out *out)
+{
+	struct dir_handle *d;
+	int fd;
+
+	fd = openat(n->fd, ".", O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -errno;
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		die("calloc");
+	d->dp = fdopendir(fd);
+	if (!d->dp) {
+		close(fd);
+		free(d);
+		return -errno;
+	}
+	memset(out, 0, sizeof(*out));
+	out->fh = (uintptr_t)d;
+	return sizeof(*out);
+}
+
+static int do_readdir(struct fuse_read_in *in, char *out)
+{
+	struct dir_handle *d = (struct dir_handle *)(uintptr_t)in->fh;
+	size_t used = 0;
+
+	if (in->offset != (uint64_t)d->offset) {
+		seekdir(d->dp, in->offset);
+		d->offset = in->offset;
+	}
+	for (;;) {
+		struct fuse_dirent *fd = (struct fuse_dirent *)(out + used);
+		struct dirent *de;
+		size_t namelen, size;
+
+		errno = 0;
+		de = readdir(d->dp);
+		if (!de) {
+			if (errno && !used)
+				return -errno;
+			break;
+		}
+		namelen = strlen(de->d_name);
+		size = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen);
+		if (used + size > in->size) {
+			seekdir(d->dp, d->offset);
+			break;
+		}
+		d->offset = telldir(d->dp);
+		fd->ino = de->d_ino;
+		fd->off = d->offset;
+		fd->namelen = namelen;
+		fd->type = de->d_type;
+		memcpy(fd->name, de->d_name, namelen);
+		memset(fd->name + namelen, 0, size - FUSE_NAME_OFFSET - namelen);
+		used += size;
+	}
+	return used;
+}
+
+static int do_statfs(struct node *n, struct fuse_statfs_out *out)
+{
+	struct statvfs st;
+	char path[64];
+
+	proc_path(path, sizeof(path), n->fd);
+	if (statvfs(path, &st))
+		return -errno;
+	memset(out, 0, sizeof(*out));
+	out->st.blocks = st.f_blocks;
+	out->st.bfree = st.f_bfree;
+	out->st.bavail = st.f_bavail;
+	out->st.files = st.f_files;
+	out->st.ffree = st.f_ffree;
+	out->st.bsize = st.f_bsize;
+	out->st.namelen = st.f_namemax;
+	out->st.frsize = st.f_frsize;
+	return sizeof(*out);
+}
+
+static int do_init(struct fuse_init_in *in, struct fuse_init_out *out)
+{
+	memset(out, 0, sizeof(*out));
+	out->major = FUSE_KERNEL_VERSION;
+	out->minor = FUSE_KERNEL_MINOR_VERSION;
+	out->max_readahead = in->max_readahead;
+	out->flags = in->flags & (FUSE_ASYNC_READ | FUSE_BIG_WRITES |
+				  FUSE_PARALLEL_DIROPS);
+	if (opt_passthrough) {
+		if ((in->flags & FUSE_INIT_EXT) &&
+		    (in->flags2 & (FUSE_PASSTHROUGH >> 32))) {
+			out->flags |= FUSE_INIT_EXT;
+			out->flags2 = FUSE_PASSTHROUGH >> 32;
+			passthrough_ok = 1;
+		} else {
+			fprintf(stderr, "kernel does not support passthrough\n");
+		}
+	}
+	out->max_background = 64;
+	out->congestion_threshold = 48;
+	out->max_write = MAX_WRITE;
+	out->time_gran = 1;
+	return sizeof(*out);
+}
+
+/*
+ * Handle one request.  The reply payload goes to @out, which may be the
+ * same buffer as @h only for FUSE_WRITE (see process()).  Returns the
+ * payload size, a negative errno, or 1 << 30 for requests without reply.
+ */
+#define NO_REPLY	(1 << 30)
+
+static int handle(struct fuse_in_header *h, char *out)
+{
+	void *arg = h + 1;
+	struct node *n = get_node(h->nodeid);
+	struct handle *fh;
+	ssize_t ret;
+	int err;
+
+	switch (h->opcode) {
+	case FUSE_INIT:
+		return do_init(arg, (void *)out);
+	case FUSE_DESTROY:
+		return 0;
+	case FUSE_LOOKUP:
+		return do_lookup(n, arg, (void *)out);
+	case FUSE_FORGET:
+		node_forget(n, ((struct fuse_forget_in *)arg)->nlookup);
+		return NO_REPLY;
+	case FUSE_BATCH_FORGET: {
+		struct fuse_batch_forget_in *bf = arg;
+		struct fuse_forget_one *one = (void *)(bf + 1);
+		uint32_t i;
+
+		for (i = 0; i < bf->count; i++)
+			node_forget(get_node(one[i].nodeid), one[i].nlookup);
+		return NO_REPLY;
+	}
+	case FUSE_INTERRUPT:
+		return NO_REPLY;
+	case FUSE_GETATTR:
+		return do_getattr_node(n, (void *)out);
+	case FUSE_SETATTR:
+		return do_setattr(n, arg, (void *)out);
+	case FUSE_OPEN:
+		return do_open(n, arg, (void *)out);
+	case FUSE_CREATE: {
+		struct fuse_create_in *in = arg;
+
+		return do_create(h, n, in, (char *)(in + 1), out);
+	}
+	case FUSE_MKDIR: {
+		struct fuse_mkdir_in *in = arg;
+		const char *name = (char *)(in + 1);
+
+		setfsuid(h->uid);
+		setfsgid(h->gid);
+		err = mkdirat(n->fd, name, in->mode) ? -errno : 0;
+		setfsuid(0);
+		setfsgid(0);
+		return err ? err : do_lookup(n, name, (void *)out);
+	}
+	case FUSE_UNLINK:
+		return unlinkat(n->fd, arg, 0) ? -errno : 0;
+	case FUSE_RMDIR:
+		return unlinkat(n->fd, arg, AT_REMOVEDIR) ? -errno : 0;
+	case FUSE_RENAME: {
+		struct fuse_rename_in *in = arg;
+		const char *oldname = (char *)(in + 1);
+		const char *newname = oldname + strlen(oldname) + 1;
+
+		return renameat(n->fd, oldname, get_node(in->newdir)->fd,
+				newname) ? -errno : 0;
+	}
+	case FUSE_READ: {
+		struct fuse_read_in in = *(struct fuse_read_in *)arg;
+
+		fh = (struct handle *)(uintptr_t)in.fh;
+		ret = pread(fh->fd, out, in.size, in.offset);
+		return ret < 0 ? -errno : ret;
+	}
+	case FUSE_WRITE: {
+		struct fuse_write_in in = *(struct fuse_write_in *)arg;
+		struct fuse_write_out *wo = (void *)out;
+
+		fh = (struct handle *)(uintptr_t)in.fh;
+		ret = pwrite(fh->fd, (struct fuse_write_in *)arg + 1, in.size,
+			     in.offset);
+		if (ret < 0)
+			return -errno;
+		memset(wo, 0, sizeof(*wo));
+		wo->size = ret;
+		return sizeof(*wo);
+	}
+	case FUSE_FLUSH:
+		return 0;
+	case FUSE_FSYNC: {
+		struct fuse_fsync_in *in = arg;
+
+		fh = (struct handle *)(uintptr_t)in->fh;
+		err = in->fsync_flags & 1 ? fdatasync(fh->fd) : fsync(fh->fd);
+		return err ? -errno : 0;
+	}
+	case FUSE_RELEASE:
+		release_handle((struct handle *)(uintptr_t)
+			       ((struct fuse_release_in *)arg)->fh);
+		return 0;
+	case FUSE_OPENDIR:
+		return do_opendir(n, (void *)out);
+	case FUSE_READDIR:
+		return do_readdir(arg, out);
+	case FUSE_RELEASEDIR: {
+		struct dir_handle *d = (struct dir_handle *)(uintptr_t)
+			((struct fuse_release_in *)arg)->fh;
+
+		closedir(d->dp);
+		free(d);
+		return 0;
+	}
+	case FUSE_FSYNCDIR:
+		return 0;
+	case FUSE_STATFS:
+		return do_statfs(n, (void *)out);
+	default:
+		return -ENOSYS;
+	}
+}
+
+/*
+ * Handle the request in @req and build the reply in @reply, returning its
+ * length or 0 if there is none.  @req and @reply may be the same buffer
+ * (a ring slot): then everything but WRITE, whose payload is consumed
+ * before the reply is written, is handled from a copy in @scratch.
+ */
+static size_t process(void *req, void *reply, void *scratch)
+{
+	struct fuse_in_header *h = req;
+	struct fuse_out_header *oh = reply;
+	uint64_t unique = h->unique;
+	int ret;
+
+	if (req == reply && h->opcode != FUSE_WRITE) {
+		memcpy(scratch, req, h->len);
+		h = scratch;
+	}
+	ret = handle(h, (char *)(oh + 1));
+	if (ret == NO_REPLY)
+		return 0;
+
+	oh->unique = unique;
+	oh->error = ret < 0 ? ret : 0;
+	oh->len = sizeof(*oh) + (ret < 0 ? 0 : ret);
+	return oh->len;
+}
+
+static int clone_dev(void)
+{
+	int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+
+	if (fd < 0)
+		die("/dev/fuse");
+	if (ioctl(fd, FUSE_DEV_IOC_CLONE, &(uint32_t){ dev_fd }))
+		die("FUSE_DEV_IOC_CLONE");
+	return fd;
+}
+
+static void pin_to_cpu(long cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* @arg is the thread number, or -1 for the main thread on dev_fd */
+static void *reader_thread(void *arg)
+{
+	long idx = (long)arg;
+	int fd = idx < 0 ? dev_fd : clone_dev();
+	char *req = malloc(BUF_SIZE), *reply = malloc(BUF_SIZE);
+	ssize_t n;
+	size_t len;
+
+	if (!req || !reply)
+		die("malloc");
+
+	if (idx >= 0 && opt_queues) {
+		struct fuse_queue_bind bind = {
+			.type = FUSE_QUEUE_CPU,
+			.id = idx % sysconf(_SC_NPROCESSORS_CONF),
+		};
+
+		pin_to_cpu(bind.id);
+		if (ioctl(fd, FUSE_DEV_IOC_QUEUE_BIND, &bind))
+			die("FUSE_DEV_IOC_QUEUE_BIND");
+	}
+
+	for (;;) {
+		n = read(fd, req, BUF_SIZE);
+		if (n < 0) {
+			if (errno == EINTR || errno == ENOENT ||
+			    errno == EAGAIN)
+				continue;
+			if (errno == ENODEV)
+				exit(0);
+			die("read /dev/fuse");
+		}
+		len = process(req, reply, NULL);
+		if (len && write(fd, reply, len) < 0 && errno != ENOENT)
+			perror("write /dev/fuse");
+	}
+	return NULL;
+}
+
+static void *ring_thread(void *arg)
+{
+	long cpu = (long)arg;
+	struct fuse_ring_setup setup = {
+		.cpu = cpu,
+		.nr_slots = 1,
+		.slot_size = BUF_SIZE,
+	};
+	struct fuse_ring_cmd cmd = { .slot = 0 };
+	char *scratch = malloc(BUF_SIZE);
+	void *slot;
+	int fd, ret;
+
+	pin_to_cpu(cpu);
+
+	fd = clone_dev();
+	if (ioctl(fd, FUSE_DEV_IOC_RING_SETUP, &setup)) {
+		perror("FUSE_DEV_IOC_RING_SETUP");
+		return NULL;
+	}
+	slot = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (slot == MAP_FAILED || !scratch)
+		die("ring mmap");
+
+	for (;;) {
+		ret = ioctl(fd, FUSE_DEV_IOC_RING_CMD, &cmd);
+		cmd.flags = 0;
+		if (ret < 0) {
+			if (errno == EINTR || errno == ENOENT)
+				continue;
+			if (errno == ENODEV)
+				exit(0);
+			die("FUSE_DEV_IOC_RING_CMD");
+		}
+		if (process(slot, slot, scratch))
+			cmd.flags = FUSE_RING_COMMIT;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, threads = 0;
+	long cpu, ncpus, idx;
+	pthread_t tid;
+	char opts[256];
+	struct stat st;
+
+	while ((opt = getopt(argc, argv, "prqt:")) != -1) {
+		switch (opt) {
+		case 'p':
+			opt_passthrough = 1;
+			break;
+		case 'r':
+			opt_rings = 1;
+			break;
+		case 'q':
+			opt_queues = 1;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 2)
+		goto usage;
+
+	root.fd = open(argv[optind], O_PATH | O_DIRECTORY);
+	if (root.fd < 0 || fstat(root.fd, &st))
+		die(argv[optind]);
+	root.dev = st.st_dev;
+	root.ino = st.st_ino;
+	root.nlookup = 1;
+
+	dev_fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+	if (dev_fd < 0)
+		die("/dev/fuse");
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=0,group_id=0,allow_other,default_permissions",
+		 dev_fd);
+	if (mount("fuse-passthrough", argv[optind + 1], "fuse.passthrough",
+		  MS_NOSUID | MS_NODEV, opts))
+		die("mount");
+
+	for (idx = 0; idx < threads; idx++)
+		if (pthread_create(&tid, NULL, reader_thread, (void *)idx))
+			die("pthread_create");
+
+	if (opt_rings) {
+		ncpus = sysconf(_SC_NPROCESSORS_CONF);
+		for (cpu = 0; cpu < ncpus; cpu++)
+			if (pthread_create(&tid, NULL, ring_thread,
+					   (void *)cpu))
+				die("pthread_create");
+	}
+
+	reader_thread((void *)-1L);
+	return 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s [-p] [-r] [-q] [-t threads] <source dir> <mountpoint>\n",
+		argv[0]);
+	return 1;
+}
@@ -133,6 +133,37 @@ static int (*bpf_rc_keydown)(void *ctx, unsigned int protocol,
 	(void *) BPF_FUNC_rc_keydown;
 static unsigned long long (*bpf_get_current_cgroup_id)(void) =
 	(void *) BPF_FUNC_get_current_cgroup_id;
+static int (*bpf_ringbuf_output)(void *ringbuf, void *data,
+				 unsigned long long size,
+				 unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_output;
+static void *(*bpf_ringbuf_reserve)(void *ringbuf, unsigned long long size,
+				    unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_reserve;
+static void (*bpf_ringbuf_submit)(void *data, unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_submit;
+static void (*bpf_ringbuf_discard)(void *data, unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_discard;
+static unsigned long long (*bpf_ringbuf_query)(void *ringbuf,
+					       unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_query;
+static void (*bpf_spin_lock)(struct bpf_spin_lock *lock) =
+	(void *) BPF_FUNC_spin_lock;
+static void (*bpf_spin_unlock)(struct bpf_spin_lock *lock) =
+	(void *) BPF_FUNC_spin_unlock;
+static int (*bpf_iter_seq_write)(void *ctx, const void *data,
+				 unsigned int len) =
+	(void *) BPF_FUNC_iter_seq_write;
+static void *(*bpf_ctx_sk_storage_get)(void *map, void *ctx, void *value,
+				       unsigned long long flags) =
+	(void *) BPF_FUNC_ctx_sk_storage_get;
+static int (*bpf_ctx_sk_storage_delete)(void *map, void *ctx) =
+	(void *) BPF_FUNC_ctx_sk_storage_delete;
+static void *(*bpf_current_task_storage_get)(void *map, void *value,
+					     unsigned long long flags) =
+	(void *) BPF_FUNC_current_task_storage_get;
+static int (*bpf_current_task_storage_delete)(void *map) =
+	(void *) BPF_FUNC_current_task_storage_delete;
 
 /* llvm builtin functions that eBPF C program may use to
  * emit BPF_LD_ABS and BPF_LD_IND instructions
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 
 #include <sys/wait.h>
+#include <sys/syscall.h>
 
 #include <linux/bpf.h>
 
@@ -442,6 +443,256 @@ static void test_arraymap_percpu_many_keys(void)
 	close(fd);
 }
 
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
+
+static inline __u64 ptr_to_u64(const void *ptr)
+{
+	return (__u64) (unsigned long) ptr;
+}
+
+/* libbpf in this tree has no wrappers for the batch commands yet */
+static int map_batch(int cmd, int fd, void *in_batch, void *out_batch,
+		     void *keys, void *values, __u32 *count, __u64 elem_flags)
+{
+	union bpf_attr attr;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.batch.map_fd = fd;
+	attr.batch.in_batch = ptr_to_u64(in_batch);
+	attr.batch.out_batch = ptr_to_u64(out_batch);
+	attr.batch.keys = ptr_to_u64(keys);
+	attr.batch.values = ptr_to_u64(values);
+	attr.batch.count = *count;
+	attr.batch.elem_flags = elem_flags;
+
+	ret = syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+	*count = attr.batch.count;
+	return ret;
+}
+
+/* Walk the whole map with lookup (or lookup-and-delete) batches of at most
+ * 'step' elements and return the number of elements seen. The cursor is
+ * opaque, so it is just carried over in a buffer large enough for any key.
+ */
+static int map_batch_dump(int cmd, int fd, __u32 step, int *keys,
+			  long *values, unsigned int value_cnt)
+{
+	char in_batch[64], out_batch[64];
+	__u32 count, total = 0;
+	int err;
+
+	do {
+		count = step;
+		err = map_batch(cmd, fd, total ? in_batch : NULL, out_batch,
+				keys + total, values + total * value_cnt,
+				&count, 0);
+		assert(!err || errno == ENOENT);
+		total += count;
+		memcpy(in_batch, out_batch, sizeof(in_batch));
+	} while (!err);
+
+	return total;
+}
+
+static void test_map_batch_hash(enum bpf_map_type type, bool percpu)
+{
+	unsigned int nr_cpus = percpu ? bpf_num_possible_cpus() : 1;
+	int fd, i, j, max_entries = 1000;
+	int *keys, *visited;
+	__u32 count, step;
+	long *values;
+
+	fd = bpf_create_map(type, sizeof(int), sizeof(long), max_entries,
+			    map_flags);
+	if (fd < 0) {
+		printf("Failed to create hashmap '%s'!\n", strerror(errno));
+		exit(1);
+	}
+
+	keys = calloc(max_entries, sizeof(*keys));
+	values = calloc(max_entries * nr_cpus, sizeof(*values));
+	visited = calloc(max_entries, sizeof(*visited));
+	assert(keys && values && visited);
+
+	for (i = 0; i < max_entries; i++) {
+		keys[i] = i;
+		for (j = 0; j < nr_cpus; j++)
+			values[i * nr_cpus + j] = i * 1000 + j;
+	}
+
+	/* An empty map has nothing to report. */
+	count = max_entries;
+	assert(map_batch(BPF_MAP_LOOKUP_BATCH, fd, NULL, &step, keys, values,
+			 &count, 0) == -1 && errno == ENOENT && count == 0);
+
+	count = max_entries;
+	assert(map_batch(BPF_MAP_UPDATE_BATCH, fd, NULL, NULL, keys, values,
+			 &count, BPF_NOEXIST) == 0 && count == max_entries);
+
+	/* The whole map is updated, so the next one must fail on the first
+	 * element already and report it.
+	 */
+	count = max_entries;
+	assert(map_batch(BPF_MAP_UPDATE_BATCH, fd, NULL, NULL, keys, values,
+			 &count, BPF_NOEXIST) == -1 && errno == EEXIST &&
+	       count == 0);
+
+	/* A bucket is never split between two batches, so every step has
+	 * to be larger than the most crowded bucket.
+	 */
+	for (step = 10; step < max_entries; step *= 4) {
+		memset(keys, 0, max_entries * sizeof(*keys));
+		memset(values, 0, max_entries * nr_cpus * sizeof(*values));
+		memset(visited, 0, max_entries * sizeof(*visited));
+
+		assert(map_batch_dump(BPF_MAP_LOOKUP_BATCH, fd, step, keys,
+				      values, nr_cpus) == max_entries);
+		for (i = 0; i < max_entries; i++) {
+			assert(keys[i] >= 0 && keys[i] < max_entries);
+			assert(!visited[keys[i]]);
+			visited[keys[i]] = 1;
+			for (j = 0; j < nr_cpus; j++)
+				assert(values[i * nr_cpus + j] ==
+				       keys[i] * 1000 + j);
+		}
+	}
+
+	/* Draining the map leaves nothing behind. */
+	assert(map_batch_dump(BPF_MAP_LOOKUP_AND_DELETE_BATCH, fd, 64, keys,
+			      values, nr_cpus) == max_entries);
+	assert(bpf_map_get_next_key(fd, NULL, &i) == -1 && errno == ENOENT);
+
+	/* Refill and delete by key. */
+	for (i = 0; i < max_entries; i++)
+		keys[i] = i;
+	count = max_entries;
+	assert(map_batch(BPF_MAP_UPDATE_BATCH, fd, NULL, NULL, keys, values,
+			 &count, BPF_ANY) == 0 && count == max_entries);
+	count = max_entries;
+	assert(map_batch(BPF_MAP_DELETE_BATCH, fd, NULL, NULL, keys, NULL,
+			 &count, 0) == 0 && count == max_entries);
+	count = max_entries;
+	assert(map_batch(BPF_MAP_DELETE_BATCH, fd, NULL, NULL, keys, NULL,
+			 &count, 0) == -1 && errno == ENOENT && count == 0);
+
+	free(keys);
+	free(values);
+	free(visited);
+	close(fd);
+}
+
+static void test_map_batch_array(enum bpf_map_type type, bool percpu)
+{
+	unsigned int nr_cpus = percpu ? bpf_num_possible_cpus() : 1;
+	int fd, i, j, max_entries = 1000;
+	__u32 count;
+	long *values;
+	int *keys;
+
+	fd = bpf_create_map(type, sizeof(int), sizeof(long), max_entries, 0);
+	if (fd < 0) {
+		printf("Failed to create arraymap '%s'!\n", strerror(errno));
+		exit(1);
+	}
+
+	keys = calloc(max_entries, sizeof(*keys));
+	values = calloc(max_entries * nr_cpus, sizeof(*values));
+	assert(keys && values);
+
+	for (i = 0; i < max_entries; i++) {
+		keys[i] = i;
+		for (j = 0; j < nr_cpus; j++)
+			values[i * nr_cpus + j] = i * 1000 + j;
+	}
+
+	count = max_entries;
+	assert(map_batch(BPF_MAP_UPDATE_BATCH, fd, NULL, NULL, keys, values,
+			 &count, BPF_ANY) == 0 && count == max_entries);
+
+	memset(keys, 0, max_entries * sizeof(*keys));
+	memset(values, 0, max_entries * nr_cpus * sizeof(*values));
+	assert(map_batch_dump(BPF_MAP_LOOKUP_BATCH, fd, 7, keys, values,
+			      nr_cpus) == max_entries);
+	for (i = 0; i < max_entries; i++) {
+		assert(keys[i] == i);
+		for (j = 0; j < nr_cpus; j++)
+			assert(values[i * nr_cpus + j] == i * 1000 + j);
+	}
+
+	/* Arrays cannot delete elements. */
+	count = max_entries;
+	assert(map_batch(BPF_MAP_LOOKUP_AND_DELETE_BATCH, fd, NULL, NULL,
+			 keys, values, &count, 0) == -1 && errno == ENOTSUPP);
+	count = max_entries;
+	assert(map_batch(BPF_MAP_DELETE_BATCH, fd, NULL, NULL, keys, NULL,
+			 &count, 0) == -1 && errno == ENOTSUPP);
+
+	free(keys);
+	free(values);
+	close(fd);
+}
+
+static void test_map_batch_lpm(void)
+{
+	struct {
+		__u32 prefixlen;
+		__u8 data[4];
+	} keys[3] = {
+		{ 8, { 10, 0, 0, 0 } },
+		{ 16, { 10, 1, 0, 0 } },
+		{ 24, { 10, 1, 2, 0 } },
+	}, out_keys[3];
+	char in_batch[sizeof(keys[0])], out_batch[sizeof(keys[0])];
+	long values[3] = { 8, 16, 24 }, out_values[3];
+	__u32 count, total = 0;
+	int fd, i, err;
+
+	fd = bpf_create_map(BPF_MAP_TYPE_LPM_TRIE, sizeof(keys[0]),
+			    sizeof(values[0]), 3, BPF_F_NO_PREALLOC);
+	if (fd < 0) {
+		printf("Failed to create lpm trie '%s'!\n", strerror(errno));
+		exit(1);
+	}
+
+	count = 3;
+	assert(map_batch(BPF_MAP_UPDATE_BATCH, fd, NULL, NULL, keys, values,
+			 &count, BPF_ANY) == 0 && count == 3);
+
+	/* Nested prefixes must each come back with their own value. */
+	do {
+		count = 1;
+		err = map_batch(BPF_MAP_LOOKUP_BATCH, fd,
+				total ? in_batch : NULL, out_batch,
+				&out_keys[total], &out_values[total], &count, 0);
+		assert(!err || errno == ENOENT);
+		total += count;
+		memcpy(in_batch, out_batch, sizeof(in_batch));
+	} while (!err);
+	assert(total == 3);
+	for (i = 0; i < 3; i++)
+		assert(out_values[i] == out_keys[i].prefixlen);
+
+	count = 3;
+	assert(map_batch(BPF_MAP_DELETE_BATCH, fd, NULL, NULL, keys, NULL,
+			 &count, 0) == 0 && count == 3);
+	assert(bpf_map_get_next_key(fd, NULL, out_keys) == -1 &&
+	       errno == ENOENT);
+
+	close(fd);
+}
+
+static void test_map_batch(void)
+{
+	test_map_batch_hash(BPF_MAP_TYPE_HASH, false);
+	test_map_batch_hash(BPF_MAP_TYPE_PERCPU_HASH, true);
+	test_map_batch_array(BPF_MAP_TYPE_ARRAY, false);
+	test_map_batch_array(BPF_MAP_TYPE_PERCPU_ARRAY, true);
+	test_map_batch_lpm();
+}
+
 static void test_devmap(int task, void *data)
 {
 	int fd;
@@ -1161,6 +1412,8 @@ static void run_all_tests(void)
 
 	test_arraymap_percpu_many_keys();
 
+	test_map_batch();
+
 	test_devmap(0, NULL);
 	test_sockmap(0, NULL);
 
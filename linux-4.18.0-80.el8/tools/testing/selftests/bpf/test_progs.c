@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <linux/types.h>
 typedef __u16 __sum16;
@@ -23,13 +24,18 @@ typedef __u16 __sum16;
 #include <linux/filter.h>
 #include <linux/perf_event.h>
 #include <linux/unistd.h>
+#include <linux/version.h>
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <fcntl.h>
 
 #include <linux/bpf.h>
+#include <linux/btf.h>
 #include <linux/err.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
@@ -1698,6 +1704,1219 @@ static void test_task_fd_query_tp(void)
 				   "sys_enter_read");
 }
 
+struct ringbuf_sample {
+	int pid;
+	int seq;
+	long value;
+};
+
+struct ringbuf_check {
+	int next_seq;
+	int cnt;
+	int bad;
+};
+
+static int process_ringbuf_sample(void *ctx, void *data, __u32 size)
+{
+	struct ringbuf_check *check = ctx;
+	struct ringbuf_sample *s = data;
+
+	/* discarded records must never show up, the rest in order */
+	if (check->next_seq % 3 == 2)
+		check->next_seq++;
+	if (size != sizeof(*s) || s->pid != getpid() ||
+	    s->seq != check->next_seq || s->value != __NR_nanosleep)
+		check->bad++;
+	check->next_seq = s->seq + 1;
+	check->cnt++;
+	return 0;
+}
+
+static void test_ringbuf(void)
+{
+	const char *file = "./test_ringbuf.o";
+	int i, efd, err, prog_fd, ringbuf_fd, control_fd;
+	struct ringbuf_check check = {};
+	struct timespec tv = {0, 10};
+	struct ringbuf_reader rb;
+	struct bpf_object *obj;
+	__u64 val, seq = 0, dropped = 0, size = 0;
+	__u32 key, duration = 0;
+
+	err = bpf_prog_load(file, BPF_PROG_TYPE_RAW_TRACEPOINT, &obj, &prog_fd);
+	if (CHECK(err, "prog_load raw tp", "err %d errno %d\n", err, errno))
+		return;
+
+	ringbuf_fd = bpf_find_map(__func__, obj, "ringbuf");
+	control_fd = bpf_find_map(__func__, obj, "control_map");
+	if (ringbuf_fd < 0 || control_fd < 0)
+		goto close_prog_noerr;
+
+	err = ringbuf_reader_open(&rb, ringbuf_fd);
+	if (CHECK(err, "ringbuf_reader_open", "err %d\n", err))
+		goto close_prog_noerr;
+
+	key = 0;
+	val = getpid();
+	bpf_map_update_elem(control_fd, &key, &val, 0);
+	key = 1;
+	val = __NR_nanosleep;
+	bpf_map_update_elem(control_fd, &key, &val, 0);
+
+	efd = bpf_raw_tracepoint_open("sys_enter", prog_fd);
+	if (CHECK(efd < 0, "raw_tp_open", "err %d errno %d\n", efd, errno))
+		goto close_reader;
+
+	/* 16k of ring hold all of the records, including the discarded
+	 * ones, without the consumer ever running in between
+	 */
+	for (i = 0; i < 100; i++)
+		nanosleep(&tv, NULL);
+	close(efd);
+
+	key = 2;
+	bpf_map_lookup_elem(control_fd, &key, &seq);
+	key = 3;
+	bpf_map_lookup_elem(control_fd, &key, &dropped);
+	key = 4;
+	bpf_map_lookup_elem(control_fd, &key, &size);
+	CHECK(seq != 100 || dropped || size != 16384, "ringbuf counters",
+	      "seq %llu dropped %llu size %llu\n", seq, dropped, size);
+
+	err = ringbuf_reader_poll(&rb, process_ringbuf_sample, &check, 100);
+	CHECK(err != 67 || check.cnt != 67 || check.bad, "ringbuf consume",
+	      "err %d cnt %d bad %d\n", err, check.cnt, check.bad);
+
+	/* everything was consumed, nothing is left to poll for */
+	err = ringbuf_reader_poll(&rb, process_ringbuf_sample, &check, 0);
+	CHECK(err, "ringbuf empty", "err %d\n", err);
+
+close_reader:
+	ringbuf_reader_close(&rb);
+close_prog_noerr:
+	bpf_object__close(obj);
+}
+
+/* Load programs that are expensive to verify, reporting how long each load
+ * took, and check that they still compute the right thing.
+ */
+static void test_verif_scale(void)
+{
+	const char *files[] = {
+		"./test_verif_scale_loop1.o",
+		"./test_verif_scale_loop2.o",
+		"./test_verif_scale_unroll.o",
+	};
+	struct timespec start, end;
+	struct bpf_object *obj;
+	__u32 duration, retval;
+	int i, err, prog_fd;
+
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		err = bpf_prog_load(files[i], BPF_PROG_TYPE_XDP, &obj, &prog_fd);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		duration = (end.tv_sec - start.tv_sec) * 1000000000ull +
+			   end.tv_nsec - start.tv_nsec;
+		if (CHECK(err, files[i], "load failed err %d errno %d\n",
+			  err, errno))
+			continue;
+
+		err = bpf_prog_test_run(prog_fd, 1, &pkt_v4, sizeof(pkt_v4),
+					NULL, NULL, &retval, &duration);
+		CHECK(err || retval != XDP_PASS, "run",
+		      "err %d errno %d retval %d\n", err, errno, retval);
+		bpf_object__close(obj);
+	}
+}
+
+#define SPIN_LOCK_THREADS	4
+#define SPIN_LOCK_RUNS		10000
+
+struct spin_lock_elem {
+	__u32 lock;
+	__u32 cnt;
+	int var[16];
+};
+
+static int map_lookup_locked(int fd, const void *key, void *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = ptr_to_u64(key);
+	attr.value = ptr_to_u64(value);
+	attr.flags = BPF_F_LOCK;
+
+	return syscall(__NR_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr));
+}
+
+static void *spin_lock_thread(void *arg)
+{
+	__u32 duration, retval;
+	int err, prog_fd = *(int *)arg;
+
+	err = bpf_prog_test_run(prog_fd, SPIN_LOCK_RUNS, &pkt_v4,
+				sizeof(pkt_v4), NULL, NULL, &retval, &duration);
+	CHECK(err || retval != XDP_PASS, "spin_lock run",
+	      "err %d errno %d retval %d\n", err, errno, retval);
+	return NULL;
+}
+
+static void test_spin_lock(void)
+{
+	const char *file = "./test_spin_lock.o";
+	pthread_t threads[SPIN_LOCK_THREADS];
+	struct spin_lock_elem val;
+	struct bpf_object *obj;
+	int i, j, err, prog_fd, map_fd, key = 0;
+	__u32 duration = 0;
+
+	err = bpf_prog_load(file, BPF_PROG_TYPE_XDP, &obj, &prog_fd);
+	if (CHECK(err, "prog_load", "err %d errno %d\n", err, errno))
+		return;
+
+	map_fd = bpf_find_map(__func__, obj, "hmap");
+	if (map_fd < 0)
+		goto close_prog_noerr;
+
+	for (i = 0; i < SPIN_LOCK_THREADS; i++)
+		if (CHECK(pthread_create(&threads[i], NULL, spin_lock_thread,
+					 &prog_fd), "pthread_create",
+			  "thread %d\n", i))
+			goto close_prog_noerr;
+
+	/* locked reads from user space never see a half written value */
+	for (i = 0; i < SPIN_LOCK_RUNS; i++) {
+		if (map_lookup_locked(map_fd, &key, &val))
+			continue;
+		for (j = 0; j < 16; j++)
+			if (val.var[j] != val.cnt)
+				break;
+		if (CHECK(j != 16 || val.lock, "locked lookup",
+			  "cnt %u var[%d] %d lock %u\n", val.cnt, j,
+			  j < 16 ? val.var[j] : 0, val.lock))
+			break;
+	}
+
+	for (i = 0; i < SPIN_LOCK_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	err = map_lookup_locked(map_fd, &key, &val);
+	CHECK(err || val.cnt != SPIN_LOCK_THREADS * SPIN_LOCK_RUNS,
+	      "spin_lock count", "err %d cnt %u\n", err, val.cnt);
+
+close_prog_noerr:
+	bpf_object__close(obj);
+}
+
+/* BTF describing the functions the fentry/fexit tests attach to, written
+ * out by hand since the programs are not built from C:
+ *
+ *   [1] int  [2] char  [3] u64
+ *   [5] int bpf_fentry_test1(int a)                     proto [4]
+ *   [7] int bpf_fentry_test2(int a, u64 b)              proto [6]
+ *   [9] int bpf_fentry_test3(char a, int b, u64 c)      proto [8]
+ *   [12] void __set_task_comm(void *tsk, void *buf, char exec)
+ *                                                       proto [11]
+ *
+ * and the iterator targets, as in BPF_ITER_FUNC_PREFIX "<target>":
+ *
+ *   [14] bpf_iter_task(void *a, void *b)                proto [13]
+ *   [16] bpf_iter_task_file(void *a, void *b, u64 c, void *d)
+ *                                                       proto [15]
+ *   [18] bpf_iter_bpf_map_elem(void *a, void *b, void *c, void *d)
+ *                                                       proto [17]
+ *   [20] bpf_iter_tcp(void *a, void *b, u64 c)          proto [19]
+ *   [22] bpf_iter_udp(void *a, void *b, u64 c, u64 d)   proto [21]
+ */
+#define BTF_INFO_ENC(kind, vlen)	((kind) << 24 | (vlen))
+#define BTF_INT_ENC(bits)		(bits)
+
+static const __u32 tracing_btf_types[] = {
+	1, BTF_INFO_ENC(BTF_KIND_INT, 0), 4, BTF_INT_ENC(32),
+	5, BTF_INFO_ENC(BTF_KIND_INT, 0), 1, BTF_INT_ENC(8),
+	10, BTF_INFO_ENC(BTF_KIND_INT, 0), 8, BTF_INT_ENC(64),
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 1), 1,
+		14, 1,
+	20, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 4,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 2), 1,
+		14, 1,
+		16, 3,
+	37, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 6,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 3), 1,
+		14, 2,
+		16, 1,
+		18, 3,
+	54, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 8,
+	0, BTF_INFO_ENC(BTF_KIND_PTR, 0), 0,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 3), 0,
+		71, 10,
+		75, 10,
+		79, 2,
+	84, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 11,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 2), 1,
+		14, 10,
+		16, 10,
+	102, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 13,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 4), 1,
+		14, 10,
+		16, 10,
+		18, 3,
+		100, 10,
+	116, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 15,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 4), 1,
+		14, 10,
+		16, 10,
+		18, 10,
+		100, 10,
+	135, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 17,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 3), 1,
+		14, 10,
+		16, 10,
+		18, 3,
+	157, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 19,
+	0, BTF_INFO_ENC(BTF_KIND_FUNC_PROTO, 4), 1,
+		14, 10,
+		16, 10,
+		18, 3,
+		100, 3,
+	170, BTF_INFO_ENC(BTF_KIND_FUNC, 0), 21,
+};
+
+static const char tracing_btf_strings[] =
+	"\0int\0char\0u64\0a\0b\0c\0bpf_fentry_test1\0bpf_fentry_test2"
+	"\0bpf_fentry_test3\0tsk\0buf\0exec\0__set_task_comm\0d\0bpf_iter_task"
+	"\0bpf_iter_task_file\0bpf_iter_bpf_map_elem\0bpf_iter_tcp\0bpf_iter_udp";
+
+enum {
+	BTF_ID_FENTRY_TEST1 = 5,
+	BTF_ID_FENTRY_TEST2 = 7,
+	BTF_ID_FENTRY_TEST3 = 9,
+	BTF_ID_SET_TASK_COMM = 12,
+	BTF_ID_ITER_TASK = 14,
+	BTF_ID_ITER_TASK_FILE = 16,
+	BTF_ID_ITER_MAP_ELEM = 18,
+	BTF_ID_ITER_TCP = 20,
+	BTF_ID_ITER_UDP = 22,
+};
+
+static int load_tracing_btf(void)
+{
+	char buf[sizeof(struct btf_header) + sizeof(tracing_btf_types) +
+		 sizeof(tracing_btf_strings)];
+	struct btf_header hdr = {
+		.magic = BTF_MAGIC,
+		.version = BTF_VERSION,
+		.hdr_len = sizeof(hdr),
+		.type_len = sizeof(tracing_btf_types),
+		.str_off = sizeof(tracing_btf_types),
+		.str_len = sizeof(tracing_btf_strings),
+	};
+	static char log[4096];
+	__u32 duration = 0;
+	int fd;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), tracing_btf_types,
+	       sizeof(tracing_btf_types));
+	memcpy(buf + sizeof(hdr) + sizeof(tracing_btf_types),
+	       tracing_btf_strings, sizeof(tracing_btf_strings));
+
+	fd = bpf_load_btf(buf, sizeof(buf), log, sizeof(log), false);
+	CHECK(fd < 0, "load_btf", "errno %d\n%s", errno, log);
+	return fd;
+}
+
+static char tracing_log[4096];
+
+static int load_tracing_prog(const struct bpf_insn *insns, int insn_cnt,
+			     enum bpf_attach_type type, int btf_fd,
+			     __u32 btf_id)
+{
+	union bpf_attr attr;
+
+	bzero(&attr, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_TRACING;
+	attr.expected_attach_type = type;
+	attr.insns = ptr_to_u64(insns);
+	attr.insn_cnt = insn_cnt;
+	attr.license = ptr_to_u64("GPL");
+	attr.log_buf = ptr_to_u64(tracing_log);
+	attr.log_size = sizeof(tracing_log);
+	attr.log_level = 1;
+	attr.attach_btf_obj_fd = btf_fd;
+	attr.attach_btf_id = btf_id;
+
+	tracing_log[0] = 0;
+	return syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+}
+
+/* Sum up the first nr_slots u64 of the context, arguments and for fexit
+ * the return value, and store the sum in element key of map_fd.
+ */
+static int gen_sum_prog(struct bpf_insn *insns, int nr_slots, int map_fd,
+			__u32 key)
+{
+	struct bpf_insn ld_map[] = { BPF_LD_MAP_FD(BPF_REG_1, map_fd) };
+	struct bpf_insn *insn = insns;
+	int i;
+
+	*insn++ = BPF_MOV64_IMM(BPF_REG_6, 0);
+	for (i = 0; i < nr_slots; i++) {
+		*insn++ = BPF_LDX_MEM(BPF_DW, BPF_REG_2, BPF_REG_1, i * 8);
+		*insn++ = BPF_ALU64_REG(BPF_ADD, BPF_REG_6, BPF_REG_2);
+	}
+	*insn++ = BPF_ST_MEM(BPF_W, BPF_REG_10, -4, key);
+	*insn++ = BPF_MOV64_REG(BPF_REG_2, BPF_REG_10);
+	*insn++ = BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4);
+	memcpy(insn, ld_map, sizeof(ld_map));
+	insn += 2;
+	*insn++ = BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem);
+	*insn++ = BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 1);
+	*insn++ = BPF_STX_MEM(BPF_DW, BPF_REG_0, BPF_REG_6, 0);
+	*insn++ = BPF_MOV64_IMM(BPF_REG_0, 0);
+	*insn++ = BPF_EXIT_INSN();
+	return insn - insns;
+}
+
+/* Attach fentry and fexit programs to bpf_fentry_test1..3(), which are
+ * called by BPF_PROG_TEST_RUN of a tracing program, and check the arguments
+ * and return values they see.
+ */
+static void test_fentry_fexit(void)
+{
+	static const struct {
+		__u32 btf_id;
+		int nr_args;
+		__u64 args_sum;
+	} funcs[] = {
+		{ BTF_ID_FENTRY_TEST1, 1, 1 },
+		{ BTF_ID_FENTRY_TEST2, 2, 2 + 3 },
+		{ BTF_ID_FENTRY_TEST3, 3, 4 + 5 + 6 },
+	};
+	const int nr_funcs = sizeof(funcs) / sizeof(funcs[0]);
+	int prog_fd[2 * nr_funcs], link_fd[2 * nr_funcs];
+	int i, btf_fd, map_fd, err, insn_cnt;
+	struct bpf_insn insns[32];
+	__u32 key, retval, duration = 0;
+	__u64 sum, expected;
+
+	for (i = 0; i < 2 * nr_funcs; i++)
+		prog_fd[i] = link_fd[i] = -1;
+
+	btf_fd = load_tracing_btf();
+	if (btf_fd < 0)
+		return;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(__u32),
+				sizeof(__u64), 2 * nr_funcs, 0);
+	if (CHECK(map_fd < 0, "create_map", "errno %d\n", errno))
+		goto close_btf;
+
+	/* fentry programs use elements 0..2, fexit programs 3..5 */
+	for (i = 0; i < 2 * nr_funcs; i++) {
+		bool fexit = i >= nr_funcs;
+		int f = i % nr_funcs;
+
+		insn_cnt = gen_sum_prog(insns, funcs[f].nr_args + fexit,
+					map_fd, i);
+		prog_fd[i] = load_tracing_prog(insns, insn_cnt,
+					       fexit ? BPF_TRACE_FEXIT :
+						       BPF_TRACE_FENTRY,
+					       btf_fd, funcs[f].btf_id);
+		if (CHECK(prog_fd[i] < 0, "load", "prog %d errno %d\n%s", i,
+			  errno, tracing_log))
+			goto close_progs;
+		link_fd[i] = bpf_raw_tracepoint_open(NULL, prog_fd[i]);
+		if (CHECK(link_fd[i] < 0, "attach", "prog %d errno %d\n", i,
+			  errno))
+			goto close_progs;
+	}
+
+	err = bpf_prog_test_run(prog_fd[0], 1, NULL, 0, NULL, NULL, &retval,
+				&duration);
+	if (CHECK(err, "test_run", "err %d errno %d\n", err, errno))
+		goto close_progs;
+
+	for (i = 0; i < 2 * nr_funcs; i++) {
+		int f = i % nr_funcs;
+
+		/* each function returns the sum of its arguments */
+		expected = funcs[f].args_sum * (i >= nr_funcs ? 2 : 1);
+		key = i;
+		sum = 0;
+		err = bpf_map_lookup_elem(map_fd, &key, &sum);
+		CHECK(err || sum != expected, "result",
+		      "prog %d err %d sum %llu expected %llu\n", i, err, sum,
+		      expected);
+	}
+
+	/* bpf_fentry_test1() has one argument, the context one u64 */
+	insn_cnt = gen_sum_prog(insns, 2, map_fd, 0);
+	err = load_tracing_prog(insns, insn_cnt, BPF_TRACE_FENTRY, btf_fd,
+				BTF_ID_FENTRY_TEST1);
+	CHECK(err >= 0 || errno != EACCES, "ctx out of bounds",
+	      "fd %d errno %d\n", err, errno);
+	if (err >= 0)
+		close(err);
+
+close_progs:
+	for (i = 0; i < 2 * nr_funcs; i++) {
+		if (link_fd[i] >= 0)
+			close(link_fd[i]);
+		if (prog_fd[i] >= 0)
+			close(prog_fd[i]);
+	}
+	close(map_fd);
+close_btf:
+	close(btf_fd);
+}
+
+#define OVERHEAD_LOOPS	1000000
+
+/* prctl(PR_SET_NAME) ends up in __set_task_comm(), which fires the
+ * task_rename tracepoint. Report how long it takes per call.
+ */
+static __u64 time_set_task_comm(const char *mode, __u64 base_ns)
+{
+	struct timespec start, end;
+	__u64 ns;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < OVERHEAD_LOOPS; i++)
+		prctl(PR_SET_NAME, "test_overhead");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1000000000ull +
+	     end.tv_nsec - start.tv_nsec;
+	ns /= OVERHEAD_LOOPS;
+	if (base_ns)
+		printf("test_overhead: %-8s %4llu ns/call, %+lld ns over base\n",
+		       mode, ns, (long long)(ns - base_ns));
+	else
+		printf("test_overhead: %-8s %4llu ns/call\n", mode, ns);
+	return ns;
+}
+
+static int kprobe_pmu_open(const char *func)
+{
+	struct perf_event_attr attr = {};
+	char buf[16];
+	int fd, n;
+
+	fd = open("/sys/bus/event_source/devices/kprobe/type", O_RDONLY);
+	if (fd < 0)
+		return fd;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = 0;
+
+	attr.size = sizeof(attr);
+	attr.type = strtol(buf, NULL, 0);
+	attr.config1 = ptr_to_u64(func);	/* kprobe_func */
+	attr.sample_period = 1;
+	attr.wakeup_events = 1;
+	return syscall(__NR_perf_event_open, &attr, -1 /* pid */,
+		       0 /* cpu 0 */, -1 /* group id */, 0 /* flags */);
+}
+
+/* Per-call cost of running an empty program on __set_task_comm() from a
+ * kprobe, from the raw task_rename tracepoint inside of it and from a
+ * trampoline on its entry or exit.
+ */
+static void test_overhead(void)
+{
+	struct bpf_insn prog[] = {
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	const int insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	int btf_fd, prog_fd, efd, err;
+	char comm[16] = {};
+	__u32 duration = 0;
+	__u64 base;
+
+	prctl(PR_GET_NAME, comm);
+	base = time_set_task_comm("base", 0);
+
+	/* kprobe */
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_KPROBE, prog, insn_cnt, "GPL",
+				   LINUX_VERSION_CODE, NULL, 0);
+	if (CHECK(prog_fd < 0, "load kprobe", "errno %d\n", errno))
+		goto restore_comm;
+	efd = kprobe_pmu_open("__set_task_comm");
+	if (CHECK(efd < 0, "kprobe pmu", "errno %d\n", errno)) {
+		close(prog_fd);
+		goto restore_comm;
+	}
+	err = ioctl(efd, PERF_EVENT_IOC_SET_BPF, prog_fd);
+	if (!CHECK(err, "attach kprobe", "err %d errno %d\n", err, errno) &&
+	    !ioctl(efd, PERF_EVENT_IOC_ENABLE, 0))
+		time_set_task_comm("kprobe", base);
+	close(efd);
+	close(prog_fd);
+
+	/* raw tracepoint */
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_RAW_TRACEPOINT, prog,
+				   insn_cnt, "GPL", 0, NULL, 0);
+	if (CHECK(prog_fd < 0, "load raw_tp", "errno %d\n", errno))
+		goto restore_comm;
+	efd = bpf_raw_tracepoint_open("task_rename", prog_fd);
+	if (!CHECK(efd < 0, "attach raw_tp", "errno %d\n", errno)) {
+		time_set_task_comm("raw_tp", base);
+		close(efd);
+	}
+	close(prog_fd);
+
+	/* fentry and fexit */
+	btf_fd = load_tracing_btf();
+	if (btf_fd < 0)
+		goto restore_comm;
+
+	prog_fd = load_tracing_prog(prog, insn_cnt, BPF_TRACE_FENTRY, btf_fd,
+				    BTF_ID_SET_TASK_COMM);
+	if (CHECK(prog_fd < 0, "load fentry", "errno %d\n%s", errno,
+		  tracing_log))
+		goto close_btf;
+	efd = bpf_raw_tracepoint_open(NULL, prog_fd);
+	if (!CHECK(efd < 0, "attach fentry", "errno %d\n", errno)) {
+		time_set_task_comm("fentry", base);
+		close(efd);
+	}
+	close(prog_fd);
+
+	prog_fd = load_tracing_prog(prog, insn_cnt, BPF_TRACE_FEXIT, btf_fd,
+				    BTF_ID_SET_TASK_COMM);
+	if (CHECK(prog_fd < 0, "load fexit", "errno %d\n%s", errno,
+		  tracing_log))
+		goto close_btf;
+	efd = bpf_raw_tracepoint_open(NULL, prog_fd);
+	if (!CHECK(efd < 0, "attach fexit", "errno %d\n", errno)) {
+		time_set_task_comm("fexit", base);
+		close(efd);
+	}
+	close(prog_fd);
+close_btf:
+	close(btf_fd);
+restore_comm:
+	prctl(PR_SET_NAME, comm);
+}
+
+static int map_freeze(int fd)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+
+	return syscall(__NR_bpf, BPF_MAP_FREEZE, &attr, sizeof(attr));
+}
+
+/* Two pages of u64 counters: element 1 is bumped by an XDP program and read
+ * back through the mapping, element 0 is written through the mapping and
+ * read back with a lookup.
+ */
+static void test_mmap(void)
+{
+	const int nr_entries = 2 * 4096 / sizeof(__u64);
+	const size_t map_sz = nr_entries * sizeof(__u64);
+	struct bpf_insn prog[] = {
+		BPF_ST_MEM(BPF_W, BPF_REG_10, -4, 1),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4),
+		BPF_LD_MAP_FD(BPF_REG_1, 0),
+		BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+		BPF_MOV64_IMM(BPF_REG_1, 1),
+		BPF_STX_XADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0),
+		BPF_MOV64_IMM(BPF_REG_0, XDP_PASS),
+		BPF_EXIT_INSN(),
+	};
+	const int insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	int err, map_fd, prog_fd, plain_fd;
+	__u32 duration = 0, retval, key;
+	__u64 val, *map;
+	void *tmp;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(__u32),
+				sizeof(__u64), nr_entries, BPF_F_MMAPABLE);
+	if (CHECK(map_fd < 0, "create mmapable array", "errno %d\n", errno))
+		return;
+
+	map = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+	if (CHECK(map == MAP_FAILED, "mmap", "errno %d\n", errno))
+		goto close_map;
+
+	/* user space writes are seen by lookups */
+	map[0] = 42;
+	key = 0;
+	err = bpf_map_lookup_elem(map_fd, &key, &val);
+	CHECK(err || val != 42, "mmap write", "err %d val %llu\n", err, val);
+
+	/* updates and program writes are seen through the mapping */
+	key = nr_entries - 1;
+	val = 123;
+	err = bpf_map_update_elem(map_fd, &key, &val, 0);
+	CHECK(err || map[nr_entries - 1] != 123, "update visible",
+	      "err %d val %llu\n", err, map[nr_entries - 1]);
+
+	prog[3].imm = map_fd;
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_XDP, prog, insn_cnt, "GPL", 0,
+				   NULL, 0);
+	if (!CHECK(prog_fd < 0, "load prog", "errno %d\n", errno)) {
+		err = bpf_prog_test_run(prog_fd, 100, &pkt_v4, sizeof(pkt_v4),
+					NULL, NULL, &retval, &duration);
+		CHECK(err || retval != XDP_PASS || map[1] != 100, "prog write",
+		      "err %d retval %u val %llu\n", err, retval, map[1]);
+		close(prog_fd);
+	}
+
+	/* mapping past the end of the values fails */
+	tmp = mmap(NULL, map_sz + 4096, PROT_READ, MAP_SHARED, map_fd, 0);
+	CHECK(tmp != MAP_FAILED, "mmap too big", "unexpected success\n");
+	if (tmp != MAP_FAILED)
+		munmap(tmp, map_sz + 4096);
+	tmp = mmap(NULL, 4096, PROT_READ, MAP_SHARED, map_fd, map_sz);
+	CHECK(tmp != MAP_FAILED, "mmap past end", "unexpected success\n");
+	if (tmp != MAP_FAILED)
+		munmap(tmp, 4096);
+
+	/* private mappings would silently lose writes */
+	tmp = mmap(NULL, map_sz, PROT_READ, MAP_PRIVATE, map_fd, 0);
+	CHECK(tmp != MAP_FAILED || errno != EINVAL, "mmap private",
+	      "errno %d\n", errno);
+
+	/* arrays created without the flag are not mmapable */
+	plain_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(__u32),
+				  sizeof(__u64), nr_entries, 0);
+	if (!CHECK(plain_fd < 0, "create array", "errno %d\n", errno)) {
+		tmp = mmap(NULL, map_sz, PROT_READ, MAP_SHARED, plain_fd, 0);
+		CHECK(tmp != MAP_FAILED || errno != EINVAL, "mmap plain array",
+		      "errno %d\n", errno);
+		close(plain_fd);
+	}
+
+	/* a writable mapping keeps the map from being frozen */
+	err = map_freeze(map_fd);
+	CHECK(!err || errno != EBUSY, "freeze while mapped", "err %d errno %d\n",
+	      err, errno);
+
+	munmap(map, map_sz);
+	err = map_freeze(map_fd);
+	if (CHECK(err, "freeze", "err %d errno %d\n", err, errno))
+		goto close_map;
+
+	/* once frozen, user space may only read */
+	tmp = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+	CHECK(tmp != MAP_FAILED || errno != EPERM, "mmap rw frozen",
+	      "errno %d\n", errno);
+
+	key = 0;
+	val = 1;
+	err = bpf_map_update_elem(map_fd, &key, &val, 0);
+	CHECK(!err || errno != EPERM, "update frozen", "err %d errno %d\n",
+	      err, errno);
+
+	map = mmap(NULL, map_sz, PROT_READ, MAP_SHARED, map_fd, 0);
+	if (CHECK(map == MAP_FAILED, "mmap ro frozen", "errno %d\n", errno))
+		goto close_map;
+	/* a read-only mapping can't be made writable later on */
+	err = mprotect(map, map_sz, PROT_READ | PROT_WRITE);
+	CHECK(!err, "mprotect rw", "unexpected success\n");
+
+	/* the mapping holds its own reference to the map */
+	close(map_fd);
+	CHECK(map[0] != 42 || map[nr_entries - 1] != 123, "mmap after close",
+	      "val %llu %llu\n", map[0], map[nr_entries - 1]);
+	munmap(map, map_sz);
+	return;
+
+close_map:
+	close(map_fd);
+}
+
+static int iter_create(int prog_fd, int map_fd)
+{
+	union bpf_attr attr;
+
+	bzero(&attr, sizeof(attr));
+	attr.prog_iter_create.prog_fd = prog_fd;
+	attr.prog_iter_create.map_fd = map_fd;
+
+	return syscall(__NR_bpf, BPF_PROG_ITER_CREATE, &attr, sizeof(attr));
+}
+
+/* Read an iterator fd up to its end, at most chunk bytes per read(). */
+static ssize_t read_iter(int fd, void *buf, size_t size, size_t chunk)
+{
+	char *p = buf;
+	ssize_t len = 0, n;
+
+	do {
+		n = read(fd, p + len, chunk < size - len ? chunk : size - len);
+		if (n < 0)
+			return n;
+		len += n;
+	} while (n && len < size);
+	return len;
+}
+
+struct iter_rec {
+	__u64 seq_num;
+	__u64 arg;
+};
+
+/* For every object write an iter_rec of meta->seq_num and the u64 at
+ * arg_off in the context; the final call without an object writes one
+ * with seq_num -1.
+ */
+static int gen_iter_seq_prog(struct bpf_insn *insns, int arg_off)
+{
+	struct bpf_insn *insn = insns;
+
+	*insn++ = BPF_MOV64_REG(BPF_REG_6, BPF_REG_1);
+	*insn++ = BPF_LDX_MEM(BPF_DW, BPF_REG_7, BPF_REG_6, 8);
+	*insn++ = BPF_LDX_MEM(BPF_DW, BPF_REG_8, BPF_REG_6, arg_off);
+	*insn++ = BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_8, -8);
+	*insn++ = BPF_ST_MEM(BPF_DW, BPF_REG_10, -16, -1);
+	*insn++ = BPF_JMP_IMM(BPF_JEQ, BPF_REG_7, 0, 6);
+	/* probe_read(fp - 16, 8, &meta->seq_num) */
+	*insn++ = BPF_MOV64_REG(BPF_REG_1, BPF_REG_10);
+	*insn++ = BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, -16);
+	*insn++ = BPF_MOV64_IMM(BPF_REG_2, 8);
+	*insn++ = BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 0);
+	*insn++ = BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, 16);
+	*insn++ = BPF_EMIT_CALL(BPF_FUNC_probe_read);
+	/* iter_seq_write(ctx, fp - 16, 16) */
+	*insn++ = BPF_MOV64_REG(BPF_REG_1, BPF_REG_6);
+	*insn++ = BPF_MOV64_REG(BPF_REG_2, BPF_REG_10);
+	*insn++ = BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -16);
+	*insn++ = BPF_MOV64_IMM(BPF_REG_3, 16);
+	*insn++ = BPF_EMIT_CALL(BPF_FUNC_iter_seq_write);
+	*insn++ = BPF_MOV64_IMM(BPF_REG_0, 0);
+	*insn++ = BPF_EXIT_INSN();
+	return insn - insns;
+}
+
+#define ITER_BUF_SIZE	(16 << 20)
+
+/* Walk the objects of the target btf_id names with a gen_iter_seq_prog()
+ * program and check that the records are numbered 0, 1, ... and followed
+ * by exactly one from the final call. Returns the number of objects, or -1.
+ */
+static int iter_seq_records(int btf_fd, __u32 btf_id, int arg_off,
+			    const char *name, struct iter_rec *recs)
+{
+	struct bpf_insn insns[32];
+	int i, n, prog_fd, iter_fd;
+	__u32 duration = 0;
+	ssize_t len;
+
+	prog_fd = load_tracing_prog(insns, gen_iter_seq_prog(insns, arg_off),
+				    BPF_TRACE_ITER, btf_fd, btf_id);
+	if (CHECK(prog_fd < 0, name, "load errno %d\n%s", errno, tracing_log))
+		return -1;
+	iter_fd = iter_create(prog_fd, 0);
+	close(prog_fd);
+	if (CHECK(iter_fd < 0, name, "iter_create errno %d\n", errno))
+		return -1;
+
+	len = read_iter(iter_fd, recs, ITER_BUF_SIZE, 4096);
+	close(iter_fd);
+	if (CHECK(len < 0 || len == ITER_BUF_SIZE || len % sizeof(*recs), name,
+		  "read len %zd errno %d\n", len, errno))
+		return -1;
+
+	n = len / sizeof(*recs) - 1;
+	for (i = 0; i < n; i++)
+		if (recs[i].seq_num != i)
+			break;
+	if (CHECK(n < 0 || i != n || recs[n].seq_num != -1ULL, name,
+		  "%d records, record %d has seq_num %llu\n", n + 1, i,
+		  n < 0 ? 0 : recs[i].seq_num))
+		return -1;
+	return n;
+}
+
+static bool iter_has_arg(const struct iter_rec *recs, int n, __u64 arg)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (recs[i].arg == arg)
+			return true;
+	return false;
+}
+
+/* Dump the elements of a hash map, dropping those with odd keys, through
+ * reads of a size that splits records.
+ */
+static void test_bpf_iter_map_elem(int btf_fd)
+{
+	const __u32 nr_elems = 100;
+	struct bpf_insn prog[] = {
+		BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+		BPF_ST_MEM(BPF_DW, BPF_REG_10, -16, 0),
+		BPF_ST_MEM(BPF_DW, BPF_REG_10, -8, 0),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 16),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_3, 0, 17),
+		/* probe_read(fp - 16, 4, key) */
+		BPF_MOV64_REG(BPF_REG_1, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, -16),
+		BPF_MOV64_IMM(BPF_REG_2, 4),
+		BPF_EMIT_CALL(BPF_FUNC_probe_read),
+		/* probe_read(fp - 8, 8, value) */
+		BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 24),
+		BPF_MOV64_REG(BPF_REG_1, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, -8),
+		BPF_MOV64_IMM(BPF_REG_2, 8),
+		BPF_EMIT_CALL(BPF_FUNC_probe_read),
+		/* iter_seq_write(ctx, fp - 16, 16), then drop it for odd keys */
+		BPF_MOV64_REG(BPF_REG_1, BPF_REG_6),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -16),
+		BPF_MOV64_IMM(BPF_REG_3, 16),
+		BPF_EMIT_CALL(BPF_FUNC_iter_seq_write),
+		BPF_LDX_MEM(BPF_W, BPF_REG_0, BPF_REG_10, -16),
+		BPF_ALU64_IMM(BPF_AND, BPF_REG_0, 1),
+		BPF_EXIT_INSN(),
+		/* final call: key -1 and meta->seq_num */
+		BPF_ST_MEM(BPF_W, BPF_REG_10, -16, -1),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 0),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, 16),
+		BPF_MOV64_REG(BPF_REG_1, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, -8),
+		BPF_MOV64_IMM(BPF_REG_2, 8),
+		BPF_EMIT_CALL(BPF_FUNC_probe_read),
+		BPF_MOV64_REG(BPF_REG_1, BPF_REG_6),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -16),
+		BPF_MOV64_IMM(BPF_REG_3, 16),
+		BPF_EMIT_CALL(BPF_FUNC_iter_seq_write),
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	const int insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	struct {
+		__u32 key;
+		__u32 pad;
+		__u64 value;
+	} recs[128];
+	int i, n, map_fd, percpu_fd, prog_fd, iter_fd;
+	__u32 duration = 0, key;
+	bool seen[100] = {};
+	ssize_t len;
+	__u64 val;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(__u32),
+				sizeof(__u64), nr_elems, 0);
+	if (CHECK(map_fd < 0, "create hash", "errno %d\n", errno))
+		return;
+	for (key = 0; key < nr_elems; key++) {
+		val = key * key;
+		bpf_map_update_elem(map_fd, &key, &val, BPF_NOEXIST);
+	}
+
+	prog_fd = load_tracing_prog(prog, insn_cnt, BPF_TRACE_ITER, btf_fd,
+				    BTF_ID_ITER_MAP_ELEM);
+	if (CHECK(prog_fd < 0, "load map_elem iter", "errno %d\n%s", errno,
+		  tracing_log))
+		goto close_map;
+
+	/* the target walks a map, so it needs one */
+	iter_fd = iter_create(prog_fd, 0);
+	CHECK(iter_fd >= 0 || errno != EINVAL, "map_elem without map",
+	      "fd %d errno %d\n", iter_fd, errno);
+
+	percpu_fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_HASH, sizeof(__u32),
+				   sizeof(__u64), 1, 0);
+	if (!CHECK(percpu_fd < 0, "create percpu hash", "errno %d\n", errno)) {
+		iter_fd = iter_create(prog_fd, percpu_fd);
+		CHECK(iter_fd >= 0 || errno != EOPNOTSUPP, "map_elem percpu",
+		      "fd %d errno %d\n", iter_fd, errno);
+		close(percpu_fd);
+	}
+
+	iter_fd = iter_create(prog_fd, map_fd);
+	if (CHECK(iter_fd < 0, "map_elem iter_create", "errno %d\n", errno))
+		goto close_prog;
+
+	len = read_iter(iter_fd, recs, sizeof(recs), 40);
+	n = len / sizeof(recs[0]) - 1;
+	if (CHECK(len != (nr_elems / 2 + 1) * sizeof(recs[0]), "map_elem read",
+		  "len %zd errno %d\n", len, errno))
+		goto close_iter;
+
+	for (i = 0; i < n; i++) {
+		key = recs[i].key;
+		if (key >= nr_elems || key & 1 || seen[key] ||
+		    recs[i].value != key * key)
+			break;
+		seen[key] = true;
+	}
+	CHECK(i != n, "map_elem records", "record %d: key %u value %llu\n",
+	      i, recs[i].key, recs[i].value);
+	CHECK(recs[n].key != -1U || recs[n].value != n, "map_elem final",
+	      "key %u seq_num %llu\n", recs[n].key, recs[n].value);
+
+	/* the final call is made once */
+	len = read(iter_fd, recs, sizeof(recs));
+	CHECK(len != 0, "map_elem eof", "len %zd errno %d\n", len, errno);
+
+close_iter:
+	close(iter_fd);
+close_prog:
+	close(prog_fd);
+close_map:
+	close(map_fd);
+}
+
+static void test_bpf_iter(void)
+{
+	const struct bpf_insn seq_write_prog[] = {
+		BPF_ST_MEM(BPF_DW, BPF_REG_10, -8, 0),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -8),
+		BPF_MOV64_IMM(BPF_REG_3, 8),
+		BPF_EMIT_CALL(BPF_FUNC_iter_seq_write),
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int n, btf_fd, prog_fd, tcp_fd = -1, udp_fd = -1;
+	struct bpf_insn insns[32];
+	struct iter_rec *recs;
+	__u32 duration = 0;
+
+	btf_fd = load_tracing_btf();
+	if (btf_fd < 0)
+		return;
+	recs = malloc(ITER_BUF_SIZE);
+	if (CHECK(!recs, "malloc", "no memory\n"))
+		goto close_btf;
+
+	/* only BPF_ITER_FUNC_PREFIX functions name iterator targets */
+	prog_fd = load_tracing_prog(insns, gen_iter_seq_prog(insns, 8),
+				    BPF_TRACE_ITER, btf_fd,
+				    BTF_ID_FENTRY_TEST1);
+	CHECK(prog_fd >= 0, "iter on bpf_fentry_test1", "unexpected success\n");
+	if (prog_fd >= 0)
+		close(prog_fd);
+
+	/* and bpf_iter_seq_write() is only for iterators */
+	prog_fd = load_tracing_prog(seq_write_prog,
+				    sizeof(seq_write_prog) / sizeof(seq_write_prog[0]),
+				    BPF_TRACE_FENTRY, btf_fd, BTF_ID_FENTRY_TEST1);
+	CHECK(prog_fd >= 0, "fentry iter_seq_write", "unexpected success\n");
+	if (prog_fd >= 0)
+		close(prog_fd);
+
+	test_bpf_iter_map_elem(btf_fd);
+
+	n = iter_seq_records(btf_fd, BTF_ID_ITER_TASK, 8, "task iter", recs);
+	CHECK(n == 0 || iter_has_arg(recs, n, 0), "task iter",
+	      "%d tasks, or a NULL one\n", n);
+
+	n = iter_seq_records(btf_fd, BTF_ID_ITER_TASK_FILE, 24,
+			     "task_file iter", recs);
+	CHECK(n == 0 || iter_has_arg(recs, n, 0), "task_file iter",
+	      "%d files, or a NULL one\n", n);
+
+	/* our own sockets are walked, they are owned by us */
+	tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (CHECK(tcp_fd < 0 ||
+		  bind(tcp_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+		  listen(tcp_fd, 1), "tcp listen", "errno %d\n", errno))
+		goto free_recs;
+	n = iter_seq_records(btf_fd, BTF_ID_ITER_TCP, 16, "tcp iter", recs);
+	CHECK(n == 0 || (n > 0 && !iter_has_arg(recs, n, getuid())),
+	      "tcp iter", "%d sockets, none of uid %u\n", n, getuid());
+
+	udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (CHECK(udp_fd < 0 ||
+		  bind(udp_fd, (struct sockaddr *)&addr, sizeof(addr)),
+		  "udp bind", "errno %d\n", errno))
+		goto free_recs;
+	n = iter_seq_records(btf_fd, BTF_ID_ITER_UDP, 16, "udp iter", recs);
+	CHECK(n == 0 || (n > 0 && !iter_has_arg(recs, n, getuid())),
+	      "udp iter", "%d sockets, none of uid %u\n", n, getuid());
+
+free_recs:
+	if (udp_fd >= 0)
+		close(udp_fd);
+	if (tcp_fd >= 0)
+		close(tcp_fd);
+	free(recs);
+close_btf:
+	close(btf_fd);
+}
+
+static void test_local_storage(void)
+{
+	struct bpf_insn task_prog[] = {
+		/* v = current_task_storage_get(map, NULL, F_CREATE);
+		 * if (v) (*v)++
+		 */
+		BPF_LD_MAP_FD(BPF_REG_1, 0),
+		BPF_MOV64_IMM(BPF_REG_2, 0),
+		BPF_MOV64_IMM(BPF_REG_3, BPF_LOCAL_STORAGE_GET_F_CREATE),
+		BPF_EMIT_CALL(BPF_FUNC_current_task_storage_get),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+		BPF_MOV64_IMM(BPF_REG_1, 1),
+		BPF_STX_XADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0),
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	struct bpf_insn sk_prog[] = {
+		/* v = ctx_sk_storage_get(map, skb, NULL, F_CREATE);
+		 * if (v) (*v)++
+		 */
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_1),
+		BPF_LD_MAP_FD(BPF_REG_1, 0),
+		BPF_MOV64_IMM(BPF_REG_3, 0),
+		BPF_MOV64_IMM(BPF_REG_4, BPF_LOCAL_STORAGE_GET_F_CREATE),
+		BPF_EMIT_CALL(BPF_FUNC_ctx_sk_storage_get),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 2),
+		BPF_MOV64_IMM(BPF_REG_1, 1),
+		BPF_STX_XADD(BPF_DW, BPF_REG_0, BPF_REG_1, 0),
+		BPF_MOV64_IMM(BPF_REG_0, 1),
+		BPF_EXIT_INSN(),
+	};
+	struct bpf_insn lookup_prog[] = {
+		/* storage maps are only reached through their own helpers */
+		BPF_ST_MEM(BPF_W, BPF_REG_10, -4, 0),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4),
+		BPF_LD_MAP_FD(BPF_REG_1, 0),
+		BPF_EMIT_CALL(BPF_FUNC_map_lookup_elem),
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	int task_map, sk_map, prog_fd, efd, sock_fd, err, i;
+	__u32 duration = 0, key;
+	char comm[16];
+	__u64 val;
+
+	task_map = bpf_create_map(BPF_MAP_TYPE_PID_TASK_STORAGE, sizeof(int),
+				  sizeof(__u64), 0, BPF_F_NO_PREALLOC);
+	if (CHECK(task_map < 0, "create task storage", "errno %d\n", errno))
+		return;
+
+	/* storage maps have no max_entries and are never preallocated */
+	err = bpf_create_map(BPF_MAP_TYPE_PID_TASK_STORAGE, sizeof(int),
+			     sizeof(__u64), 1, BPF_F_NO_PREALLOC);
+	CHECK(err >= 0 || errno != EINVAL, "create with max_entries",
+	      "fd %d errno %d\n", err, errno);
+	if (err >= 0)
+		close(err);
+	err = bpf_create_map(BPF_MAP_TYPE_PID_TASK_STORAGE, sizeof(int),
+			     sizeof(__u64), 0, 0);
+	CHECK(err >= 0 || errno != EINVAL, "create preallocated",
+	      "fd %d errno %d\n", err, errno);
+	if (err >= 0)
+		close(err);
+
+	/* the storage of the current task is created on first rename */
+	task_prog[0].imm = task_map;
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_RAW_TRACEPOINT, task_prog,
+				   sizeof(task_prog) / sizeof(task_prog[0]), "GPL",
+				   0, NULL, 0);
+	if (CHECK(prog_fd < 0, "load task prog", "errno %d\n", errno))
+		goto close_task_map;
+	efd = bpf_raw_tracepoint_open("task_rename", prog_fd);
+	if (CHECK(efd < 0, "attach task prog", "errno %d\n", errno)) {
+		close(prog_fd);
+		goto close_task_map;
+	}
+
+	key = getpid();
+	err = bpf_map_lookup_elem(task_map, &key, &val);
+	CHECK(!err || errno != ENOENT, "task lookup before",
+	      "err %d errno %d\n", err, errno);
+
+	prctl(PR_GET_NAME, comm, 0, 0, 0);
+	for (i = 0; i < 10; i++)
+		prctl(PR_SET_NAME, comm, 0, 0, 0);
+	close(efd);
+	close(prog_fd);
+
+	err = bpf_map_lookup_elem(task_map, &key, &val);
+	CHECK(err || val != 10, "task lookup", "err %d errno %d val %llu\n",
+	      err, errno, val);
+
+	/* user space sees and updates the same storage by pid */
+	val = 100;
+	err = bpf_map_update_elem(task_map, &key, &val, BPF_EXIST);
+	CHECK(err, "task update", "err %d errno %d\n", err, errno);
+	err = bpf_map_delete_elem(task_map, &key);
+	CHECK(err, "task delete", "err %d errno %d\n", err, errno);
+	err = bpf_map_delete_elem(task_map, &key);
+	CHECK(!err || errno != ENOENT, "task delete again",
+	      "err %d errno %d\n", err, errno);
+
+	lookup_prog[3].imm = task_map;
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_RAW_TRACEPOINT, lookup_prog,
+				   sizeof(lookup_prog) / sizeof(lookup_prog[0]), "GPL",
+				   0, NULL, 0);
+	CHECK(prog_fd >= 0, "map_lookup_elem on storage",
+	      "unexpected success\n");
+	if (prog_fd >= 0)
+		close(prog_fd);
+
+	/* socket storage, keyed by socket fd from user space */
+	sk_map = bpf_create_map(BPF_MAP_TYPE_SK_STORAGE, sizeof(int),
+				sizeof(__u64), 0, BPF_F_NO_PREALLOC);
+	if (CHECK(sk_map < 0, "create sk storage", "errno %d\n", errno))
+		goto close_task_map;
+
+	sk_prog[1].imm = sk_map;
+	prog_fd = bpf_load_program(BPF_PROG_TYPE_CGROUP_SKB, sk_prog,
+				   sizeof(sk_prog) / sizeof(sk_prog[0]), "GPL",
+				   0, NULL, 0);
+	CHECK(prog_fd < 0, "load cgroup_skb prog", "errno %d\n", errno);
+	if (prog_fd >= 0)
+		close(prog_fd);
+
+	sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (CHECK(sock_fd < 0, "socket", "errno %d\n", errno))
+		goto close_sk_map;
+
+	key = sock_fd;
+	val = 42;
+	err = bpf_map_update_elem(sk_map, &key, &val, BPF_NOEXIST);
+	CHECK(err, "sk update", "err %d errno %d\n", err, errno);
+	err = bpf_map_update_elem(sk_map, &key, &val, BPF_NOEXIST);
+	CHECK(!err || errno != EEXIST, "sk update noexist",
+	      "err %d errno %d\n", err, errno);
+	val = 0;
+	err = bpf_map_lookup_elem(sk_map, &key, &val);
+	CHECK(err || val != 42, "sk lookup", "err %d errno %d val %llu\n",
+	      err, errno, val);
+	err = bpf_map_delete_elem(sk_map, &key);
+	CHECK(err, "sk delete", "err %d errno %d\n", err, errno);
+	err = bpf_map_lookup_elem(sk_map, &key, &val);
+	CHECK(!err || errno != ENOENT, "sk lookup deleted",
+	      "err %d errno %d\n", err, errno);
+
+	/* the storage of a socket still holding it goes away with it */
+	err = bpf_map_update_elem(sk_map, &key, &val, 0);
+	CHECK(err, "sk update again", "err %d errno %d\n", err, errno);
+	close(sock_fd);
+
+close_sk_map:
+	close(sk_map);
+close_task_map:
+	close(task_map);
+}
+
 int main(void)
 {
 	jit_enabled = is_jit_enabled();
@@ -1719,6 +2938,14 @@ int main(void)
 	test_get_stack_raw_tp();
 	test_task_fd_query_rawtp();
 	test_task_fd_query_tp();
+	test_ringbuf();
+	test_verif_scale();
+	test_spin_lock();
+	test_fentry_fexit();
+	test_overhead();
+	test_mmap();
+	test_bpf_iter();
+	test_local_storage();
 
 	printf("Summary: %d PASSED, %d FAILED\n", pass_cnt, error_cnt);
 	return error_cnt ? EXIT_FAILURE : EXIT_SUCCESS;
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <linux/bpf.h>
+#include "bpf_helpers.h"
+
+struct sample {
+	int pid;
+	int seq;
+	long value;
+};
+
+struct bpf_map_def SEC("maps") ringbuf = {
+	.type = BPF_MAP_TYPE_RINGBUF,
+	.max_entries = 16384,
+};
+
+/* [0] = pid to trace, [1] = syscall nr to trace, [2] = seq,
+ * [3] = reserve failures, [4] = ring size
+ */
+struct bpf_map_def SEC("maps") control_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u64),
+	.max_entries = 5,
+};
+
+static __always_inline __u64 *control(__u32 key)
+{
+	return bpf_map_lookup_elem(&control_map, &key);
+}
+
+SEC("raw_tracepoint/sys_enter")
+int test_ringbuf(struct bpf_raw_tracepoint_args *ctx)
+{
+	__u64 *pid, *nr, *seq, *dropped, *size;
+	struct sample *s;
+
+	pid = control(0);
+	nr = control(1);
+	seq = control(2);
+	dropped = control(3);
+	size = control(4);
+	if (!pid || !nr || !seq || !dropped || !size)
+		return 0;
+	if (*pid != bpf_get_current_pid_tgid() >> 32 || *nr != ctx->args[1])
+		return 0;
+
+	*size = bpf_ringbuf_query(&ringbuf, BPF_RB_RING_SIZE);
+
+	s = bpf_ringbuf_reserve(&ringbuf, sizeof(*s), 0);
+	if (!s) {
+		__sync_fetch_and_add(dropped, 1);
+		return 0;
+	}
+	s->pid = *pid;
+	s->seq = __sync_fetch_and_add(seq, 1);
+	s->value = ctx->args[1];
+
+	/* every third record is thrown away again, and every other one
+	 * goes through bpf_ringbuf_output() instead
+	 */
+	if (s->seq % 3 == 2) {
+		bpf_ringbuf_discard(s, 0);
+	} else if (s->seq & 1) {
+		struct sample copy = *s;
+
+		bpf_ringbuf_discard(s, BPF_RB_NO_WAKEUP);
+		bpf_ringbuf_output(&ringbuf, &copy, sizeof(copy), 0);
+	} else {
+		bpf_ringbuf_submit(s, 0);
+	}
+	return 0;
+}
+
+char _license[] SEC("license") = "GPL";
+__u32 _version SEC("version") = 1; /* ignored by tracepoints, required by libbpf.a */
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <linux/bpf.h>
+#include <linux/version.h>
+#include "bpf_helpers.h"
+
+#define VAR_NUM 16
+
+struct hmap_elem {
+	struct bpf_spin_lock lock;
+	unsigned int cnt;
+	int var[VAR_NUM];
+};
+
+struct bpf_map_def SEC("maps") hmap = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(int),
+	.value_size = sizeof(struct hmap_elem),
+	.max_entries = 1,
+};
+
+BPF_ANNOTATE_KV_PAIR(hmap, int, struct hmap_elem);
+
+/* Every run bumps the counter and sets all of var[] to its new value while
+ * holding the lock, so nobody, in a program or in user space with
+ * BPF_F_LOCK, may ever see var[] disagree with cnt.
+ */
+SEC("xdp_spin_lock")
+int bpf_spin_lock_test(struct xdp_md *ctx)
+{
+	struct hmap_elem zero = {}, *val;
+	int key = 0, i, ret = XDP_PASS;
+
+	val = bpf_map_lookup_elem(&hmap, &key);
+	if (!val) {
+		bpf_map_update_elem(&hmap, &key, &zero, BPF_NOEXIST);
+		val = bpf_map_lookup_elem(&hmap, &key);
+		if (!val)
+			return XDP_ABORTED;
+	}
+
+	bpf_spin_lock(&val->lock);
+	for (i = 0; i < VAR_NUM; i++)
+		if (val->var[i] != val->cnt)
+			ret = XDP_DROP;
+	val->cnt++;
+	for (i = 0; i < VAR_NUM; i++)
+		val->var[i] = val->cnt;
+	bpf_spin_unlock(&val->lock);
+
+	return ret;
+}
+
+char _license[] SEC("license") = "GPL";
+__u32 _version SEC("version") = 1;
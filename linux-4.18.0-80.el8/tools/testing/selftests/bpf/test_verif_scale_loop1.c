@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Sum up the first bytes of the packet in a loop the compiler keeps as a
+ * loop, so the verifier has to walk it once per iteration.
+ */
+#include <linux/bpf.h>
+#include "bpf_helpers.h"
+
+int _version SEC("version") = 1;
+
+SEC("xdp_loop1")
+int xdp_loop1(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	unsigned char *data = (void *)(long)ctx->data;
+	__u32 sum = 0;
+	int i;
+
+#pragma clang loop unroll(disable)
+	for (i = 0; i < 64; i++) {
+		if (data + i + 1 > data_end)
+			break;
+		sum += data[i];
+	}
+	return sum ? XDP_PASS : XDP_DROP;
+}
+
+char _license[] SEC("license") = "GPL";
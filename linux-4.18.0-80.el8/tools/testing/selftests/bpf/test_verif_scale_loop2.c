@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Two nested loops over a map value; the inner bound depends on the outer
+ * counter, so every iteration has a different state.
+ */
+#include <linux/bpf.h>
+#include "bpf_helpers.h"
+
+int _version SEC("version") = 1;
+
+struct bpf_map_def SEC("maps") loop2_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = 16 * sizeof(__u32),
+	.max_entries = 1,
+};
+
+SEC("xdp_loop2")
+int xdp_loop2(struct xdp_md *ctx)
+{
+	__u32 key = 0, sum = 0;
+	__u32 *val;
+	int i, j;
+
+	val = bpf_map_lookup_elem(&loop2_map, &key);
+	if (!val)
+		return XDP_DROP;
+
+#pragma clang loop unroll(disable)
+	for (i = 0; i < 16; i++) {
+#pragma clang loop unroll(disable)
+		for (j = 0; j <= i; j++)
+			sum += val[(i * j) & 15] + j;
+	}
+	val[0] = sum;
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
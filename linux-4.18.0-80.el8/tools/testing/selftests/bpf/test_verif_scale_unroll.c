@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-2.0
+/* The same walk over the packet as test_verif_scale_loop1.c, but fully
+ * unrolled; the program is well above BPF_MAXINSNS and only loads for root.
+ */
+#include <linux/bpf.h>
+#include "bpf_helpers.h"
+
+int _version SEC("version") = 1;
+
+SEC("xdp_unroll")
+int xdp_unroll(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	unsigned char *data = (void *)(long)ctx->data;
+	__u32 sum = 0;
+	int i;
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < 1024; i++) {
+		if (data + i + 1 > data_end)
+			break;
+		sum += data[i];
+	}
+	return sum ? XDP_PASS : XDP_DROP;
+}
+
+char _license[] SEC("license") = "GPL";
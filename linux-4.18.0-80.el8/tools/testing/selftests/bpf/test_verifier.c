@@ -50,7 +50,7 @@
 
 #define MAX_INSNS	BPF_MAXINSNS
 #define MAX_FIXUPS	8
-#define MAX_NR_MAPS	7
+#define MAX_NR_MAPS	8
 #define POINTER_VALUE	0xcafe4all
 #define TEST_DATA_LEN	64
 
@@ -70,6 +70,7 @@ struct bpf_test {
 	int fixup_prog1[MAX_FIXUPS];
 	int fixup_prog2[MAX_FIXUPS];
 	int fixup_map_in_map[MAX_FIXUPS];
+	int fixup_ringbuf[MAX_FIXUPS];
 	const char *errstr;
 	const char *errstr_unpriv;
 	uint32_t retval;
@@ -746,7 +747,8 @@ static struct bpf_test tests[] = {
 			BPF_JMP_IMM(BPF_JA, 0, 0, -1),
 			BPF_EXIT_INSN(),
 		},
-		.errstr = "back-edge",
+		.errstr = "unreachable insn 1",
+		.errstr_unpriv = "back-edge",
 		.result = REJECT,
 	},
 	{
@@ -758,19 +760,130 @@ static struct bpf_test tests[] = {
 			BPF_JMP_IMM(BPF_JA, 0, 0, -4),
 			BPF_EXIT_INSN(),
 		},
-		.errstr = "back-edge",
+		.errstr = "unreachable insn 4",
+		.errstr_unpriv = "back-edge",
 		.result = REJECT,
 	},
 	{
 		"conditional loop",
 		.insns = {
-			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_MOV64_REG(BPF_REG_0, BPF_REG_1),
 			BPF_MOV64_REG(BPF_REG_2, BPF_REG_0),
 			BPF_MOV64_REG(BPF_REG_3, BPF_REG_0),
 			BPF_JMP_IMM(BPF_JEQ, BPF_REG_1, 0, -3),
 			BPF_EXIT_INSN(),
 		},
-		.errstr = "back-edge",
+		.errstr = "infinite loop detected",
+		.errstr_unpriv = "back-edge",
+		.result = REJECT,
+	},
+	{
+		"bounded loop, count to 4",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_0, 1),
+			BPF_JMP_IMM(BPF_JLT, BPF_REG_0, 4, -2),
+			BPF_EXIT_INSN(),
+		},
+		.errstr_unpriv = "back-edge",
+		.result_unpriv = REJECT,
+		.result = ACCEPT,
+		.retval = 4,
+	},
+	{
+		"bounded loop, start in the middle",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_JMP_IMM(BPF_JA, 0, 0, 1),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_0, 1),
+			BPF_JMP_IMM(BPF_JLT, BPF_REG_0, 4, -2),
+			BPF_EXIT_INSN(),
+		},
+		.errstr_unpriv = "back-edge",
+		.result_unpriv = REJECT,
+		.result = ACCEPT,
+		.retval = 4,
+	},
+	{
+		"bounded loop, not taken back-edge to the first insn",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_0, 123),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 4, -2),
+			BPF_EXIT_INSN(),
+		},
+		.errstr_unpriv = "back-edge",
+		.result_unpriv = REJECT,
+		.result = ACCEPT,
+		.retval = 123,
+	},
+	{
+		"infinite loop in two jumps",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_JMP_IMM(BPF_JA, 0, 0, 0),
+			BPF_JMP_IMM(BPF_JLT, BPF_REG_0, 4, -2),
+			BPF_EXIT_INSN(),
+		},
+		.errstr = "infinite loop detected",
+		.errstr_unpriv = "back-edge",
+		.result = REJECT,
+	},
+	{
+		"infinite loop after a conditional jump",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_0, 5),
+			BPF_JMP_IMM(BPF_JLT, BPF_REG_0, 4, 2),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_0, 1),
+			BPF_JMP_IMM(BPF_JA, 0, 0, -2),
+			BPF_EXIT_INSN(),
+		},
+		.errstr = "program is too large",
+		.errstr_unpriv = "back-edge",
+		.result = REJECT,
+	},
+	{
+		"bounded loop, more iterations than the old insn limit",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_0, 1),
+			BPF_JMP_IMM(BPF_JLT, BPF_REG_0, 100000, -2),
+			BPF_EXIT_INSN(),
+		},
+		.errstr_unpriv = "back-edge",
+		.result_unpriv = REJECT,
+		.result = ACCEPT,
+		.retval = 100000,
+	},
+	{
+		"precise: zero and nonzero spilled to the same stack slot",
+		.insns = {
+			BPF_ST_MEM(BPF_DW, BPF_REG_10, -16, 0),
+			BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -16),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0,
+				     BPF_FUNC_map_lookup_elem),
+			BPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0, 1),
+			BPF_EXIT_INSN(),
+			BPF_MOV64_REG(BPF_REG_7, BPF_REG_0),
+			BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0,
+				     BPF_FUNC_get_prandom_u32),
+			BPF_MOV64_IMM(BPF_REG_8, 0),
+			BPF_MOV64_IMM(BPF_REG_9, 0),
+			BPF_MOV64_IMM(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_MOV64_IMM(BPF_REG_6, 0x1000),
+			BPF_JMP_IMM(BPF_JNE, BPF_REG_0, 0, 1),
+			BPF_MOV64_IMM(BPF_REG_6, 0),
+			BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_6, -8),
+			BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_10, -8),
+			BPF_ALU64_REG(BPF_ADD, BPF_REG_7, BPF_REG_1),
+			BPF_LDX_MEM(BPF_B, BPF_REG_0, BPF_REG_7, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_map2 = { 3 },
+		.errstr = "invalid access to map value, value_size=48 off=4096",
 		.result = REJECT,
 	},
 	{
@@ -12372,6 +12485,186 @@ static struct bpf_test tests[] = {
 		.result = REJECT,
 		.errstr = "variable ctx access var_off=(0x0; 0x4)",
 	},
+	{
+		"ringbuf: reserve, write and submit",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 8),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 4),
+			BPF_ST_MEM(BPF_DW, BPF_REG_0, 0, 42),
+			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_submit),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = ACCEPT,
+	},
+	{
+		"ringbuf: reserve and discard through spilled pointer",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 16),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_0, -8),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 5),
+			BPF_ST_MEM(BPF_DW, BPF_REG_0, 8, 42),
+			BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_10, -8),
+			BPF_ST_MEM(BPF_DW, BPF_REG_1, 0, 0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_discard),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = ACCEPT,
+	},
+	{
+		"ringbuf: output from stack",
+		.insns = {
+			BPF_ST_MEM(BPF_DW, BPF_REG_10, -8, 42),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -8),
+			BPF_MOV64_IMM(BPF_REG_3, 8),
+			BPF_MOV64_IMM(BPF_REG_4, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_output),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = ACCEPT,
+	},
+	{
+		"ringbuf: unreleased record",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 8),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 1),
+			BPF_ST_MEM(BPF_DW, BPF_REG_0, 0, 42),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = REJECT,
+		.errstr = "Unreleased reference",
+	},
+	{
+		"ringbuf: write past the reserved size",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 8),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 4),
+			BPF_ST_MEM(BPF_DW, BPF_REG_0, 8, 42),
+			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_submit),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = REJECT,
+		.errstr = "invalid access to memory, mem_size=8 off=8 size=8",
+	},
+	{
+		"ringbuf: access after submit",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 8),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 5),
+			BPF_MOV64_REG(BPF_REG_6, BPF_REG_0),
+			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_submit),
+			BPF_ST_MEM(BPF_DW, BPF_REG_6, 0, 42),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = REJECT,
+		.errstr = "R6 invalid mem access 'inv'",
+	},
+	{
+		"ringbuf: submit without NULL check",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 8),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_submit),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = REJECT,
+		.errstr = "R1 type=mem_or_null expected=mem",
+	},
+	{
+		"ringbuf: submit of a modified pointer",
+		.insns = {
+			BPF_MOV64_IMM(BPF_REG_2, 16),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 4),
+			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, 8),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_submit),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = REJECT,
+		.errstr = "R1 must be an unmodified pointer returned by an allocating helper",
+	},
+	{
+		"ringbuf: reserve of a variable size",
+		.insns = {
+			BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, 0),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_IMM(BPF_REG_3, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_reserve),
+			BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 3),
+			BPF_MOV64_REG(BPF_REG_1, BPF_REG_0),
+			BPF_MOV64_IMM(BPF_REG_2, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_submit),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_ringbuf = { 1 },
+		.result = REJECT,
+		.errstr = "R2 is not a known constant",
+	},
+	{
+		"ringbuf: ringbuf_output into a hash map",
+		.insns = {
+			BPF_ST_MEM(BPF_DW, BPF_REG_10, -8, 42),
+			BPF_LD_MAP_FD(BPF_REG_1, 0),
+			BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+			BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -8),
+			BPF_MOV64_IMM(BPF_REG_3, 8),
+			BPF_MOV64_IMM(BPF_REG_4, 0),
+			BPF_EMIT_CALL(BPF_FUNC_ringbuf_output),
+			BPF_MOV64_IMM(BPF_REG_0, 0),
+			BPF_EXIT_INSN(),
+		},
+		.fixup_map1 = { 1 },
+		.result = REJECT,
+		.errstr = "cannot pass map_type 1 into func bpf_ringbuf_output",
+	},
 };
 
 static int probe_filter_length(const struct bpf_insn *fp)
@@ -12488,6 +12781,7 @@ static void do_test_fixup(struct bpf_test *test, struct bpf_insn *prog,
 	int *fixup_prog1 = test->fixup_prog1;
 	int *fixup_prog2 = test->fixup_prog2;
 	int *fixup_map_in_map = test->fixup_map_in_map;
+	int *fixup_ringbuf = test->fixup_ringbuf;
 
 	if (test->fill_helper)
 		test->fill_helper(test);
@@ -12555,6 +12849,14 @@ static void do_test_fixup(struct bpf_test *test, struct bpf_insn *prog,
 			fixup_map_in_map++;
 		} while (*fixup_map_in_map);
 	}
+
+	if (*fixup_ringbuf) {
+		map_fds[7] = create_map(BPF_MAP_TYPE_RINGBUF, 0, 0, 4096);
+		do {
+			prog[*fixup_ringbuf].imm = map_fds[7];
+			fixup_ringbuf++;
+		} while (*fixup_ringbuf);
+	}
 }
 
 static void do_test_single(struct bpf_test *test, bool unpriv,
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <linux/perf_event.h>
 #include <sys/mman.h>
+#include <bpf.h>
 #include "trace_helpers.h"
 
 #define MAX_SYMS 300000
@@ -163,3 +164,102 @@ int perf_event_poller(int fd, perf_event_print_fn output_fn)
 
 	return ret;
 }
+
+int ringbuf_reader_open(struct ringbuf_reader *r, int map_fd)
+{
+	struct bpf_map_info info = {};
+	__u32 len = sizeof(info);
+	int page_size = getpagesize();
+	void *base;
+
+	if (bpf_obj_get_info_by_fd(map_fd, &info, &len))
+		return -errno;
+	if (info.type != BPF_MAP_TYPE_RINGBUF)
+		return -EINVAL;
+
+	memset(r, 0, sizeof(*r));
+	r->map_fd = map_fd;
+	r->mask = info.max_entries - 1;
+
+	/* only the consumer position may be written to by user space */
+	base = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    map_fd, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+	r->consumer_pos = base;
+
+	/* the data pages are mapped twice in a row, so that a record that
+	 * wraps around the end of the ring can be read in one piece
+	 */
+	base = mmap(NULL, page_size + 2 * (size_t)info.max_entries, PROT_READ,
+		    MAP_SHARED, map_fd, page_size);
+	if (base == MAP_FAILED) {
+		munmap(r->consumer_pos, page_size);
+		return -errno;
+	}
+	r->producer_pos = base;
+	r->data = base + page_size;
+	return 0;
+}
+
+void ringbuf_reader_close(struct ringbuf_reader *r)
+{
+	int page_size = getpagesize();
+
+	munmap(r->consumer_pos, page_size);
+	munmap(r->producer_pos, page_size + 2 * (r->mask + 1));
+}
+
+static __u32 ringbuf_rec_len(__u32 len)
+{
+	len &= ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+	return (len + BPF_RINGBUF_HDR_SZ + 7) & ~7;
+}
+
+int ringbuf_reader_consume(struct ringbuf_reader *r, ringbuf_sample_fn fn,
+			   void *ctx)
+{
+	unsigned long cons_pos, prod_pos;
+	int cnt = 0, err;
+	__u32 *hdr, len;
+
+	cons_pos = __atomic_load_n(r->consumer_pos, __ATOMIC_ACQUIRE);
+	for (;;) {
+		prod_pos = __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE);
+		if (cons_pos == prod_pos)
+			break;
+
+		hdr = r->data + (cons_pos & r->mask);
+		len = __atomic_load_n(hdr, __ATOMIC_ACQUIRE);
+		/* records are committed in any order but consumed in the
+		 * order they were reserved in
+		 */
+		if (len & BPF_RINGBUF_BUSY_BIT)
+			break;
+
+		cons_pos += ringbuf_rec_len(len);
+		if (!(len & BPF_RINGBUF_DISCARD_BIT)) {
+			err = fn(ctx, (void *)hdr + BPF_RINGBUF_HDR_SZ, len);
+			if (err) {
+				__atomic_store_n(r->consumer_pos, cons_pos,
+						 __ATOMIC_RELEASE);
+				return err;
+			}
+			cnt++;
+		}
+		__atomic_store_n(r->consumer_pos, cons_pos, __ATOMIC_RELEASE);
+	}
+	return cnt;
+}
+
+int ringbuf_reader_poll(struct ringbuf_reader *r, ringbuf_sample_fn fn,
+			void *ctx, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = r->map_fd, .events = POLLIN };
+	int err;
+
+	err = poll(&pfd, 1, timeout_ms);
+	if (err < 0)
+		return -errno;
+	return ringbuf_reader_consume(r, fn, ctx);
+}
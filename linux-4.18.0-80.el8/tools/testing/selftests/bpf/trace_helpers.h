@@ -18,4 +18,24 @@ typedef enum bpf_perf_event_ret (*perf_event_print_fn)(void *data, int size);
 int perf_event_mmap(int fd);
 /* return LIBBPF_PERF_EVENT_DONE or LIBBPF_PERF_EVENT_ERROR */
 int perf_event_poller(int fd, perf_event_print_fn output_fn);
+
+/* consumer side of a BPF_MAP_TYPE_RINGBUF map */
+struct ringbuf_reader {
+	int map_fd;
+	unsigned long mask;
+	unsigned long *consumer_pos;
+	unsigned long *producer_pos;
+	void *data;
+};
+
+/* return non-zero to stop consuming, it is passed back to the caller */
+typedef int (*ringbuf_sample_fn)(void *ctx, void *data, __u32 size);
+
+int ringbuf_reader_open(struct ringbuf_reader *r, int map_fd);
+void ringbuf_reader_close(struct ringbuf_reader *r);
+/* return the number of records consumed, or the callback's return value */
+int ringbuf_reader_consume(struct ringbuf_reader *r, ringbuf_sample_fn fn,
+			   void *ctx);
+int ringbuf_reader_poll(struct ringbuf_reader *r, ringbuf_sample_fn fn,
+			void *ctx, int timeout_ms);
 #endif
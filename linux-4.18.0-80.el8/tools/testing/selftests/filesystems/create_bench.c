@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Metadata stress benchmark: creates per second against thread count.
+ *
+ * Every thread creates, stats and unlinks files in its own directory below
+ * the target directory, so the directory i_rwsem is not what limits the
+ * scaling; what is left is mostly the inode cache (hash, sb inode list) and
+ * the dentry cache.
+ *
+ *   create_bench [-d dir] [-n files per thread] [-t max threads]
+ *
+ * The thread counts 1, 2, 4, ... up to -t (default 200, capped to the
+ * number of online cpus times four) are run one after the other.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *base_dir = ".";
+static unsigned long nr_files = 10000;
+static pthread_barrier_t start_barrier;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int err;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char dir[4096], path[4200];
+	struct stat st;
+	unsigned long i;
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s/create_bench.%d.%d",
+		 base_dir, getpid(), w->id);
+	if (mkdir(dir, 0700) && errno != EEXIST) {
+		w->err = errno;
+		pthread_barrier_wait(&start_barrier);
+		return NULL;
+	}
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/f%lu", dir, i);
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0600);
+		if (fd < 0) {
+			w->err = errno;
+			break;
+		}
+		close(fd);
+	}
+	for (i = 0; i < nr_files && !w->err; i++) {
+		snprintf(path, sizeof(path), "%s/f%lu", dir, i);
+		if (stat(path, &st))
+			w->err = errno;
+	}
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/f%lu", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	return NULL;
+}
+
+static int run(int nr_threads)
+{
+	struct worker *workers;
+	double start, elapsed;
+	int i, err = 0;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		return -ENOMEM;
+
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err)
+			err = workers[i].err;
+	}
+	elapsed = now() - start;
+	pthread_barrier_destroy(&start_barrier);
+	free(workers);
+
+	if (err) {
+		fprintf(stderr, "%d threads: %s\n", nr_threads, strerror(err));
+		return -err;
+	}
+
+	/* one create, one stat and one unlink per file */
+	printf("%8d %14.0f %14.0f\n", nr_threads,
+	       nr_threads * nr_files / elapsed,
+	       nr_threads * nr_files * 3 / elapsed);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long max_threads = 200, cpus;
+	int opt, t;
+
+	while ((opt = getopt(argc, argv, "d:n:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base_dir = optarg;
+			break;
+		case 'n':
+			nr_files = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = strtol(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-n files] [-t threads]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && max_threads > cpus * 4)
+		max_threads = cpus * 4;
+	if (max_threads < 1 || !nr_files) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	printf("%8s %14s %14s\n", "threads", "creates/s", "ops/s");
+	for (t = 1; t < max_threads; t *= 2)
+		if (run(t))
+			return 1;
+	return run(max_threads) ? 1 : 0;
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Dentry cache flood benchmark: lookup latency and dcache size while -j
+ * threads stat() names that don't exist, the way PATH and library search
+ * probes do.
+ *
+ * Every -i probes the latency of stat() on -h files that do exist is
+ * sampled, and the dentry counts from /proc/sys/fs/dentry-state and
+ * SReclaimable from /proc/meminfo are reported.  Compare runs with
+ * /proc/sys/fs/negative-dentry-limit at 0 and set.  -R adds a thread that
+ * keeps renaming a file in the directory, which used to make concurrent
+ * ref-walk lookups anywhere retry.
+ *
+ *   dentry_bench [-d dir] [-n probes] [-i interval] [-j threads]
+ *		  [-h hot files] [-R]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *dir = ".";
+static unsigned long nr_probes = 10000000, interval = 1000000, nr_hot = 100;
+static int nr_threads = 1, renamer;
+static volatile unsigned long probes_done;
+static volatile int stop;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void *probe_fn(void *arg)
+{
+	long id = (long)arg;
+	char path[4096];
+	unsigned long i;
+	struct stat st;
+
+	for (i = id; i < nr_probes && !stop; i += nr_threads) {
+		snprintf(path, sizeof(path), "%s/missing.%lu", dir, i);
+		if (!stat(path, &st) || errno != ENOENT) {
+			perror(path);
+			stop = 1;
+			break;
+		}
+		__atomic_add_fetch(&probes_done, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void *rename_fn(void *arg __attribute__((unused)))
+{
+	char a[4096], b[4096];
+	unsigned long i;
+
+	snprintf(a, sizeof(a), "%s/rename.a", dir);
+	snprintf(b, sizeof(b), "%s/rename.b", dir);
+	close(open(a, O_CREAT | O_WRONLY, 0644));
+	for (i = 0; !stop; i++)
+		if (rename(i & 1 ? b : a, i & 1 ? a : b))
+			break;
+	unlink(a);
+	unlink(b);
+	return NULL;
+}
+
+static long meminfo_kb(const char *key)
+{
+	char line[256];
+	long val = -1;
+	FILE *f;
+
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, key, strlen(key))) {
+			val = strtol(line + strlen(key), NULL, 10);
+			break;
+		}
+	fclose(f);
+	return val;
+}
+
+static void report(unsigned long done, double *lat)
+{
+	long nr_dentry = -1, nr_unused = -1, age, want, nr_negative = -1;
+	double start, total = 0;
+	char path[4096];
+	struct stat st;
+	unsigned long i;
+	FILE *f;
+
+	for (i = 0; i < nr_hot; i++) {
+		snprintf(path, sizeof(path), "%s/hot.%lu", dir, i);
+		start = now_us();
+		stat(path, &st);
+		lat[i] = now_us() - start;
+		total += lat[i];
+	}
+	qsort(lat, nr_hot, sizeof(*lat), cmp_double);
+
+	f = fopen("/proc/sys/fs/dentry-state", "r");
+	if (f) {
+		if (fscanf(f, "%ld %ld %ld %ld %ld", &nr_dentry, &nr_unused,
+			   &age, &want, &nr_negative) != 5)
+			nr_negative = -1;
+		fclose(f);
+	}
+	printf("%10lu %10.2f %10.2f %10.2f %12ld %12ld %12ld %12ld\n", done,
+	       total / nr_hot, lat[nr_hot / 2], lat[nr_hot - 1], nr_dentry,
+	       nr_unused, nr_negative, meminfo_kb("SReclaimable:"));
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *threads, rename_thread;
+	unsigned long i, next;
+	char path[4096];
+	double *lat;
+	int opt, t;
+
+	while ((opt = getopt(argc, argv, "d:n:i:j:h:R")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'n':
+			nr_probes = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'h':
+			nr_hot = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			renamer = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-n probes] [-i interval] [-j threads] [-h hot files] [-R]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_probes || !interval || !nr_hot || nr_threads < 1) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	lat = calloc(nr_hot, sizeof(*lat));
+	if (!threads || !lat)
+		return 1;
+
+	for (i = 0; i < nr_hot; i++) {
+		int fd;
+
+		snprintf(path, sizeof(path), "%s/hot.%lu", dir, i);
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0) {
+			perror(path);
+			return 1;
+		}
+		close(fd);
+	}
+
+	printf("%10s %10s %10s %10s %12s %12s %12s %12s\n", "probes",
+	       "hot avg us", "hot p50 us", "hot max us", "dentries",
+	       "unused", "negative", "SReclaim KiB");
+	report(0, lat);
+
+	if (renamer && pthread_create(&rename_thread, NULL, rename_fn, NULL))
+		renamer = 0;
+	for (t = 0; t < nr_threads; t++) {
+		if (pthread_create(&threads[t], NULL, probe_fn,
+				   (void *)(long)t)) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+
+	for (next = interval; next <= nr_probes && !stop; next += interval) {
+		while (__atomic_load_n(&probes_done, __ATOMIC_RELAXED) < next &&
+		       !stop)
+			usleep(1000);
+		if (!stop)
+			report(next, lat);
+	}
+
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	stop = 1;
+	if (renamer)
+		pthread_join(rename_thread, NULL);
+
+	for (i = 0; i < nr_hot; i++) {
+		snprintf(path, sizeof(path), "%s/hot.%lu", dir, i);
+		unlink(path);
+	}
+	free(threads);
+	free(lat);
+	return 0;
+}
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fsync latency of small appends on ext4, with fast commits against full
+ * journal commits.
+ *
+ * Every iteration appends -s bytes to one file and fsyncs it.  In "fast"
+ * mode nothing else touches the running transaction, so with the
+ * fast_commit feature each fsync writes one inode image into the fast
+ * commit area.  In "full" mode every append is followed by a setxattr on
+ * the file, which makes the transaction ineligible for a fast commit, so
+ * every fsync waits for a full jbd2 commit of the same data.
+ *
+ * Besides the latency the benchmark reports the KiB written to the device
+ * per fsync, from /sys/dev/block/<dev>/stat, and how the fsyncs were
+ * served, from /proc/fs/ext4/<dev>/fc_info.  Run it on an otherwise idle
+ * filesystem.
+ *
+ *   ext4_fc_bench [-d dir] [-n fsyncs] [-s size] [-m fast|full|both]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *base_dir = ".";
+static unsigned long nr_fsyncs = 10000, append_size = 4096;
+static char sysfs_stat[PATH_MAX], fc_info[PATH_MAX];
+static char *buf;
+
+struct counters {
+	unsigned long long sectors_written;
+	long long fast_commits;
+	long long ineligible;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Find the block device stat file and fc_info of the fs holding base_dir */
+static void find_dev(void)
+{
+	char link[PATH_MAX], path[64];
+	struct stat st;
+	ssize_t len;
+
+	if (stat(base_dir, &st)) {
+		perror(base_dir);
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u",
+		 major(st.st_dev), minor(st.st_dev));
+	snprintf(sysfs_stat, sizeof(sysfs_stat), "%s/stat", path);
+	len = readlink(path, link, sizeof(link) - 1);
+	if (len < 0)
+		return;
+	link[len] = '\0';
+	snprintf(fc_info, sizeof(fc_info), "/proc/fs/ext4/%s/fc_info",
+		 basename(link));
+}
+
+static void read_counters(struct counters *c)
+{
+	unsigned long long v[7];
+	char line[256];
+	FILE *f;
+
+	memset(c, 0, sizeof(*c));
+
+	f = fopen(sysfs_stat, "r");
+	if (f) {
+		if (fscanf(f, "%llu %llu %llu %llu %llu %llu %llu", &v[0],
+			   &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) == 7)
+			c->sectors_written = v[6];
+		fclose(f);
+	}
+
+	f = fopen(fc_info, "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		sscanf(line, "fast commits: %lld", &c->fast_commits);
+		sscanf(line, "ineligible: %lld", &c->ineligible);
+	}
+	fclose(f);
+}
+
+static int run(int full, double *lat)
+{
+	struct counters before, after;
+	double start, elapsed = 0, total = 0;
+	char path[PATH_MAX];
+	unsigned long i, n = nr_fsyncs;
+	int fd, err = 0;
+
+	snprintf(path, sizeof(path), "%s/ext4_fc_bench.%d", base_dir,
+		 getpid());
+	fd = open(path, O_CREAT | O_EXCL | O_WRONLY | O_APPEND, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -errno;
+	}
+	/* the create itself always needs a full commit, keep it out */
+	if (fsync(fd)) {
+		err = errno;
+		goto out;
+	}
+
+	read_counters(&before);
+	start = now_us();
+	for (i = 0; i < n; i++) {
+		double t = now_us();
+
+		if (write(fd, buf, append_size) != (ssize_t)append_size) {
+			err = errno ? errno : ENOSPC;
+			break;
+		}
+		if (full && fsetxattr(fd, "user.ext4_fc_bench", &i, sizeof(i),
+				      0)) {
+			err = errno;
+			break;
+		}
+		if (fsync(fd)) {
+			err = errno;
+			break;
+		}
+		lat[i] = now_us() - t;
+	}
+	elapsed = (now_us() - start) / 1e6;
+	read_counters(&after);
+out:
+	close(fd);
+	unlink(path);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", full ? "full" : "fast",
+			strerror(err));
+		return -err;
+	}
+
+	for (i = 0; i < n; i++)
+		total += lat[i];
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%6s %10.0f %10.1f %10.1f %10.1f %10.1f %12.1f %8lld %8lld\n",
+	       full ? "full" : "fast", n / elapsed, total / n, lat[n / 2],
+	       lat[n * 99 / 100], lat[n - 1],
+	       (after.sectors_written - before.sectors_written) / 2.0 / n,
+	       after.fast_commits - before.fast_commits,
+	       after.ineligible - before.ineligible);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *mode = "both";
+	double *lat;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:s:m:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base_dir = optarg;
+			break;
+		case 'n':
+			nr_fsyncs = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			append_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-n fsyncs] [-s size] [-m fast|full|both]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_fsyncs || !append_size) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	buf = calloc(1, append_size);
+	lat = calloc(nr_fsyncs, sizeof(*lat));
+	if (!buf || !lat)
+		return 1;
+	memset(buf, 'f', append_size);
+	find_dev();
+
+	printf("%lu fsyncs of %lu byte appends\n", nr_fsyncs, append_size);
+	printf("%6s %10s %10s %10s %10s %10s %12s %8s %8s\n", "mode",
+	       "fsyncs/s", "avg us", "p50 us", "p99 us", "max us",
+	       "KiB/fsync", "fast", "inelig");
+	if (strcmp(mode, "full"))
+		ret |= run(0, lat);
+	if (strcmp(mode, "fast"))
+		ret |= run(1, lat);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,182 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Crash consistency of ext4 fast commits, in the style of the dm-flakey
+# tests of xfstests.
+#
+# An ext4 filesystem with the fast_commit feature is mounted through a
+# dm-flakey device.  Files are appended to and fsynced, some of them after
+# an operation that forces the next fsync into a full commit.  Then the
+# device starts dropping every write, more unsynced data is written and
+# the filesystem is unmounted, which loses everything not yet on disk like
+# a power cut would.  After mounting again, jbd2 recovery and fast commit
+# replay must have brought every file back to its size and contents at
+# its last fsync, and e2fsck must find the filesystem clean.
+#
+# The fast commit area lives in the journal inode blocks past the end of
+# the jbd2 log, so the journal superblock's s_maxlen is lowered by
+# FC_BLOCKS after mkfs.  The metadata_csum feature is turned off because
+# that would also checksum the journal superblock.
+#
+#   SCRATCH_DEV=/dev/sdX ext4_fc_replay.sh
+#
+# SCRATCH_DEV is overwritten.
+
+KSFT_SKIP=4
+FC_BLOCKS=256
+NR_FILES=8
+NR_APPENDS=50
+FLAKEY=ext4_fc_replay
+MNT=$(mktemp -d)
+EXPECTED=$(mktemp)
+
+cleanup()
+{
+	umount "$MNT" 2>/dev/null
+	dmsetup remove "$FLAKEY" 2>/dev/null
+	rmdir "$MNT"
+	rm -f "$EXPECTED"
+}
+trap cleanup EXIT
+
+skip()
+{
+	echo "SKIP: $*"
+	exit $KSFT_SKIP
+}
+
+fail()
+{
+	echo "FAIL: $*"
+	exit 1
+}
+
+[ "$(id -u)" = 0 ] || skip "must be run as root"
+[ -b "$SCRATCH_DEV" ] || skip "SCRATCH_DEV is not set to a block device"
+for tool in dmsetup mkfs.ext4 debugfs e2fsck blockdev setfattr md5sum od; do
+	command -v $tool >/dev/null || skip "$tool not found"
+done
+
+SECTORS=$(blockdev --getsz "$SCRATCH_DEV")
+
+# all I/O passes through, or with drop_writes, writes are acknowledged but
+# never reach the disk
+flakey_table()
+{
+	if [ "$1" = drop ]; then
+		echo "0 $SECTORS flakey $SCRATCH_DEV 0 0 180 1 drop_writes"
+	else
+		echo "0 $SECTORS flakey $SCRATCH_DEV 0 180 0"
+	fi
+}
+
+flakey_load()
+{
+	dmsetup suspend "$FLAKEY" || fail "dmsetup suspend"
+	dmsetup load "$FLAKEY" --table "$(flakey_table "$1")" ||
+		fail "dmsetup load"
+	dmsetup resume "$FLAKEY" || fail "dmsetup resume"
+}
+
+# read or write a big endian u32 of the journal superblock
+jsb_offset()
+{
+	local blk bs
+
+	bs=$(debugfs -R "stats" "$SCRATCH_DEV" 2>/dev/null |
+	     awk '/^Block size:/ { print $3 }')
+	blk=$(debugfs -R "bmap <8> 0" "$SCRATCH_DEV" 2>/dev/null)
+	[ -n "$bs" ] && [ -n "$blk" ] || fail "cannot find the journal"
+	echo $((blk * bs))
+}
+
+jsb_get_be32()
+{
+	printf "%d" "0x$(od -An -t x1 -j $(($1 + $2)) -N 4 "$SCRATCH_DEV" |
+			 tr -d ' \n')"
+}
+
+jsb_set_be32()
+{
+	printf "$(printf '\\x%02x\\x%02x\\x%02x\\x%02x' \
+		  $(($3 >> 24 & 255)) $(($3 >> 16 & 255)) \
+		  $(($3 >> 8 & 255)) $(($3 & 255)))" |
+		dd of="$SCRATCH_DEV" bs=1 seek=$(($1 + $2)) count=4 \
+		   conv=notrunc status=none || fail "writing journal superblock"
+}
+
+mkfs.ext4 -q -F -O ^metadata_csum -J size=16 "$SCRATCH_DEV" ||
+	fail "mkfs.ext4"
+
+# s_maxlen is at offset 16 of the journal superblock
+off=$(jsb_offset)
+maxlen=$(jsb_get_be32 "$off" 16)
+jsb_set_be32 "$off" 16 $((maxlen - FC_BLOCKS))
+
+# EXT4_FEATURE_COMPAT_FAST_COMMIT, set through debugfs so that the
+# superblock stays consistent
+compat=$(od -An -t u4 -j $((1024 + 92)) -N 4 "$SCRATCH_DEV" | tr -d ' ')
+debugfs -w -R "ssv feature_compat $((compat | 0x400))" "$SCRATCH_DEV" \
+	>/dev/null 2>&1 || fail "setting the fast_commit feature"
+
+dmsetup create "$FLAKEY" --table "$(flakey_table up)" || fail "dmsetup create"
+DEV=/dev/mapper/$FLAKEY
+mount -t ext4 "$DEV" "$MNT" || fail "mount"
+
+DEVNAME=$(basename "$(readlink -f "$DEV")")
+FC_INFO=/proc/fs/ext4/$DEVNAME/fc_info
+grep -q "fast commit area" "$FC_INFO" 2>/dev/null ||
+	skip "fast commit not enabled on $DEVNAME"
+
+# create the files and commit them fully first, creates are ineligible
+for f in $(seq $NR_FILES); do
+	: > "$MNT/f$f"
+done
+sync
+
+for i in $(seq $NR_APPENDS); do
+	for f in $(seq $NR_FILES); do
+		# every third file also gets an xattr, forcing a full commit
+		if [ $((f % 3)) = 0 ]; then
+			setfattr -n user.i -v $i "$MNT/f$f" ||
+				fail "setfattr f$f"
+		fi
+		# append and fsync
+		head -c $((512 * (i + f))) /dev/urandom |
+			dd of="$MNT/f$f" oflag=append conv=notrunc,fsync \
+			   status=none || fail "append to f$f"
+	done
+done
+
+for f in $(seq $NR_FILES); do
+	echo "f$f $(stat -c %s "$MNT/f$f") $(md5sum < "$MNT/f$f" | cut -d' ' -f1)"
+done > "$EXPECTED"
+
+fast=$(awk '/^fast commits:/ { print $3 }' "$FC_INFO")
+[ "${fast:-0}" -gt 0 ] || fail "no fsync was served by a fast commit"
+
+# power cut: everything from here on is lost
+flakey_load drop
+for f in $(seq $NR_FILES); do
+	head -c 8192 /dev/urandom >> "$MNT/f$f"
+done
+umount "$MNT" || fail "umount"
+flakey_load up
+
+mount -t ext4 "$DEV" "$MNT" || fail "mount after crash"
+replayed=$(awk '/^replayed at mount:/ { print $4 }' "$FC_INFO")
+
+while read -r name size sum; do
+	got_size=$(stat -c %s "$MNT/$name")
+	got_sum=$(md5sum < "$MNT/$name" | cut -d' ' -f1)
+	[ "$got_size" = "$size" ] ||
+		fail "$name: size $got_size after replay, $size at fsync"
+	[ "$got_sum" = "$sum" ] ||
+		fail "$name: contents differ from the last fsync"
+done < "$EXPECTED"
+
+umount "$MNT" || fail "umount after replay"
+e2fsck -fn "$DEV" >/dev/null 2>&1 || fail "e2fsck found errors after replay"
+
+echo "PASS: $fast fast commits, $replayed inodes replayed"
+exit 0
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Free space fragmentation benchmark: block allocation latency.
+ *
+ * Fills the target directory with small files, removes every other one so
+ * that free space is spread over many small holes across all groups, then
+ * times fallocate() of larger files which the allocator has to find room
+ * for.  Run it on a nearly full filesystem with many block groups and
+ * compare with /sys/fs/ext4/<dev>/mb_optimize_scan set to 0 and 1;
+ * /proc/fs/ext4/<dev>/mb_stats (with mb_stats set to 1) shows where the
+ * allocator spent its time.
+ *
+ *   frag_bench [-d dir] [-f fill files] [-s fill size KiB]
+ *		[-n timed allocations] [-S alloc size KiB]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *dir = ".";
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int alloc_file(const char *prefix, unsigned long i, off_t len)
+{
+	char path[4096];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s%lu", dir, prefix, i);
+	fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if (fd < 0)
+		return -errno;
+	if (fallocate(fd, 0, 0, len))
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+static void remove_files(const char *prefix, unsigned long n,
+			 unsigned long step)
+{
+	char path[4096];
+	unsigned long i;
+
+	for (i = 0; i < n; i += step) {
+		snprintf(path, sizeof(path), "%s/%s%lu", dir, prefix, i);
+		unlink(path);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long nr_fill = 100000, nr_alloc = 1000, i, done;
+	off_t fill_size = 64 << 10, alloc_size = 8 << 20;
+	double *lat, start, total = 0;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "d:f:s:n:S:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'f':
+			nr_fill = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			fill_size = strtoull(optarg, NULL, 0) << 10;
+			break;
+		case 'n':
+			nr_alloc = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			alloc_size = strtoull(optarg, NULL, 0) << 10;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-f files] [-s KiB] [-n allocs] [-S KiB]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_alloc || !fill_size || !alloc_size) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	lat = calloc(nr_alloc, sizeof(*lat));
+	if (!lat)
+		return 1;
+
+	/* fill, stopping early if the filesystem is full */
+	for (i = 0; i < nr_fill; i++) {
+		ret = alloc_file("fill", i, fill_size);
+		if (ret == -ENOSPC)
+			break;
+		if (ret) {
+			fprintf(stderr, "fill: %s\n", strerror(-ret));
+			return 1;
+		}
+	}
+	nr_fill = i;
+	sync();
+
+	/* punch holes all over the filesystem */
+	remove_files("fill", nr_fill, 2);
+	sync();
+
+	for (done = 0; done < nr_alloc; done++) {
+		start = now_us();
+		ret = alloc_file("alloc", done, alloc_size);
+		lat[done] = now_us() - start;
+		if (ret == -ENOSPC)
+			break;
+		if (ret) {
+			fprintf(stderr, "alloc: %s\n", strerror(-ret));
+			return 1;
+		}
+		total += lat[done];
+	}
+
+	printf("fill files: %lu x %lld KiB, every other one removed\n",
+	       nr_fill, (long long)fill_size >> 10);
+	if (done) {
+		qsort(lat, done, sizeof(*lat), cmp_double);
+		printf("allocations: %lu x %lld KiB\n", done,
+		       (long long)alloc_size >> 10);
+		printf("latency us: avg %.1f p50 %.1f p99 %.1f max %.1f\n",
+		       total / done, lat[done / 2], lat[done * 99 / 100],
+		       lat[done - 1]);
+	}
+
+	remove_files("alloc", done, 1);
+	remove_files("fill", nr_fill, 1);
+	free(lat);
+	return done ? 0 : 1;
+}
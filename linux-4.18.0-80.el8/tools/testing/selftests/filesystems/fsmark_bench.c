@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fs_mark style parallel create benchmark: every thread creates files of -s
+ * bytes in its own directory and keeps them, so the directories and the
+ * inode count grow the way they do when unpacking or checking out a tree.
+ *
+ * With small or empty files nearly all of the work is metadata, so on XFS
+ * this mostly measures how transaction commits into the log scale with the
+ * number of threads.  -S 1 fsyncs every file before closing it, which makes
+ * every create force the log as well.
+ *
+ * The thread counts 1, 2, 4, ... up to -t (default: the number of online
+ * cpus) are run one after the other, each in fresh directories which are
+ * removed again afterwards unless -k is given.
+ *
+ *   fsmark_bench [-d dir] [-n files per thread] [-s size] [-t max threads]
+ *		  [-S 0|1] [-k]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *base_dir = ".";
+static unsigned long nr_files = 10000, file_size;
+static int do_fsync, keep;
+static char *buf;
+static pthread_barrier_t start_barrier;
+
+struct worker {
+	pthread_t thread;
+	int nr_threads;
+	int id;
+	int err;
+	double *lat;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int create_one(const char *path)
+{
+	unsigned long done;
+	ssize_t ret;
+	int fd, err = 0;
+
+	fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+	if (fd < 0)
+		return errno;
+	for (done = 0; done < file_size; done += ret) {
+		ret = write(fd, buf, file_size - done);
+		if (ret <= 0) {
+			err = ret ? errno : ENOSPC;
+			break;
+		}
+	}
+	if (!err && do_fsync && fsync(fd))
+		err = errno;
+	close(fd);
+	return err;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char dir[4096], path[4200];
+	unsigned long i;
+	double start;
+
+	snprintf(dir, sizeof(dir), "%s/fsmark_bench.%d.%d.%d", base_dir,
+		 getpid(), w->nr_threads, w->id);
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		w->err = errno;
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < nr_files && !w->err; i++) {
+		snprintf(path, sizeof(path), "%s/f%08lu", dir, i);
+		start = now_us();
+		w->err = create_one(path);
+		w->lat[i] = now_us() - start;
+	}
+	return NULL;
+}
+
+static void cleanup(int nr_threads)
+{
+	char dir[4096], path[4200];
+	unsigned long i;
+	int t;
+
+	for (t = 0; t < nr_threads; t++) {
+		snprintf(dir, sizeof(dir), "%s/fsmark_bench.%d.%d.%d",
+			 base_dir, getpid(), nr_threads, t);
+		for (i = 0; i < nr_files; i++) {
+			snprintf(path, sizeof(path), "%s/f%08lu", dir, i);
+			unlink(path);
+		}
+		rmdir(dir);
+	}
+}
+
+static int run(int nr_threads, double *lat)
+{
+	struct worker *workers;
+	double start, elapsed, total = 0;
+	unsigned long n = 0, i;
+	int t, err = 0;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		return -ENOMEM;
+
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (t = 0; t < nr_threads; t++) {
+		workers[t].nr_threads = nr_threads;
+		workers[t].id = t;
+		workers[t].lat = lat + t * nr_files;
+		if (pthread_create(&workers[t].thread, NULL, worker_fn,
+				   &workers[t])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = now_us();
+	for (t = 0; t < nr_threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		if (workers[t].err)
+			err = workers[t].err;
+	}
+	elapsed = (now_us() - start) / 1e6;
+	pthread_barrier_destroy(&start_barrier);
+	free(workers);
+
+	if (!keep)
+		cleanup(nr_threads);
+	if (err) {
+		fprintf(stderr, "%d threads: %s\n", nr_threads, strerror(err));
+		return -err;
+	}
+
+	n = nr_threads * nr_files;
+	for (i = 0; i < n; i++)
+		total += lat[i];
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%8d %10lu %12.0f %10.1f %10.1f %10.1f %10.1f\n", nr_threads,
+	       n, n / elapsed, total / n, lat[n / 2], lat[n * 99 / 100],
+	       lat[n - 1]);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long max_threads, cpus;
+	double *lat;
+	int opt, t;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	max_threads = cpus > 0 ? cpus : 1;
+
+	while ((opt = getopt(argc, argv, "d:n:s:t:S:k")) != -1) {
+		switch (opt) {
+		case 'd':
+			base_dir = optarg;
+			break;
+		case 'n':
+			nr_files = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			file_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			do_fsync = atoi(optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-n files] [-s size] [-t threads] [-S 0|1] [-k]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1 || !nr_files) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	buf = calloc(1, file_size ? file_size : 1);
+	lat = calloc(max_threads * nr_files, sizeof(*lat));
+	if (!buf || !lat)
+		return 1;
+
+	printf("%lu files per thread, %lu bytes, %s\n", nr_files, file_size,
+	       do_fsync ? "fsync" : "no sync");
+	printf("%8s %10s %12s %10s %10s %10s %10s\n", "threads", "files",
+	       "files/s", "avg us", "p50 us", "p99 us", "max us");
+	for (t = 1; t < max_threads; t *= 2)
+		if (run(t, lat))
+			return 1;
+	return run(max_threads, lat) ? 1 : 0;
+}
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Overlayfs copy-up benchmark: latency and bytes written to the upper
+ * layer for the things a container does to files of its image.
+ *
+ * Builds a lower layer of -n files of -s KiB each, spread over a few
+ * directories like an image layer, mounts an overlay on top of it below
+ * the base directory and then runs these phases, each on its own quarter
+ * of the files, so that every operation hits a file not copied up yet:
+ *
+ *   chmod      attribute change, metadata only copy-up with metacopy=on
+ *   open-rw    open O_RDWR and close again without writing
+ *   read-rw    open O_RDWR, read 4 KiB, close
+ *   append     open O_WRONLY | O_APPEND, write 4 KiB, close
+ *
+ * Each phase reports the per file latency and the growth of the upper
+ * filesystem's used space.  Run it with -o metacopy=on and -o metacopy=off
+ * and with upper on a filesystem that can reflink (xfs with reflink=1,
+ * btrfs) against one that can't.  Use an empty base directory for every
+ * run.  Needs root.
+ *
+ *   ovl_copyup_bench [-d base dir] [-n files] [-s KiB] [-o mount options]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NR_DIRS		16
+
+static const char *base = ".";
+static unsigned long nr_files = 1000;
+static off_t file_size = 1 << 20;
+static char lower[4096], upper[4096], work[4096], merged[4096];
+
+enum phase { CHMOD, OPEN_RW, READ_RW, APPEND, NR_PHASES };
+
+static const char *phase_name[] = { "chmod", "open-rw", "read-rw", "append" };
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void file_path(char *buf, size_t size, const char *root,
+		      unsigned long i)
+{
+	snprintf(buf, size, "%s/d%lu/f%lu", root, i % NR_DIRS, i);
+}
+
+static long long upper_used(void)
+{
+	struct statvfs st;
+	int fd;
+
+	fd = open(upper, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0) {
+		syncfs(fd);
+		close(fd);
+	}
+	if (statvfs(upper, &st))
+		return -1;
+	return (long long)(st.f_blocks - st.f_bfree) * st.f_frsize;
+}
+
+static int make_lower(void)
+{
+	char path[4200], *buf;
+	unsigned long i;
+	off_t off;
+	int fd;
+
+	buf = malloc(1 << 16);
+	if (!buf)
+		return -ENOMEM;
+	memset(buf, 0x5a, 1 << 16);
+
+	for (i = 0; i < NR_DIRS; i++) {
+		snprintf(path, sizeof(path), "%s/d%lu", lower, i);
+		if (mkdir(path, 0755) && errno != EEXIST)
+			goto err;
+	}
+	for (i = 0; i < nr_files; i++) {
+		file_path(path, sizeof(path), lower, i);
+		fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+		if (fd < 0)
+			goto err;
+		for (off = 0; off < file_size; off += 1 << 16) {
+			size_t len = file_size - off < 1 << 16 ?
+				     file_size - off : 1 << 16;
+
+			if (pwrite(fd, buf, len, off) != (ssize_t)len) {
+				close(fd);
+				goto err;
+			}
+		}
+		close(fd);
+	}
+	free(buf);
+	sync();
+	return 0;
+err:
+	free(buf);
+	return -errno;
+}
+
+static int do_op(enum phase phase, const char *path)
+{
+	char buf[4096];
+	int fd, ret = 0;
+
+	switch (phase) {
+	case CHMOD:
+		return chmod(path, 0600) ? -errno : 0;
+	case OPEN_RW:
+		fd = open(path, O_RDWR);
+		break;
+	case READ_RW:
+		fd = open(path, O_RDWR);
+		if (fd >= 0 && read(fd, buf, sizeof(buf)) < 0)
+			ret = -errno;
+		break;
+	case APPEND:
+		memset(buf, 0xa5, sizeof(buf));
+		fd = open(path, O_WRONLY | O_APPEND);
+		if (fd >= 0 && write(fd, buf, sizeof(buf)) != sizeof(buf))
+			ret = -EIO;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (fd < 0)
+		return -errno;
+	close(fd);
+	return ret;
+}
+
+static int run_phase(enum phase phase, double *lat)
+{
+	unsigned long i, n = nr_files / NR_PHASES;
+	char path[4200];
+	long long before, after;
+	double start, total = 0;
+	int ret;
+
+	before = upper_used();
+	for (i = 0; i < n; i++) {
+		file_path(path, sizeof(path), merged, i * NR_PHASES + phase);
+		start = now_us();
+		ret = do_op(phase, path);
+		lat[i] = now_us() - start;
+		if (ret) {
+			fprintf(stderr, "%s %s: %s\n", phase_name[phase], path,
+				strerror(-ret));
+			return ret;
+		}
+		total += lat[i];
+	}
+	after = upper_used();
+
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%-8s %10.1f %10.1f %10.1f %10.1f %14lld\n", phase_name[phase],
+	       total / n, lat[n / 2], lat[n * 99 / 100], lat[n - 1],
+	       (after - before) >> 10);
+	return 0;
+}
+
+static int make_dir(char *buf, const char *name)
+{
+	snprintf(buf, 4096, "%s/%s", base, name);
+	if (mkdir(buf, 0755) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *extra = NULL;
+	char opts[16384];
+	enum phase phase;
+	double *lat;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "d:n:s:o:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 'n':
+			nr_files = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			file_size = strtoull(optarg, NULL, 0) << 10;
+			break;
+		case 'o':
+			extra = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-n files] [-s KiB] [-o options]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_files < NR_PHASES) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	lat = calloc(nr_files, sizeof(*lat));
+	if (!lat)
+		return 1;
+
+	if (make_dir(lower, "lower") || make_dir(upper, "upper") ||
+	    make_dir(work, "work") || make_dir(merged, "merged")) {
+		perror("mkdir");
+		return 1;
+	}
+	if (make_lower()) {
+		perror("lower layer");
+		return 1;
+	}
+
+	snprintf(opts, sizeof(opts), "lowerdir=%s,upperdir=%s,workdir=%s%s%s",
+		 lower, upper, work, extra ? "," : "", extra ? extra : "");
+	if (mount("overlay", merged, "overlay", 0, opts)) {
+		perror("mount overlay");
+		return 1;
+	}
+
+	printf("%lu files per phase, %lld KiB each, %s\n",
+	       nr_files / NR_PHASES,
+	       (long long)file_size >> 10, extra ? extra : "default options");
+	printf("%-8s %10s %10s %10s %10s %14s\n", "phase", "avg us",
+	       "p50 us", "p99 us", "max us", "upper KiB");
+	for (phase = CHMOD; phase < NR_PHASES; phase++)
+		if (run_phase(phase, lat))
+			goto out;
+	ret = 0;
+out:
+	umount(merged);
+	free(lat);
+	return ret;
+}
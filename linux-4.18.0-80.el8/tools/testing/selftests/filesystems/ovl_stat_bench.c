@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Overlayfs stat storm benchmark: lookup latency in a merge directory
+ * with many lower layers.
+ *
+ * Builds -l lower layers that all have a directory d, puts -n files into
+ * d spread round robin over the layers, so most of them are found deep
+ * down the stack, mounts an overlay of all layers below the base directory
+ * and stats names in merged/d in these phases:
+ *
+ *   cold-hit   every file once, with the dentry cache dropped first
+ *   cold-miss  as many names that don't exist in any layer
+ *   warm-hit   every file -r times from each of -j threads
+ *   warm-miss  the names that don't exist, the same way
+ *
+ * merged/d stays open during the run so that dropping the dentry cache
+ * only drops its children.  Compare with a single lower layer holding all
+ * the files for the cost of the stacking.  Use an empty base directory for
+ * every run.  Needs root.
+ *
+ *   ovl_stat_bench [-d base dir] [-l layers] [-n files] [-r rounds]
+ *		    [-j threads] [-o mount options]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *base = ".";
+static unsigned long nr_layers = 32, nr_files = 10000, nr_rounds = 10;
+static int nr_threads = 1, dirfd = -1;
+static pthread_barrier_t start_barrier;
+
+enum phase { COLD_HIT, COLD_MISS, WARM_HIT, WARM_MISS, NR_PHASES };
+
+static const char *phase_name[] = {
+	"cold-hit", "cold-miss", "warm-hit", "warm-miss"
+};
+
+struct worker {
+	pthread_t thread;
+	enum phase phase;
+	int err;
+	unsigned long nr_lat;
+	double *lat;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int make_dir(const char *fmt, unsigned long n)
+{
+	char path[4096], name[64];
+
+	snprintf(name, sizeof(name), fmt, n);
+	snprintf(path, sizeof(path), "%s/%s", base, name);
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+static int make_layers(void)
+{
+	char path[4096];
+	unsigned long i;
+	int fd;
+
+	for (i = 0; i < nr_layers; i++)
+		if (make_dir("l%lu", i) || make_dir("l%lu/d", i))
+			return -errno;
+	if (make_dir("upper", 0) || make_dir("upper/d", 0) ||
+	    make_dir("work", 0) || make_dir("merged", 0))
+		return -errno;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/l%lu/d/f%lu", base,
+			 i % nr_layers, i);
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0)
+			return -errno;
+		close(fd);
+	}
+	sync();
+	return 0;
+}
+
+static int drop_dentries(void)
+{
+	int fd, ret = 0;
+
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, "2", 1) != 1)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+static int stat_one(enum phase phase, unsigned long i)
+{
+	int miss = phase == COLD_MISS || phase == WARM_MISS;
+	char name[64];
+	struct stat st;
+
+	snprintf(name, sizeof(name), "%s%lu", miss ? "m" : "f", i);
+	if (!fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW))
+		return miss ? -EEXIST : 0;
+	return miss && errno == ENOENT ? 0 : -errno;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long rounds = w->phase < WARM_HIT ? 1 : nr_rounds;
+	unsigned long r, i;
+	double start;
+
+	pthread_barrier_wait(&start_barrier);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < nr_files; i++) {
+			start = now_us();
+			w->err = stat_one(w->phase, i);
+			if (w->err)
+				return NULL;
+			w->lat[w->nr_lat++] = now_us() - start;
+		}
+	}
+	return NULL;
+}
+
+static int run_phase(enum phase phase, struct worker *workers, double *lat)
+{
+	int threads = phase < WARM_HIT ? 1 : nr_threads;
+	unsigned long n = 0, i;
+	double start, elapsed, total = 0;
+	int t, err = 0;
+
+	if (phase < WARM_HIT) {
+		err = drop_dentries();
+		if (err) {
+			fprintf(stderr, "drop_caches: %s\n", strerror(-err));
+			return err;
+		}
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, threads + 1);
+	for (t = 0; t < threads; t++) {
+		workers[t].phase = phase;
+		workers[t].err = 0;
+		workers[t].nr_lat = 0;
+		if (pthread_create(&workers[t].thread, NULL, worker_fn,
+				   &workers[t])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = now_us();
+	for (t = 0; t < threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		if (workers[t].err)
+			err = workers[t].err;
+	}
+	elapsed = (now_us() - start) / 1e6;
+	pthread_barrier_destroy(&start_barrier);
+
+	if (err) {
+		fprintf(stderr, "%s: %s\n", phase_name[phase], strerror(-err));
+		return err;
+	}
+
+	for (t = 0; t < threads; t++) {
+		for (i = 0; i < workers[t].nr_lat; i++) {
+			lat[n++] = workers[t].lat[i];
+			total += workers[t].lat[i];
+		}
+	}
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%-10s %8d %12.0f %10.2f %10.2f %10.2f %10.1f\n",
+	       phase_name[phase], threads, n / elapsed, total / n,
+	       lat[n / 2], lat[n * 99 / 100], lat[n - 1]);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *extra = NULL;
+	struct worker *workers;
+	char merged[4096], *opts;
+	enum phase phase;
+	size_t len, off;
+	unsigned long i;
+	double *lat;
+	int opt, t, ret = 1;
+
+	while ((opt = getopt(argc, argv, "d:l:n:r:j:o:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 'l':
+			nr_layers = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_files = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'o':
+			extra = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-l layers] [-n files] [-r rounds] [-j threads] [-o options]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_layers || !nr_files || !nr_rounds || nr_threads < 1) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	lat = calloc(nr_files * nr_rounds * nr_threads, sizeof(*lat));
+	len = 256 + nr_layers * (strlen(base) + 32) + (extra ? strlen(extra) : 0);
+	opts = malloc(len);
+	if (!workers || !lat || !opts)
+		return 1;
+	for (t = 0; t < nr_threads; t++) {
+		workers[t].lat = calloc(nr_files * nr_rounds,
+					sizeof(*workers[t].lat));
+		if (!workers[t].lat)
+			return 1;
+	}
+
+	ret = make_layers();
+	if (ret) {
+		fprintf(stderr, "layers: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	/* l0 is the top lower layer */
+	off = snprintf(opts, len, "lowerdir=");
+	for (i = 0; i < nr_layers; i++)
+		off += snprintf(opts + off, len - off, "%s%s/l%lu",
+				i ? ":" : "", base, i);
+	snprintf(opts + off, len - off, ",upperdir=%s/upper,workdir=%s/work%s%s",
+		 base, base, extra ? "," : "", extra ? extra : "");
+	snprintf(merged, sizeof(merged), "%s/merged", base);
+	if (mount("overlay", merged, "overlay", 0, opts)) {
+		perror("mount overlay");
+		return 1;
+	}
+
+	ret = 1;
+	snprintf(opts, len, "%s/d", merged);
+	dirfd = open(opts, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0) {
+		perror(opts);
+		goto out;
+	}
+
+	printf("%lu lower layers, %lu files, %s\n", nr_layers, nr_files,
+	       extra ? extra : "default options");
+	printf("%-10s %8s %12s %10s %10s %10s %10s\n", "phase", "threads",
+	       "stats/s", "avg us", "p50 us", "p99 us", "max us");
+	for (phase = COLD_HIT; phase < NR_PHASES; phase++)
+		if (run_phase(phase, workers, lat))
+			goto out;
+	ret = 0;
+out:
+	if (dirfd >= 0)
+		close(dirfd);
+	umount(merged);
+	return ret;
+}
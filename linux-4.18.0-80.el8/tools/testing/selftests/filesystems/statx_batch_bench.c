@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Batched stat benchmark: walks a directory tree such as a kernel source
+ * tree the way a build system or backup tool does, reading each directory
+ * and getting the attributes of all its entries, once with one statx()
+ * per entry and once with one FS_IOC_STATX_BATCH per directory.
+ *
+ * Each method walks the tree -r times; the first walk warms the caches
+ * and is not counted.  -m size asks only for STATX_TYPE | STATX_SIZE |
+ * STATX_MTIME instead of STATX_BASIC_STATS.  Both methods must see the
+ * same entries, inode numbers and sizes.
+ *
+ *   statx_batch_bench [-d dir] [-r rounds] [-m basic|size]
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <linux/stat.h>
+
+#define MAX_DEPTH	64
+
+static unsigned int mask = STATX_BASIC_STATS;
+static int use_batch;
+
+struct totals {
+	unsigned long dirs;
+	unsigned long entries;
+	unsigned long errors;
+	unsigned long long sum;
+};
+
+struct dir_entries {
+	unsigned long nr, size;
+	char **names;
+	struct statx_batch_entry *entries;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int read_names(int dfd, struct dir_entries *de)
+{
+	struct dirent *d;
+	DIR *dir;
+
+	dir = fdopendir(dup(dfd));
+	if (!dir)
+		return -errno;
+	de->nr = 0;
+	while ((d = readdir(dir))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+		if (de->nr == de->size) {
+			de->size = de->size ? de->size * 2 : 64;
+			de->names = realloc(de->names,
+					    de->size * sizeof(*de->names));
+			de->entries = realloc(de->entries,
+					      de->size * sizeof(*de->entries));
+			if (!de->names || !de->entries)
+				return -ENOMEM;
+		}
+		de->names[de->nr++] = strdup(d->d_name);
+	}
+	closedir(dir);
+	return 0;
+}
+
+static int stat_names(int dfd, struct dir_entries *de)
+{
+	struct statx_batch batch = {
+		.flags = AT_SYMLINK_NOFOLLOW,
+		.mask = mask,
+	};
+	unsigned long i;
+
+	for (i = 0; i < de->nr; i++)
+		de->entries[i].name = (unsigned long)de->names[i];
+
+	if (use_batch) {
+		batch.count = de->nr;
+		batch.entries = (unsigned long)de->entries;
+		if (ioctl(dfd, FS_IOC_STATX_BATCH, &batch))
+			return -errno;
+		return batch.count == de->nr ? 0 : -EIO;
+	}
+
+	for (i = 0; i < de->nr; i++) {
+		struct statx_batch_entry *e = &de->entries[i];
+
+		e->error = 0;
+		if (syscall(SYS_statx, dfd, de->names[i], AT_SYMLINK_NOFOLLOW,
+			    mask, &e->stx))
+			e->error = -errno;
+	}
+	return 0;
+}
+
+static int walk(int dfd, int depth, struct totals *t)
+{
+	struct dir_entries de = { 0 };
+	unsigned long i;
+	int ret, fd;
+
+	ret = read_names(dfd, &de);
+	if (!ret)
+		ret = stat_names(dfd, &de);
+	t->dirs++;
+
+	for (i = 0; !ret && i < de.nr; i++) {
+		struct statx_batch_entry *e = &de.entries[i];
+
+		t->entries++;
+		if (e->error) {
+			t->errors++;
+			continue;
+		}
+		t->sum += e->stx.stx_ino + e->stx.stx_size;
+		if ((e->stx.stx_mode & S_IFMT) != S_IFDIR || depth >= MAX_DEPTH)
+			continue;
+		fd = openat(dfd, de.names[i], O_RDONLY | O_DIRECTORY |
+			    O_NOFOLLOW);
+		if (fd < 0) {
+			t->errors++;
+			continue;
+		}
+		ret = walk(fd, depth + 1, t);
+		close(fd);
+	}
+
+	for (i = 0; i < de.nr; i++)
+		free(de.names[i]);
+	free(de.names);
+	free(de.entries);
+	return ret;
+}
+
+static int run(const char *path, int rounds, struct totals *t)
+{
+	double start, best = 0, total = 0;
+	int r, fd, ret;
+
+	for (r = 0; r <= rounds; r++) {
+		fd = open(path, O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			return -errno;
+		memset(t, 0, sizeof(*t));
+		start = now_us();
+		ret = walk(fd, 0, t);
+		start = now_us() - start;
+		close(fd);
+		if (ret)
+			return ret;
+		/* round 0 only warms the caches */
+		if (!r)
+			continue;
+		total += start;
+		if (r == 1 || start < best)
+			best = start;
+	}
+
+	printf("%-6s %8lu %10lu %8lu %10.1f %10.1f %12.0f\n",
+	       use_batch ? "batch" : "statx", t->dirs, t->entries, t->errors,
+	       total / rounds / 1e3, best / 1e3, t->entries / best * 1e6);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct totals single, batch;
+	const char *path = ".";
+	int opt, rounds = 5, ret;
+
+	while ((opt = getopt(argc, argv, "d:r:m:")) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "size"))
+				mask = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+			else if (strcmp(optarg, "basic"))
+				goto usage;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (rounds < 1) {
+		fprintf(stderr, "nothing to do\n");
+		return 1;
+	}
+
+	printf("%-6s %8s %10s %8s %10s %10s %12s\n", "method", "dirs",
+	       "entries", "errors", "avg ms", "best ms", "entries/s");
+	ret = run(path, rounds, &single);
+	if (ret) {
+		fprintf(stderr, "statx: %s\n", strerror(-ret));
+		return 1;
+	}
+	use_batch = 1;
+	ret = run(path, rounds, &batch);
+	if (ret) {
+		fprintf(stderr, "FS_IOC_STATX_BATCH: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	if (single.entries != batch.entries || single.sum != batch.sum) {
+		fprintf(stderr, "results differ: %lu/%llx vs %lu/%llx entries/sum\n",
+			single.entries, single.sum, batch.entries, batch.sum);
+		return 1;
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-d dir] [-r rounds] [-m basic|size]\n",
+		argv[0]);
+	return 1;
+}
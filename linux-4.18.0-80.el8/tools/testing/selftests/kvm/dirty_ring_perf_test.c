@@ -0,0 +1,417 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * dirty_ring_perf_test
+ *
+ * Copyright (C) 2018, Red Hat, Inc.
+ *
+ * Guest slowdown and dirty page harvesting rate while the pages a vCPU
+ * writes are logged, as during the iterative phase of live migration.
+ *
+ * The guest writes one word to each page of a test memory slot, over
+ * and over. It runs once with dirty logging off, for a baseline, then
+ * again with KVM_MEM_LOG_DIRTY_PAGES set on the slot while a collector
+ * thread harvests the dirty pages every interval_ms, either from the
+ * dirty ring of the vCPU (the default) or with KVM_GET_DIRTY_LOG. In
+ * ring mode the vCPU thread also harvests when its ring fills up.
+ *
+ *	dirty_ring_perf_test [-m ring|bitmap] [-p pages] [-n passes]
+ *			     [-i interval_ms] [-s ring_entries]
+ */
+#define _GNU_SOURCE /* for program_invocation_name */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_util.h"
+
+#include "kvm_util.h"
+#include "x86.h"
+
+#define VCPU_ID				0
+
+/* Clear of the memory the test program is loaded to */
+#define TEST_MEM_OFFSET			0xc0000000
+#define TEST_MEM_SLOT_INDEX		1
+#define TEST_PAGE_SIZE			4096
+
+#define DEFAULT_TEST_PAGES		65536
+#define DEFAULT_PASSES			20
+#define DEFAULT_INTERVAL_MS		10
+#define DEFAULT_RING_ENTRIES		4096
+
+/* Read by the guest, at the same address in the guest and the host */
+static uint64_t guest_pages = DEFAULT_TEST_PAGES;
+static uint64_t guest_passes = DEFAULT_PASSES;
+
+static void guest_code(void)
+{
+	uint64_t pass, i;
+
+	for (pass = 1; pass <= guest_passes; pass++)
+		for (i = 0; i < guest_pages; i++)
+			*(volatile uint64_t *)(TEST_MEM_OFFSET +
+					       i * TEST_PAGE_SIZE) = pass;
+
+	GUEST_DONE();
+}
+
+enum harvest_mode {
+	HARVEST_NONE,
+	HARVEST_RING,
+	HARVEST_BITMAP,
+};
+
+static struct kvm_vm *vm;
+static enum harvest_mode mode;
+static uint32_t ring_entries = DEFAULT_RING_ENTRIES;
+static uint64_t interval_ms = DEFAULT_INTERVAL_MS;
+static volatile bool vcpu_done;
+
+/* Harvesting state, under harvest_lock */
+static pthread_mutex_t harvest_lock = PTHREAD_MUTEX_INITIALIZER;
+static int vm_fd;
+static struct kvm_dirty_gfn *ring;
+static uint32_t fetch_index;
+static unsigned long *bitmap;
+static uint64_t harvested, harvest_calls, ring_full_exits;
+static struct timespec harvest_time;
+
+static void timespec_add_elapsed(struct timespec *sum,
+				 const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sum->tv_sec += now.tv_sec - start->tv_sec;
+	sum->tv_nsec += now.tv_nsec - start->tv_nsec;
+	while (sum->tv_nsec < 0) {
+		sum->tv_sec--;
+		sum->tv_nsec += 1000000000L;
+	}
+	while (sum->tv_nsec >= 1000000000L) {
+		sum->tv_sec++;
+		sum->tv_nsec -= 1000000000L;
+	}
+}
+
+static double timespec_to_s(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+/* Collect every DIRTY entry of the ring, then have KVM reset them */
+static uint64_t harvest_ring(void)
+{
+	struct kvm_dirty_gfn *entry;
+	uint64_t count = 0;
+	int ret;
+
+	for (;;) {
+		entry = &ring[fetch_index & (ring_entries - 1)];
+		if (!(__atomic_load_n(&entry->flags, __ATOMIC_ACQUIRE) &
+		      KVM_DIRTY_GFN_F_DIRTY))
+			break;
+
+		TEST_ASSERT(entry->slot == TEST_MEM_SLOT_INDEX &&
+			    entry->offset < guest_pages,
+			    "Bad dirty ring entry %u: slot %u offset 0x%llx",
+			    fetch_index, entry->slot,
+			    (unsigned long long)entry->offset);
+
+		__atomic_store_n(&entry->flags,
+				 KVM_DIRTY_GFN_F_DIRTY | KVM_DIRTY_GFN_F_RESET,
+				 __ATOMIC_RELEASE);
+		fetch_index++;
+		count++;
+	}
+
+	if (count) {
+		ret = ioctl(vm_fd, KVM_RESET_DIRTY_RINGS);
+		TEST_ASSERT(ret >= 0, "KVM_RESET_DIRTY_RINGS failed, "
+			    "ret: %i errno: %i", ret, errno);
+	}
+
+	return count;
+}
+
+static uint64_t harvest_bitmap(void)
+{
+	uint64_t count = 0, i;
+
+	kvm_vm_get_dirty_log(vm, TEST_MEM_SLOT_INDEX, bitmap);
+	for (i = 0; i < guest_pages / (8 * sizeof(*bitmap)); i++)
+		count += __builtin_popcountl(bitmap[i]);
+
+	return count;
+}
+
+static void harvest(void)
+{
+	struct timespec start;
+
+	pthread_mutex_lock(&harvest_lock);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (mode == HARVEST_RING)
+		harvested += harvest_ring();
+	else
+		harvested += harvest_bitmap();
+	harvest_calls++;
+	timespec_add_elapsed(&harvest_time, &start);
+	pthread_mutex_unlock(&harvest_lock);
+}
+
+static void *collector_thread(void *arg)
+{
+	struct timespec ts = {
+		.tv_sec = interval_ms / 1000,
+		.tv_nsec = (interval_ms % 1000) * 1000000,
+	};
+
+	while (!vcpu_done) {
+		nanosleep(&ts, NULL);
+		harvest();
+	}
+
+	return NULL;
+}
+
+/* Run the guest to completion, returns how long it took */
+static struct timespec run_vcpu(void)
+{
+	struct kvm_run *run = vcpu_state(vm, VCPU_ID);
+	struct timespec start, elapsed = { 0 };
+	struct kvm_regs regs;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		vcpu_run(vm, VCPU_ID);
+
+		if (run->exit_reason == KVM_EXIT_DIRTY_RING_FULL) {
+			TEST_ASSERT(mode == HARVEST_RING,
+				    "Dirty ring full exit without a ring");
+			ring_full_exits++;
+			harvest();
+			continue;
+		}
+
+		TEST_ASSERT(run->exit_reason == KVM_EXIT_IO,
+			    "Unexpected exit reason: %u (%s)",
+			    run->exit_reason,
+			    exit_reason_str(run->exit_reason));
+
+		vcpu_regs_get(vm, VCPU_ID, &regs);
+		switch (run->io.port) {
+		case GUEST_PORT_ABORT:
+			TEST_ASSERT(false, "%s at %s:%llu",
+				    (const char *)regs.rdi, __FILE__,
+				    regs.rsi);
+			/* NOT REACHED */
+		case GUEST_PORT_DONE:
+			timespec_add_elapsed(&elapsed, &start);
+			return elapsed;
+		default:
+			TEST_ASSERT(false, "Unknown port 0x%x.", run->io.port);
+		}
+	}
+}
+
+/*
+ * The VM and vCPU fds are private to the library; ours are the only
+ * ones open in this process.
+ */
+static int find_fd(const char *prefix)
+{
+	char path[PATH_MAX], target[64];
+	struct dirent *de;
+	int fd = -1;
+	ssize_t len;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	TEST_ASSERT(dir, "Cannot open /proc/self/fd");
+	while ((de = readdir(dir))) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", de->d_name);
+		len = readlink(path, target, sizeof(target) - 1);
+		if (len < 0)
+			continue;
+		target[len] = 0;
+		if (!strncmp(target, prefix, strlen(prefix))) {
+			fd = atoi(de->d_name);
+			break;
+		}
+	}
+	closedir(dir);
+
+	TEST_ASSERT(fd >= 0, "No %s fd", prefix);
+	return fd;
+}
+
+static void create_vm(void)
+{
+	struct kvm_enable_cap cap = {
+		.cap = KVM_CAP_DIRTY_LOG_RING,
+		.args[0] = ring_entries * sizeof(struct kvm_dirty_gfn),
+	};
+	/* Page tables for the identity map of the test slot */
+	uint64_t pt_pages = guest_pages / 512 + 16;
+
+	vm = vm_create(VM_MODE_FLAT48PG, DEFAULT_GUEST_PHY_PAGES + pt_pages,
+		       O_RDWR);
+	/* The rings are allocated with the vCPUs */
+	if (mode == HARVEST_RING)
+		vm_ioctl(vm, KVM_ENABLE_CAP, &cap);
+
+	kvm_vm_elf_load(vm, program_invocation_name, 0, 0);
+	vm_create_irqchip(vm);
+	vm_vcpu_add_default(vm, VCPU_ID, guest_code);
+	vcpu_set_cpuid(vm, VCPU_ID, kvm_get_supported_cpuid());
+
+	vm_userspace_mem_region_add(vm, VM_MEM_SRC_ANONYMOUS, TEST_MEM_OFFSET,
+				    TEST_MEM_SLOT_INDEX, guest_pages,
+				    mode == HARVEST_NONE ?
+				    0 : KVM_MEM_LOG_DIRTY_PAGES);
+	virt_map(vm, TEST_MEM_OFFSET, TEST_MEM_OFFSET,
+		 guest_pages * TEST_PAGE_SIZE, 0);
+
+	*(uint64_t *)addr_gva2hva(vm, (vm_vaddr_t)&guest_pages) = guest_pages;
+	*(uint64_t *)addr_gva2hva(vm, (vm_vaddr_t)&guest_passes) =
+		guest_passes;
+
+	if (mode == HARVEST_RING) {
+		vm_fd = find_fd("anon_inode:kvm-vm");
+		ring = mmap(NULL, ring_entries * sizeof(struct kvm_dirty_gfn),
+			    PROT_READ | PROT_WRITE, MAP_SHARED,
+			    find_fd("anon_inode:kvm-vcpu:"),
+			    KVM_DIRTY_LOG_PAGE_OFFSET * getpagesize());
+		TEST_ASSERT(ring != MAP_FAILED, "Cannot mmap dirty ring, "
+			    "errno: %i", errno);
+		fetch_index = 0;
+	}
+}
+
+static void destroy_vm(void)
+{
+	if (ring) {
+		munmap(ring, ring_entries * sizeof(struct kvm_dirty_gfn));
+		ring = NULL;
+	}
+	kvm_vm_free(vm);
+	vm = NULL;
+}
+
+static void help(char *name)
+{
+	puts("");
+	printf("usage: %s [-m ring|bitmap] [-p pages] [-n passes] "
+	       "[-i interval_ms] [-s ring_entries]\n", name);
+	puts("");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	enum harvest_mode log_mode = HARVEST_RING;
+	struct timespec base, logged;
+	pthread_t collector;
+	uint64_t writes;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hm:p:n:i:s:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "ring"))
+				log_mode = HARVEST_RING;
+			else if (!strcmp(optarg, "bitmap"))
+				log_mode = HARVEST_BITMAP;
+			else
+				help(argv[0]);
+			break;
+		case 'p':
+			guest_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			guest_passes = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval_ms = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			ring_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			break;
+		}
+	}
+	TEST_ASSERT(guest_pages && !(guest_pages % 64),
+		    "Pages must be a non-zero multiple of 64");
+	TEST_ASSERT(guest_passes > 0, "Passes must be greater than zero");
+	TEST_ASSERT(ring_entries && !(ring_entries & (ring_entries - 1)),
+		    "Ring entries must be a power of 2");
+
+	if (log_mode == HARVEST_RING &&
+	    kvm_check_cap(KVM_CAP_DIRTY_LOG_RING) <
+	    ring_entries * sizeof(struct kvm_dirty_gfn)) {
+		fprintf(stderr, "KVM_CAP_DIRTY_LOG_RING not supported, "
+			"skipping test\n");
+		exit(KSFT_SKIP);
+	}
+
+	writes = guest_pages * guest_passes;
+
+	/* Baseline, nothing logged */
+	mode = HARVEST_NONE;
+	create_vm();
+	base = run_vcpu();
+	destroy_vm();
+
+	/* Dirty logging on, harvested as during migration */
+	mode = log_mode;
+	if (mode == HARVEST_BITMAP) {
+		bitmap = calloc(guest_pages / 8, 1);
+		TEST_ASSERT(bitmap, "Cannot allocate dirty bitmap");
+	}
+	create_vm();
+	vcpu_done = false;
+	pthread_create(&collector, NULL, collector_thread, NULL);
+	logged = run_vcpu();
+	vcpu_done = true;
+	pthread_join(collector, NULL);
+	/* Whatever the guest dirtied since the last round */
+	harvest();
+	destroy_vm();
+
+	printf("%llu pages x %llu passes, 4K writes:\n",
+	       (unsigned long long)guest_pages,
+	       (unsigned long long)guest_passes);
+	printf("  no dirty logging: %.3f s, %.0f writes/s\n",
+	       timespec_to_s(&base), writes / timespec_to_s(&base));
+	printf("  %s logging: %.3f s, %.0f writes/s, guest slowdown %.1f%%\n",
+	       mode == HARVEST_RING ? "dirty ring" : "dirty bitmap",
+	       timespec_to_s(&logged), writes / timespec_to_s(&logged),
+	       (timespec_to_s(&logged) / timespec_to_s(&base) - 1) * 100);
+	printf("  harvested %llu pages in %llu rounds, %.0f pages/s, "
+	       "%.3f s harvesting",
+	       (unsigned long long)harvested,
+	       (unsigned long long)harvest_calls,
+	       harvested / timespec_to_s(&logged),
+	       timespec_to_s(&harvest_time));
+	if (mode == HARVEST_RING)
+		printf(", %llu ring full exits",
+		       (unsigned long long)ring_full_exits);
+	printf("\n");
+
+	free(bitmap);
+	return 0;
+}
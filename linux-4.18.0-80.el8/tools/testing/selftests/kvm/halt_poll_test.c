@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * halt_poll_test
+ *
+ * Copyright (C) 2018, Red Hat, Inc.
+ *
+ * IPI round trip latency between two halted vCPUs, and the time KVM
+ * spent polling for them in vain.
+ *
+ * vCPU 0 sends an IPI to vCPU 1 and halts until vCPU 1, woken by it,
+ * sends one back; it then waits for gap_us with interrupts disabled
+ * before the next round. Round trips are timed in the guest with the
+ * TSC. The poll window KVM picked for each vCPU, and the time it polled
+ * successfully and in vain, are taken from the vCPU directories in
+ * debugfs, next to the CPU time of the vCPU threads.
+ *
+ *	halt_poll_test [-i iterations] [-g gap_us] [-m max_ns] [-n min_ns]
+ *
+ * -m and -n set the halt polling bounds of the VM with KVM_CAP_HALT_POLL,
+ * otherwise the halt_poll_ns module parameter applies.
+ */
+#define _GNU_SOURCE /* for RUSAGE_THREAD */
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test_util.h"
+
+#include "kvm_util.h"
+#include "x86.h"
+
+#define SENDER_ID		0
+#define RECEIVER_ID		1
+#define IPI_VECTOR		0x40
+
+#define APICBASE_X2APIC		((1ULL << 10) | (1ULL << 11))
+#define MSR_X2APIC_EOI		0x80b
+#define MSR_X2APIC_SVR		0x80f
+#define MSR_X2APIC_ICR		0x830
+#define APIC_SVR_ENABLE		0x100
+
+#define DEBUGFS_KVM		"/sys/kernel/debug/kvm"
+
+/* Shared by the two vCPUs, at the same address in the guest and the host */
+static volatile uint64_t ping_seq, pong_seq;
+static volatile bool receiver_ready, done;
+static uint64_t iterations = 100000;
+static uint64_t gap_cycles;
+static uint64_t rtt_cycles;
+
+static struct table_ptr {
+	uint16_t size;
+	uint64_t address;
+} __attribute__((packed)) gdt_ptr, idt_ptr;
+
+static uint64_t gdt[3] = {
+	0,
+	0x00af9b000000ffffULL,	/* 0x08: 64-bit code */
+	0x00cf93000000ffffULL,	/* 0x10: data */
+};
+
+struct idt_gate {
+	uint16_t offset0;
+	uint16_t selector;
+	uint16_t flags;
+	uint16_t offset1;
+	uint32_t offset2;
+	uint32_t reserved;
+};
+
+static struct idt_gate idt[256];
+
+extern char ipi_handler[];
+asm(".pushsection .text\n"
+    "ipi_handler:\n\t"
+    "push %rax\n\t"
+    "push %rcx\n\t"
+    "push %rdx\n\t"
+    "mov $0x80b, %ecx\n\t"		/* MSR_X2APIC_EOI */
+    "xor %eax, %eax\n\t"
+    "xor %edx, %edx\n\t"
+    "wrmsr\n\t"
+    "pop %rdx\n\t"
+    "pop %rcx\n\t"
+    "pop %rax\n\t"
+    "iretq\n\t"
+    ".popsection");
+
+/*
+ * Halt with interrupts enabled until one arrives. The handler runs on
+ * this stack, so step over the red zone of the caller first.
+ */
+static inline void safe_halt(void)
+{
+	asm volatile("sub $128, %%rsp\n\t"
+		     "sti\n\t"
+		     "hlt\n\t"
+		     "cli\n\t"
+		     "add $128, %%rsp" : : : "memory");
+}
+
+/* GDT and IDT of our own, so that interrupts can be delivered */
+static void guest_setup(void)
+{
+	uint64_t handler = (uint64_t)ipi_handler;
+	struct idt_gate *gate = &idt[IPI_VECTOR];
+
+	gdt_ptr.size = sizeof(gdt) - 1;
+	gdt_ptr.address = (uint64_t)gdt;
+	asm volatile("lgdt %0\n\t"
+		     "pushq $0x8\n\t"
+		     "lea 1f(%%rip), %%rax\n\t"
+		     "pushq %%rax\n\t"
+		     "lretq\n"
+		     "1:\n\t"
+		     "mov $0x10, %%ax\n\t"
+		     "mov %%ax, %%ds\n\t"
+		     "mov %%ax, %%es\n\t"
+		     "mov %%ax, %%ss"
+		     : : "m"(gdt_ptr) : "rax", "memory");
+
+	gate->offset0 = handler;
+	gate->selector = 0x8;
+	gate->flags = 0x8e00;		/* present, interrupt gate */
+	gate->offset1 = handler >> 16;
+	gate->offset2 = handler >> 32;
+	idt_ptr.size = sizeof(idt) - 1;
+	idt_ptr.address = (uint64_t)idt;
+	asm volatile("lidt %0" : : "m"(idt_ptr) : "memory");
+
+	wrmsr(MSR_IA32_APICBASE, rdmsr(MSR_IA32_APICBASE) | APICBASE_X2APIC);
+	wrmsr(MSR_X2APIC_SVR, APIC_SVR_ENABLE | 0xff);
+}
+
+static void send_ipi(uint32_t apic_id)
+{
+	wrmsr(MSR_X2APIC_ICR, ((uint64_t)apic_id << 32) | IPI_VECTOR);
+}
+
+static void sender_code(void)
+{
+	uint64_t i, t;
+
+	guest_setup();
+	while (!receiver_ready)
+		asm volatile("pause");
+
+	for (i = 1; i <= iterations; i++) {
+		t = rdtsc();
+		while (rdtsc() - t < gap_cycles)
+			asm volatile("pause");
+
+		t = rdtsc();
+		ping_seq = i;
+		send_ipi(RECEIVER_ID);
+		while (pong_seq != i)
+			safe_halt();
+		rtt_cycles += rdtsc() - t;
+	}
+
+	done = true;
+	send_ipi(RECEIVER_ID);
+	GUEST_DONE();
+}
+
+static void receiver_code(void)
+{
+	uint64_t seq = 0;
+
+	guest_setup();
+	receiver_ready = true;
+
+	for (;;) {
+		while (ping_seq == seq && !done)
+			safe_halt();
+		if (done)
+			break;
+		seq = ping_seq;
+		pong_seq = seq;
+		send_ipi(SENDER_ID);
+	}
+
+	GUEST_DONE();
+}
+
+struct vcpu_thread {
+	struct kvm_vm *vm;
+	uint32_t id;
+	pthread_t thread;
+	struct timeval cpu_time;
+};
+
+static void *vcpu_thread(void *arg)
+{
+	struct vcpu_thread *vt = arg;
+	struct kvm_run *run = vcpu_state(vt->vm, vt->id);
+	struct kvm_regs regs;
+	struct rusage ru;
+
+	for (;;) {
+		vcpu_run(vt->vm, vt->id);
+		TEST_ASSERT(run->exit_reason == KVM_EXIT_IO,
+			    "vCPU %u: unexpected exit reason: %u (%s)",
+			    vt->id, run->exit_reason,
+			    exit_reason_str(run->exit_reason));
+
+		vcpu_regs_get(vt->vm, vt->id, &regs);
+		switch (run->io.port) {
+		case GUEST_PORT_ABORT:
+			TEST_ASSERT(false, "%s at %s:%llu",
+				    (const char *)regs.rdi, __FILE__,
+				    regs.rsi);
+			/* NOT REACHED */
+		case GUEST_PORT_DONE:
+			getrusage(RUSAGE_THREAD, &ru);
+			timeradd(&ru.ru_utime, &ru.ru_stime, &vt->cpu_time);
+			return NULL;
+		default:
+			TEST_ASSERT(false, "Unknown port 0x%x.", run->io.port);
+		}
+	}
+}
+
+struct halt_poll_stat {
+	uint64_t poll_ns;
+	uint64_t success_ns;
+	uint64_t fail_ns;
+	uint64_t wait_ns;
+};
+
+/* Our VM is the one directory of this process in debugfs */
+static bool read_halt_poll_stat(uint32_t vcpu_id, struct halt_poll_stat *st)
+{
+	char prefix[32], path[PATH_MAX], name[32];
+	unsigned long long val;
+	struct dirent *de;
+	bool found = false;
+	DIR *dir;
+	FILE *f;
+
+	dir = opendir(DEBUGFS_KVM);
+	if (!dir)
+		return false;
+
+	snprintf(prefix, sizeof(prefix), "%d-", getpid());
+	while ((de = readdir(dir))) {
+		if (!strncmp(de->d_name, prefix, strlen(prefix))) {
+			found = true;
+			break;
+		}
+	}
+	if (found)
+		snprintf(path, sizeof(path), DEBUGFS_KVM "/%s/vcpu%u/",
+			 de->d_name, vcpu_id);
+	closedir(dir);
+	if (!found)
+		return false;
+
+	memset(st, 0, sizeof(*st));
+
+	strncat(path, "halt-poll-ns", sizeof(path) - strlen(path) - 1);
+	f = fopen(path, "r");
+	if (!f)
+		return false;
+	if (fscanf(f, "%llu", &val) == 1)
+		st->poll_ns = val;
+	fclose(f);
+
+	strcpy(strrchr(path, '/') + 1, "halt-poll");
+	f = fopen(path, "r");
+	if (!f)
+		return false;
+	while (fscanf(f, "%31s %llu", name, &val) == 2) {
+		if (!strcmp(name, "success_ns"))
+			st->success_ns = val;
+		else if (!strcmp(name, "fail_ns"))
+			st->fail_ns = val;
+		else if (!strcmp(name, "wait_ns"))
+			st->wait_ns = val;
+		else
+			break;
+	}
+	fclose(f);
+	return true;
+}
+
+/* TSC ticks per microsecond, the guest TSC runs at the host rate */
+static uint64_t tsc_per_us(void)
+{
+	struct timespec ts = { .tv_nsec = 20 * 1000 * 1000 };
+	uint64_t t = rdtsc();
+
+	nanosleep(&ts, NULL);
+	return (rdtsc() - t) / 20000;
+}
+
+static void report(struct vcpu_thread *vt, uint64_t rate)
+{
+	uint64_t rtt = *(uint64_t *)addr_gva2hva(vt[0].vm,
+						 (vm_vaddr_t)&rtt_cycles);
+	struct halt_poll_stat st;
+	int i;
+
+	printf("%llu round trips, average %.2f us\n",
+	       (unsigned long long)iterations,
+	       (double)rtt / rate / iterations);
+
+	for (i = 0; i < 2; i++) {
+		printf("vcpu%u: cpu time %ld.%06ld s", vt[i].id,
+		       (long)vt[i].cpu_time.tv_sec,
+		       (long)vt[i].cpu_time.tv_usec);
+		if (read_halt_poll_stat(vt[i].id, &st))
+			printf(", poll window %llu ns, polled %llu us "
+			       "(%llu us in vain), slept %llu us",
+			       (unsigned long long)st.poll_ns,
+			       (unsigned long long)(st.success_ns +
+						    st.fail_ns) / 1000,
+			       (unsigned long long)st.fail_ns / 1000,
+			       (unsigned long long)st.wait_ns / 1000);
+		printf("\n");
+	}
+}
+
+static void help(char *name)
+{
+	puts("");
+	printf("usage: %s [-i iterations] [-g gap_us] [-m max_ns] "
+	       "[-n min_ns]\n", name);
+	puts("");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct kvm_enable_cap cap = { .cap = KVM_CAP_HALT_POLL };
+	struct vcpu_thread vt[2];
+	bool set_bounds = false;
+	struct kvm_vm *vm;
+	uint64_t gap_us = 0, rate;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "hi:g:m:n:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = strtoull(optarg, NULL, 0);
+			break;
+		case 'g':
+			gap_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			cap.args[0] = strtoull(optarg, NULL, 0);
+			set_bounds = true;
+			break;
+		case 'n':
+			cap.args[1] = strtoull(optarg, NULL, 0);
+			set_bounds = true;
+			break;
+		case 'h':
+		default:
+			help(argv[0]);
+			break;
+		}
+	}
+	TEST_ASSERT(iterations > 0, "Iterations must be greater than zero");
+
+	if (set_bounds && !kvm_check_cap(KVM_CAP_HALT_POLL)) {
+		fprintf(stderr, "KVM_CAP_HALT_POLL not supported, skipping test\n");
+		exit(KSFT_SKIP);
+	}
+
+	/* Create VM */
+	vm = vm_create_default(SENDER_ID, 0, sender_code);
+	vcpu_set_cpuid(vm, SENDER_ID, kvm_get_supported_cpuid());
+	vm_vcpu_add_default(vm, RECEIVER_ID, receiver_code);
+	vcpu_set_cpuid(vm, RECEIVER_ID, kvm_get_supported_cpuid());
+
+	if (set_bounds) {
+		if (!cap.args[0])
+			cap.args[0] = cap.args[1];
+		vm_ioctl(vm, KVM_ENABLE_CAP, &cap);
+	}
+
+	rate = tsc_per_us();
+	*(uint64_t *)addr_gva2hva(vm, (vm_vaddr_t)&iterations) = iterations;
+	*(uint64_t *)addr_gva2hva(vm, (vm_vaddr_t)&gap_cycles) = gap_us * rate;
+
+	for (i = 0; i < 2; i++) {
+		vt[i].vm = vm;
+		vt[i].id = i ? RECEIVER_ID : SENDER_ID;
+		pthread_create(&vt[i].thread, NULL, vcpu_thread, &vt[i]);
+	}
+
+	for (i = 0; i < 2; i++)
+		pthread_join(vt[i].thread, NULL);
+
+	report(vt, rate);
+
+	kvm_vm_free(vm);
+	return 0;
+}
@@ -0,0 +1,501 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Packet rate of vhost-net over a multiqueue tap device.
+ *
+ * Plays the guest: each queue pair gets its own vhost-net device, with
+ * rings and buffers in memory of this process, and a thread keeping its
+ * tx (or rx) ring full. On tx, frames go out of the vhost worker into the
+ * tap device and are dropped by the stack. On rx, an AF_PACKET socket
+ * sends frames out of the tap device, which vhost copies into the rings.
+ *
+ * Each vq can get a worker of its own (-w), and workers can be pinned to
+ * CPUs (-c): the default worker of queue pair q runs on CPU c + 2q, the
+ * tx worker next to it.
+ *
+ * With the default unlimited sndbuf of tap, vhost hands copied tx frames
+ * to tun in batches; a limited one (-S) sends them one by one.
+ *
+ * The rings use the split layout, or the packed one with -p. Every frame
+ * takes a single descriptor, so the packet rate is the descriptor rate.
+ *
+ *	vhost_net_bench [-r] [-p] [-q queues] [-w] [-c cpu] [-b busyloop_us]
+ *			[-s size] [-S sndbuf] [-t seconds] [-i ifname]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include <linux/vhost.h>
+#include <linux/virtio_net.h>
+#include <linux/virtio_ring.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#define RING_NUM	256
+#define BUF_SIZE	2048
+#define MAX_QUEUES	64
+#define BENCH_ETH_P	0x88b5	/* local experimental ethertype */
+
+enum { VQ_RX = 0, VQ_TX = 1 };
+
+struct queue {
+	int index;
+	int vhost_fd;
+	int tap_fd;
+	int kick_fd;
+	void *mem;
+	size_t mem_size;
+	struct vring vring;
+	char *bufs;
+	unsigned long long packets;
+	pthread_t thread;
+};
+
+static struct queue queues[MAX_QUEUES];
+static int nqueues = 1;
+static bool rx_mode;
+static bool packed;
+static bool worker_per_vq;
+static int base_cpu = -1;
+static int busyloop_us;
+static int pkt_size = 64;
+static int sndbuf;
+static int duration = 5;
+static char ifname[IFNAMSIZ] = "vhbench0";
+static volatile bool stop;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void vhost_ioctl(struct queue *q, unsigned long req, void *arg,
+			const char *what)
+{
+	if (ioctl(q->vhost_fd, req, arg) < 0)
+		die(what);
+}
+
+static int tap_open(void)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR);
+	if (fd < 0)
+		die("open /dev/net/tun");
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR | IFF_MULTI_QUEUE;
+	memcpy(ifr.ifr_name, ifname, IFNAMSIZ);
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+		die("TUNSETIFF");
+	if (sndbuf && ioctl(fd, TUNSETSNDBUF, &sndbuf) < 0)
+		die("TUNSETSNDBUF");
+	return fd;
+}
+
+static void tap_up(void)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, ifname, IFNAMSIZ);
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0)
+		die("SIOCGIFFLAGS");
+	ifr.ifr_flags |= IFF_UP;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0)
+		die("SIOCSIFFLAGS");
+	close(fd);
+}
+
+static void fill_frame(char *p)
+{
+	struct ethhdr *eth = (struct ethhdr *)p;
+
+	memset(p, 0, pkt_size);
+	memset(eth->h_dest, 0xff, ETH_ALEN);
+	eth->h_source[0] = 0x02;
+	eth->h_source[5] = 0x01;
+	eth->h_proto = htons(BENCH_ETH_P);
+}
+
+/* Pin a worker, or leave it alone without -c. */
+static void set_worker_cpu(struct queue *q, unsigned int id, int cpu)
+{
+	struct vhost_worker_cpu wc = { .worker_id = id, .cpu = cpu };
+
+	if (base_cpu < 0)
+		return;
+	vhost_ioctl(q, VHOST_SET_WORKER_CPU, &wc, "VHOST_SET_WORKER_CPU");
+}
+
+static void setup_workers(struct queue *q)
+{
+	int cpu = base_cpu < 0 ? -1 : base_cpu + 2 * q->index;
+	struct vhost_vring_worker w = { .index = VQ_TX };
+	struct vhost_worker_state state;
+
+	/* The default worker, serving rx and without -w tx as well */
+	vhost_ioctl(q, VHOST_GET_VRING_WORKER, &w, "VHOST_GET_VRING_WORKER");
+	set_worker_cpu(q, w.worker_id, cpu);
+
+	if (!worker_per_vq)
+		return;
+	vhost_ioctl(q, VHOST_NEW_WORKER, &state, "VHOST_NEW_WORKER");
+	set_worker_cpu(q, state.worker_id, cpu + 1);
+	w.worker_id = state.worker_id;
+	vhost_ioctl(q, VHOST_ATTACH_VRING_WORKER, &w,
+		    "VHOST_ATTACH_VRING_WORKER");
+}
+
+static void setup_vring(struct queue *q, int index, struct vring *vr)
+{
+	struct vhost_vring_state state = { .index = index };
+	struct vhost_vring_file file = { .index = index };
+	struct vhost_vring_addr addr = {
+		.index = index,
+		.desc_user_addr = (uint64_t)(unsigned long)vr->desc,
+		.avail_user_addr = (uint64_t)(unsigned long)vr->avail,
+		.used_user_addr = (uint64_t)(unsigned long)vr->used,
+	};
+
+	state.num = RING_NUM;
+	vhost_ioctl(q, VHOST_SET_VRING_NUM, &state, "VHOST_SET_VRING_NUM");
+	/* The wrap counters of a packed ring start at 1 */
+	state.num = packed ? 1 << 15 : 0;
+	vhost_ioctl(q, VHOST_SET_VRING_BASE, &state, "VHOST_SET_VRING_BASE");
+	vhost_ioctl(q, VHOST_SET_VRING_ADDR, &addr, "VHOST_SET_VRING_ADDR");
+	if (busyloop_us) {
+		state.num = busyloop_us;
+		vhost_ioctl(q, VHOST_SET_VRING_BUSYLOOP_TIMEOUT, &state,
+			    "VHOST_SET_VRING_BUSYLOOP_TIMEOUT");
+	}
+
+	/* The rings are polled, so no call eventfd: only the one in use is
+	 * kicked, the other one never has buffers. */
+	file.fd = index == (rx_mode ? VQ_RX : VQ_TX) ? q->kick_fd : -1;
+	if (file.fd >= 0)
+		vhost_ioctl(q, VHOST_SET_VRING_KICK, &file,
+			    "VHOST_SET_VRING_KICK");
+}
+
+static void setup_queue(struct queue *q, int index)
+{
+	struct {
+		struct vhost_memory mem;
+		struct vhost_memory_region region;
+	} table;
+	size_t ring_size = vring_size(RING_NUM, 4096);
+	struct vring idle;
+	struct vhost_vring_file backend;
+	uint64_t features = packed ? 1ULL << VIRTIO_F_RING_PACKED : 0;
+	int i;
+
+	q->index = index;
+	/* A packed ring uses the desc table of the split one, with the
+	 * driver and device event structures in place of avail and used. */
+	q->mem_size = 2 * ring_size + RING_NUM * BUF_SIZE;
+	q->mem = mmap(NULL, q->mem_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (q->mem == MAP_FAILED)
+		die("mmap");
+	vring_init(&q->vring, RING_NUM, q->mem, 4096);
+	vring_init(&idle, RING_NUM, (char *)q->mem + ring_size, 4096);
+	q->bufs = (char *)q->mem + 2 * ring_size;
+
+	q->kick_fd = eventfd(0, 0);
+	if (q->kick_fd < 0)
+		die("eventfd");
+	q->tap_fd = tap_open();
+	q->vhost_fd = open("/dev/vhost-net", O_RDWR);
+	if (q->vhost_fd < 0)
+		die("open /dev/vhost-net");
+
+	vhost_ioctl(q, VHOST_SET_OWNER, NULL, "VHOST_SET_OWNER");
+	/* Legacy header, read and written by tap */
+	vhost_ioctl(q, VHOST_SET_FEATURES, &features, "VHOST_SET_FEATURES");
+
+	/* Guest physical addresses are our own */
+	memset(&table, 0, sizeof(table));
+	table.mem.nregions = 1;
+	table.region.guest_phys_addr = (uint64_t)(unsigned long)q->mem;
+	table.region.userspace_addr = (uint64_t)(unsigned long)q->mem;
+	table.region.memory_size = q->mem_size;
+	vhost_ioctl(q, VHOST_SET_MEM_TABLE, &table, "VHOST_SET_MEM_TABLE");
+
+	setup_workers(q);
+	setup_vring(q, rx_mode ? VQ_RX : VQ_TX, &q->vring);
+	setup_vring(q, rx_mode ? VQ_TX : VQ_RX, &idle);
+
+	for (i = 0; i < RING_NUM; i++) {
+		char *buf = q->bufs + i * BUF_SIZE;
+
+		q->vring.desc[i].addr = (uint64_t)(unsigned long)buf;
+		if (packed) {
+			/* made available by guest_thread_packed */
+			if (!rx_mode) {
+				memset(buf, 0, sizeof(struct virtio_net_hdr));
+				fill_frame(buf + sizeof(struct virtio_net_hdr));
+			}
+		} else if (rx_mode) {
+			q->vring.desc[i].len = BUF_SIZE;
+			q->vring.desc[i].flags = VRING_DESC_F_WRITE;
+		} else {
+			memset(buf, 0, sizeof(struct virtio_net_hdr));
+			fill_frame(buf + sizeof(struct virtio_net_hdr));
+			q->vring.desc[i].len = sizeof(struct virtio_net_hdr) +
+					       pkt_size;
+			q->vring.desc[i].flags = 0;
+		}
+	}
+
+	backend.fd = q->tap_fd;
+	for (backend.index = VQ_RX; backend.index <= VQ_TX; backend.index++)
+		vhost_ioctl(q, VHOST_NET_SET_BACKEND, &backend,
+			    "VHOST_NET_SET_BACKEND");
+}
+
+/* Make buffer id available in the packed descriptor at *avail. */
+static void put_avail_packed(struct queue *q, uint16_t *avail, bool *wrap,
+			     uint16_t id)
+{
+	struct vring_packed_desc *desc =
+		(struct vring_packed_desc *)q->vring.desc + *avail;
+	uint16_t flags = *wrap ? 1 << VRING_PACKED_DESC_F_AVAIL :
+				 1 << VRING_PACKED_DESC_F_USED;
+
+	desc->addr = (uint64_t)(unsigned long)(q->bufs + id * BUF_SIZE);
+	if (rx_mode) {
+		desc->len = BUF_SIZE;
+		flags |= VRING_DESC_F_WRITE;
+	} else {
+		desc->len = sizeof(struct virtio_net_hdr) + pkt_size;
+	}
+	desc->id = id;
+	__atomic_store_n(&desc->flags, flags, __ATOMIC_RELEASE);
+
+	if (++*avail == RING_NUM) {
+		*avail = 0;
+		*wrap = !*wrap;
+	}
+}
+
+static bool desc_used_packed(struct queue *q, uint16_t used, bool wrap)
+{
+	struct vring_packed_desc *desc =
+		(struct vring_packed_desc *)q->vring.desc + used;
+	uint16_t flags = __atomic_load_n(&desc->flags, __ATOMIC_ACQUIRE);
+
+	return !!(flags & 1 << VRING_PACKED_DESC_F_AVAIL) == wrap &&
+	       !!(flags & 1 << VRING_PACKED_DESC_F_USED) == wrap;
+}
+
+/* guest_thread for packed rings. vhost uses buffers in order, one used
+ * descriptor each, so the slots freed are always the next ones to fill. */
+static void *guest_thread_packed(struct queue *q)
+{
+	struct vring_packed_desc *desc =
+		(struct vring_packed_desc *)q->vring.desc;
+	struct vring_packed_desc_event *device =
+		(struct vring_packed_desc_event *)q->vring.used;
+	uint16_t avail = 0, used = 0;
+	bool avail_wrap = true, used_wrap = true;
+	uint64_t kick = 1;
+	int i;
+
+	for (i = 0; i < RING_NUM; i++)
+		put_avail_packed(q, &avail, &avail_wrap, i);
+
+	while (!stop) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&device->flags, __ATOMIC_RELAXED) !=
+		    VRING_PACKED_EVENT_FLAG_DISABLE)
+			if (write(q->kick_fd, &kick, sizeof(kick)) < 0)
+				die("kick");
+
+		while (!stop && !desc_used_packed(q, used, used_wrap))
+			sched_yield();
+		while (desc_used_packed(q, used, used_wrap)) {
+			uint16_t id = desc[used].id;
+
+			if (++used == RING_NUM) {
+				used = 0;
+				used_wrap = !used_wrap;
+			}
+			q->packets++;
+			put_avail_packed(q, &avail, &avail_wrap, id);
+		}
+	}
+	return NULL;
+}
+
+/* Keep all buffers available, and put back those the device used. */
+static void *guest_thread(void *arg)
+{
+	struct queue *q = arg;
+	struct vring *vr = &q->vring;
+	uint16_t avail = 0, used = 0, idx;
+	uint64_t kick = 1;
+	int i;
+
+	if (packed)
+		return guest_thread_packed(q);
+
+	for (i = 0; i < RING_NUM; i++)
+		vr->avail->ring[avail++ % RING_NUM] = i;
+
+	while (!stop) {
+		__atomic_store_n(&vr->avail->idx, avail, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!(__atomic_load_n(&vr->used->flags, __ATOMIC_RELAXED) &
+		      VRING_USED_F_NO_NOTIFY))
+			if (write(q->kick_fd, &kick, sizeof(kick)) < 0)
+				die("kick");
+
+		idx = used;
+		while (!stop) {
+			idx = __atomic_load_n(&vr->used->idx,
+					      __ATOMIC_ACQUIRE);
+			if (idx != used)
+				break;
+			sched_yield();
+		}
+		q->packets += (uint16_t)(idx - used);
+		for (; used != idx; used++)
+			vr->avail->ring[avail++ % RING_NUM] =
+				vr->used->ring[used % RING_NUM].id;
+	}
+	return NULL;
+}
+
+/* On rx, feed the tap device from the host side. */
+static void *sender_thread(void *arg __attribute__((unused)))
+{
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(BENCH_ETH_P),
+		.sll_ifindex = if_nametoindex(ifname),
+	};
+	char frame[BUF_SIZE];
+	int fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(BENCH_ETH_P));
+	if (fd < 0)
+		die("socket AF_PACKET");
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+		die("bind AF_PACKET");
+
+	fill_frame(frame);
+	while (!stop)
+		if (send(fd, frame, pkt_size, 0) < 0 && errno != ENOBUFS)
+			die("send");
+
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-r] [-p] [-q queues] [-w] [-c cpu] "
+		"[-b busyloop_us] [-s size] [-S sndbuf] [-t seconds] "
+		"[-i ifname]\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long total = 0;
+	pthread_t sender;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "rpq:wc:b:s:S:t:i:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rx_mode = true;
+			break;
+		case 'p':
+			packed = true;
+			break;
+		case 'q':
+			nqueues = atoi(optarg);
+			break;
+		case 'w':
+			worker_per_vq = true;
+			break;
+		case 'c':
+			base_cpu = atoi(optarg);
+			break;
+		case 'b':
+			busyloop_us = atoi(optarg);
+			break;
+		case 's':
+			pkt_size = atoi(optarg);
+			break;
+		case 'S':
+			sndbuf = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'i':
+			strncpy(ifname, optarg, IFNAMSIZ - 1);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nqueues < 1 || nqueues > MAX_QUEUES || duration < 1 ||
+	    sndbuf < 0 || pkt_size < ETH_ZLEN ||
+	    pkt_size > BUF_SIZE - (int)sizeof(struct virtio_net_hdr))
+		usage(argv[0]);
+
+	for (i = 0; i < nqueues; i++)
+		setup_queue(&queues[i], i);
+	tap_up();
+
+	for (i = 0; i < nqueues; i++)
+		if (pthread_create(&queues[i].thread, NULL, guest_thread,
+				   &queues[i]))
+			die("pthread_create");
+	if (rx_mode && pthread_create(&sender, NULL, sender_thread, NULL))
+		die("pthread_create");
+
+	sleep(duration);
+	stop = true;
+
+	if (rx_mode)
+		pthread_join(sender, NULL);
+	for (i = 0; i < nqueues; i++) {
+		pthread_join(queues[i].thread, NULL);
+		printf("queue %d: %llu pps\n", i,
+		       queues[i].packets / duration);
+		total += queues[i].packets;
+	}
+	printf("%s %d queue(s), %s ring%s, %d byte frames: %.3f Mpps\n",
+	       rx_mode ? "rx" : "tx", nqueues, packed ? "packed" : "split",
+	       worker_per_vq ? ", worker per vq" : "", pkt_size,
+	       total / (double)duration / 1e6);
+	return 0;
+}
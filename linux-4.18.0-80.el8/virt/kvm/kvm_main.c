@@ -104,6 +104,7 @@ struct kmem_cache *kvm_vcpu_cache;
 EXPORT_SYMBOL_GPL(kvm_vcpu_cache);
 
 static __read_mostly struct preempt_ops kvm_preempt_ops;
+static DEFINE_PER_CPU(struct kvm_vcpu *, kvm_running_vcpu);
 
 struct dentry *kvm_debugfs_dir;
 EXPORT_SYMBOL_GPL(kvm_debugfs_dir);
@@ -127,7 +128,8 @@ static void hardware_disable_all(void);
 
 static void kvm_io_bus_destroy(struct kvm_io_bus *bus);
 
-static void mark_page_dirty_in_slot(struct kvm_memory_slot *memslot, gfn_t gfn);
+static void mark_page_dirty_in_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot, gfn_t gfn);
 
 __visible bool kvm_rebooting;
 EXPORT_SYMBOL_GPL(kvm_rebooting);
@@ -159,6 +161,8 @@ bool kvm_is_reserved_pfn(kvm_pfn_t pfn)
 void vcpu_load(struct kvm_vcpu *vcpu)
 {
 	int cpu = get_cpu();
+
+	__this_cpu_write(kvm_running_vcpu, vcpu);
 	preempt_notifier_register(&vcpu->preempt_notifier);
 	kvm_arch_vcpu_load(vcpu, cpu);
 	put_cpu();
@@ -170,10 +174,27 @@ void vcpu_put(struct kvm_vcpu *vcpu)
 	preempt_disable();
 	kvm_arch_vcpu_put(vcpu);
 	preempt_notifier_unregister(&vcpu->preempt_notifier);
+	__this_cpu_write(kvm_running_vcpu, NULL);
 	preempt_enable();
 }
 EXPORT_SYMBOL_GPL(vcpu_put);
 
+/*
+ * The vcpu loaded by the current task, between vcpu_load() and
+ * vcpu_put(), or NULL.
+ */
+struct kvm_vcpu *kvm_get_running_vcpu(void)
+{
+	struct kvm_vcpu *vcpu;
+
+	preempt_disable();
+	vcpu = __this_cpu_read(kvm_running_vcpu);
+	preempt_enable();
+
+	return vcpu;
+}
+EXPORT_SYMBOL_GPL(kvm_get_running_vcpu);
+
 /* TODO: merge with kvm_arch_vcpu_should_kick */
 static bool kvm_request_needs_ipi(struct kvm_vcpu *vcpu, unsigned req)
 {
@@ -313,11 +334,20 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	kvm_vcpu_set_dy_eligible(vcpu, false);
 	vcpu->preempted = false;
 
+	if (kvm->dirty_ring_size) {
+		r = kvm_dirty_ring_alloc(&vcpu->dirty_ring, id,
+					 kvm->dirty_ring_size);
+		if (r)
+			goto fail_free_run;
+	}
+
 	r = kvm_arch_vcpu_init(vcpu);
 	if (r < 0)
-		goto fail_free_run;
+		goto fail_free_ring;
 	return 0;
 
+fail_free_ring:
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 fail_free_run:
 	free_page((unsigned long)vcpu->run);
 fail:
@@ -334,6 +364,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu)
 	 */
 	put_pid(rcu_dereference_protected(vcpu->pid, 1));
 	kvm_arch_vcpu_uninit(vcpu);
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 	free_page((unsigned long)vcpu->run);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_uninit);
@@ -952,6 +983,7 @@ int __kvm_set_memory_region(struct kvm *kvm,
 	new = old = *slot;
 
 	new.id = id;
+	new.as_id = as_id;
 	new.base_gfn = base_gfn;
 	new.npages = npages;
 	new.flags = mem->flags;
@@ -1007,8 +1039,9 @@ int __kvm_set_memory_region(struct kvm *kvm,
 			goto out_free;
 	}
 
-	/* Allocate page dirty bitmap if needed */
-	if ((new.flags & KVM_MEM_LOG_DIRTY_PAGES) && !new.dirty_bitmap) {
+	/* Allocate page dirty bitmap if needed, the dirty ring does without */
+	if ((new.flags & KVM_MEM_LOG_DIRTY_PAGES) && !new.dirty_bitmap &&
+	    !kvm->dirty_ring_size) {
 		if (kvm_create_dirty_bitmap(&new) < 0)
 			goto out_free;
 	}
@@ -1099,6 +1132,10 @@ int kvm_get_dirty_log(struct kvm *kvm,
 	unsigned long n;
 	unsigned long any = 0;
 
+	/* Dirty ring tracking is exclusive to dirty log tracking */
+	if (kvm->dirty_ring_size)
+		return -ENXIO;
+
 	as_id = log->slot >> 16;
 	id = (u16)log->slot;
 	if (as_id >= KVM_ADDRESS_SPACE_NUM || id >= KVM_USER_MEM_SLOTS)
@@ -1156,6 +1193,10 @@ int kvm_get_dirty_log_protect(struct kvm *kvm,
 	unsigned long *dirty_bitmap;
 	unsigned long *dirty_bitmap_buffer;
 
+	/* Dirty ring tracking is exclusive to dirty log tracking */
+	if (kvm->dirty_ring_size)
+		return -ENXIO;
+
 	as_id = log->slot >> 16;
 	id = (u16)log->slot;
 	if (as_id >= KVM_ADDRESS_SPACE_NUM || id >= KVM_USER_MEM_SLOTS)
@@ -1832,7 +1873,8 @@ int kvm_vcpu_read_guest_atomic(struct kvm_vcpu *vcpu, gpa_t gpa,
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_read_guest_atomic);
 
-static int __kvm_write_guest_page(struct kvm_memory_slot *memslot, gfn_t gfn,
+static int __kvm_write_guest_page(struct kvm *kvm,
+				  struct kvm_memory_slot *memslot, gfn_t gfn,
 			          const void *data, int offset, int len)
 {
 	int r;
@@ -1844,7 +1886,7 @@ static int __kvm_write_guest_page(struct kvm_memory_slot *memslot, gfn_t gfn,
 	r = __copy_to_user((void __user *)addr + offset, data, len);
 	if (r)
 		return -EFAULT;
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(kvm, memslot, gfn);
 	return 0;
 }
 
@@ -1853,7 +1895,7 @@ int kvm_write_guest_page(struct kvm *kvm, gfn_t gfn,
 {
 	struct kvm_memory_slot *slot = gfn_to_memslot(kvm, gfn);
 
-	return __kvm_write_guest_page(slot, gfn, data, offset, len);
+	return __kvm_write_guest_page(kvm, slot, gfn, data, offset, len);
 }
 EXPORT_SYMBOL_GPL(kvm_write_guest_page);
 
@@ -1862,7 +1904,7 @@ int kvm_vcpu_write_guest_page(struct kvm_vcpu *vcpu, gfn_t gfn,
 {
 	struct kvm_memory_slot *slot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
 
-	return __kvm_write_guest_page(slot, gfn, data, offset, len);
+	return __kvm_write_guest_page(vcpu->kvm, slot, gfn, data, offset, len);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_write_guest_page);
 
@@ -1976,7 +2018,7 @@ int kvm_write_guest_offset_cached(struct kvm *kvm, struct gfn_to_hva_cache *ghc,
 	r = __copy_to_user((void __user *)ghc->hva + offset, data, len);
 	if (r)
 		return -EFAULT;
-	mark_page_dirty_in_slot(ghc->memslot, gpa >> PAGE_SHIFT);
+	mark_page_dirty_in_slot(kvm, ghc->memslot, gpa >> PAGE_SHIFT);
 
 	return 0;
 }
@@ -2041,12 +2083,24 @@ int kvm_clear_guest(struct kvm *kvm, gpa_t gpa, unsigned long len)
 }
 EXPORT_SYMBOL_GPL(kvm_clear_guest);
 
-static void mark_page_dirty_in_slot(struct kvm_memory_slot *memslot,
+static void mark_page_dirty_in_slot(struct kvm *kvm,
+				    struct kvm_memory_slot *memslot,
 				    gfn_t gfn)
 {
-	if (memslot && memslot->dirty_bitmap) {
-		unsigned long rel_gfn = gfn - memslot->base_gfn;
+	struct kvm_dirty_ring *ring;
+	unsigned long rel_gfn;
+
+	if (!memslot || !(memslot->flags & KVM_MEM_LOG_DIRTY_PAGES))
+		return;
 
+	rel_gfn = gfn - memslot->base_gfn;
+	if (kvm->dirty_ring_size) {
+		ring = kvm_dirty_ring_get(kvm);
+		if (ring)
+			kvm_dirty_ring_push(ring,
+					    (memslot->as_id << 16) | memslot->id,
+					    rel_gfn);
+	} else if (memslot->dirty_bitmap) {
 		set_bit_le(rel_gfn, memslot->dirty_bitmap);
 	}
 }
@@ -2056,7 +2110,7 @@ void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 	struct kvm_memory_slot *memslot;
 
 	memslot = gfn_to_memslot(kvm, gfn);
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(kvm, memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(mark_page_dirty);
 
@@ -2065,7 +2119,7 @@ void kvm_vcpu_mark_page_dirty(struct kvm_vcpu *vcpu, gfn_t gfn)
 	struct kvm_memory_slot *memslot;
 
 	memslot = kvm_vcpu_gfn_to_memslot(vcpu, gfn);
-	mark_page_dirty_in_slot(memslot, gfn);
+	mark_page_dirty_in_slot(vcpu->kvm, memslot, gfn);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_mark_page_dirty);
 
@@ -2092,7 +2146,29 @@ void kvm_sigset_deactivate(struct kvm_vcpu *vcpu)
 	sigemptyset(&current->real_blocked);
 }
 
-static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
+/* Upper bound of the poll window: the VM's if set, else halt_poll_ns */
+static unsigned int kvm_vcpu_max_halt_poll_ns(struct kvm_vcpu *vcpu)
+{
+	struct kvm *kvm = vcpu->kvm;
+
+	if (READ_ONCE(kvm->override_halt_poll_ns))
+		return READ_ONCE(kvm->max_halt_poll_ns);
+
+	return READ_ONCE(halt_poll_ns);
+}
+
+static unsigned int kvm_vcpu_min_halt_poll_ns(struct kvm_vcpu *vcpu,
+					      unsigned int max)
+{
+	struct kvm *kvm = vcpu->kvm;
+
+	if (READ_ONCE(kvm->override_halt_poll_ns))
+		return min(READ_ONCE(kvm->min_halt_poll_ns), max);
+
+	return 0;
+}
+
+static void grow_halt_poll_ns(struct kvm_vcpu *vcpu, unsigned int target)
 {
 	unsigned int old, val, grow;
 
@@ -2104,14 +2180,14 @@ static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
 	else
 		val *= grow;
 
-	if (val > halt_poll_ns)
-		val = halt_poll_ns;
+	if (val > target)
+		val = target;
 
 	vcpu->halt_poll_ns = val;
 	trace_kvm_halt_poll_ns_grow(vcpu->vcpu_id, val, old);
 }
 
-static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu)
+static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu, unsigned int target)
 {
 	unsigned int old, val, shrink;
 
@@ -2122,10 +2198,87 @@ static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu)
 	else
 		val /= shrink;
 
+	if (val < target)
+		val = target;
+
 	vcpu->halt_poll_ns = val;
 	trace_kvm_halt_poll_ns_shrink(vcpu->vcpu_id, val, old);
 }
 
+static void kvm_halt_poll_hist_add(struct kvm_halt_poll_stat *st, u64 block_ns)
+{
+	int i = fls64(block_ns >> KVM_HALT_POLL_HIST_SHIFT);
+
+	if (i >= KVM_HALT_POLL_HIST_BUCKETS)
+		i = KVM_HALT_POLL_HIST_BUCKETS - 1;
+	st->hist[i]++;
+	st->samples++;
+
+	if (++st->since_decay < KVM_HALT_POLL_HIST_DECAY)
+		return;
+
+	st->since_decay = 0;
+	st->samples = 0;
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++) {
+		st->hist[i] >>= 1;
+		st->samples += st->hist[i];
+	}
+}
+
+/*
+ * The shortest poll window within [min, max] that would have caught at
+ * least half of the recent wakeups. If even max would not, polling mostly
+ * burns CPU before sleeping anyway, so only poll for min.
+ */
+static unsigned int kvm_halt_poll_target(struct kvm_halt_poll_stat *st,
+					 unsigned int min, unsigned int max)
+{
+	u64 window;
+	u32 sum = 0;
+	int i;
+
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS - 1; i++) {
+		sum += st->hist[i];
+		if (2 * sum >= st->samples)
+			break;
+	}
+	if (i == KVM_HALT_POLL_HIST_BUCKETS - 1)
+		return min;
+
+	window = 1ULL << (KVM_HALT_POLL_HIST_SHIFT + i);
+	/* The bucket straddles max: part of it is still within reach */
+	if (window > max)
+		window = (window >> 1) < max ? max : min;
+
+	return max_t(u64, window, min);
+}
+
+static void update_halt_poll_ns(struct kvm_vcpu *vcpu, u64 block_ns)
+{
+	struct kvm_halt_poll_stat *st = &vcpu->halt_poll_stat;
+	unsigned int max = kvm_vcpu_max_halt_poll_ns(vcpu);
+	unsigned int min = kvm_vcpu_min_halt_poll_ns(vcpu, max);
+	unsigned int target;
+
+	if (!max) {
+		vcpu->halt_poll_ns = 0;
+		return;
+	}
+
+	if (!vcpu_valid_wakeup(vcpu)) {
+		shrink_halt_poll_ns(vcpu, min);
+		return;
+	}
+
+	kvm_halt_poll_hist_add(st, block_ns);
+	target = kvm_halt_poll_target(st, min, max);
+
+	if (vcpu->halt_poll_ns < target)
+		grow_halt_poll_ns(vcpu, target);
+	else if (vcpu->halt_poll_ns > target)
+		shrink_halt_poll_ns(vcpu, target);
+}
+
 static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
 {
 	int ret = -EINTR;
@@ -2151,12 +2304,13 @@ out:
  */
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
-	ktime_t start, cur;
+	struct kvm_halt_poll_stat *st = &vcpu->halt_poll_stat;
+	ktime_t start, cur, poll_end;
 	DECLARE_SWAITQUEUE(wait);
 	bool waited = false;
 	u64 block_ns;
 
-	start = cur = ktime_get();
+	start = cur = poll_end = ktime_get();
 	if (vcpu->halt_poll_ns) {
 		ktime_t stop = ktime_add_ns(ktime_get(), vcpu->halt_poll_ns);
 
@@ -2172,7 +2326,7 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 					++vcpu->stat.halt_poll_invalid;
 				goto out;
 			}
-			cur = ktime_get();
+			poll_end = cur = ktime_get();
 		} while (single_task_running() && ktime_before(cur, stop));
 	}
 
@@ -2195,20 +2349,14 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 out:
 	block_ns = ktime_to_ns(cur) - ktime_to_ns(start);
 
-	if (!vcpu_valid_wakeup(vcpu))
-		shrink_halt_poll_ns(vcpu);
-	else if (halt_poll_ns) {
-		if (block_ns <= vcpu->halt_poll_ns)
-			;
-		/* we had a long block, shrink polling */
-		else if (vcpu->halt_poll_ns && block_ns > halt_poll_ns)
-			shrink_halt_poll_ns(vcpu);
-		/* we had a short halt and our poll time is too small */
-		else if (vcpu->halt_poll_ns < halt_poll_ns &&
-			block_ns < halt_poll_ns)
-			grow_halt_poll_ns(vcpu);
-	} else
-		vcpu->halt_poll_ns = 0;
+	if (waited) {
+		st->fail_ns += ktime_to_ns(poll_end) - ktime_to_ns(start);
+		st->wait_ns += ktime_to_ns(cur) - ktime_to_ns(poll_end);
+	} else {
+		st->success_ns += block_ns;
+	}
+
+	update_halt_poll_ns(vcpu, block_ns);
 
 	trace_kvm_vcpu_wakeup(block_ns, waited, vcpu_valid_wakeup(vcpu));
 	kvm_arch_vcpu_block_finish(vcpu);
@@ -2364,6 +2512,14 @@ void kvm_vcpu_on_spin(struct kvm_vcpu *me, bool yield_to_kernel_mode)
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_on_spin);
 
+static bool kvm_page_in_dirty_ring(struct kvm *kvm, unsigned long pgoff)
+{
+	return kvm->dirty_ring_size &&
+	       pgoff >= KVM_DIRTY_LOG_PAGE_OFFSET &&
+	       pgoff < KVM_DIRTY_LOG_PAGE_OFFSET +
+		       kvm->dirty_ring_size / PAGE_SIZE;
+}
+
 static vm_fault_t kvm_vcpu_fault(struct vm_fault *vmf)
 {
 	struct kvm_vcpu *vcpu = vmf->vma->vm_file->private_data;
@@ -2379,6 +2535,9 @@ static vm_fault_t kvm_vcpu_fault(struct vm_fault *vmf)
 	else if (vmf->pgoff == KVM_COALESCED_MMIO_PAGE_OFFSET)
 		page = virt_to_page(vcpu->kvm->coalesced_mmio_ring);
 #endif
+	else if (kvm_page_in_dirty_ring(vcpu->kvm, vmf->pgoff))
+		page = kvm_dirty_ring_get_page(&vcpu->dirty_ring,
+				vmf->pgoff - KVM_DIRTY_LOG_PAGE_OFFSET);
 	else
 		return kvm_arch_vcpu_fault(vcpu, vmf);
 	get_page(page);
@@ -2392,6 +2551,15 @@ static const struct vm_operations_struct kvm_vcpu_vm_ops = {
 
 static int kvm_vcpu_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct kvm_vcpu *vcpu = file->private_data;
+	unsigned long pages = vma_pages(vma);
+
+	/* Userspace writes the ring too, but a private copy would be useless */
+	if ((kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff) ||
+	     kvm_page_in_dirty_ring(vcpu->kvm, vma->vm_pgoff + pages - 1)) &&
+	    ((vma->vm_flags & VM_EXEC) || !(vma->vm_flags & VM_SHARED)))
+		return -EINVAL;
+
 	vma->vm_ops = &kvm_vcpu_vm_ops;
 	return 0;
 }
@@ -2424,14 +2592,55 @@ static int create_vcpu_fd(struct kvm_vcpu *vcpu)
 	return anon_inode_getfd(name, &kvm_vcpu_fops, vcpu, O_RDWR | O_CLOEXEC);
 }
 
+static int vcpu_get_halt_poll_ns(void *data, u64 *val)
+{
+	struct kvm_vcpu *vcpu = data;
+
+	*val = READ_ONCE(vcpu->halt_poll_ns);
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(vcpu_halt_poll_ns_fops, vcpu_get_halt_poll_ns, NULL,
+			"%llu\n");
+
+static int vcpu_halt_poll_hist_show(struct seq_file *m, void *v)
+{
+	struct kvm_vcpu *vcpu = m->private;
+	struct kvm_halt_poll_stat *st = &vcpu->halt_poll_stat;
+	int i;
+
+	seq_printf(m, "success_ns %llu\nfail_ns %llu\nwait_ns %llu\n",
+		   READ_ONCE(st->success_ns), READ_ONCE(st->fail_ns),
+		   READ_ONCE(st->wait_ns));
+
+	/* Weight of each bucket, by the upper bound of its block time */
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS - 1; i++)
+		seq_printf(m, "< %llu %u\n",
+			   1ULL << (KVM_HALT_POLL_HIST_SHIFT + i),
+			   READ_ONCE(st->hist[i]));
+	seq_printf(m, ">= %llu %u\n",
+		   1ULL << (KVM_HALT_POLL_HIST_SHIFT + i - 1),
+		   READ_ONCE(st->hist[i]));
+	return 0;
+}
+
+static int vcpu_halt_poll_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vcpu_halt_poll_hist_show, inode->i_private);
+}
+
+static const struct file_operations vcpu_halt_poll_hist_fops = {
+	.open = vcpu_halt_poll_hist_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int kvm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 {
 	char dir_name[ITOA_MAX_LEN * 2];
 	int ret;
 
-	if (!kvm_arch_has_vcpu_debugfs())
-		return 0;
-
 	if (!debugfs_initialized())
 		return 0;
 
@@ -2441,13 +2650,26 @@ static int kvm_create_vcpu_debugfs(struct kvm_vcpu *vcpu)
 	if (!vcpu->debugfs_dentry)
 		return -ENOMEM;
 
+	ret = -ENOMEM;
+	if (!debugfs_create_file("halt-poll-ns", 0444, vcpu->debugfs_dentry,
+				 vcpu, &vcpu_halt_poll_ns_fops))
+		goto out_remove;
+	if (!debugfs_create_file("halt-poll", 0444, vcpu->debugfs_dentry,
+				 vcpu, &vcpu_halt_poll_hist_fops))
+		goto out_remove;
+
+	if (!kvm_arch_has_vcpu_debugfs())
+		return 0;
+
 	ret = kvm_arch_create_vcpu_debugfs(vcpu);
-	if (ret < 0) {
-		debugfs_remove_recursive(vcpu->debugfs_dentry);
-		return ret;
-	}
+	if (ret < 0)
+		goto out_remove;
 
 	return 0;
+
+out_remove:
+	debugfs_remove_recursive(vcpu->debugfs_dentry);
+	return ret;
 }
 
 /*
@@ -2955,12 +3177,96 @@ static long kvm_vm_ioctl_check_extension_generic(struct kvm *kvm, long arg)
 #endif
 	case KVM_CAP_MAX_VCPU_ID:
 		return KVM_MAX_VCPU_ID;
+	case KVM_CAP_HALT_POLL:
+		return 1;
+	case KVM_CAP_DIRTY_LOG_RING:
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+		return KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn);
+#else
+		return 0;
+#endif
 	default:
 		break;
 	}
 	return kvm_vm_ioctl_check_extension(kvm, arg);
 }
 
+static int kvm_vm_ioctl_enable_dirty_log_ring(struct kvm *kvm, u64 size)
+{
+	int r;
+
+	if (!IS_ENABLED(CONFIG_HAVE_KVM_DIRTY_RING))
+		return -EINVAL;
+
+	/* A power of 2 in bytes, with room for the reserved entries */
+	if (!size || (size & (size - 1)) || size < PAGE_SIZE ||
+	    size < kvm_dirty_ring_get_rsvd_entries() *
+		   sizeof(struct kvm_dirty_gfn))
+		return -EINVAL;
+
+	if (size > KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn))
+		return -E2BIG;
+
+	mutex_lock(&kvm->lock);
+	/* The rings are allocated with the vcpus, and only once */
+	if (kvm->created_vcpus || kvm->dirty_ring_size)
+		r = -EINVAL;
+	else {
+		kvm->dirty_ring_size = size;
+		r = 0;
+	}
+	mutex_unlock(&kvm->lock);
+
+	return r;
+}
+
+static int kvm_vm_ioctl_reset_dirty_pages(struct kvm *kvm)
+{
+	struct kvm_vcpu *vcpu;
+	int cleared = 0;
+	int i;
+
+	if (!kvm->dirty_ring_size)
+		return -EINVAL;
+
+	mutex_lock(&kvm->slots_lock);
+
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		cleared += kvm_dirty_ring_reset(vcpu->kvm, &vcpu->dirty_ring);
+
+	mutex_unlock(&kvm->slots_lock);
+
+	if (cleared)
+		kvm_flush_remote_tlbs(kvm);
+
+	return cleared;
+}
+
+static int kvm_vm_ioctl_enable_cap_generic(struct file *filp, struct kvm *kvm,
+					   struct kvm_enable_cap *cap,
+					   unsigned long arg)
+{
+	switch (cap->cap) {
+	case KVM_CAP_HALT_POLL:
+		/* args[0] is the maximum poll window in ns, args[1] the minimum */
+		if (cap->flags || cap->args[0] > UINT_MAX ||
+		    cap->args[1] > cap->args[0])
+			return -EINVAL;
+
+		WRITE_ONCE(kvm->min_halt_poll_ns, cap->args[1]);
+		WRITE_ONCE(kvm->max_halt_poll_ns, cap->args[0]);
+		WRITE_ONCE(kvm->override_halt_poll_ns, true);
+		return 0;
+	case KVM_CAP_DIRTY_LOG_RING:
+		/* args[0] is the size of the ring of each vcpu, in bytes */
+		if (cap->flags)
+			return -EINVAL;
+		return kvm_vm_ioctl_enable_dirty_log_ring(kvm, cap->args[0]);
+	default:
+		return kvm_arch_vm_ioctl(filp, KVM_ENABLE_CAP, arg);
+	}
+}
+
 static long kvm_vm_ioctl(struct file *filp,
 			   unsigned int ioctl, unsigned long arg)
 {
@@ -3123,6 +3429,18 @@ out_free_irq_routing:
 	case KVM_CHECK_EXTENSION:
 		r = kvm_vm_ioctl_check_extension_generic(kvm, arg);
 		break;
+	case KVM_ENABLE_CAP: {
+		struct kvm_enable_cap cap;
+
+		r = -EFAULT;
+		if (copy_from_user(&cap, argp, sizeof(cap)))
+			goto out;
+		r = kvm_vm_ioctl_enable_cap_generic(filp, kvm, &cap, arg);
+		break;
+	}
+	case KVM_RESET_DIRTY_RINGS:
+		r = kvm_vm_ioctl_reset_dirty_pages(kvm);
+		break;
 	default:
 		r = kvm_arch_vm_ioctl(filp, ioctl, arg);
 	}
@@ -3968,6 +4286,7 @@ static void kvm_sched_in(struct preempt_notifier *pn, int cpu)
 	if (vcpu->preempted)
 		vcpu->preempted = false;
 
+	__this_cpu_write(kvm_running_vcpu, vcpu);
 	kvm_arch_sched_in(vcpu, cpu);
 
 	kvm_arch_vcpu_load(vcpu, cpu);
@@ -3981,6 +4300,7 @@ static void kvm_sched_out(struct preempt_notifier *pn,
 	if (current->state == TASK_RUNNING)
 		vcpu->preempted = true;
 	kvm_arch_vcpu_put(vcpu);
+	__this_cpu_write(kvm_running_vcpu, NULL);
 }
 
 int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,